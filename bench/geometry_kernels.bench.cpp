@@ -0,0 +1,107 @@
+// Isolates the ring winding and segment distance kernels from the rest of the query.
+//
+// Usage: geometry_kernels_bench [vertices] [queries]
+//
+// Builds one large, jagged ring in tile coordinates (like the landuse and water
+// polygons in the streets and terrain fixtures), then runs the same query points
+// through every kernel the CPU supports, checking they agree with the scalar ones.
+#include "../src/geometry_kernels.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+kernels::flat_geometry make_ring(std::size_t vertices, std::mt19937& gen) {
+    std::uniform_real_distribution<double> jitter(0.85, 1.15);
+    kernels::flat_geometry geom;
+    double const step = 2.0 * M_PI / static_cast<double>(vertices);
+    for (std::size_t i = 0; i < vertices; ++i) {
+        double const radius = 1800.0 * jitter(gen);
+        double const angle = step * static_cast<double>(i);
+        geom.add_point(static_cast<std::int32_t>(2048.0 + radius * std::cos(angle)),
+                       static_cast<std::int32_t>(2048.0 + radius * std::sin(angle)));
+    }
+    geom.close_ring();
+    geom.part_starts.push_back(0);
+    geom.end_ring();
+    return geom;
+}
+
+struct run_result {
+    double ms;
+    double checksum;
+};
+
+run_result run_distance(kernels::kernel_table const& k, kernels::flat_geometry const& geom, std::vector<double> const& points) {
+    auto const start = std::chrono::steady_clock::now();
+    double checksum = 0.0;
+    for (std::size_t i = 0; i + 1 < points.size(); i += 2) {
+        auto const best = k.segment_distance(geom.xs.data(), geom.ys.data(), geom.xs.size(), points[i], points[i + 1]);
+        checksum += best.distance_squared + static_cast<double>(best.index);
+    }
+    std::chrono::duration<double, std::milli> const elapsed = std::chrono::steady_clock::now() - start;
+    return run_result{elapsed.count(), checksum};
+}
+
+run_result run_winding(kernels::kernel_table const& k, kernels::flat_geometry const& geom, std::vector<double> const& points) {
+    auto const start = std::chrono::steady_clock::now();
+    double checksum = 0.0;
+    for (std::size_t i = 0; i + 1 < points.size(); i += 2) {
+        checksum += k.winding(geom.xs.data(), geom.ys.data(), geom.xs.size(), points[i], points[i + 1]);
+    }
+    std::chrono::duration<double, std::milli> const elapsed = std::chrono::steady_clock::now() - start;
+    return run_result{elapsed.count(), checksum};
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::size_t const vertices = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 5000;
+    std::size_t const queries = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 20000;
+
+    std::mt19937 gen(42);
+    auto const geom = make_ring(vertices, gen);
+    std::uniform_int_distribution<std::int32_t> coord(-256, 4352);
+    std::vector<double> points;
+    points.reserve(queries * 2);
+    for (std::size_t i = 0; i < queries * 2; ++i) {
+        points.push_back(coord(gen));
+    }
+
+    std::vector<kernels::kernel_table> tables{kernels::scalar_kernels()};
+#ifdef VTQUERY_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1")) {
+        tables.push_back(kernels::kernel_table{"sse4", &kernels::segment_distance_sse4, &kernels::winding_sse4});
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        tables.push_back(kernels::kernel_table{"avx2", &kernels::segment_distance_avx2, &kernels::winding_avx2});
+    }
+#endif
+
+    std::printf("%zu vertices, %zu query points, selected kernels: %s\n", geom.xs.size(), queries, kernels::active_kernels().name);
+    // warm up before timing anything
+    run_distance(tables.front(), geom, points);
+    std::vector<run_result> distances;
+    std::vector<run_result> windings;
+    for (auto const& k : tables) {
+        distances.push_back(run_distance(k, geom, points));
+        windings.push_back(run_winding(k, geom, points));
+    }
+    int status = 0;
+    for (std::size_t i = 0; i < tables.size(); ++i) {
+        bool const agrees = std::abs(distances[i].checksum - distances.front().checksum) < 1e-6 && std::abs(windings[i].checksum - windings.front().checksum) < 1e-6;
+        std::printf("%-7s segment distance: %8.2f ms (%.2fx)  winding: %8.2f ms (%.2fx)%s\n",
+                    tables[i].name,
+                    distances[i].ms, distances.front().ms / distances[i].ms,
+                    windings[i].ms, windings.front().ms / windings[i].ms,
+                    agrees ? "" : "  MISMATCH");
+        if (!agrees) {
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -41,6 +41,14 @@ module.exports = [
       { z: 14, x: 13698, y: 7519, buffer: fs.readFileSync('./test/fixtures/manila-roads-terrain-14-13698-7519.mvt')}
     ]
   },
+  {
+    description: 'query: polygons, mapbox streets landuse and terrain',
+    queryPoint: [120.991, 14.6147],
+    options: { radius: 3000, geometry: 'polygon' },
+    tiles: [
+      { z: 14, x: 13698, y: 7519, buffer: fs.readFileSync('./test/fixtures/manila-roads-terrain-14-13698-7519.mvt')}
+    ]
+  },
   {
     description: 'query: polygons, mapbox streets buildings',
     queryPoint: [120.9667, 14.6028],
@@ -91,6 +99,48 @@ module.exports = [
     ]
   },
 
+  // option combinations, each running its own specialized feature loop
+  {
+    description: 'options: dense single tile, basic-filters all',
+    queryPoint: [-122.437, 37.7666],
+    options: { radius: 1000, 'basic-filters': ['all', [['height', '>', 10], ['height', '<', 100]]] },
+    tiles: [
+      { z: 15, x: 5239, y: 12666, buffer: getTile('sanfrancisco', '15-5239-12666.mvt')}
+    ]
+  },
+  {
+    description: 'options: dense single tile, basic-filters any',
+    queryPoint: [-122.437, 37.7666],
+    options: { radius: 1000, 'basic-filters': ['any', [['height', '>', 10], ['scalerank', '<', 3]]] },
+    tiles: [
+      { z: 15, x: 5239, y: 12666, buffer: getTile('sanfrancisco', '15-5239-12666.mvt')}
+    ]
+  },
+  {
+    description: 'options: dense single tile, dedupe off',
+    queryPoint: [-122.437, 37.7666],
+    options: { radius: 1000, dedupe: false },
+    tiles: [
+      { z: 15, x: 5239, y: 12666, buffer: getTile('sanfrancisco', '15-5239-12666.mvt')}
+    ]
+  },
+  {
+    description: 'options: dense single tile, direct_hit_polygon',
+    queryPoint: [-122.437, 37.7666],
+    options: { radius: 1000, direct_hit_polygon: true },
+    tiles: [
+      { z: 15, x: 5239, y: 12666, buffer: getTile('sanfrancisco', '15-5239-12666.mvt')}
+    ]
+  },
+  {
+    description: 'options: dense single tile, points only, dedupe off',
+    queryPoint: [-122.437, 37.7666],
+    options: { radius: 1000, geometry: 'point', dedupe: false },
+    tiles: [
+      { z: 15, x: 5239, y: 12666, buffer: getTile('sanfrancisco', '15-5239-12666.mvt')}
+    ]
+  },
+
   // real-world elevation
   {
     description: 'elevation: terrain tile nepal',
@@ -149,6 +199,50 @@ module.exports = [
     tiles: [
       { z: 16, x: 10498, y: 22872, buffer: fs.readFileSync('./test/fixtures/polygons-properties-16-10498-22872.mvt')}
     ]
+  },
+
+  // the same queries against cached columnar tiles
+  {
+    description: 'columnar: pip many building polygons',
+    queryPoint: [120.9667, 14.6028],
+    options: { radius: 0, columnar: true },
+    tiles: [
+      { z: 16, x: 54789, y: 30080, buffer: fs.readFileSync('./test/fixtures/manila-buildings-16-54789-30080.mvt')}
+    ]
+  },
+  {
+    description: 'columnar: query linestrings, mapbox streets roads',
+    queryPoint: [120.991, 14.6147],
+    options: { radius: 3000, geometry: 'linestring', columnar: true },
+    tiles: [
+      { z: 14, x: 13698, y: 7519, buffer: fs.readFileSync('./test/fixtures/manila-roads-terrain-14-13698-7519.mvt')}
+    ]
+  },
+  {
+    description: 'columnar: 2000 points in a single tile, with properties',
+    queryPoint: [-122.3302, 47.6639],
+    options: { radius: 500, geometry: 'point', columnar: true },
+    tiles: [
+      { z: 16, x: 10498, y: 22872, buffer: fs.readFileSync('./test/fixtures/points-properties-16-10498-22872.mvt')}
+    ]
+  },
+
+  // features ruled out on simplified geometry before measuring them exactly
+  {
+    description: 'tolerance: polygons, mapbox streets landuse and terrain',
+    queryPoint: [120.991, 14.6147],
+    options: { radius: 3000, geometry: 'polygon', tolerance: 50 },
+    tiles: [
+      { z: 14, x: 13698, y: 7519, buffer: fs.readFileSync('./test/fixtures/manila-roads-terrain-14-13698-7519.mvt')}
+    ]
+  },
+  {
+    description: 'tolerance: pip many building polygons',
+    queryPoint: [120.9667, 14.6028],
+    options: { radius: 0, tolerance: 5 },
+    tiles: [
+      { z: 16, x: 54789, y: 30080, buffer: fs.readFileSync('./test/fixtures/manila-buildings-16-54789-30080.mvt')}
+    ]
   }
 ];
 
@@ -0,0 +1,165 @@
+"use strict";
+
+// Scaling curves: query cost against one tile parameter at a time, on tiles
+// generated by bench/synthetic-tile.js. Every axis starts from the same base
+// scenario and changes a single parameter.
+//
+//   node bench/scaling.bench.js --iterations 200 --concurrency 1 [--axes features,holes] [--format csv|json] [--out file]
+//   node bench/scaling.bench.js --compare base.json head.json [--threshold 0.1]
+
+const argv = require('minimist')(process.argv.slice(2), { string: ['axes', 'format', 'out', 'compare'] });
+
+const fs = require('fs');
+
+if (argv.compare) {
+  const files = [argv.compare].concat(argv._);
+  if (files.length !== 2) {
+    console.error('Please provide two result files to compare');
+    console.error('Example: \nnode bench/scaling.bench.js --compare base.json head.json --threshold 0.1');
+    process.exit(1);
+  }
+  process.exit(compare(JSON.parse(fs.readFileSync(files[0])), JSON.parse(fs.readFileSync(files[1])), argv.threshold === undefined ? 0.1 : Number(argv.threshold)));
+}
+
+if (!argv.iterations || !argv.concurrency) {
+  console.error('Please provide desired iterations, concurrency');
+  console.error('Example: \nnode bench/scaling.bench.js --iterations 200 --concurrency 1');
+  process.exit(1);
+}
+
+// set before vtquery touches the threadpool, see bench/vtquery.bench.js
+process.env.UV_THREADPOOL_SIZE = argv.concurrency;
+
+const Queue = require('d3-queue').queue;
+const vtquery = require('../lib/index.js');
+const synthetic = require('./synthetic-tile');
+
+const TILE = { z: 14, x: 8185, y: 5449 };
+
+// what every axis starts from
+const BASE = {
+  geometry: 'point',
+  distribution: 'uniform',
+  features: 1000,
+  vertices: 16,
+  holes: 0,
+  layers: 1,
+  properties: 5,
+  radius: 500,
+  limit: 5
+};
+
+const AXES = {
+  features: { values: [100, 1000, 10000, 50000] },
+  clustered: { param: 'features', values: [100, 1000, 10000, 50000], base: { distribution: 'clustered' } },
+  vertices: { values: [4, 64, 1024, 8192], base: { geometry: 'linestring', features: 100 } },
+  holes: { values: [0, 10, 100, 500], base: { geometry: 'polygon', features: 50, radius: 0 } },
+  layers: { values: [1, 10, 50, 100], base: { features: 200 } },
+  properties: { values: [0, 10, 50, 200] },
+  limit: { values: [1, 5, 50, 500], base: { radius: 5000 } }
+};
+
+const COLUMNS = ['axis', 'value', 'geometry', 'distribution', 'features', 'vertices', 'holes', 'layers', 'properties',
+  'radius', 'limit', 'tile_bytes', 'runs_per_s', 'mean_ms', 'p50_ms', 'p99_ms'];
+
+function scenarios(axes) {
+  const list = [];
+  axes.forEach(axis => {
+    const spec = AXES[axis];
+    if (!spec) throw new Error(`unknown axis '${axis}', use one of ${Object.keys(AXES).join(', ')}`);
+    spec.values.forEach(value => {
+      const params = Object.assign({}, BASE, spec.base);
+      params[spec.param || axis] = value;
+      list.push({ axis: axis, value: value, params: params });
+    });
+  });
+  return list;
+}
+
+function percentile(sorted, q) {
+  return sorted[Math.min(sorted.length - 1, Math.floor(q * sorted.length))];
+}
+
+function runScenario(scenario, callback) {
+  const params = scenario.params;
+  const buffer = synthetic.generate(params);
+  const tiles = [Object.assign({ buffer: buffer }, TILE)];
+  // off center, so queries measure distances instead of starting on a feature
+  const point = synthetic.lngLat(TILE.z, TILE.x, TILE.y, 0.37, 0.61);
+  const options = { radius: params.radius, limit: params.limit };
+  const latencies = [];
+
+  const runs = Queue(argv.concurrency);
+  for (let i = 0; i < argv.iterations; ++i) {
+    runs.defer(cb => {
+      const start = process.hrtime.bigint();
+      vtquery(tiles, point, options, err => {
+        latencies.push(Number(process.hrtime.bigint() - start) / 1e6);
+        cb(err);
+      });
+    });
+  }
+
+  const start = process.hrtime.bigint();
+  runs.awaitAll(err => {
+    if (err) return callback(err);
+    const elapsed = Number(process.hrtime.bigint() - start) / 1e9;
+    latencies.sort((a, b) => a - b);
+    const row = Object.assign({ axis: scenario.axis, value: scenario.value }, params, {
+      tile_bytes: buffer.length,
+      runs_per_s: Math.round(argv.iterations / elapsed),
+      mean_ms: latencies.reduce((sum, l) => sum + l, 0) / latencies.length,
+      p50_ms: percentile(latencies, 0.5),
+      p99_ms: percentile(latencies, 0.99)
+    });
+    process.stderr.write(`${row.axis}=${row.value}: ${row.runs_per_s} runs/s, p50 ${row.p50_ms.toFixed(3)}ms\n`);
+    callback(null, row);
+  });
+}
+
+function toCsv(rows) {
+  const lines = [COLUMNS.join(',')];
+  rows.forEach(row => {
+    lines.push(COLUMNS.map(c => typeof row[c] === 'number' && !Number.isInteger(row[c]) ? row[c].toFixed(4) : row[c]).join(','));
+  });
+  return lines.join('\n') + '\n';
+}
+
+// flags scenarios whose mean latency grew by more than `threshold` (0.1 is 10%), returns the exit code
+function compare(base, head, threshold) {
+  const key = row => `${row.axis}=${row.value}`;
+  const baseRows = new Map(base.map(row => [key(row), row]));
+  let regressions = 0;
+  head.forEach(row => {
+    const before = baseRows.get(key(row));
+    if (!before) {
+      console.log(`${key(row)}: only in the second run`);
+      return;
+    }
+    const change = row.mean_ms / before.mean_ms - 1;
+    const flag = change > threshold ? 'REGRESSION' : change < -threshold ? 'improvement' : '';
+    if (flag === 'REGRESSION') ++regressions;
+    console.log(`${key(row)}: ${before.mean_ms.toFixed(3)}ms -> ${row.mean_ms.toFixed(3)}ms (${(change * 100).toFixed(1)}%) ${flag}`.trim());
+  });
+  console.log(regressions ? `${regressions} regression(s) over ${(threshold * 100).toFixed(0)}%` : 'no regressions');
+  return regressions ? 1 : 0;
+}
+
+const axes = argv.axes ? argv.axes.split(',') : Object.keys(AXES);
+const format = argv.format || 'csv';
+if (format !== 'csv' && format !== 'json') {
+  console.error(`unknown format '${format}', use csv or json`);
+  process.exit(1);
+}
+
+const queue = Queue(1);
+scenarios(axes).forEach(scenario => queue.defer(runScenario, scenario));
+queue.awaitAll((err, rows) => {
+  if (err) throw err;
+  const output = format === 'json' ? JSON.stringify(rows, null, 2) + '\n' : toCsv(rows);
+  if (argv.out) {
+    fs.writeFileSync(argv.out, output);
+  } else {
+    process.stdout.write(output);
+  }
+});
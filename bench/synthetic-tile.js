@@ -0,0 +1,269 @@
+'use strict';
+
+// Generates Mapbox Vector Tiles with controlled sizes, for benchmarks that need
+// to see how query cost scales with one parameter at a time.
+//
+//   const tile = require('./synthetic-tile');
+//   const buffer = tile.generate({ geometry: 'polygon', features: 100, holes: 50 });
+//
+// Parameters (all optional):
+//   geometry      'point', 'linestring' or 'polygon' (default 'point')
+//   distribution  'uniform' or 'clustered' placement of features (default 'uniform')
+//   features      features per layer (default 1000)
+//   vertices      vertices per linestring, or per polygon ring (default 16)
+//   holes         holes per polygon (default 0)
+//   layers        number of layers, named layer-0, layer-1, ... (default 1)
+//   properties    properties per feature, half numbers and half strings (default 5)
+//   extent        layer extent (default 4096)
+//   seed          seed of the random placement, the same parameters and seed give the same bytes (default 1)
+
+const DEFAULTS = {
+  geometry: 'point',
+  distribution: 'uniform',
+  features: 1000,
+  vertices: 16,
+  holes: 0,
+  layers: 1,
+  properties: 5,
+  extent: 4096,
+  seed: 1
+};
+
+const GEOM_TYPES = { point: 1, linestring: 2, polygon: 3 };
+
+// mulberry32, small and good enough to place features
+function random(seed) {
+  let a = seed >>> 0;
+  return function() {
+    a = (a + 0x6D2B79F5) >>> 0;
+    let t = a;
+    t = Math.imul(t ^ (t >>> 15), t | 1);
+    t ^= t + Math.imul(t ^ (t >>> 7), t | 61);
+    return ((t ^ (t >>> 14)) >>> 0) / 4294967296;
+  };
+}
+
+// protocol buffer writing, only what vector tiles use
+class Writer {
+  constructor() {
+    this.chunks = [];
+  }
+
+  varint(value) {
+    const bytes = [];
+    // values can be above 2^32, so no bit operators until the last byte
+    while (value >= 0x80) {
+      bytes.push((value % 0x80) | 0x80);
+      value = Math.floor(value / 0x80);
+    }
+    bytes.push(value);
+    this.chunks.push(Buffer.from(bytes));
+    return this;
+  }
+
+  tag(field, wireType) {
+    return this.varint(field * 8 + wireType);
+  }
+
+  varintField(field, value) {
+    return this.tag(field, 0).varint(value);
+  }
+
+  bytesField(field, buffer) {
+    this.tag(field, 2).varint(buffer.length);
+    this.chunks.push(buffer);
+    return this;
+  }
+
+  stringField(field, string) {
+    return this.bytesField(field, Buffer.from(string, 'utf8'));
+  }
+
+  doubleField(field, value) {
+    const buffer = Buffer.alloc(8);
+    buffer.writeDoubleLE(value, 0);
+    this.tag(field, 1);
+    this.chunks.push(buffer);
+    return this;
+  }
+
+  packedField(field, values) {
+    const packed = new Writer();
+    values.forEach(v => packed.varint(v));
+    return this.bytesField(field, packed.finish());
+  }
+
+  finish() {
+    return Buffer.concat(this.chunks);
+  }
+}
+
+function zigzag(n) {
+  return (n << 1) ^ (n >> 31);
+}
+
+function command(id, count) {
+  return (id & 0x7) | (count << 3);
+}
+
+// encodes rings or lines as tile geometry commands, with the cursor carried across parts
+function encodeGeometry(parts, closed) {
+  const out = [];
+  let cx = 0;
+  let cy = 0;
+  parts.forEach(part => {
+    out.push(command(1, 1), zigzag(part[0][0] - cx), zigzag(part[0][1] - cy));
+    cx = part[0][0];
+    cy = part[0][1];
+    if (part.length > 1) {
+      out.push(command(2, part.length - 1));
+      for (let i = 1; i < part.length; ++i) {
+        out.push(zigzag(part[i][0] - cx), zigzag(part[i][1] - cy));
+        cx = part[i][0];
+        cy = part[i][1];
+      }
+    }
+    if (closed) out.push(command(7, 1));
+  });
+  return out;
+}
+
+function clamp(v, extent) {
+  return Math.max(0, Math.min(extent - 1, Math.round(v)));
+}
+
+// the centers of features: uniform over the tile, or gathered around a few hot spots
+function placer(p, rand) {
+  if (p.distribution === 'uniform') {
+    return () => [rand() * p.extent, rand() * p.extent];
+  }
+  if (p.distribution !== 'clustered') throw new Error(`unknown distribution '${p.distribution}'`);
+  const clusters = [];
+  for (let i = 0; i < 8; ++i) clusters.push([rand() * p.extent, rand() * p.extent]);
+  const spread = p.extent / 64;
+  return () => {
+    const c = clusters[Math.floor(rand() * clusters.length)];
+    // sum of uniforms, roughly normal around the cluster center
+    const dx = (rand() + rand() + rand() - 1.5) * spread;
+    const dy = (rand() + rand() + rand() - 1.5) * spread;
+    return [c[0] + dx, c[1] + dy];
+  };
+}
+
+// a closed ring around a center, exterior rings have a positive area in tile coordinates and holes a negative one
+function ring(cx, cy, radius, vertices, extent, hole) {
+  const points = [];
+  const n = Math.max(3, vertices);
+  for (let i = 0; i < n; ++i) {
+    const a = (hole ? -1 : 1) * 2 * Math.PI * i / n;
+    points.push([clamp(cx + radius * Math.cos(a), extent), clamp(cy + radius * Math.sin(a), extent)]);
+  }
+  return points;
+}
+
+function featureGeometry(p, center, rand) {
+  const size = p.extent / Math.max(8, Math.sqrt(p.features));
+  if (p.geometry === 'point') {
+    return encodeGeometry([[[clamp(center[0], p.extent), clamp(center[1], p.extent)]]], false);
+  }
+  if (p.geometry === 'linestring') {
+    // a random walk, long lines wander across the tile
+    const line = [];
+    let x = center[0];
+    let y = center[1];
+    let heading = rand() * 2 * Math.PI;
+    const step = Math.max(2, size / 4);
+    for (let i = 0; i < Math.max(2, p.vertices); ++i) {
+      line.push([clamp(x, p.extent), clamp(y, p.extent)]);
+      heading += (rand() - 0.5);
+      x += step * Math.cos(heading);
+      y += step * Math.sin(heading);
+    }
+    return encodeGeometry([line], false);
+  }
+  if (p.geometry === 'polygon') {
+    // whole polygons stay inside the tile, clipped rings would make holes degenerate
+    const radius = Math.min(size * (1 + p.holes / 16), p.extent / 2 - 1);
+    const cx = Math.max(radius, Math.min(p.extent - 1 - radius, center[0]));
+    const cy = Math.max(radius, Math.min(p.extent - 1 - radius, center[1]));
+    const rings = [ring(cx, cy, radius, p.vertices, p.extent, false)];
+    // holes on a grid inside the exterior ring, small enough not to touch each other
+    const side = Math.ceil(Math.sqrt(p.holes));
+    const cell = (radius * 1.2) / Math.max(1, side);
+    for (let h = 0; h < p.holes; ++h) {
+      const hx = cx - radius * 0.6 + cell * (h % side + 0.5);
+      const hy = cy - radius * 0.6 + cell * (Math.floor(h / side) + 0.5);
+      rings.push(ring(hx, hy, cell / 4, Math.min(p.vertices, 16), p.extent, true));
+    }
+    return encodeGeometry(rings, true);
+  }
+  throw new Error(`unknown geometry '${p.geometry}'`);
+}
+
+function encodeValue(value) {
+  const w = new Writer();
+  if (typeof value === 'string') w.stringField(1, value);
+  else if (Number.isInteger(value)) w.varintField(5, value);
+  else w.doubleField(3, value);
+  return w.finish();
+}
+
+function encodeLayer(p, index, rand) {
+  const layer = new Writer();
+  layer.varintField(15, 2);
+  layer.stringField(1, `layer-${index}`);
+
+  const keys = [];
+  for (let k = 0; k < p.properties; ++k) keys.push(`key-${k}`);
+  const values = [];
+  const valueIndex = new Map();
+  function valueId(value) {
+    const id = (typeof value) + ':' + value;
+    if (!valueIndex.has(id)) {
+      valueIndex.set(id, values.length);
+      values.push(value);
+    }
+    return valueIndex.get(id);
+  }
+
+  const place = placer(p, rand);
+  for (let f = 0; f < p.features; ++f) {
+    const feature = new Writer();
+    feature.varintField(1, f + 1);
+    const tags = [];
+    for (let k = 0; k < p.properties; ++k) {
+      // half numbers and half strings, with few distinct values so they dedupe like real tiles
+      const value = k % 2 === 0 ? (f + k) % 100 : `value-${(f * 7 + k) % 50}`;
+      tags.push(k, valueId(value));
+    }
+    if (tags.length) feature.packedField(2, tags);
+    feature.varintField(3, GEOM_TYPES[p.geometry]);
+    feature.packedField(4, featureGeometry(p, place(), rand));
+    layer.bytesField(2, feature.finish());
+  }
+
+  keys.forEach(key => layer.stringField(3, key));
+  values.forEach(value => layer.bytesField(4, encodeValue(value)));
+  layer.varintField(5, p.extent);
+  return layer.finish();
+}
+
+function generate(params) {
+  const p = Object.assign({}, DEFAULTS, params);
+  const rand = random(p.seed);
+  const tile = new Writer();
+  for (let l = 0; l < p.layers; ++l) {
+    tile.bytesField(3, encodeLayer(p, l, rand));
+  }
+  return tile.finish();
+}
+
+// the lng/lat of a position in tile z/x/y, given as a fraction of the tile
+function lngLat(z, x, y, fx, fy) {
+  const n = Math.pow(2, z);
+  const lng = (x + fx) / n * 360 - 180;
+  const lat = Math.atan(Math.sinh(Math.PI * (1 - 2 * (y + fy) / n))) * 180 / Math.PI;
+  return [lng, lat];
+}
+
+module.exports = { generate: generate, lngLat: lngLat, DEFAULTS: DEFAULTS };
@@ -0,0 +1,421 @@
+// Runs queries through the query engine (src/query.hpp) without node, for
+// profiling with perf or valgrind and for load testing.
+//
+// Usage: vtquery-bench [options] <tile or directory>...
+//
+//   --threads N        query threads (default 1)
+//   --duration S       seconds to run for (default 5)
+//   --points FILE      query points, one "lng,lat" per line, each queried
+//                      against the tiles it falls in
+//   --random N         otherwise, N random points inside the tiles (default 1000)
+//   --seed N           seed of the random points (default 42)
+//   --radius M         query radius in meters (default 0)
+//   --limit N          results per query (default 5)
+//   --layers A,B       only query these layers
+//   --geometry TYPE    point, linestring or polygon
+//   --columnar         query the columnar form of the tiles
+//
+// Tiles are read from files named like the fixtures, `name-Z-X-Y.mvt`, or laid
+// out as `Z/X/Y.mvt`. Directories are searched recursively for .mvt and .pbf
+// files, files whose coordinates can not be read are skipped there.
+//
+// Reports throughput, latency percentiles and the heap allocations of a query,
+// counted by replacing the global operator new of this program.
+#include "../src/query.hpp"
+#include "../src/util.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <exception>
+#include <fstream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+namespace {
+
+thread_local std::uint64_t allocations = 0;
+
+} // namespace
+
+void* operator new(std::size_t size) {
+    ++allocations;
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t /*size*/) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t /*size*/) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+using VectorTileQuery::QueryOptions;
+using VectorTileQuery::TileInput;
+
+struct tile_file {
+    std::string path;
+    std::string data;
+    std::int32_t z;
+    std::int32_t x;
+    std::int32_t y;
+    std::vector<TileInput> input;
+};
+
+struct query_point {
+    mapbox::geometry::point<double> lnglat;
+    std::size_t tile;
+};
+
+struct thread_result {
+    std::vector<double> latencies_us;
+    std::uint64_t allocations{0};
+    std::uint64_t results{0};
+    std::string error;
+};
+
+[[noreturn]] void fail(std::string const& message) {
+    std::fprintf(stderr, "vtquery-bench: %s\n", message.c_str());
+    std::exit(1);
+}
+
+bool parse_int(std::string const& s, std::int32_t& value) {
+    if (s.empty() || s.size() > 9 || s.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    value = static_cast<std::int32_t>(std::stol(s));
+    return true;
+}
+
+/// z/x/y from `name-Z-X-Y.ext` or `.../Z/X/Y.ext`
+bool parse_tile_coordinates(std::string const& path, std::int32_t& z, std::int32_t& x, std::int32_t& y) {
+    std::string const stem = path.substr(0, path.rfind('.'));
+    for (char const separator : {'-', '/'}) {
+        std::vector<std::string> parts;
+        std::string part;
+        std::istringstream in(stem);
+        while (std::getline(in, part, separator)) {
+            parts.push_back(part);
+        }
+        if (parts.size() >= 3 &&
+            parse_int(parts[parts.size() - 3], z) &&
+            parse_int(parts[parts.size() - 2], x) &&
+            parse_int(parts[parts.size() - 1], y) &&
+            z <= 30 && x < (1 << z) && y < (1 << z)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string read_file(std::string const& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        fail("could not read '" + path + "'");
+    }
+    std::ostringstream out;
+    out << in.rdbuf();
+    return out.str();
+}
+
+bool is_directory(std::string const& path) {
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool has_tile_extension(std::string const& name) {
+    auto const dot = name.rfind('.');
+    return dot != std::string::npos && (name.compare(dot, std::string::npos, ".mvt") == 0 || name.compare(dot, std::string::npos, ".pbf") == 0);
+}
+
+void add_tile(std::string const& path, bool required, std::vector<tile_file>& tiles) {
+    tile_file tile;
+    if (!parse_tile_coordinates(path, tile.z, tile.x, tile.y)) {
+        if (required) {
+            fail("can not tell the z/x/y of '" + path + "', name it like name-Z-X-Y.mvt");
+        }
+        std::fprintf(stderr, "skipping %s: no z/x/y in its name\n", path.c_str());
+        return;
+    }
+    tile.path = path;
+    tile.data = read_file(path);
+    tiles.push_back(std::move(tile));
+}
+
+void find_tiles(std::string const& dir, std::vector<tile_file>& tiles) {
+    DIR* d = ::opendir(dir.c_str());
+    if (d == nullptr) {
+        fail("could not open '" + dir + "'");
+    }
+    std::vector<std::string> names;
+    while (dirent* entry = ::readdir(d)) {
+        std::string const name = entry->d_name;
+        if (name != "." && name != "..") {
+            names.push_back(name);
+        }
+    }
+    ::closedir(d);
+    std::sort(names.begin(), names.end());
+    for (auto const& name : names) {
+        std::string const path = dir + "/" + name;
+        if (is_directory(path)) {
+            find_tiles(path, tiles);
+        } else if (has_tile_extension(name)) {
+            add_tile(path, false, tiles);
+        }
+    }
+}
+
+/// every tile containing lng/lat
+std::vector<std::size_t> tiles_at(std::vector<tile_file> const& tiles, mapbox::geometry::point<double> const& lnglat) {
+    std::vector<std::size_t> found;
+    for (std::size_t i = 0; i < tiles.size(); ++i) {
+        auto const p = utils::create_query_point(lnglat.x, lnglat.y, 4096, tiles[i].z, tiles[i].x, tiles[i].y);
+        if (p.x >= 0 && p.x < 4096 && p.y >= 0 && p.y < 4096) {
+            found.push_back(i);
+        }
+    }
+    return found;
+}
+
+std::vector<query_point> read_points(std::string const& path, std::vector<tile_file> const& tiles) {
+    std::ifstream in(path);
+    if (!in) {
+        fail("could not read '" + path + "'");
+    }
+    std::vector<query_point> points;
+    std::size_t outside = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream fields(line);
+        mapbox::geometry::point<double> lnglat;
+        if (!(fields >> lnglat.x >> lnglat.y)) {
+            fail("'" + line + "' in '" + path + "' is not a lng,lat pair");
+        }
+        auto const found = tiles_at(tiles, lnglat);
+        if (found.empty()) {
+            ++outside;
+        }
+        for (auto const tile : found) {
+            points.push_back(query_point{lnglat, tile});
+        }
+    }
+    if (outside > 0) {
+        std::fprintf(stderr, "skipping %zu points outside of every tile\n", outside);
+    }
+    return points;
+}
+
+std::vector<query_point> random_points(std::size_t count, unsigned seed, std::vector<tile_file> const& tiles) {
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<std::size_t> which(0, tiles.size() - 1);
+    std::uniform_real_distribution<double> position(0.0, 4096.0);
+    std::vector<query_point> points;
+    points.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        std::size_t const tile = which(gen);
+        auto const& t = tiles[tile];
+        auto const lnglat = utils::convert_vt_to_ll(4096, t.z, t.x, t.y, mapbox::geometry::point<double>{position(gen), position(gen)});
+        points.push_back(query_point{lnglat, tile});
+    }
+    return points;
+}
+
+void run_thread(std::size_t offset,
+                std::chrono::steady_clock::time_point deadline,
+                std::vector<tile_file> const& tiles,
+                std::vector<query_point> const& points,
+                QueryOptions const& options,
+                std::atomic<bool>& stop,
+                thread_result& out) {
+    try {
+        for (std::size_t i = offset; !stop.load(std::memory_order_relaxed); ++i) {
+            auto const& point = points[i % points.size()];
+            std::uint64_t const allocations_before = allocations;
+            auto const start = std::chrono::steady_clock::now();
+            auto const results = VectorTileQuery::query(tiles[point.tile].input, point.lnglat, options);
+            auto const end = std::chrono::steady_clock::now();
+            out.allocations += allocations - allocations_before;
+            out.results += results.size();
+            out.latencies_us.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+            if (end >= deadline) {
+                break;
+            }
+        }
+    } catch (std::exception const& e) {
+        out.error = e.what();
+        stop = true;
+    }
+}
+
+double percentile(std::vector<double> const& sorted, double p) {
+    auto const rank = static_cast<std::size_t>(std::ceil(p * static_cast<double>(sorted.size())));
+    return sorted[std::min(sorted.size() - 1, rank == 0 ? 0 : rank - 1)];
+}
+
+VectorTileQuery::GeomType parse_geometry(std::string const& value) {
+    if (value == "point") {
+        return VectorTileQuery::GeomType::point;
+    }
+    if (value == "linestring") {
+        return VectorTileQuery::GeomType::linestring;
+    }
+    if (value == "polygon") {
+        return VectorTileQuery::GeomType::polygon;
+    }
+    fail("--geometry must be point, linestring or polygon");
+}
+
+[[noreturn]] void usage() {
+    std::fprintf(stderr, "Usage: vtquery-bench [--threads N] [--duration S] [--points FILE | --random N] [--seed N]\n"
+                         "                     [--radius M] [--limit N] [--layers A,B] [--geometry TYPE] [--columnar]\n"
+                         "                     <tile or directory>...\n");
+    std::exit(1);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::size_t threads = 1;
+    double duration = 5.0;
+    std::string points_path;
+    std::size_t random_count = 1000;
+    unsigned seed = 42;
+    QueryOptions options;
+    std::vector<std::string> inputs;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string const arg = argv[i];
+        if (arg == "--columnar") {
+            options.columnar = true;
+            continue;
+        }
+        if (arg.compare(0, 2, "--") != 0) {
+            inputs.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage();
+        }
+        std::string const value = argv[++i];
+        if (arg == "--threads") {
+            threads = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg == "--duration") {
+            duration = std::strtod(value.c_str(), nullptr);
+        } else if (arg == "--points") {
+            points_path = value;
+        } else if (arg == "--random") {
+            random_count = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg == "--seed") {
+            seed = static_cast<unsigned>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (arg == "--radius") {
+            options.radius = std::strtod(value.c_str(), nullptr);
+        } else if (arg == "--limit") {
+            options.num_results = static_cast<std::uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (arg == "--layers") {
+            std::istringstream names(value);
+            std::string name;
+            while (std::getline(names, name, ',')) {
+                options.layers.insert(name);
+            }
+        } else if (arg == "--geometry") {
+            options.geometry_filter_type = parse_geometry(value);
+        } else {
+            usage();
+        }
+    }
+    if (inputs.empty() || threads == 0 || !(duration > 0.0) || options.num_results == 0 || options.radius < 0.0) {
+        usage();
+    }
+
+    std::vector<tile_file> tiles;
+    for (auto const& input : inputs) {
+        if (is_directory(input)) {
+            find_tiles(input, tiles);
+        } else {
+            add_tile(input, true, tiles);
+        }
+    }
+    if (tiles.empty()) {
+        fail("no tiles found");
+    }
+    // the inputs point into `data`, which stays put once every tile is loaded
+    for (auto& tile : tiles) {
+        tile.input.emplace_back(vtzero::data_view{tile.data}, tile.z, tile.x, tile.y);
+    }
+
+    auto const points = points_path.empty() ? random_points(random_count, seed, tiles) : read_points(points_path, tiles);
+    if (points.empty()) {
+        fail("no query points");
+    }
+
+    std::printf("%zu tiles, %zu points, %zu threads, %.1f seconds\n", tiles.size(), points.size(), threads, duration);
+
+    std::atomic<bool> stop{false};
+    std::vector<thread_result> results(threads);
+    std::vector<std::thread> workers;
+    auto const start = std::chrono::steady_clock::now();
+    auto const deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(duration));
+    for (std::size_t t = 0; t < threads; ++t) {
+        // threads start at different points so they do not query in lockstep
+        workers.emplace_back(run_thread, t * points.size() / threads, deadline, std::cref(tiles), std::cref(points),
+                             std::cref(options), std::ref(stop), std::ref(results[t]));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+
+    std::vector<double> latencies;
+    std::uint64_t total_allocations = 0;
+    std::uint64_t total_results = 0;
+    for (auto const& result : results) {
+        if (!result.error.empty()) {
+            fail("query failed: " + result.error);
+        }
+        latencies.insert(latencies.end(), result.latencies_us.begin(), result.latencies_us.end());
+        total_allocations += result.allocations;
+        total_results += result.results;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double const queries = static_cast<double>(latencies.size());
+
+    std::printf("queries:     %zu\n", latencies.size());
+    std::printf("throughput:  %.0f queries/s\n", queries / elapsed.count());
+    std::printf("latency:     p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us\n",
+                percentile(latencies, 0.5), percentile(latencies, 0.99), percentile(latencies, 0.999), latencies.back());
+    std::printf("allocations: %.1f per query\n", static_cast<double>(total_allocations) / queries);
+    std::printf("results:     %.2f per query\n", static_cast<double>(total_results) / queries);
+    return 0;
+}
@@ -1,6 +1,6 @@
 "use strict";
 
-const argv = require('minimist')(process.argv.slice(2));
+const argv = require('minimist')(process.argv.slice(2), { string: ['output'] });
 if (!argv.iterations || !argv.concurrency) {
   console.error('Please provide desired iterations, concurrency');
   console.error('Example: \nnode bench/vtquery.bench.js --iterations 50 --concurrency 10');
@@ -16,10 +16,22 @@ process.env.UV_THREADPOOL_SIZE = argv.concurrency;
 const fs = require('fs');
 const path = require('path');
 const assert = require('assert');
+const perf_hooks = require('perf_hooks');
 const Queue = require('d3-queue').queue;
 const vtquery = require('../lib/index.js');
 const rules = require('./rules');
 let ruleCount = 1;
+const rows = [];
+
+// GC pauses are reported to an observer, summed here and reset by each rule
+const gc = { count: 0, ms: 0 };
+const gcObserver = new perf_hooks.PerformanceObserver(function(list) {
+  list.getEntries().forEach(function(entry) {
+    ++gc.count;
+    gc.ms += entry.duration;
+  });
+});
+gcObserver.observe({ entryTypes: ['gc'] });
 
 // run each rule synchronously
 const ruleQueue = Queue(1);
@@ -29,15 +41,27 @@ rules.forEach(function(rule) {
 
 ruleQueue.awaitAll(function(err, res) {
   if (err) throw err;
-  process.stdout.write('\n');
+  gcObserver.disconnect();
+  if (argv.output === 'json') {
+    process.stdout.write(JSON.stringify(rows, null, 2) + '\n');
+  } else {
+    process.stdout.write('\n');
+  }
 });
 
+function mb(bytes) {
+  return (bytes >= 0 ? '+' : '') + (bytes / 1048576).toFixed(1) + 'MB';
+}
+
 function runRule(rule, ruleCallback) {
 
-  process.stdout.write(`\n${ruleCount}: ${rule.description} ... `);
+  log(`\n${ruleCount}: ${rule.description} ... `);
 
   let runs = 0;
   let runsQueue = Queue();
+  // nanoseconds spent in the completion callbacks, which includes starting the next queued query.
+  // Building the FeatureCollection before the callback is called is timed by vtquery.metrics()
+  let callbackNs = 0n;
 
   function run(cb) {
     vtquery(rule.tiles, rule.queryPoint, rule.options, function(err, result) {
@@ -45,10 +69,21 @@ function runRule(rule, ruleCallback) {
         return cb(err);
       }
       ++runs;
-      return cb();
+      const start = process.hrtime.bigint();
+      cb();
+      callbackNs += process.hrtime.bigint() - start;
     });
   }
 
+  // start every rule from a collected heap when node runs with --expose-gc, so growth is not left over from the last one
+  if (global.gc) global.gc();
+  const memoryBefore = process.memoryUsage();
+  gc.count = 0;
+  gc.ms = 0;
+  vtquery.metrics();
+  const loopDelay = perf_hooks.monitorEventLoopDelay({ resolution: 10 });
+  loopDelay.enable();
+
   // Start monitoring time before async work begins within the defer iterator below.
   // AsyncWorkers will kick off actual work before the defer iterator is finished,
   // and we want to make sure we capture the time of the work of that initial cycle.
@@ -66,25 +101,52 @@ function runRule(rule, ruleCallback) {
     // check rate
     time = +(new Date()) - time;
 
+    loopDelay.disable();
+    const memoryAfter = process.memoryUsage();
+    const results = vtquery.metrics().result_ns;
+
     if (time == 0) {
       console.log("Warning: ms timer not high enough resolution to reliably track rate. Try more iterations");
     } else {
     // number of milliseconds per iteration
       var rate = runs/(time/1000);
-      process.stdout.write(rate.toFixed(0) + ' runs/s (' + time + 'ms)');
+      log(rate.toFixed(0) + ' runs/s (' + time + 'ms)');
     }
 
-    // There may be instances when you want to assert some performance metric
-    //assert.equal(rate > 1000, true, 'speed not at least 1000/second ( rate was ' + rate + ' runs/s )');
-    ++ruleCount;
-    return ruleCallback();
+    // pending GC entries are delivered on a later tick
+    setImmediate(function() {
+      const row = {
+        rule: rule.description,
+        runs_per_s: time ? Math.round(rate) : null,
+        time_ms: time,
+        loop_delay_p50_ms: loopDelay.percentile(50) / 1e6,
+        loop_delay_p99_ms: loopDelay.percentile(99) / 1e6,
+        loop_delay_max_ms: loopDelay.max / 1e6,
+        gc_pauses: gc.count,
+        gc_pause_ms: gc.ms,
+        heap_growth_bytes: memoryAfter.heapUsed - memoryBefore.heapUsed,
+        rss_growth_bytes: memoryAfter.rss - memoryBefore.rss,
+        result_ms: results.sum / 1e6,
+        result_p99_ms: results.p99 / 1e6,
+        callback_ms: Number(callbackNs) / 1e6
+      };
+      rows.push(row);
+      log(`\n    loop delay p50 ${row.loop_delay_p50_ms.toFixed(2)}ms p99 ${row.loop_delay_p99_ms.toFixed(2)}ms max ${row.loop_delay_max_ms.toFixed(2)}ms` +
+          ` | gc ${row.gc_pauses} pauses ${row.gc_pause_ms.toFixed(1)}ms` +
+          ` | heap ${mb(row.heap_growth_bytes)} rss ${mb(row.rss_growth_bytes)}` +
+          ` | results ${row.result_ms.toFixed(1)}ms (p99 ${row.result_p99_ms.toFixed(3)}ms) callback ${row.callback_ms.toFixed(1)}ms`);
+
+      // There may be instances when you want to assert some performance metric
+      //assert.equal(rate > 1000, true, 'speed not at least 1000/second ( rate was ' + rate + ' runs/s )');
+      ++ruleCount;
+      return ruleCallback();
+    });
   });
 }
 
+// with --output json the per rule lines are replaced by one JSON array of rows at the end
 function log(message) {
-  if (argv.output && argv.output === 'json') {
-    // handle JSON output
-  } else {
+  if (argv.output !== 'json') {
     process.stdout.write(message);
   }
 }
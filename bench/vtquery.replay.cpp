@@ -0,0 +1,203 @@
+// Replays queries captured with vtquery.configure({ capture_dir }) through the
+// query engine (src/query.hpp), without node, so production latency outliers
+// can be reproduced, profiled and compared between builds.
+//
+// Usage: vtquery-replay [options] <capture file or directory>...
+//
+//   --repeat N     timed runs of each query (default 10)
+//   --warmup N     untimed runs first, which fill the columnar and polygon
+//                  caches as production had them (default 1)
+//
+// Directories are searched for .query files, not recursively. Each query is
+// run exactly as it was captured (the progress callback and the result cache
+// left out) and reported with its captured time, the replayed time and how
+// that time splits into reading tiles, scanning features and materializing
+// results, from the same per-phase metrics vtquery.metrics() reports.
+//
+// To profile one query: perf record -g vtquery-replay --repeat 1000 <file>
+#include "../src/capture.hpp"
+#include "../src/metrics.hpp"
+#include "../src/query.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <exception>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace {
+
+struct run_timings {
+    double total_us{0.0};
+    double prepare_us{0.0};
+    double scan_us{0.0};
+    double materialize_us{0.0};
+    std::uint64_t features_scanned{0};
+    std::size_t results{0};
+};
+
+[[noreturn]] void fail(std::string const& message) {
+    std::fprintf(stderr, "vtquery-replay: %s\n", message.c_str());
+    std::exit(1);
+}
+
+bool is_directory(std::string const& path) {
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool has_query_extension(std::string const& name) {
+    std::string const extension = ".query";
+    return name.size() > extension.size() && name.compare(name.size() - extension.size(), std::string::npos, extension) == 0;
+}
+
+void find_captures(std::string const& dir, std::vector<std::string>& paths) {
+    DIR* d = ::opendir(dir.c_str());
+    if (d == nullptr) {
+        fail("could not open '" + dir + "'");
+    }
+    std::vector<std::string> names;
+    while (dirent* entry = ::readdir(d)) {
+        std::string const name = entry->d_name;
+        if (has_query_extension(name)) {
+            names.push_back(name);
+        }
+    }
+    ::closedir(d);
+    // capture files start with their time, so this is the order they were captured in
+    std::sort(names.begin(), names.end());
+    for (auto const& name : names) {
+        paths.push_back(dir + "/" + name);
+    }
+}
+
+double us(std::uint64_t ns) {
+    return static_cast<double>(ns) / 1e3;
+}
+
+/// one run of a captured query, timed as a whole and per phase
+run_timings run(capture::captured_query const& q, std::vector<VectorTileQuery::TileInput> const& inputs) {
+    metrics::snapshot totals;
+    metrics::drain(totals);
+
+    run_timings t;
+    auto const start = std::chrono::steady_clock::now();
+    if (q.batch) {
+        for (auto const& point : VectorTileQuery::query_batch(inputs, q.points, q.options)) {
+            t.results += point.results.size();
+        }
+    } else {
+        t.results = VectorTileQuery::query(inputs, q.points.front(), q.options).size();
+    }
+    t.total_us = us(metrics::elapsed_ns(start));
+
+    metrics::snapshot const delta = metrics::drain(totals);
+    t.prepare_us = us(delta.histograms[metrics::prepare_ns].sum);
+    t.scan_us = us(delta.histograms[metrics::scan_ns].sum);
+    t.materialize_us = us(delta.histograms[metrics::materialize_ns].sum);
+    t.features_scanned = delta.histograms[metrics::features_scanned].sum;
+    return t;
+}
+
+double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+void replay(std::string const& path, std::size_t warmup, std::size_t repeat) {
+    // captures leave `cache` out, every run does the whole query
+    capture::captured_query const q = capture::read_capture(path);
+    auto const inputs = q.inputs();
+
+    for (std::size_t i = 0; i < warmup; ++i) {
+        run(q, inputs);
+    }
+    std::vector<double> total;
+    std::vector<double> prepare;
+    std::vector<double> scan;
+    std::vector<double> materialize;
+    run_timings last;
+    for (std::size_t i = 0; i < repeat; ++i) {
+        last = run(q, inputs);
+        total.push_back(last.total_us);
+        prepare.push_back(last.prepare_us);
+        scan.push_back(last.scan_us);
+        materialize.push_back(last.materialize_us);
+    }
+
+    std::sort(total.begin(), total.end());
+    std::printf("%s\n", path.c_str());
+    std::printf("  query:       %zu point%s%s, %zu tile%s, radius %g, limit %u\n", q.points.size(), q.points.size() == 1 ? "" : "s",
+                q.batch ? " (batch)" : "", q.tiles.size(), q.tiles.size() == 1 ? "" : "s", q.options.radius, q.options.num_results);
+    if (q.error.empty()) {
+        std::printf("  captured:    %.1f us\n", us(q.execute_ns));
+    } else {
+        std::printf("  captured:    %.1f us, failed: %s\n", us(q.execute_ns), q.error.c_str());
+    }
+    std::printf("  replayed:    p50 %.1f us, min %.1f us, max %.1f us over %zu runs\n", total[total.size() / 2], total.front(), total.back(), repeat);
+    std::printf("  phases p50:  prepare %.1f us, scan %.1f us, materialize %.1f us\n", median(prepare), median(scan), median(materialize));
+    std::printf("  work:        %llu features scanned, %zu results\n", static_cast<unsigned long long>(last.features_scanned), last.results);
+}
+
+[[noreturn]] void usage() {
+    std::fprintf(stderr, "Usage: vtquery-replay [--repeat N] [--warmup N] <capture file or directory>...\n");
+    std::exit(1);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::size_t repeat = 10;
+    std::size_t warmup = 1;
+    std::vector<std::string> inputs;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string const arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            inputs.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage();
+        }
+        std::string const value = argv[++i];
+        if (arg == "--repeat") {
+            repeat = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg == "--warmup") {
+            warmup = std::strtoul(value.c_str(), nullptr, 10);
+        } else {
+            usage();
+        }
+    }
+    if (inputs.empty() || repeat == 0) {
+        usage();
+    }
+
+    std::vector<std::string> paths;
+    for (auto const& input : inputs) {
+        if (is_directory(input)) {
+            find_captures(input, paths);
+        } else {
+            paths.push_back(input);
+        }
+    }
+    if (paths.empty()) {
+        fail("no captured queries found");
+    }
+
+    int failed = 0;
+    for (auto const& path : paths) {
+        try {
+            replay(path, warmup, repeat);
+        } catch (std::exception const& e) {
+            // a query that failed in production fails again here, the others still run
+            std::printf("%s\n  failed:      %s\n", path.c_str(), e.what());
+            ++failed;
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
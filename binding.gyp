@@ -11,6 +11,7 @@
   'includes': [ 'common.gypi' ], # brings in a default set of options that are inherited from gyp
   'variables': { # custom variables we use specific to this file
       'error_on_warnings%':'true', # can be overriden by a command line variable because of the % sign using "WERROR" (defined in Makefile)
+      'generic_kernel%':'false', # set to true to build the runtime-checked feature loop instead of the specialized ones, for benchmarking
       # Use this variable to silence warnings from mason dependencies and from node-addon-api
       # It's a variable to make easy to pass to
       # cflags (linux) and xcode (mac)
@@ -60,12 +61,54 @@
         }
       ]
     },
+    {
+      # the query engine without any N-API code, see src/query.hpp
+      # the same library is built by CMakeLists.txt for use outside of node
+      'target_name': 'vtquery_core',
+      'type': 'static_library',
+      'dependencies': [ 'action_before_build' ],
+      'sources': [
+        './src/query.cpp'
+      ],
+      'direct_dependent_settings': {
+        'include_dirs': [ './src' ]
+      },
+      'conditions': [
+        ['error_on_warnings == "true"', {
+            'cflags_cc' : [ '-Werror' ],
+            'xcode_settings': {
+              'OTHER_CPLUSPLUSFLAGS': [ '-Werror' ]
+            }
+        }],
+        ['generic_kernel == "true"', {
+            'defines': [ 'VTQUERY_GENERIC_KERNEL' ]
+        }]
+      ],
+      'cflags': [
+          # linked into the loadable module
+          '-fPIC',
+          '<@(system_includes)',
+          '<@(compiler_checks)'
+      ],
+      'xcode_settings': {
+        'OTHER_CPLUSPLUSFLAGS': [
+            '<@(system_includes)',
+            '<@(compiler_checks)'
+        ],
+        'GCC_ENABLE_CPP_RTTI': 'YES',
+        'GCC_ENABLE_CPP_EXCEPTIONS': 'YES',
+        'MACOSX_DEPLOYMENT_TARGET':'10.8',
+        'CLANG_CXX_LIBRARY': 'libc++',
+        'CLANG_CXX_LANGUAGE_STANDARD':'c++14',
+        'GCC_VERSION': 'com.apple.compilers.llvm.clang.1_0'
+      }
+    },
     {
       # module_name and module_path are both variables passed by node-pre-gyp from package.json
       'target_name': '<(module_name)', # sets the name of the binary file
       'product_dir': '<(module_path)', # controls where the node binary file gets copied to (./lib/binding/module.node)
       'type': 'loadable_module',
-      'dependencies': [ 'action_before_build' ],
+      'dependencies': [ 'action_before_build', 'vtquery_core' ],
       # "make" only watches files specified here, and will sometimes cache these files after the first compile.
       # This cache can sometimes cause confusing errors when removing/renaming/adding new files.
       # Running "make clean" helps to prevent this "mysterious error by cache" scenario
@@ -84,6 +127,9 @@
             'xcode_settings': {
               'OTHER_CPLUSPLUSFLAGS': [ '-Werror' ]
             }
+        }],
+        ['generic_kernel == "true"', {
+            'defines': [ 'VTQUERY_GENERIC_KERNEL' ]
         }]
       ],
       'cflags': [
@@ -3,7 +3,10 @@
 /**
  * @name vtquery
  *
- * @param {Array<Object>} tiles an array of tile objects with `buffer`, `z`, `x`, and `y` values
+ * @param {Array<Object>} tiles an array of tile objects with `buffer`, `z`, `x`, and `y` values, and optionally a sidecar index
+ * from `vtquery.buildIndex` as either `index` (a Buffer) or `index_path` (the path of a file to map). `buffer` can be a Buffer, any other
+ * TypedArray, a DataView, an ArrayBuffer or a SharedArrayBuffer, and must not be changed until `callback` is called. Instead of `buffer`,
+ * `stored` names a tile kept by `vtquery.storeTile`
  * @param {Array<Number>} LngLat a query point of longitude and latitude to query, `[lng, lat]`
  * @param {Object} [options]
  * @param {Number} [options.radius=0] the radius to query for features. If your radius is larger than
@@ -12,11 +15,31 @@
  * @param {Array<String>} [options.layers] an array of layer string names to query from. Default is all layers.
  * @param {String} [options.geometry] only return features of a particular geometry type. Can be `point`, `linestring`, or `polygon`.
  * Defaults to all geometry types.
+ * @param {String|Array<String>} [options.group_by] `layer`, `geometry` or both in an array: `limit` then applies to each layer,
+ * each geometry type or each geometry type of each layer, and every group's nearest features are returned together, nearest first.
  * @param {String} [options.dedup=true] perform deduplication of features based on shared layers, geometry, IDs and matching
  * properties.
  * @param {Array<String,Array>} [options.basic-filters] - an expression-like filter to include features with Numeric or Boolean properties
  * that match the filters based on the following conditions: `=, !=, <, <=, >, >=`. The first item must be the value "any" or "all" whether
  * any or all filters must evaluate to true.
+ * @param {Boolean} [options.columnar=false] query a pre-decoded, columnar copy of each tile instead of the encoded tile. The copy is built on
+ * first use and cached natively (up to 256MB), so this only pays off when the same tiles are queried repeatedly.
+ *
+ * @param {Boolean} [options.cache=false] answer from, and add to, a native cache of results. A query is answered from the cache when an
+ * earlier query used the same tiles, options and exact query point, with the results it would have returned.
+ *
+ * @param {Number} [options.tolerance=0] meters of geometry simplification. Linestrings and polygons are first measured against a copy
+ * simplified to within this many meters, cached per tile and layer, and only measured exactly when they could still make the results.
+ * Results are the same as without it.
+ *
+ * @param {Number} [options.max_memory] bytes the query may hold: the tiles it decompresses, the columnar tiles, polygon grids and
+ * simplified layers it builds, its decoded geometry and its results. A query going over it fails with the error
+ * `query exceeded 'max_memory' of <max_memory> bytes`. Gzipped tiles are checked before each block of their output is allocated,
+ * everything else once it is built, so a query can briefly hold more than `max_memory` by what it built last. No limit by default.
+ *
+ * @param {Function} [options.progress] called with the results found so far after each tile but the last, nearest tile first, and
+ * `{ tiles_queried, tiles_total }`. Return `false` to stop the query early: `callback` then gets the results of the tiles queried so far.
+ * Can not be compiled or used with `vtquery.batch`.
  *
  * @example
  * const vtquery = require('@mapbox/vtquery');
@@ -40,4 +63,212 @@
  *   console.log(result); // geojson FeatureCollection
  * });
  */
-module.exports = require('./binding/module.node').vtquery;
+const binding = require('./binding/module.node');
+const scheduler = require('./scheduler.js')(binding);
+const nearest = require('./nearest.js')(scheduler.query);
+
+module.exports = scheduler.query;
+
+/**
+ * Precompute the sidecar index of a tile: its layer directory and the bounding box and geometry type of every feature.
+ * Pass the index back with the tile, as `index` (a Buffer) or `index_path` (a file vtquery maps into memory), to let
+ * queries skip layers and features that cannot be in range without decoding them. An index is only valid for the exact
+ * tile bytes it was built from, queries with a mismatched index return an error.
+ *
+ * @name buildIndex
+ * @memberof vtquery
+ * @param {Buffer} buffer a vector tile buffer, gzip compressed or not, exactly as it will be passed to vtquery
+ * @param {Function} callback called with an error or the index as a Buffer
+ *
+ * @example
+ * const vtquery = require('@mapbox/vtquery');
+ * const buffer = fs.readFileSync('./path/to/tile.mvt');
+ *
+ * vtquery.buildIndex(buffer, function(err, index) {
+ *   if (err) throw err;
+ *   fs.writeFileSync('./path/to/tile.mvt.vtqi', index);
+ *   vtquery([{ buffer: buffer, index: index, z: 15, x: 5238, y: 12666 }], [-122.4477, 37.7665], {}, callback);
+ * });
+ */
+module.exports.buildIndex = binding.buildIndex;
+
+/**
+ * Validate query options once, for queries that are made over and over with the same options. Pass the returned object
+ * to vtquery or vtquery.batch in place of the options object: it is shared by every query, so none of them parse,
+ * validate or copy the options again. Compiled options can not be changed, compile new ones instead.
+ *
+ * @name compile
+ * @memberof vtquery
+ * @param {Object} options the same options as for vtquery
+ * @returns {Object} compiled options
+ * @throws {TypeError} if the options are not valid, with the same message vtquery would return
+ *
+ * @example
+ * const nearbyParks = vtquery.compile({ radius: 100, layers: ['parks'], geometry: 'polygon' });
+ *
+ * vtquery(tiles, [-122.4477, 37.7665], nearbyParks, function(err, result) {
+ *   if (err) throw err;
+ *   console.log(result); // geojson FeatureCollection
+ * });
+ */
+module.exports.compile = binding.compile;
+
+/**
+ * Query the same tiles from many points at once. Each layer's features are scanned once and measured against every
+ * point, which is what `configure({ batch_window_ms })` does for separate calls. Tiles are always queried in their
+ * columnar form (see `options.columnar`), sidecar indexes and `options.cache` are not used.
+ *
+ * @name batch
+ * @memberof vtquery
+ * @param {Array<Object>} tiles the same tile objects as for vtquery
+ * @param {Array<Array<Number>>} points the query points, each `[lng, lat]`
+ * @param {Object} [options] the same options as for vtquery, or compiled options, applied to every point
+ * @param {Function} callback called with an error or an array holding a FeatureCollection for each point, in order. A point
+ * whose own results go over `max_memory` has an Error in its place, the other points still get theirs
+ *
+ * @example
+ * vtquery.batch(tiles, [[-122.4477, 37.7665], [-122.4470, 37.7660]], { radius: 100 }, function(err, results) {
+ *   if (err) throw err;
+ *   console.log(results[1]); // geojson FeatureCollection of the second point
+ * });
+ */
+module.exports.batch = binding.batch;
+
+/**
+ * Find the `limit` features closest to a point without knowing which tiles they are in. Tiles of one zoom level are
+ * asked for from `loader` as they are needed: first the tile holding the point, then the ring of 8 tiles around it,
+ * the 16 around those and so on, each ring queried once it is loaded. The search stops as soon as the `limit`-th
+ * closest feature found is nearer than any tile not loaded yet, when `radius` is reached, or after `max_rings` rings.
+ * Features found in more than one tile are deduplicated as with `dedupe`. The search does not wrap around the
+ * antimeridian.
+ *
+ * @name nearest
+ * @memberof vtquery
+ * @param {Array<Number>} LngLat the query point, `[lng, lat]`
+ * @param {Object} options the same options as for vtquery (not compiled, and without `progress`), plus:
+ * @param {Number} options.zoom the zoom level of the tiles to load
+ * @param {Function} options.loader called as `loader(z, x, y, callback)` for each tile. It can return the tile, return a
+ * promise of it, or call `callback(err, tile)`. A tile is a Buffer (or any other tile source vtquery takes), a tile object
+ * without `z`, `x` and `y` (to pass `index` or `stored`), or `null` when there is no tile
+ * @param {Number} [options.radius] the farthest a feature can be, in meters. No limit by default
+ * @param {Number} [options.max_rings=3] how many rings of tiles around the first one may be loaded, `0` loads only the tile
+ * holding the point and `3` up to 49 tiles
+ * @param {Function} callback called with an error or a FeatureCollection of the closest features, nearest first
+ *
+ * @example
+ * vtquery.nearest([-122.4477, 37.7665], {
+ *   zoom: 15,
+ *   limit: 3,
+ *   layers: ['poi_label'],
+ *   loader: (z, x, y) => tileCache.get(`${z}/${x}/${y}`) // a Buffer, a promise of one, or null
+ * }, function(err, result) {
+ *   if (err) throw err;
+ *   console.log(result); // geojson FeatureCollection
+ * });
+ */
+module.exports.nearest = nearest;
+
+/**
+ * Change process-wide settings.
+ *
+ * @name configure
+ * @memberof vtquery
+ * @param {Object} options
+ * @param {Number} [options.result_cache_bytes=33554432] the size of the cache used by queries with `cache: true`. `0` empties and disables it.
+ * @param {Number} [options.batch_window_ms=0] hold queries for up to this many milliseconds so queries against the same tiles with the
+ * same options, but different query points, are answered by one scan of the tiles' features. Only queries with `columnar: true`
+ * are held, batches query the columnar form of the tiles. `0` disables batching.
+ * @param {Number} [options.batch_max=64] run a batch as soon as it holds this many queries, without waiting for the window to end
+ * @param {String} [options.capture_dir] write every query slower than `capture_threshold_ms` on the threadpool, with its tiles,
+ * to this directory (created if missing) for `vtquery-replay` to run again. `null` stops capturing.
+ * @param {Number} [options.capture_threshold_ms=100] how long a query has to take to be captured
+ * @param {Number} [options.capture_max_bytes=268435456] stop capturing once this many bytes were written to `capture_dir`
+ *
+ * @example
+ * vtquery.configure({ result_cache_bytes: 64 * 1024 * 1024 });
+ * vtquery.configure({ batch_window_ms: 1, batch_max: 32 });
+ * vtquery.configure({ capture_dir: '/var/tmp/vtquery-slow', capture_threshold_ms: 50 });
+ */
+module.exports.configure = function(options) {
+  binding.configure(options);
+  scheduler.configure(options);
+};
+
+/**
+ * Process-wide counters.
+ *
+ * @name stats
+ * @memberof vtquery
+ * @returns {Object} `coalesced`: how many queries were answered by an identical query that was already running,
+ * `stored_tiles` and `stored_bytes`: the tiles kept by `vtquery.storeTile` and their size,
+ * `memory_current` and `memory_peak`: the bytes held by running queries now and at most (see `options.max_memory`),
+ * `memory_exceeded`: how many queries failed for going over their `max_memory`,
+ * `captured_queries`, `captured_bytes` and `capture_dropped`: slow queries written to `capture_dir`, the bytes written there and
+ * the slow queries left out because it was full or could not be written
+ */
+module.exports.stats = binding.stats;
+
+/**
+ * Process-wide query telemetry, recorded by every thread without locks and cheap enough to leave on. Each call returns
+ * what was recorded since the previous call (in either format) and starts over.
+ *
+ * Counters: `queries` and `errors`. Histograms, each with `count`, `sum`, `p50`, `p90`, `p99`, `p999`, `max` and
+ * `buckets` (`[upper bound, count]` pairs for the buckets holding values, within 12.5% of the values in them):
+ * `queue_wait_ns` from a query being queued to it starting on the threadpool, `execute_ns` its time on the threadpool,
+ * `result_ns` the main thread time to build each FeatureCollection, `bytes_inflated` the size of each gzipped tile
+ * once inflated, `features_scanned` the features each query visited, and `prepare_ns`, `scan_ns` and `materialize_ns` how
+ * each query's time on the threadpool splits into reading its tiles, its feature loops and copying out its results.
+ *
+ * @name metrics
+ * @memberof vtquery
+ * @param {Object} [options]
+ * @param {String} [options.format='json'] `prometheus` returns the totals since the process started in the Prometheus
+ * text format instead, times in seconds
+ * @returns {Object|String}
+ *
+ * @example
+ * setInterval(() => {
+ *   const m = vtquery.metrics();
+ *   console.log(m.queries, m.execute_ns.p99 / 1e6 + 'ms');
+ * }, 10000);
+ *
+ * // in a /metrics handler
+ * res.end(vtquery.metrics({ format: 'prometheus' }));
+ */
+module.exports.metrics = binding.metrics;
+
+/**
+ * Copy a tile into native memory shared by the whole process, then query it with `{ stored: key, z, x, y }` instead of
+ * `{ buffer, z, x, y }`. Every worker thread sees the same stored tiles, so one copy of a hot tile serves all of them.
+ * Storing a tile under a key already in use replaces it, queries already running keep reading the tile they started with.
+ * Queries held by this thread's batch window (see `configure`) that read `key` are run first.
+ *
+ * @name storeTile
+ * @memberof vtquery
+ * @param {String} key the name queries use for the tile
+ * @param {Buffer|TypedArray|DataView|ArrayBuffer|SharedArrayBuffer} buffer a vector tile, gzip compressed or not
+ *
+ * @example
+ * // main thread, or any worker
+ * vtquery.storeTile('streets/15/5238/12666', fs.readFileSync('./path/to/tile.mvt'));
+ * // any thread
+ * vtquery([{ stored: 'streets/15/5238/12666', z: 15, x: 5238, y: 12666 }], [-122.4477, 37.7665], options, callback);
+ */
+module.exports.storeTile = function(key) {
+  scheduler.flushStored(key);
+  return binding.storeTile.apply(null, arguments);
+};
+
+/**
+ * Remove a tile from the native store. Its memory is freed once no running query reads it. Queries held by this thread's
+ * batch window that read `key` are run first.
+ *
+ * @name dropTile
+ * @memberof vtquery
+ * @param {String} key the name the tile was stored as
+ * @returns {Boolean} whether a tile was stored as `key`
+ */
+module.exports.dropTile = function(key) {
+  scheduler.flushStored(key);
+  return binding.dropTile.apply(null, arguments);
+};
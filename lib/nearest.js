@@ -0,0 +1,250 @@
+'use strict';
+
+// k-nearest search over tiles loaded on demand.
+//
+// The search starts with the tile holding the query point and moves outward
+// one ring of tiles at a time: ring 1 is the 8 tiles around it, ring 2 the 16
+// around those, and so on. Each ring's tiles are loaded and queried together,
+// and the search stops as soon as the `limit`-th closest feature found is
+// nearer than anything in the next ring could be, so a point in the middle of
+// a dense tile never loads its neighbours.
+
+// cheap-ruler's meters per degree, as vtquery measures distances
+const RE = 6378.137;
+const FE = 1 / 298.257223563;
+const E2 = FE * (2 - FE);
+const RAD = Math.PI / 180;
+
+// distance bounds are shaded by this much so they never overestimate what vtquery measures
+const SLACK = 0.01;
+
+function rulerFactors(lat) {
+  const m = RAD * RE * 1000;
+  const coslat = Math.cos(lat * RAD);
+  const w2 = 1 / (1 - E2 * (1 - coslat * coslat));
+  const w = Math.sqrt(w2);
+  return { kx: m * w * coslat, ky: m * w * w2 * (1 - E2) };
+}
+
+function tileX(lng, n) {
+  return (lng + 180) / 360 * n;
+}
+
+function tileY(lat, n) {
+  const sin = Math.sin(lat * RAD);
+  return (0.5 - Math.log((1 + sin) / (1 - sin)) / (4 * Math.PI)) * n;
+}
+
+function tileLng(x, n) {
+  return x / n * 360 - 180;
+}
+
+function tileLat(y, n) {
+  return Math.atan(Math.sinh(Math.PI * (1 - 2 * y / n))) / RAD;
+}
+
+function isByteSource(value) {
+  return ArrayBuffer.isView(value) || value instanceof ArrayBuffer ||
+    (typeof SharedArrayBuffer === 'function' && value instanceof SharedArrayBuffer);
+}
+
+function isLngLat(lnglat) {
+  return Array.isArray(lnglat) && lnglat.length === 2 && typeof lnglat[0] === 'number' && typeof lnglat[1] === 'number';
+}
+
+// the tiles at Chebyshev distance `r` from the center tile, inside the world
+function ringTiles(cx, cy, r, n) {
+  const tiles = [];
+  for (let y = cy - r; y <= cy + r; ++y) {
+    if (y < 0 || y >= n) continue;
+    const edge = y === cy - r || y === cy + r;
+    for (let x = cx - r; x <= cx + r; x += edge || r === 0 ? 1 : 2 * r) {
+      if (x >= 0 && x < n) tiles.push({ x: x, y: y });
+    }
+  }
+  return tiles;
+}
+
+// the same feature found in two tiles, as vtquery's `dedupe` decides it
+function sameFeature(a, b) {
+  if (a.id !== b.id) return false;
+  const ta = a.properties.tilequery;
+  const tb = b.properties.tilequery;
+  if (ta.layer !== tb.layer || ta.geometry !== tb.geometry) return false;
+  const keys = Object.keys(a.properties);
+  if (keys.length !== Object.keys(b.properties).length) return false;
+  return keys.every(key => key === 'tilequery' || a.properties[key] === b.properties[key]);
+}
+
+// calls `loader` for one tile, whichever way it answers: a value, a promise or the callback
+function loadTile(loader, z, x, y, callback) {
+  let done = false;
+  function finish(err, value) {
+    if (done) return;
+    done = true;
+    callback(err, value);
+  }
+  let value;
+  try {
+    value = loader(z, x, y, finish);
+  } catch (err) {
+    return finish(err);
+  }
+  if (value !== undefined) {
+    if (value !== null && typeof value.then === 'function') {
+      value.then(v => finish(null, v), err => finish(err || new Error('tile loader failed')));
+    } else {
+      finish(null, value);
+    }
+  }
+}
+
+// the tile object to query for what the loader returned, null for a missing tile
+function tileObject(value, z, x, y) {
+  if (value === null || value === undefined) return null;
+  if (isByteSource(value)) return { buffer: value, z: z, x: x, y: y };
+  if (typeof value === 'object') return Object.assign({}, value, { z: z, x: x, y: y });
+  throw new Error(`tile loader returned neither a tile buffer nor a tile object for ${z}/${x}/${y}`);
+}
+
+function createNearest(query) {
+  // the options nearest() takes for itself, everything else is passed to each ring's query
+  const OWN = ['zoom', 'loader', 'max_rings', 'radius'];
+
+  function validate(lnglat, options) {
+    if (!isLngLat(lnglat)) return "first arg 'lnglat' must be an array with [longitude, latitude] values";
+    if (options === null || typeof options !== 'object' || Array.isArray(options)) return "second arg 'options' must be an object";
+    if (!Number.isInteger(options.zoom) || options.zoom < 0 || options.zoom > 30) return "'zoom' must be an integer from 0 to 30";
+    if (typeof options.loader !== 'function') return "'loader' must be a function";
+    if (options.max_rings !== undefined && (!Number.isInteger(options.max_rings) || options.max_rings < 0)) {
+      return "'max_rings' must be an integer, 0 or greater";
+    }
+    if (options.radius !== undefined && (typeof options.radius !== 'number' || !(options.radius >= 0))) {
+      return "'radius' must be a positive number";
+    }
+    if (options.limit !== undefined) {
+      if (typeof options.limit !== 'number') return "'limit' must be a number";
+      if (options.limit < 1) return "'limit' must be 1 or greater";
+      if (options.limit > 1000) return "'limit' must be less than 1000";
+    }
+    if (options.progress !== undefined) return "'progress' can not be used with vtquery.nearest";
+    if (options.group_by !== undefined) return "'group_by' can not be used with vtquery.nearest";
+    return null;
+  }
+
+  function nearest(lnglat, options, callback) {
+    if (typeof callback !== 'function') throw new TypeError("last arg 'callback' must be a function");
+    const error = validate(lnglat, options);
+    if (error) return callback(new Error(error));
+
+    const z = options.zoom;
+    const n = Math.pow(2, z);
+    const lng = lnglat[0];
+    const lat = lnglat[1];
+    const limit = options.limit === undefined ? 5 : options.limit;
+    const maxRadius = options.radius === undefined ? Infinity : options.radius;
+    const maxRings = options.max_rings === undefined ? 3 : options.max_rings;
+    const ruler = rulerFactors(lat);
+    const fx = tileX(lng, n);
+    const fy = tileY(lat, n);
+    const cx = Math.min(n - 1, Math.max(0, Math.floor(fx)));
+    const cy = Math.min(n - 1, Math.max(0, Math.floor(fy)));
+
+    const ringOptions = {};
+    Object.keys(options).forEach(key => {
+      if (OWN.indexOf(key) === -1) ringOptions[key] = options[key];
+    });
+
+    // the closest any feature of a tile outside rings 0 to r can be, Infinity when no tiles are left
+    function beyond(r) {
+      const sides = [Infinity];
+      if (cx - r > 0) sides.push((lng - tileLng(cx - r, n)) * ruler.kx);
+      if (cx + r < n - 1) sides.push((tileLng(cx + r + 1, n) - lng) * ruler.kx);
+      if (cy - r > 0) sides.push((tileLat(cy - r, n) - lat) * ruler.ky);
+      if (cy + r < n - 1) sides.push((lat - tileLat(cy + r + 1, n)) * ruler.ky);
+      return Math.max(0, Math.min.apply(null, sides)) * (1 - SLACK);
+    }
+
+    // the farthest any feature of rings 0 to r can be
+    function within(r) {
+      const dx = Math.max(lng - tileLng(cx - r, n), tileLng(cx + r + 1, n) - lng) * ruler.kx;
+      const dy = Math.max(tileLat(cy - r, n) - lat, lat - tileLat(cy + r + 1, n)) * ruler.ky;
+      return Math.sqrt(dx * dx + dy * dy) * (1 + SLACK);
+    }
+
+    let found = [];
+
+    function kthDistance() {
+      return found.length >= limit ? found[limit - 1].properties.tilequery.distance : Infinity;
+    }
+
+    function merge(features) {
+      features.forEach(feature => {
+        if (ringOptions.dedupe !== false) {
+          for (let i = 0; i < found.length; ++i) {
+            if (sameFeature(found[i], feature)) {
+              if (feature.properties.tilequery.distance < found[i].properties.tilequery.distance) found[i] = feature;
+              return;
+            }
+          }
+        }
+        found.push(feature);
+      });
+      found.sort((a, b) => a.properties.tilequery.distance - b.properties.tilequery.distance);
+      found = found.slice(0, limit);
+    }
+
+    function finish(err) {
+      if (err) return callback(err);
+      callback(null, { type: 'FeatureCollection', features: found });
+    }
+
+    function searchRing(r) {
+      const tiles = ringTiles(cx, cy, r, n);
+      const loaded = new Array(tiles.length);
+      let pending = tiles.length;
+      let failed = false;
+      if (pending === 0) return next(r, []);
+      tiles.forEach((tile, i) => {
+        loadTile(options.loader, z, tile.x, tile.y, (err, value) => {
+          if (failed) return;
+          if (!err) {
+            try {
+              loaded[i] = tileObject(value, z, tile.x, tile.y);
+            } catch (e) {
+              err = e;
+            }
+          }
+          if (err) {
+            failed = true;
+            return finish(err);
+          }
+          if (--pending === 0) next(r, loaded.filter(t => t !== null));
+        });
+      });
+    }
+
+    function next(r, tiles) {
+      function advance() {
+        const bound = beyond(r);
+        // done once nothing unvisited can be closer than the results or within the radius, or the rings run out
+        if (bound === Infinity || kthDistance() <= bound || bound > maxRadius || r >= maxRings) return finish();
+        searchRing(r + 1);
+      }
+      if (tiles.length === 0) return advance();
+      // only what can still make the results: closer than the `limit`-th feature found, within the radius
+      const radius = Math.min(kthDistance(), maxRadius, within(r));
+      query(tiles, lnglat, Object.assign({}, ringOptions, { radius: radius }), (err, result) => {
+        if (err) return finish(err);
+        merge(result.features);
+        advance();
+      });
+    }
+
+    searchRing(0);
+  }
+
+  return nearest;
+}
+
+module.exports = createNearest;
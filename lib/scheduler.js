@@ -0,0 +1,157 @@
+'use strict';
+
+// Micro-batching of vtquery calls.
+//
+// When enabled with `configure({ batch_window_ms })`, calls are held for up to
+// the window and calls against the same tiles with the same options are
+// answered together by `binding.batch`, which scans each layer's features once
+// for every pending query point. Each call still gets its own callback and
+// result. Calls that can not share a scan go straight to `binding.vtquery`.
+//
+// A group keeps what its first call passed as it was at the time of the call:
+// a copy of the tiles array and tile objects, and the options compiled. Groups
+// reading a stored tile run before that tile is stored again or dropped.
+
+function createScheduler(binding) {
+  let windowMs = 0;
+  let maxBatch = 64;
+  const groups = new Map();
+
+  // buffers and compiled options are grouped by identity, not by content
+  const objectIds = new WeakMap();
+  let nextObjectId = 1;
+  function objectId(object) {
+    let id = objectIds.get(object);
+    if (id === undefined) {
+      id = nextObjectId++;
+      objectIds.set(object, id);
+    }
+    return id;
+  }
+
+  function isByteSource(value) {
+    return ArrayBuffer.isView(value) || value instanceof ArrayBuffer ||
+      (typeof SharedArrayBuffer === 'function' && value instanceof SharedArrayBuffer);
+  }
+
+  function isLngLat(lnglat) {
+    return Array.isArray(lnglat) && lnglat.length === 2 && typeof lnglat[0] === 'number' && typeof lnglat[1] === 'number';
+  }
+
+  // the key of the group a call can join, or null when it has to run on its own
+  function groupKey(tiles, options) {
+    if (!Array.isArray(tiles) || tiles.length === 0) return null;
+    if (options === null || typeof options !== 'object' || Array.isArray(options)) return null;
+    // batches do not use the result cache, indexed tiles validate their index,
+    // progress callbacks belong to a single query. Batches decode their tiles
+    // to columnar form, which only calls that asked for it are charged for
+    if (options.cache || options.progress !== undefined || options.columnar !== true) return null;
+    const ids = [];
+    for (let i = 0; i < tiles.length; ++i) {
+      const tile = tiles[i];
+      if (tile === null || typeof tile !== 'object') return null;
+      if (tile.index !== undefined || tile.index_path !== undefined) return null;
+      if (tile.stored !== undefined) {
+        if (typeof tile.stored !== 'string' || tile.buffer !== undefined) return null;
+        ids.push(JSON.stringify(tile.stored), tile.z, tile.x, tile.y);
+      } else {
+        if (!isByteSource(tile.buffer)) return null;
+        ids.push(objectId(tile.buffer), tile.z, tile.x, tile.y);
+      }
+    }
+    if (options instanceof binding.CompiledOptions) {
+      return ids.join(',') + '|#' + objectId(options);
+    }
+    let optionsKey;
+    try {
+      optionsKey = JSON.stringify(options);
+    } catch (err) {
+      return null;
+    }
+    return ids.join(',') + '|' + optionsKey;
+  }
+
+  // the tiles of a call, copied so changing the caller's array or tile objects does not change the group
+  function copyTiles(tiles) {
+    return tiles.map(tile => Object.assign({}, tile));
+  }
+
+  function flush(key) {
+    const group = groups.get(key);
+    if (!group) return;
+    groups.delete(key);
+    clearTimeout(group.timer);
+
+    if (group.points.length === 1) {
+      return binding.vtquery(group.tiles, group.points[0], group.options, group.callbacks[0]);
+    }
+    binding.batch(group.tiles, group.points, group.options, (err, collections) => {
+      group.callbacks.forEach((callback, i) => {
+        if (err) return callback(new Error(err.message));
+        // a point that went over max_memory with results of its own fails alone
+        if (collections[i] instanceof Error) return callback(collections[i]);
+        callback(null, collections[i]);
+      });
+    });
+  }
+
+  function query(tiles, lnglat, options, callback) {
+    if (windowMs <= 0 || arguments.length !== 4 || typeof callback !== 'function' || !isLngLat(lnglat)) {
+      return binding.vtquery.apply(null, arguments);
+    }
+    const key = groupKey(tiles, options);
+    if (key === null) {
+      return binding.vtquery(tiles, lnglat, options, callback);
+    }
+
+    let group = groups.get(key);
+    if (!group) {
+      let compiled = options;
+      if (!(options instanceof binding.CompiledOptions)) {
+        try {
+          compiled = binding.compile(options);
+        } catch (err) {
+          // invalid options get their error from the query, as without batching
+          return binding.vtquery(tiles, lnglat, options, callback);
+        }
+      }
+      const stored = tiles.filter(tile => tile.stored !== undefined).map(tile => tile.stored);
+      group = { tiles: copyTiles(tiles), options: compiled, stored: stored, points: [], callbacks: [], timer: null };
+      groups.set(key, group);
+      group.timer = setTimeout(flush, windowMs, key);
+    }
+    group.points.push(lnglat);
+    group.callbacks.push(callback);
+    if (group.points.length >= maxBatch) flush(key);
+  }
+
+  function configure(options) {
+    if (options.batch_window_ms !== undefined) {
+      if (typeof options.batch_window_ms !== 'number' || !(options.batch_window_ms >= 0)) {
+        throw new TypeError("'batch_window_ms' must be a positive number");
+      }
+    }
+    if (options.batch_max !== undefined) {
+      if (typeof options.batch_max !== 'number' || !(options.batch_max >= 1)) {
+        throw new TypeError("'batch_max' must be 1 or greater");
+      }
+    }
+    if (options.batch_window_ms !== undefined) {
+      windowMs = options.batch_window_ms;
+      // nothing waits once batching is turned off
+      if (windowMs <= 0) Array.from(groups.keys()).forEach(flush);
+    }
+    if (options.batch_max !== undefined) maxBatch = Math.floor(options.batch_max);
+  }
+
+  // run the groups reading the tile stored as `storedKey`, before it is replaced or dropped
+  function flushStored(storedKey) {
+    Array.from(groups.keys()).forEach(key => {
+      if (groups.get(key).stored.indexOf(storedKey) !== -1) flush(key);
+    });
+  }
+
+  return { query: query, configure: configure, flushStored: flushStored };
+}
+
+module.exports = createScheduler;
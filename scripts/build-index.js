@@ -0,0 +1,62 @@
+#!/usr/bin/env node
+'use strict';
+
+// Builds a vtquery sidecar index next to every tile in a directory.
+//
+// Usage: node scripts/build-index.js <directory> [--ext .mvt] [--force]
+//
+// Each `tile.mvt` gets a `tile.mvt.vtqi`, which can be passed to vtquery as
+// `index_path`. Existing indexes are kept unless they are older than their tile
+// or --force is given.
+
+const fs = require('fs');
+const path = require('path');
+const argv = require('minimist')(process.argv.slice(2), { string: ['ext'], boolean: ['force'] });
+const queue = require('d3-queue').queue;
+const vtquery = require('../lib/index.js');
+
+const dir = argv._[0];
+if (!dir) {
+  console.error('Usage: node scripts/build-index.js <directory> [--ext .mvt] [--force]');
+  process.exit(1);
+}
+const extensions = argv.ext ? [].concat(argv.ext) : ['.mvt', '.pbf'];
+
+function findTiles(d) {
+  let found = [];
+  fs.readdirSync(d).forEach(name => {
+    const file = path.join(d, name);
+    const stat = fs.statSync(file);
+    if (stat.isDirectory()) {
+      found = found.concat(findTiles(file));
+    } else if (extensions.indexOf(path.extname(name)) !== -1) {
+      found.push(file);
+    }
+  });
+  return found;
+}
+
+function buildOne(file, done) {
+  const indexFile = file + '.vtqi';
+  if (!argv.force && fs.existsSync(indexFile) && fs.statSync(indexFile).mtimeMs >= fs.statSync(file).mtimeMs) {
+    return done(null, false);
+  }
+  vtquery.buildIndex(fs.readFileSync(file), (err, index) => {
+    if (err) return done(new Error(file + ': ' + err.message));
+    // write then rename so a query never maps a half written index
+    fs.writeFileSync(indexFile + '.tmp', index);
+    fs.renameSync(indexFile + '.tmp', indexFile);
+    done(null, true);
+  });
+}
+
+const tiles = findTiles(dir);
+const q = queue(4);
+tiles.forEach(file => q.defer(buildOne, file));
+q.awaitAll((err, built) => {
+  if (err) {
+    console.error(err.message);
+    process.exit(1);
+  }
+  console.log('built ' + built.filter(Boolean).length + ' of ' + tiles.length + ' indexes');
+});
@@ -0,0 +1,576 @@
+#pragma once
+#include "query.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+/*
+  Slow-query capture, turned on with vtquery.configure({ capture_dir }).
+
+  A captured query is a small text file, `<dir>/<unix ms>-<pid>-<n>.query`,
+  listing its query points, options and tiles, one per line. The bytes of each
+  tile (and sidecar index) go to `<dir>/tiles/<hash>.mvt` (or `.idx`) exactly
+  as they were passed in, gzipped or not, so a tile shared by many slow queries
+  is written once. Files are written under a temporary name and renamed, so
+  readers never see half of one. Queries that failed are captured too, with
+  the error they failed with.
+
+  vtquery-replay (bench/vtquery.replay.cpp) reads them back with read_capture().
+*/
+namespace capture {
+
+constexpr char const* format_header = "vtquery-capture 1";
+
+/// a captured query as read back from its file, with the tile bytes loaded
+struct captured_query {
+    struct tile {
+        std::int32_t z{0};
+        std::int32_t x{0};
+        std::int32_t y{0};
+        std::string data;
+        std::string index;
+    };
+
+    std::string path;
+    /// the query's time on the threadpool when it was captured
+    std::uint64_t execute_ns{0};
+    /// answered by query_batch(), always true when there are several points
+    bool batch{false};
+    /// the message the query failed with when it was captured, empty if it succeeded
+    std::string error;
+    std::vector<mapbox::geometry::point<double>> points;
+    VectorTileQuery::QueryOptions options;
+    std::vector<tile> tiles;
+
+    /// TileInputs pointing into `tiles`, valid as long as this object is not changed
+    std::vector<VectorTileQuery::TileInput> inputs() const {
+        std::vector<VectorTileQuery::TileInput> v;
+        for (auto const& t : tiles) {
+            v.emplace_back(vtzero::data_view{t.data}, t.z, t.x, t.y);
+            if (!t.index.empty()) {
+                v.back().index_data = vtzero::data_view{t.index};
+            }
+        }
+        return v;
+    }
+};
+
+/// doubles with every digit needed to read the same value back
+inline std::string format_double(double value) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+    return buffer;
+}
+
+inline std::string hex(std::uint64_t value) {
+    char buffer[17];
+    std::snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+    return buffer;
+}
+
+inline char const* filter_op_string(VectorTileQuery::BasicFilterType type) {
+    switch (type) {
+    case VectorTileQuery::ne:
+        return "!=";
+    case VectorTileQuery::lt:
+        return "<";
+    case VectorTileQuery::lte:
+        return "<=";
+    case VectorTileQuery::gt:
+        return ">";
+    case VectorTileQuery::gte:
+        return ">=";
+    default:
+        return "=";
+    }
+}
+
+inline bool parse_filter_op(std::string const& op, VectorTileQuery::BasicFilterType& type) {
+    static std::pair<char const*, VectorTileQuery::BasicFilterType> const ops[] = {
+        {"=", VectorTileQuery::eq}, {"!=", VectorTileQuery::ne}, {"<", VectorTileQuery::lt}, {"<=", VectorTileQuery::lte}, {">", VectorTileQuery::gt}, {">=", VectorTileQuery::gte}};
+    for (auto const& o : ops) {
+        if (op == o.first) {
+            type = o.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// a filter value as one token: a number, `true`, `false`, or `string` for string values, which never match
+inline std::string filter_value_string(VectorTileQuery::value_type const& value) {
+    switch (value.which()) {
+    case 0:
+        return format_double(static_cast<double>(boost::get<float>(value)));
+    case 1:
+        return format_double(boost::get<double>(value));
+    case 2:
+        return format_double(static_cast<double>(boost::get<std::int64_t>(value)));
+    case 3:
+        return format_double(static_cast<double>(boost::get<std::uint64_t>(value)));
+    case 4:
+        return boost::get<bool>(value) ? "true" : "false";
+    default:
+        return "string";
+    }
+}
+
+/**
+  The text of a capture file. `tile_files` holds the data and index file names
+  of each tile, relative to the capture directory, the index name empty when
+  the tile has none. `error` is empty for a query that succeeded.
+*/
+inline std::string write_manifest(std::uint64_t execute_ns,
+                                  bool batch,
+                                  std::string const& error,
+                                  std::vector<mapbox::geometry::point<double>> const& points,
+                                  VectorTileQuery::QueryOptions const& options,
+                                  std::vector<VectorTileQuery::TileInput> const& tiles,
+                                  std::vector<std::pair<std::string, std::string>> const& tile_files) {
+    std::string out = std::string(format_header) + "\n";
+    out += "execute_ns " + std::to_string(execute_ns) + "\n";
+    out += std::string("batch ") + (batch ? "true" : "false") + "\n";
+    if (!error.empty()) {
+        // the message runs to the end of the line, so it is kept on one
+        std::string message = error;
+        std::replace(message.begin(), message.end(), '\n', ' ');
+        out += "error " + message + "\n";
+    }
+    for (auto const& point : points) {
+        out += "point " + format_double(point.x) + " " + format_double(point.y) + "\n";
+    }
+    out += "radius " + format_double(options.radius) + "\n";
+    out += "limit " + std::to_string(options.num_results) + "\n";
+    out += std::string("dedupe ") + (options.dedupe ? "true" : "false") + "\n";
+    out += std::string("direct_hit_polygon ") + (options.direct_hit_polygon ? "true" : "false") + "\n";
+    out += std::string("columnar ") + (options.columnar ? "true" : "false") + "\n";
+    out += "tolerance " + format_double(options.tolerance) + "\n";
+    out += "max_memory " + std::to_string(options.max_memory) + "\n";
+    out += std::string("geometry ") + (options.geometry_filter_type == VectorTileQuery::GeomType::all ? "all" : VectorTileQuery::getGeomTypeString(options.geometry_filter_type)) + "\n";
+    out += std::string("group_by_layer ") + (options.group_by_layer ? "true" : "false") + "\n";
+    out += std::string("group_by_geometry ") + (options.group_by_geometry ? "true" : "false") + "\n";
+    out += std::string("filter ") + (options.basic_filter.type == VectorTileQuery::filter_any ? "any" : "all") + "\n";
+    // names run to the end of the line, they may hold spaces
+    for (auto const& filter : options.basic_filter.filters) {
+        out += std::string("filter_rule ") + filter_op_string(filter.type) + " " + filter_value_string(filter.value) + " " + filter.key + "\n";
+    }
+    for (auto const& layer : options.layers) {
+        out += "layer " + layer + "\n";
+    }
+    for (std::size_t i = 0; i < tiles.size(); ++i) {
+        out += "tile " + std::to_string(tiles[i].z) + " " + std::to_string(tiles[i].x) + " " + std::to_string(tiles[i].y) + " " + tile_files[i].first;
+        if (!tile_files[i].second.empty()) {
+            out += " " + tile_files[i].second;
+        }
+        out += "\n";
+    }
+    return out;
+}
+
+inline std::string read_whole_file(std::string const& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("could not read '" + path + "'");
+    }
+    std::ostringstream out;
+    out << in.rdbuf();
+    return out.str();
+}
+
+/// the rest of a line after the fields read so far, without the separating space
+inline std::string rest_of_line(std::istringstream& fields) {
+    std::string rest;
+    std::getline(fields, rest);
+    return rest.empty() ? rest : rest.substr(1);
+}
+
+inline bool parse_bool(std::string const& value) {
+    if (value == "true") {
+        return true;
+    }
+    if (value != "false") {
+        throw std::runtime_error("'" + value + "' is not true or false");
+    }
+    return false;
+}
+
+/// a capture file and the tiles it names, throws std::runtime_error if it can not be read
+inline captured_query read_capture(std::string const& path) {
+    captured_query q;
+    q.path = path;
+    auto const slash = path.rfind('/');
+    std::string const dir = slash == std::string::npos ? "." : path.substr(0, slash);
+
+    std::istringstream in(read_whole_file(path));
+    std::string line;
+    if (!std::getline(in, line) || line != format_header) {
+        throw std::runtime_error("'" + path + "' is not a vtquery capture");
+    }
+    std::size_t line_number = 1;
+    while (std::getline(in, line)) {
+        ++line_number;
+        if (line.empty()) {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string name;
+        std::string value;
+        fields >> name;
+        try {
+            if (name == "execute_ns") {
+                fields >> q.execute_ns;
+            } else if (name == "batch") {
+                fields >> value;
+                q.batch = parse_bool(value);
+            } else if (name == "error") {
+                q.error = rest_of_line(fields);
+            } else if (name == "point") {
+                mapbox::geometry::point<double> point;
+                fields >> point.x >> point.y;
+                q.points.push_back(point);
+            } else if (name == "radius") {
+                fields >> q.options.radius;
+            } else if (name == "limit") {
+                fields >> q.options.num_results;
+            } else if (name == "dedupe") {
+                fields >> value;
+                q.options.dedupe = parse_bool(value);
+            } else if (name == "direct_hit_polygon") {
+                fields >> value;
+                q.options.direct_hit_polygon = parse_bool(value);
+            } else if (name == "columnar") {
+                fields >> value;
+                q.options.columnar = parse_bool(value);
+            } else if (name == "tolerance") {
+                fields >> q.options.tolerance;
+            } else if (name == "max_memory") {
+                fields >> q.options.max_memory;
+            } else if (name == "geometry") {
+                fields >> value;
+                if (value == "point") {
+                    q.options.geometry_filter_type = VectorTileQuery::GeomType::point;
+                } else if (value == "linestring") {
+                    q.options.geometry_filter_type = VectorTileQuery::GeomType::linestring;
+                } else if (value == "polygon") {
+                    q.options.geometry_filter_type = VectorTileQuery::GeomType::polygon;
+                } else if (value != "all") {
+                    throw std::runtime_error("unknown geometry '" + value + "'");
+                }
+            } else if (name == "group_by_layer") {
+                fields >> value;
+                q.options.group_by_layer = parse_bool(value);
+            } else if (name == "group_by_geometry") {
+                fields >> value;
+                q.options.group_by_geometry = parse_bool(value);
+            } else if (name == "filter") {
+                fields >> value;
+                q.options.basic_filter.type = value == "any" ? VectorTileQuery::filter_any : VectorTileQuery::filter_all;
+            } else if (name == "filter_rule") {
+                VectorTileQuery::basic_filter_struct filter;
+                std::string op;
+                fields >> op >> value;
+                if (!parse_filter_op(op, filter.type)) {
+                    throw std::runtime_error("unknown filter condition '" + op + "'");
+                }
+                if (value == "true" || value == "false") {
+                    filter.value = value == "true";
+                } else if (value == "string") {
+                    filter.value = std::string{};
+                } else {
+                    filter.value = std::stod(value);
+                }
+                filter.key = rest_of_line(fields);
+                q.options.basic_filter.filters.push_back(filter);
+            } else if (name == "layer") {
+                q.options.layers.insert(rest_of_line(fields));
+            } else if (name == "tile") {
+                captured_query::tile t;
+                std::string data_file;
+                std::string index_file;
+                if (!(fields >> t.z >> t.x >> t.y >> data_file)) {
+                    throw std::runtime_error("tiles must be 'tile z x y file [index file]'");
+                }
+                // the index file is optional, leaving `fields` failed when there is none
+                fields >> index_file;
+                t.data = read_whole_file(dir + "/" + data_file);
+                if (!index_file.empty()) {
+                    t.index = read_whole_file(dir + "/" + index_file);
+                }
+                q.tiles.push_back(std::move(t));
+                continue;
+            }
+            // lines this version does not know are skipped, newer captures stay readable
+        } catch (std::exception const& e) {
+            throw std::runtime_error(path + ":" + std::to_string(line_number) + ": " + e.what());
+        }
+        if (fields.fail()) {
+            throw std::runtime_error(path + ":" + std::to_string(line_number) + ": could not read '" + line + "'");
+        }
+    }
+    if (q.points.empty() || q.tiles.empty()) {
+        throw std::runtime_error("'" + path + "' has no query point or no tile");
+    }
+    q.batch = q.batch || q.points.size() > 1;
+    return q;
+}
+
+/**
+  Writes queries slower than a threshold to a capture directory, until the
+  files it wrote reach `max_bytes`. Queries call capture() after every run, so
+  the check for whether to write anything is a pair of relaxed loads. Writing
+  happens on the thread that ran the query, the lock is only held to reserve
+  the bytes and file names of a capture, never while writing it.
+*/
+class recorder {
+  public:
+    /// start capturing to `dir`, created if missing, or stop with an empty one. Throws std::runtime_error
+    void set_directory(std::string const& dir) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        enabled_.store(false, std::memory_order_relaxed);
+        dir_.clear();
+        bytes_ = 0;
+        tile_files_.clear();
+        ++generation_;
+        if (dir.empty()) {
+            return;
+        }
+        make_directory(dir);
+        make_directory(dir + "/tiles");
+        dir_ = dir;
+        enabled_.store(true, std::memory_order_relaxed);
+    }
+
+    void set_threshold_ns(std::uint64_t threshold_ns) {
+        threshold_ns_.store(threshold_ns, std::memory_order_relaxed);
+    }
+
+    void set_max_bytes(std::uint64_t max_bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        max_bytes_ = max_bytes;
+    }
+
+    /// write the query if it took `execute_ns` or more, `error` is the message it failed with, if it did. Never throws
+    void capture(std::uint64_t execute_ns,
+                 bool batch,
+                 std::vector<VectorTileQuery::TileInput> const& tiles,
+                 std::vector<mapbox::geometry::point<double>> const& points,
+                 VectorTileQuery::QueryOptions const& options,
+                 std::string const& error = std::string{}) {
+        if (!enabled_.load(std::memory_order_relaxed) || execute_ns < threshold_ns_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        try {
+            save(execute_ns, batch, error, tiles, points, options);
+        } catch (std::exception const&) {
+            // a full disk or a vanished directory must not fail the query that was captured
+            ++errors_;
+        }
+    }
+
+    /// queries written since the process started
+    std::uint64_t captured() const { return captured_.load(); }
+    /// bytes written to the current directory, or being written
+    std::uint64_t bytes() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return bytes_;
+    }
+    /// slow queries not written because the directory was full, or because writing failed
+    std::uint64_t dropped() const { return dropped_.load() + errors_.load(); }
+
+  private:
+    /// the files one capture writes, reserved under the lock and written outside it
+    struct reservation {
+        std::string dir;
+        std::uint64_t generation{0};
+        std::uint64_t size{0};
+        std::string name;
+        std::vector<std::pair<std::string, vtzero::data_view>> writes;
+    };
+
+    static void make_directory(std::string const& dir) {
+        if (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw std::runtime_error("could not create '" + dir + "': " + std::strerror(errno));
+        }
+    }
+
+    static bool file_exists(std::string const& path) {
+        struct stat st;
+        return ::stat(path.c_str(), &st) == 0;
+    }
+
+    /**
+      Write under a temporary name and rename, so a file is either whole or
+      missing. The temporary name is unique to this process and write, other
+      threads or processes writing the same file never share one.
+    */
+    void write_file(std::string const& path, char const* data, std::size_t size) {
+        std::string const tmp = path + ".tmp." + std::to_string(::getpid()) + "." + std::to_string(++temp_sequence_);
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            out.write(data, static_cast<std::streamsize>(size));
+            if (!out) {
+                std::remove(tmp.c_str());
+                throw std::runtime_error("could not write '" + tmp + "'");
+            }
+        }
+        if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+            std::string const message = "could not rename '" + tmp + "': " + std::strerror(errno);
+            std::remove(tmp.c_str());
+            throw std::runtime_error(message);
+        }
+    }
+
+    /// the directory to capture to and its generation, an empty directory when capturing is off
+    void directory(reservation& r) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        r.dir = dir_;
+        r.generation = generation_;
+    }
+
+    /**
+      Claim the bytes and tile files of a capture to the directory in `r`, false
+      when the directory changed since or is full. Tiles already claimed by
+      another capture are not written again.
+    */
+    bool reserve(std::vector<std::pair<std::string, vtzero::data_view>> const& files, std::uint64_t manifest_size, reservation& r) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (dir_.empty() || generation_ != r.generation) {
+            return false;
+        }
+        r.size = manifest_size;
+        for (auto const& file : files) {
+            if (tile_files_.count(file.first) == 0) {
+                r.writes.push_back(file);
+                r.size += file.second.size();
+            }
+        }
+        if (bytes_ + r.size > max_bytes_) {
+            ++dropped_;
+            return false;
+        }
+        bytes_ += r.size;
+        for (auto const& w : r.writes) {
+            tile_files_.insert(w.first);
+        }
+        auto const ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        r.name = std::to_string(ms) + "-" + std::to_string(::getpid()) + "-" + std::to_string(++sequence_) + ".query";
+        return true;
+    }
+
+    /// give back what reserve() claimed for a capture that could not be written
+    void release(reservation const& r) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (r.generation != generation_) {
+            return;
+        }
+        bytes_ -= r.size;
+        for (auto const& w : r.writes) {
+            tile_files_.erase(w.first);
+        }
+    }
+
+    void save(std::uint64_t execute_ns,
+              bool batch,
+              std::string const& error,
+              std::vector<VectorTileQuery::TileInput> const& tiles,
+              std::vector<mapbox::geometry::point<double>> const& points,
+              VectorTileQuery::QueryOptions const& options) {
+        // the bytes of each tile and index, those given as a path are read here
+        std::vector<std::string> mapped_indexes(tiles.size());
+        for (std::size_t i = 0; i < tiles.size(); ++i) {
+            if (tiles[i].index_data.empty() && !tiles[i].index_path.empty()) {
+                mapped_indexes[i] = read_whole_file(tiles[i].index_path);
+            }
+        }
+        auto const index_of = [&](std::size_t i) {
+            return mapped_indexes[i].empty() ? tiles[i].index_data : vtzero::data_view{mapped_indexes[i]};
+        };
+
+        std::vector<std::pair<std::string, std::string>> tile_files;
+        for (std::size_t i = 0; i < tiles.size(); ++i) {
+            std::string data_file = "tiles/" + hex(utils::hash_bytes(tiles[i].data.data(), tiles[i].data.size())) + ".mvt";
+            std::string index_file;
+            auto const index = index_of(i);
+            if (!index.empty()) {
+                index_file = "tiles/" + hex(utils::hash_bytes(index.data(), index.size())) + ".idx";
+            }
+            tile_files.emplace_back(std::move(data_file), std::move(index_file));
+        }
+        std::string const manifest = write_manifest(execute_ns, batch, error, points, options, tiles, tile_files);
+
+        // each tile and index once, leaving out those already on disk from an
+        // earlier capture or another process
+        reservation r;
+        directory(r);
+        if (r.dir.empty()) {
+            return;
+        }
+        std::vector<std::pair<std::string, vtzero::data_view>> files;
+        for (std::size_t i = 0; i < tiles.size(); ++i) {
+            for (auto const& file : {std::make_pair(tile_files[i].first, tiles[i].data), std::make_pair(tile_files[i].second, index_of(i))}) {
+                if (file.first.empty() || file_exists(r.dir + "/" + file.first)) {
+                    continue;
+                }
+                bool listed = false;
+                for (auto const& f : files) {
+                    listed = listed || f.first == file.first;
+                }
+                if (!listed) {
+                    files.push_back(file);
+                }
+            }
+        }
+
+        if (!reserve(files, manifest.size(), r)) {
+            return;
+        }
+        try {
+            for (auto const& w : r.writes) {
+                write_file(r.dir + "/" + w.first, w.second.data(), w.second.size());
+            }
+            write_file(r.dir + "/" + r.name, manifest.data(), manifest.size());
+        } catch (std::exception const&) {
+            release(r);
+            throw;
+        }
+        ++captured_;
+    }
+
+    mutable std::mutex mutex_;
+    std::atomic<bool> enabled_{false};
+    std::atomic<std::uint64_t> threshold_ns_{100000000};
+    std::string dir_;
+    /// changed by every set_directory(), so a failed write does not give back bytes of an older directory
+    std::uint64_t generation_{0};
+    std::uint64_t max_bytes_{256 * 1024 * 1024};
+    std::uint64_t bytes_{0};
+    /// tile and index files written to the current directory, or being written
+    std::unordered_set<std::string> tile_files_;
+    std::uint64_t sequence_{0};
+    std::atomic<std::uint64_t> temp_sequence_{0};
+    std::atomic<std::uint64_t> captured_{0};
+    std::atomic<std::uint64_t> dropped_{0};
+    std::atomic<std::uint64_t> errors_{0};
+};
+
+/// never destroyed, like the metrics registry, worker threads may still capture while the process exits
+inline recorder& get_recorder() {
+    static recorder* r = new recorder;
+    return *r;
+}
+
+} // namespace capture
@@ -0,0 +1,228 @@
+#pragma once
+#include "geometry_kernels.hpp"
+#include "vector_tile_util.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+#include <vtzero/exception.hpp>
+#include <vtzero/vector_tile.hpp>
+
+namespace columnar {
+
+/*
+  One layer of a vector tile decoded once into flat per-feature arrays.
+
+  Feature `i` owns parts [part_offsets[i], part_offsets[i + 1]) of `geometry`
+  (one part per point, per line or per polygon with its holes) and key/value
+  index pairs [tag_offsets[i], tag_offsets[i + 1]) of `tags`. Keys and values
+  are views into the tile's own buffer, so properties are only materialized
+  for features that end up in the results.
+*/
+struct layer {
+    std::string name;
+    std::uint32_t extent{4096};
+    std::vector<vtzero::data_view> keys;
+    std::vector<vtzero::property_value> values;
+
+    // one entry per feature, empty geometries have min > max
+    std::vector<std::uint8_t> geometry_types;
+    std::vector<std::uint8_t> has_ids;
+    std::vector<std::uint64_t> ids;
+    std::vector<std::int32_t> min_xs;
+    std::vector<std::int32_t> min_ys;
+    std::vector<std::int32_t> max_xs;
+    std::vector<std::int32_t> max_ys;
+    std::vector<std::uint32_t> part_offsets{0};
+    std::vector<std::uint32_t> tag_offsets{0};
+
+    kernels::flat_geometry geometry;
+    std::vector<std::uint32_t> tags;
+
+    // the whole layer: bit 1 << type for each vtzero::GeomType present, and the box around every feature
+    std::uint32_t geometry_type_mask{0};
+    std::int32_t min_x{std::numeric_limits<std::int32_t>::max()};
+    std::int32_t min_y{std::numeric_limits<std::int32_t>::max()};
+    std::int32_t max_x{std::numeric_limits<std::int32_t>::min()};
+    std::int32_t max_y{std::numeric_limits<std::int32_t>::min()};
+
+    std::size_t num_features() const { return geometry_types.size(); }
+
+    vtzero::GeomType geometry_type(std::size_t i) const { return static_cast<vtzero::GeomType>(geometry_types[i]); }
+
+    std::size_t first_part(std::size_t i) const { return part_offsets[i]; }
+
+    std::size_t last_part(std::size_t i) const { return part_offsets[i + 1]; }
+
+    std::size_t first_ring(std::size_t i) const {
+        return first_part(i) < last_part(i) ? geometry.part_starts[first_part(i)] : 0;
+    }
+
+    std::size_t last_ring(std::size_t i) const {
+        return first_part(i) < last_part(i) ? geometry.part_end(last_part(i) - 1) : 0;
+    }
+
+    std::size_t num_vertices(std::size_t i) const {
+        return geometry.ring_offsets[last_ring(i)] - geometry.ring_offsets[first_ring(i)];
+    }
+
+    std::vector<vtzero::property> properties(std::size_t i) const {
+        std::vector<vtzero::property> v;
+        v.reserve((tag_offsets[i + 1] - tag_offsets[i]) / 2);
+        for (std::size_t t = tag_offsets[i]; t < tag_offsets[i + 1]; t += 2) {
+            v.emplace_back(keys[tags[t]], values[tags[t + 1]]);
+        }
+        return v;
+    }
+
+    /// copy the geometry of one feature into `out`, renumbered to start at zero
+    void copy_geometry(std::size_t i, kernels::flat_geometry& out) const {
+        out.clear();
+        std::size_t const ring_base = first_ring(i);
+        std::size_t const vertex_base = geometry.ring_offsets[ring_base];
+        std::size_t const vertex_end = geometry.ring_offsets[last_ring(i)];
+        out.xs.assign(geometry.xs.begin() + static_cast<std::ptrdiff_t>(vertex_base), geometry.xs.begin() + static_cast<std::ptrdiff_t>(vertex_end));
+        out.ys.assign(geometry.ys.begin() + static_cast<std::ptrdiff_t>(vertex_base), geometry.ys.begin() + static_cast<std::ptrdiff_t>(vertex_end));
+        for (std::size_t r = ring_base; r < last_ring(i); ++r) {
+            out.ring_offsets.push_back(static_cast<std::uint32_t>(geometry.ring_offsets[r + 1] - vertex_base));
+        }
+        for (std::size_t part = first_part(i); part < last_part(i); ++part) {
+            out.part_starts.push_back(static_cast<std::uint32_t>(geometry.part_starts[part] - ring_base));
+        }
+    }
+
+    std::size_t memory_usage() const {
+        return sizeof(layer) + name.capacity() +
+               keys.capacity() * sizeof(vtzero::data_view) +
+               values.capacity() * sizeof(vtzero::property_value) +
+               (geometry_types.capacity() + has_ids.capacity()) +
+               ids.capacity() * sizeof(std::uint64_t) +
+               (min_xs.capacity() + min_ys.capacity() + max_xs.capacity() + max_ys.capacity()) * sizeof(std::int32_t) +
+               (part_offsets.capacity() + tag_offsets.capacity() + tags.capacity()) * sizeof(std::uint32_t) +
+               (geometry.xs.capacity() + geometry.ys.capacity()) * sizeof(std::int32_t) +
+               (geometry.ring_offsets.capacity() + geometry.part_starts.capacity()) * sizeof(std::uint32_t);
+    }
+};
+
+namespace detail {
+
+inline void decode_layer(vtzero::layer& in, layer& out) {
+    out.name = std::string(in.name());
+    out.extent = in.extent();
+    out.keys = in.key_table();
+    out.values = in.value_table();
+
+    std::size_t const num_features = in.num_features();
+    out.geometry_types.reserve(num_features);
+    out.has_ids.reserve(num_features);
+    out.ids.reserve(num_features);
+    out.min_xs.reserve(num_features);
+    out.min_ys.reserve(num_features);
+    out.max_xs.reserve(num_features);
+    out.max_ys.reserve(num_features);
+    out.part_offsets.reserve(num_features + 1);
+    out.tag_offsets.reserve(num_features + 1);
+
+    while (auto feature = in.next_feature()) {
+        std::size_t const first_vertex = out.geometry.xs.size();
+        switch (feature.geometry_type()) {
+        case vtzero::GeomType::POINT:
+            vtzero::decode_point_geometry(feature.geometry(), mapbox::vector_tile::detail::flat_point_handler(out.geometry));
+            break;
+        case vtzero::GeomType::LINESTRING:
+            vtzero::decode_linestring_geometry(feature.geometry(), mapbox::vector_tile::detail::flat_line_string_handler(out.geometry));
+            break;
+        case vtzero::GeomType::POLYGON:
+            vtzero::decode_polygon_geometry(feature.geometry(), mapbox::vector_tile::detail::flat_polygon_handler(out.geometry));
+            break;
+        default:
+            break;
+        }
+
+        std::int32_t min_x = std::numeric_limits<std::int32_t>::max();
+        std::int32_t min_y = std::numeric_limits<std::int32_t>::max();
+        std::int32_t max_x = std::numeric_limits<std::int32_t>::min();
+        std::int32_t max_y = std::numeric_limits<std::int32_t>::min();
+        for (std::size_t v = first_vertex; v < out.geometry.xs.size(); ++v) {
+            min_x = std::min(min_x, out.geometry.xs[v]);
+            min_y = std::min(min_y, out.geometry.ys[v]);
+            max_x = std::max(max_x, out.geometry.xs[v]);
+            max_y = std::max(max_y, out.geometry.ys[v]);
+        }
+
+        // checked here once so reading properties later never has to
+        while (auto indexes = feature.next_property_indexes()) {
+            if (indexes.key().value() >= out.keys.size()) {
+                throw vtzero::out_of_range_exception{indexes.key().value()};
+            }
+            if (indexes.value().value() >= out.values.size()) {
+                throw vtzero::out_of_range_exception{indexes.value().value()};
+            }
+            out.tags.push_back(indexes.key().value());
+            out.tags.push_back(indexes.value().value());
+        }
+
+        out.geometry_type_mask |= 1U << static_cast<unsigned>(feature.geometry_type());
+        out.min_x = std::min(out.min_x, min_x);
+        out.min_y = std::min(out.min_y, min_y);
+        out.max_x = std::max(out.max_x, max_x);
+        out.max_y = std::max(out.max_y, max_y);
+
+        out.geometry_types.push_back(static_cast<std::uint8_t>(feature.geometry_type()));
+        out.has_ids.push_back(feature.has_id() ? 1 : 0);
+        out.ids.push_back(feature.id());
+        out.min_xs.push_back(min_x);
+        out.min_ys.push_back(min_y);
+        out.max_xs.push_back(max_x);
+        out.max_ys.push_back(max_y);
+        out.part_offsets.push_back(static_cast<std::uint32_t>(out.geometry.num_parts()));
+        out.tag_offsets.push_back(static_cast<std::uint32_t>(out.tags.size()));
+    }
+}
+
+} // namespace detail
+
+/*
+  A whole tile in columnar form. It keeps its own copy of the (decompressed)
+  tile bytes that the layers' keys and values point into, so it can be cached
+  and shared between queries.
+*/
+class tile {
+  public:
+    explicit tile(std::string data)
+        : data_(std::move(data)) {
+        vtzero::vector_tile vt{data_};
+        while (auto l = vt.next_layer()) {
+            layers_.emplace_back();
+            detail::decode_layer(l, layers_.back());
+        }
+    }
+
+    // non-copyable
+    tile(tile const&) = delete;
+    tile& operator=(tile const&) = delete;
+
+    // non-movable, the layers hold views into data_
+    tile(tile&&) = delete;
+    tile& operator=(tile&&) = delete;
+
+    ~tile() = default;
+
+    std::vector<layer> const& layers() const { return layers_; }
+
+    std::size_t memory_usage() const {
+        std::size_t bytes = sizeof(tile) + data_.capacity();
+        for (auto const& l : layers_) {
+            bytes += l.memory_usage();
+        }
+        return bytes;
+    }
+
+  private:
+    std::string data_;
+    std::vector<layer> layers_;
+};
+
+} // namespace columnar
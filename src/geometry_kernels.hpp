@@ -0,0 +1,448 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+// Vectorized kernels are only built where we can pick them at runtime
+#if defined(__x86_64__) && defined(__linux__) && (defined(__GNUC__) || defined(__clang__))
+#define VTQUERY_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+namespace kernels {
+
+/*
+  Decoded linestring or polygon geometry stored as flat int32 coordinate arrays.
+
+  Ring (or line) `i` is the vertex range [ring_offsets[i], ring_offsets[i + 1]).
+  Part (polygon or line) `j` starts at ring `part_starts[j]` and runs until the
+  next part starts. Polygon rings are always closed, so their last vertex repeats
+  the first one.
+*/
+struct flat_geometry {
+    std::vector<std::int32_t> xs;
+    std::vector<std::int32_t> ys;
+    std::vector<std::uint32_t> ring_offsets{0};
+    std::vector<std::uint32_t> part_starts;
+
+    void clear() {
+        xs.clear();
+        ys.clear();
+        ring_offsets.assign(1, 0);
+        part_starts.clear();
+    }
+
+    std::size_t num_rings() const { return ring_offsets.size() - 1; }
+
+    /// bytes held by the buffers, not by the struct itself
+    std::size_t memory_usage() const {
+        return (xs.capacity() + ys.capacity()) * sizeof(std::int32_t) +
+               (ring_offsets.capacity() + part_starts.capacity()) * sizeof(std::uint32_t);
+    }
+
+    std::size_t num_parts() const { return part_starts.size(); }
+
+    std::size_t ring_begin(std::size_t ring) const { return ring_offsets[ring]; }
+
+    std::size_t ring_size(std::size_t ring) const { return ring_offsets[ring + 1] - ring_offsets[ring]; }
+
+    std::size_t part_end(std::size_t part) const {
+        return part + 1 < part_starts.size() ? part_starts[part + 1] : num_rings();
+    }
+
+    void add_point(std::int32_t x, std::int32_t y) {
+        xs.push_back(x);
+        ys.push_back(y);
+    }
+
+    /// finish the ring started after the last call to end_ring
+    void end_ring() {
+        ring_offsets.push_back(static_cast<std::uint32_t>(xs.size()));
+    }
+
+    /// drop the points added since the last call to end_ring
+    void discard_ring() {
+        xs.resize(ring_offsets.back());
+        ys.resize(ring_offsets.back());
+    }
+
+    /// repeat the first point of the open ring if it does not end there already
+    void close_ring() {
+        std::size_t const begin = ring_offsets.back();
+        if (xs.size() > begin && (xs[begin] != xs.back() || ys[begin] != ys.back())) {
+            add_point(xs[begin], ys[begin]);
+        }
+    }
+};
+
+/// closest point on a geometry in tile coordinates, distance is -1.0 when there is no geometry
+struct closest_point_info {
+    double x{0.0};
+    double y{0.0};
+    double distance{-1.0};
+};
+
+/// smallest squared distance to a run of segments and the index of the segment's first vertex
+struct segment_distance {
+    double distance_squared;
+    std::size_t index;
+};
+
+/// minimum squared distance from (px, py) to the segments joining `count` consecutive vertices
+using segment_distance_fn = segment_distance (*)(std::int32_t const* xs, std::int32_t const* ys, std::size_t count, double px, double py);
+
+/// winding number of a closed ring of `count` vertices around (px, py), 0 when outside
+using winding_fn = int (*)(std::int32_t const* xs, std::int32_t const* ys, std::size_t count, double px, double py);
+
+inline double segment_distance_squared(double ax, double ay, double bx, double by, double px, double py) {
+    double const dx = bx - ax;
+    double const dy = by - ay;
+    double const wx = px - ax;
+    double const wy = py - ay;
+    // degenerate segments have a dot product of zero too, so clamping the
+    // divisor keeps them at t = 0 without a branch
+    double t = (wx * dx + wy * dy) / std::max(dx * dx + dy * dy, 1.0);
+    t = std::min(std::max(t, 0.0), 1.0);
+    double const ex = wx - t * dx;
+    double const ey = wy - t * dy;
+    return ex * ex + ey * ey;
+}
+
+inline segment_distance segment_distance_scalar(std::int32_t const* xs, std::int32_t const* ys, std::size_t count, double px, double py) {
+    segment_distance best{std::numeric_limits<double>::infinity(), 0};
+    for (std::size_t i = 0; i + 1 < count; ++i) {
+        double const d2 = segment_distance_squared(xs[i], ys[i], xs[i + 1], ys[i + 1], px, py);
+        if (d2 < best.distance_squared) {
+            best.distance_squared = d2;
+            best.index = i;
+        }
+    }
+    return best;
+}
+
+inline int winding_scalar(std::int32_t const* xs, std::int32_t const* ys, std::size_t count, double px, double py) {
+    int winding = 0;
+    for (std::size_t i = 0; i + 1 < count; ++i) {
+        double const ax = xs[i];
+        double const ay = ys[i];
+        double const bx = xs[i + 1];
+        double const by = ys[i + 1];
+        double const is_left = (bx - ax) * (py - ay) - (px - ax) * (by - ay);
+        if (ay <= py && by > py && is_left > 0.0) {
+            ++winding;
+        } else if (ay > py && by <= py && is_left < 0.0) {
+            --winding;
+        }
+    }
+    return winding;
+}
+
+#ifdef VTQUERY_X86_DISPATCH
+
+/// merge per-lane minimums, ties go to the earliest segment like the scalar loop
+inline void reduce_lanes(double const* lane_distance, double const* lane_index, std::size_t lanes, segment_distance& best) {
+    for (std::size_t l = 0; l < lanes; ++l) {
+        if (lane_index[l] < 0.0) {
+            continue;
+        }
+        auto const index = static_cast<std::size_t>(lane_index[l]);
+        if (lane_distance[l] < best.distance_squared || (lane_distance[l] <= best.distance_squared && index < best.index)) {
+            best.distance_squared = lane_distance[l];
+            best.index = index;
+        }
+    }
+}
+
+__attribute__((target("sse4.1"))) inline segment_distance segment_distance_sse4(std::int32_t const* xs, std::int32_t const* ys, std::size_t count, double px, double py) {
+    segment_distance best{std::numeric_limits<double>::infinity(), 0};
+    if (count < 2) {
+        return best;
+    }
+    std::size_t const segments = count - 1;
+    __m128d const vpx = _mm_set1_pd(px);
+    __m128d const vpy = _mm_set1_pd(py);
+    __m128d const zero = _mm_setzero_pd();
+    __m128d const one = _mm_set1_pd(1.0);
+    __m128d const step = _mm_set1_pd(2.0);
+    __m128d best_d = _mm_set1_pd(std::numeric_limits<double>::infinity());
+    __m128d best_i = _mm_set1_pd(-1.0);
+    __m128d index = _mm_setr_pd(0.0, 1.0);
+    std::size_t i = 0;
+    for (; i + 2 <= segments; i += 2) {
+        __m128d const ax = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(xs + i)));
+        __m128d const ay = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(ys + i)));
+        __m128d const bx = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(xs + i + 1)));
+        __m128d const by = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(ys + i + 1)));
+        __m128d const dx = _mm_sub_pd(bx, ax);
+        __m128d const dy = _mm_sub_pd(by, ay);
+        __m128d const wx = _mm_sub_pd(vpx, ax);
+        __m128d const wy = _mm_sub_pd(vpy, ay);
+        __m128d const len2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+        __m128d const dot = _mm_add_pd(_mm_mul_pd(wx, dx), _mm_mul_pd(wy, dy));
+        __m128d t = _mm_div_pd(dot, _mm_max_pd(len2, one));
+        t = _mm_min_pd(_mm_max_pd(t, zero), one);
+        __m128d const ex = _mm_sub_pd(wx, _mm_mul_pd(t, dx));
+        __m128d const ey = _mm_sub_pd(wy, _mm_mul_pd(t, dy));
+        __m128d const d2 = _mm_add_pd(_mm_mul_pd(ex, ex), _mm_mul_pd(ey, ey));
+        __m128d const closer = _mm_cmplt_pd(d2, best_d);
+        best_d = _mm_blendv_pd(best_d, d2, closer);
+        best_i = _mm_blendv_pd(best_i, index, closer);
+        index = _mm_add_pd(index, step);
+    }
+    alignas(16) double lane_distance[2];
+    alignas(16) double lane_index[2];
+    _mm_store_pd(lane_distance, best_d);
+    _mm_store_pd(lane_index, best_i);
+    reduce_lanes(lane_distance, lane_index, 2, best);
+    for (; i < segments; ++i) {
+        double const d2 = segment_distance_squared(xs[i], ys[i], xs[i + 1], ys[i + 1], px, py);
+        if (d2 < best.distance_squared) {
+            best.distance_squared = d2;
+            best.index = i;
+        }
+    }
+    return best;
+}
+
+__attribute__((target("sse4.1"))) inline int winding_sse4(std::int32_t const* xs, std::int32_t const* ys, std::size_t count, double px, double py) {
+    if (count < 2) {
+        return 0;
+    }
+    std::size_t const segments = count - 1;
+    __m128d const vpx = _mm_set1_pd(px);
+    __m128d const vpy = _mm_set1_pd(py);
+    __m128d const zero = _mm_setzero_pd();
+    __m128d const one = _mm_set1_pd(1.0);
+    __m128d total = _mm_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 2 <= segments; i += 2) {
+        __m128d const ax = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(xs + i)));
+        __m128d const ay = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(ys + i)));
+        __m128d const bx = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(xs + i + 1)));
+        __m128d const by = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(ys + i + 1)));
+        __m128d const is_left = _mm_sub_pd(_mm_mul_pd(_mm_sub_pd(bx, ax), _mm_sub_pd(vpy, ay)),
+                                           _mm_mul_pd(_mm_sub_pd(vpx, ax), _mm_sub_pd(by, ay)));
+        __m128d const up = _mm_and_pd(_mm_and_pd(_mm_cmple_pd(ay, vpy), _mm_cmpgt_pd(by, vpy)), _mm_cmpgt_pd(is_left, zero));
+        __m128d const down = _mm_and_pd(_mm_and_pd(_mm_cmpgt_pd(ay, vpy), _mm_cmple_pd(by, vpy)), _mm_cmplt_pd(is_left, zero));
+        total = _mm_add_pd(total, _mm_sub_pd(_mm_and_pd(up, one), _mm_and_pd(down, one)));
+    }
+    alignas(16) double lanes[2];
+    _mm_store_pd(lanes, total);
+    int winding = static_cast<int>(lanes[0] + lanes[1]);
+    if (i < segments) {
+        winding += winding_scalar(xs + i, ys + i, count - i, px, py);
+    }
+    return winding;
+}
+
+__attribute__((target("avx2"))) inline segment_distance segment_distance_avx2(std::int32_t const* xs, std::int32_t const* ys, std::size_t count, double px, double py) {
+    segment_distance best{std::numeric_limits<double>::infinity(), 0};
+    if (count < 2) {
+        return best;
+    }
+    std::size_t const segments = count - 1;
+    __m256d const vpx = _mm256_set1_pd(px);
+    __m256d const vpy = _mm256_set1_pd(py);
+    __m256d const zero = _mm256_setzero_pd();
+    __m256d const one = _mm256_set1_pd(1.0);
+    __m256d const step = _mm256_set1_pd(4.0);
+    __m256d best_d = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+    __m256d best_i = _mm256_set1_pd(-1.0);
+    __m256d index = _mm256_setr_pd(0.0, 1.0, 2.0, 3.0);
+    std::size_t i = 0;
+    for (; i + 4 <= segments; i += 4) {
+        __m256d const ax = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<__m128i const*>(xs + i)));
+        __m256d const ay = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<__m128i const*>(ys + i)));
+        __m256d const bx = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<__m128i const*>(xs + i + 1)));
+        __m256d const by = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<__m128i const*>(ys + i + 1)));
+        __m256d const dx = _mm256_sub_pd(bx, ax);
+        __m256d const dy = _mm256_sub_pd(by, ay);
+        __m256d const wx = _mm256_sub_pd(vpx, ax);
+        __m256d const wy = _mm256_sub_pd(vpy, ay);
+        __m256d const len2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+        __m256d const dot = _mm256_add_pd(_mm256_mul_pd(wx, dx), _mm256_mul_pd(wy, dy));
+        __m256d t = _mm256_div_pd(dot, _mm256_max_pd(len2, one));
+        t = _mm256_min_pd(_mm256_max_pd(t, zero), one);
+        __m256d const ex = _mm256_sub_pd(wx, _mm256_mul_pd(t, dx));
+        __m256d const ey = _mm256_sub_pd(wy, _mm256_mul_pd(t, dy));
+        __m256d const d2 = _mm256_add_pd(_mm256_mul_pd(ex, ex), _mm256_mul_pd(ey, ey));
+        __m256d const closer = _mm256_cmp_pd(d2, best_d, _CMP_LT_OQ);
+        best_d = _mm256_blendv_pd(best_d, d2, closer);
+        best_i = _mm256_blendv_pd(best_i, index, closer);
+        index = _mm256_add_pd(index, step);
+    }
+    alignas(32) double lane_distance[4];
+    alignas(32) double lane_index[4];
+    _mm256_store_pd(lane_distance, best_d);
+    _mm256_store_pd(lane_index, best_i);
+    reduce_lanes(lane_distance, lane_index, 4, best);
+    for (; i < segments; ++i) {
+        double const d2 = segment_distance_squared(xs[i], ys[i], xs[i + 1], ys[i + 1], px, py);
+        if (d2 < best.distance_squared) {
+            best.distance_squared = d2;
+            best.index = i;
+        }
+    }
+    return best;
+}
+
+__attribute__((target("avx2"))) inline int winding_avx2(std::int32_t const* xs, std::int32_t const* ys, std::size_t count, double px, double py) {
+    if (count < 2) {
+        return 0;
+    }
+    std::size_t const segments = count - 1;
+    __m256d const vpx = _mm256_set1_pd(px);
+    __m256d const vpy = _mm256_set1_pd(py);
+    __m256d const zero = _mm256_setzero_pd();
+    __m256d const one = _mm256_set1_pd(1.0);
+    __m256d total = _mm256_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 4 <= segments; i += 4) {
+        __m256d const ax = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<__m128i const*>(xs + i)));
+        __m256d const ay = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<__m128i const*>(ys + i)));
+        __m256d const bx = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<__m128i const*>(xs + i + 1)));
+        __m256d const by = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<__m128i const*>(ys + i + 1)));
+        __m256d const is_left = _mm256_sub_pd(_mm256_mul_pd(_mm256_sub_pd(bx, ax), _mm256_sub_pd(vpy, ay)),
+                                              _mm256_mul_pd(_mm256_sub_pd(vpx, ax), _mm256_sub_pd(by, ay)));
+        __m256d const up = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(ay, vpy, _CMP_LE_OQ), _mm256_cmp_pd(by, vpy, _CMP_GT_OQ)),
+                                         _mm256_cmp_pd(is_left, zero, _CMP_GT_OQ));
+        __m256d const down = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(ay, vpy, _CMP_GT_OQ), _mm256_cmp_pd(by, vpy, _CMP_LE_OQ)),
+                                           _mm256_cmp_pd(is_left, zero, _CMP_LT_OQ));
+        total = _mm256_add_pd(total, _mm256_sub_pd(_mm256_and_pd(up, one), _mm256_and_pd(down, one)));
+    }
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, total);
+    int winding = static_cast<int>(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    if (i < segments) {
+        winding += winding_scalar(xs + i, ys + i, count - i, px, py);
+    }
+    return winding;
+}
+
+#endif
+
+/// the kernels in use by this process
+struct kernel_table {
+    char const* name;
+    segment_distance_fn segment_distance;
+    winding_fn winding;
+};
+
+inline kernel_table scalar_kernels() {
+    return kernel_table{"scalar", &segment_distance_scalar, &winding_scalar};
+}
+
+/*
+  Pick the widest kernels the CPU supports, once per process.
+
+  Setting VTQUERY_SIMD to "scalar" or "sse4" caps the choice, which is how the
+  benchmarks compare the kernels against each other.
+*/
+inline kernel_table select_kernels() {
+    kernel_table table = scalar_kernels();
+#ifdef VTQUERY_X86_DISPATCH
+    char const* cap = std::getenv("VTQUERY_SIMD");
+    bool const allow_sse4 = cap == nullptr || std::strcmp(cap, "scalar") != 0;
+    bool const allow_avx2 = cap == nullptr || (std::strcmp(cap, "scalar") != 0 && std::strcmp(cap, "sse4") != 0);
+    __builtin_cpu_init();
+    if (allow_avx2 && __builtin_cpu_supports("avx2")) {
+        table = kernel_table{"avx2", &segment_distance_avx2, &winding_avx2};
+    } else if (allow_sse4 && __builtin_cpu_supports("sse4.1")) {
+        table = kernel_table{"sse4", &segment_distance_sse4, &winding_sse4};
+    }
+#endif
+    return table;
+}
+
+inline kernel_table const& active_kernels() {
+    static kernel_table const table = select_kernels();
+    return table;
+}
+
+/// closest point on the segment of a ring (or line) that starts at vertex `index`
+inline closest_point_info closest_point_on_segment(flat_geometry const& geom, std::size_t index, std::size_t end, double px, double py, double distance_squared) {
+    double const ax = geom.xs[index];
+    double const ay = geom.ys[index];
+    double t = 0.0;
+    double dx = 0.0;
+    double dy = 0.0;
+    if (index + 1 < end) {
+        dx = geom.xs[index + 1] - ax;
+        dy = geom.ys[index + 1] - ay;
+        t = ((px - ax) * dx + (py - ay) * dy) / std::max(dx * dx + dy * dy, 1.0);
+        t = std::min(std::max(t, 0.0), 1.0);
+    }
+    return closest_point_info{ax + t * dx, ay + t * dy, std::sqrt(distance_squared)};
+}
+
+/// nearest vertex range and segment over a run of rings, single vertex rings count as points
+inline closest_point_info closest_point_rings(flat_geometry const& geom, std::size_t first_ring, std::size_t last_ring, double px, double py, kernel_table const& k) {
+    segment_distance best{std::numeric_limits<double>::infinity(), 0};
+    std::size_t best_end = 0;
+    for (std::size_t r = first_ring; r < last_ring; ++r) {
+        std::size_t const begin = geom.ring_begin(r);
+        std::size_t const size = geom.ring_size(r);
+        segment_distance candidate{std::numeric_limits<double>::infinity(), 0};
+        if (size == 1) {
+            double const dx = geom.xs[begin] - px;
+            double const dy = geom.ys[begin] - py;
+            candidate.distance_squared = dx * dx + dy * dy;
+        } else if (size > 1) {
+            candidate = k.segment_distance(geom.xs.data() + begin, geom.ys.data() + begin, size, px, py);
+        }
+        if (candidate.distance_squared < best.distance_squared) {
+            best.distance_squared = candidate.distance_squared;
+            best.index = begin + candidate.index;
+            best_end = begin + size;
+        }
+    }
+    if (best_end == 0) {
+        return closest_point_info{};
+    }
+    return closest_point_on_segment(geom, best.index, best_end, px, py, best.distance_squared);
+}
+
+/// closest point on any line of a (multi)linestring
+inline closest_point_info closest_point_line_string(flat_geometry const& geom, double px, double py) {
+    return closest_point_rings(geom, 0, geom.num_rings(), px, py, active_kernels());
+}
+
+/*
+  Closest point on the polygons [first_part, last_part) of a geometry.
+
+  A point inside a polygon's outer ring and outside all of its holes is a
+  direct hit at distance 0.0 and returns the query point itself, otherwise the
+  nearest point along any ring is used.
+*/
+inline closest_point_info closest_point_polygon(flat_geometry const& geom, std::size_t first_part, std::size_t last_part, double px, double py) {
+    kernel_table const& k = active_kernels();
+    for (std::size_t part = first_part; part < last_part; ++part) {
+        std::size_t const outer = geom.part_starts[part];
+        std::size_t const end = geom.part_end(part);
+        if (k.winding(geom.xs.data() + geom.ring_begin(outer), geom.ys.data() + geom.ring_begin(outer), geom.ring_size(outer), px, py) == 0) {
+            continue;
+        }
+        bool in_hole = false;
+        for (std::size_t r = outer + 1; r < end && !in_hole; ++r) {
+            in_hole = k.winding(geom.xs.data() + geom.ring_begin(r), geom.ys.data() + geom.ring_begin(r), geom.ring_size(r), px, py) != 0;
+        }
+        if (!in_hole) {
+            return closest_point_info{px, py, 0.0};
+        }
+    }
+    if (first_part >= last_part) {
+        return closest_point_info{};
+    }
+    return closest_point_rings(geom, geom.part_starts[first_part], geom.part_end(last_part - 1), px, py, k);
+}
+
+/// closest point on a (multi)polygon
+inline closest_point_info closest_point_polygon(flat_geometry const& geom, double px, double py) {
+    return closest_point_polygon(geom, 0, geom.num_parts(), px, py);
+}
+
+} // namespace kernels
@@ -0,0 +1,120 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace utils {
+
+/*
+  A thread-safe least-recently-used cache bounded by an approximate byte size.
+
+  Values are shared immutable objects, so a caller can keep using one after it
+  has been evicted. The size of each entry is given by the caller when it is
+  inserted; `entry_overhead` is added to it to account for the bookkeeping.
+*/
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class lru_cache {
+  public:
+    using value_ptr = std::shared_ptr<Value const>;
+
+    static constexpr std::size_t entry_overhead = 64;
+
+    explicit lru_cache(std::size_t capacity_bytes)
+        : capacity_(capacity_bytes) {}
+
+    // non-copyable
+    lru_cache(lru_cache const&) = delete;
+    lru_cache& operator=(lru_cache const&) = delete;
+
+    // non-movable
+    lru_cache(lru_cache&&) = delete;
+    lru_cache& operator=(lru_cache&&) = delete;
+
+    ~lru_cache() = default;
+
+    /// find an entry and mark it as most recently used, returns nullptr if missing
+    value_ptr get(Key const& key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            return nullptr;
+        }
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return it->second->value;
+    }
+
+    /// insert or replace an entry, evicting the least recently used ones if over capacity
+    void put(Key const& key, value_ptr value, std::size_t bytes) {
+        bytes += entry_overhead;
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            size_ -= it->second->bytes;
+            entries_.erase(it->second);
+            index_.erase(it);
+        }
+        if (bytes > capacity_) {
+            return;
+        }
+        entries_.push_front(entry{key, std::move(value), bytes});
+        index_.emplace(key, entries_.begin());
+        size_ += bytes;
+        evict();
+    }
+
+    void set_capacity(std::size_t capacity_bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capacity_ = capacity_bytes;
+        evict();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        index_.clear();
+        entries_.clear();
+        size_ = 0;
+    }
+
+    std::size_t capacity() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return capacity_;
+    }
+
+    std::size_t size_bytes() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return size_;
+    }
+
+    std::size_t count() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.size();
+    }
+
+  private:
+    struct entry {
+        Key key;
+        value_ptr value;
+        std::size_t bytes;
+    };
+
+    void evict() {
+        while (size_ > capacity_ && !entries_.empty()) {
+            entry const& last = entries_.back();
+            size_ -= last.bytes;
+            index_.erase(last.key);
+            entries_.pop_back();
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::list<entry> entries_;
+    std::unordered_map<Key, typename std::list<entry>::iterator, Hash> index_;
+    std::size_t capacity_;
+    std::size_t size_{0};
+};
+
+} // namespace utils
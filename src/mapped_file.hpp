@@ -0,0 +1,98 @@
+#pragma once
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vtzero/types.hpp>
+
+namespace utils {
+
+/// modification time and size of a file, used to notice that a mapped file was replaced
+struct file_version {
+    std::time_t modified{0};
+    long modified_nsec{0};
+    off_t size{0};
+
+    bool operator==(file_version const& other) const {
+        return modified == other.modified && modified_nsec == other.modified_nsec && size == other.size;
+    }
+};
+
+inline file_version make_file_version(struct stat const& st) {
+#ifdef __APPLE__
+    return file_version{st.st_mtimespec.tv_sec, st.st_mtimespec.tv_nsec, st.st_size};
+#else
+    return file_version{st.st_mtim.tv_sec, st.st_mtim.tv_nsec, st.st_size};
+#endif
+}
+
+/// stat a file, throwing std::runtime_error if it cannot be read
+inline file_version stat_file(std::string const& path) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        throw std::runtime_error("could not stat '" + path + "': " + std::strerror(errno));
+    }
+    return make_file_version(st);
+}
+
+/*
+  A read-only memory mapping of a whole file, unmapped when destroyed.
+  Throws std::runtime_error if the file cannot be opened or mapped.
+*/
+class mapped_file {
+  public:
+    explicit mapped_file(std::string const& path) {
+        int const fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("could not open '" + path + "': " + std::strerror(errno));
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("could not stat '" + path + "': " + std::strerror(errno));
+        }
+        version_ = make_file_version(st);
+        size_ = static_cast<std::size_t>(st.st_size);
+        if (size_ > 0) {
+            void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) { // NOLINT
+                ::close(fd);
+                throw std::runtime_error("could not map '" + path + "': " + std::strerror(errno));
+            }
+            data_ = static_cast<char const*>(addr);
+        }
+        ::close(fd);
+    }
+
+    ~mapped_file() {
+        if (data_ != nullptr) {
+            ::munmap(const_cast<char*>(data_), size_); // NOLINT
+        }
+    }
+
+    // non-copyable
+    mapped_file(mapped_file const&) = delete;
+    mapped_file& operator=(mapped_file const&) = delete;
+
+    // non-movable
+    mapped_file(mapped_file&&) = delete;
+    mapped_file& operator=(mapped_file&&) = delete;
+
+    vtzero::data_view data() const { return vtzero::data_view{data_, size_}; }
+
+    std::size_t size() const { return size_; }
+
+    file_version const& version() const { return version_; }
+
+  private:
+    char const* data_{nullptr};
+    std::size_t size_{0};
+    file_version version_;
+};
+
+} // namespace utils
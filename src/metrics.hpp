@@ -0,0 +1,346 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+  Process-wide query telemetry, cheap enough to leave on.
+
+  Every thread records into a shard of its own with relaxed atomic adds, so
+  recording never takes a lock or contends with another thread. drain() folds
+  every shard into a snapshot and zeroes it, and adds the snapshot to running
+  totals. Histograms use HDR-style buckets: exact below 8, then 8 buckets per
+  power of two, so any value is known to within 12.5%.
+*/
+namespace metrics {
+
+enum histogram_id : std::size_t {
+    /// from a worker being queued to it starting to run on the threadpool
+    queue_wait_ns,
+    /// time spent running a query (or batch) on the threadpool
+    execute_ns,
+    /// main thread time to turn results into a FeatureCollection
+    result_ns,
+    /// the size of each gzipped tile once inflated
+    bytes_inflated,
+    /// the features each query visited
+    features_scanned,
+    /// time a query spent reading its tiles: decompressing, decoding columnar tiles and indexes
+    prepare_ns,
+    /// time a query spent in its feature loops
+    scan_ns,
+    /// time a query spent sorting and copying out its results
+    materialize_ns,
+    num_histograms
+};
+
+enum counter_id : std::size_t {
+    queries,
+    errors,
+    num_counters
+};
+
+constexpr std::size_t sub_bucket_bits = 3;
+constexpr std::size_t sub_buckets = std::size_t{1} << sub_bucket_bits;
+constexpr std::size_t num_buckets = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+inline std::size_t bucket_of(std::uint64_t value) {
+    if (value < sub_buckets) {
+        return static_cast<std::size_t>(value);
+    }
+    auto const msb = static_cast<std::size_t>(63 - __builtin_clzll(value));
+    std::size_t const shift = msb - sub_bucket_bits;
+    return (shift + 1) * sub_buckets + static_cast<std::size_t>((value >> shift) & (sub_buckets - 1));
+}
+
+/// the largest value that falls in `bucket`
+inline std::uint64_t bucket_upper_bound(std::size_t bucket) {
+    if (bucket < sub_buckets) {
+        return bucket;
+    }
+    std::size_t const shift = bucket / sub_buckets - 1;
+    std::uint64_t const lower = static_cast<std::uint64_t>(sub_buckets + bucket % sub_buckets) << shift;
+    return lower + ((std::uint64_t{1} << shift) - 1);
+}
+
+struct histogram {
+    std::array<std::uint64_t, num_buckets> buckets{};
+    std::uint64_t count{0};
+    std::uint64_t sum{0};
+
+    /// the upper bound of the bucket holding the `q` quantile, 0 when empty
+    std::uint64_t quantile(double q) const {
+        if (count == 0) {
+            return 0;
+        }
+        auto const rank = static_cast<std::uint64_t>(q * static_cast<double>(count - 1)) + 1;
+        std::uint64_t seen = 0;
+        for (std::size_t b = 0; b < num_buckets; ++b) {
+            seen += buckets[b];
+            if (seen >= rank) {
+                return bucket_upper_bound(b);
+            }
+        }
+        return bucket_upper_bound(num_buckets - 1);
+    }
+
+    histogram& operator+=(histogram const& other) {
+        for (std::size_t b = 0; b < num_buckets; ++b) {
+            buckets[b] += other.buckets[b];
+        }
+        count += other.count;
+        sum += other.sum;
+        return *this;
+    }
+};
+
+struct snapshot {
+    std::array<histogram, num_histograms> histograms{};
+    std::array<std::uint64_t, num_counters> counters{};
+
+    snapshot& operator+=(snapshot const& other) {
+        for (std::size_t h = 0; h < num_histograms; ++h) {
+            histograms[h] += other.histograms[h];
+        }
+        for (std::size_t c = 0; c < num_counters; ++c) {
+            counters[c] += other.counters[c];
+        }
+        return *this;
+    }
+};
+
+/// what one thread recorded since the last drain
+struct shard {
+    shard() {
+        for (auto& buckets : histogram_buckets) {
+            for (auto& bucket : buckets) {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+        }
+        for (auto& sum : sums) {
+            sum.store(0, std::memory_order_relaxed);
+        }
+        for (auto& counter : counters) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /// move everything recorded so far into `out`
+    void drain_into(snapshot& out) {
+        for (std::size_t h = 0; h < num_histograms; ++h) {
+            auto& hist = out.histograms[h];
+            for (std::size_t b = 0; b < num_buckets; ++b) {
+                std::uint64_t const n = histogram_buckets[h][b].exchange(0, std::memory_order_relaxed);
+                hist.buckets[b] += n;
+                hist.count += n;
+            }
+            hist.sum += sums[h].exchange(0, std::memory_order_relaxed);
+        }
+        for (std::size_t c = 0; c < num_counters; ++c) {
+            out.counters[c] += counters[c].exchange(0, std::memory_order_relaxed);
+        }
+    }
+
+    std::array<std::array<std::atomic<std::uint64_t>, num_buckets>, num_histograms> histogram_buckets;
+    std::array<std::atomic<std::uint64_t>, num_histograms> sums;
+    std::array<std::atomic<std::uint64_t>, num_counters> counters;
+};
+
+struct registry {
+    std::mutex mutex;
+    std::vector<shard*> shards;
+    /// left behind by threads that exited since the last drain
+    snapshot retired;
+    /// everything drained so far
+    snapshot totals;
+};
+
+/// never destroyed, threads may still exit while the process shuts down
+inline registry& get_registry() {
+    static registry* r = new registry;
+    return *r;
+}
+
+/// registers the shard of a thread, and hands what it holds over when the thread exits
+class thread_shard {
+  public:
+    thread_shard()
+        : shard_{std::make_unique<shard>()} {
+        registry& r = get_registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.shards.push_back(shard_.get());
+    }
+
+    ~thread_shard() {
+        registry& r = get_registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        shard_->drain_into(r.retired);
+        for (auto it = r.shards.begin(); it != r.shards.end(); ++it) {
+            if (*it == shard_.get()) {
+                r.shards.erase(it);
+                break;
+            }
+        }
+    }
+
+    thread_shard(thread_shard const&) = delete;
+    thread_shard& operator=(thread_shard const&) = delete;
+
+    shard& get() { return *shard_; }
+
+  private:
+    // on the heap, large thread_local objects do not fit everywhere a module can be loaded
+    std::unique_ptr<shard> shard_;
+};
+
+inline shard& local_shard() {
+    thread_local thread_shard s;
+    return s.get();
+}
+
+inline void record(histogram_id h, std::uint64_t value) {
+    shard& s = local_shard();
+    s.histogram_buckets[h][bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+    s.sums[h].fetch_add(value, std::memory_order_relaxed);
+}
+
+inline void count(counter_id c, std::uint64_t n = 1) {
+    local_shard().counters[c].fetch_add(n, std::memory_order_relaxed);
+}
+
+/// nanoseconds since `start`
+inline std::uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+    auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return ns > 0 ? static_cast<std::uint64_t>(ns) : 0;
+}
+
+/// records the time from construction to destruction in a histogram
+class scoped_timer {
+  public:
+    explicit scoped_timer(histogram_id h)
+        : histogram_{h},
+          start_{std::chrono::steady_clock::now()} {}
+
+    ~scoped_timer() {
+        record(histogram_, elapsed_ns(start_));
+    }
+
+    scoped_timer(scoped_timer const&) = delete;
+    scoped_timer& operator=(scoped_timer const&) = delete;
+
+  private:
+    histogram_id histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/**
+  What was recorded since the last drain, and zero it. The same amounts are
+  added to `totals`, the running totals since the process started.
+*/
+inline snapshot drain(snapshot& totals) {
+    registry& r = get_registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    snapshot delta = r.retired;
+    r.retired = snapshot{};
+    for (shard* s : r.shards) {
+        s->drain_into(delta);
+    }
+    r.totals += delta;
+    totals = r.totals;
+    return delta;
+}
+
+inline char const* histogram_name(histogram_id h) {
+    switch (h) {
+    case queue_wait_ns:
+        return "queue_wait_ns";
+    case execute_ns:
+        return "execute_ns";
+    case result_ns:
+        return "result_ns";
+    case bytes_inflated:
+        return "bytes_inflated";
+    case features_scanned:
+        return "features_scanned";
+    case prepare_ns:
+        return "prepare_ns";
+    case scan_ns:
+        return "scan_ns";
+    case materialize_ns:
+        return "materialize_ns";
+    default:
+        return "";
+    }
+}
+
+inline char const* counter_name(counter_id c) {
+    switch (c) {
+    case queries:
+        return "queries";
+    case errors:
+        return "errors";
+    default:
+        return "";
+    }
+}
+
+/**
+  The Prometheus text exposition of running totals. Times are converted to
+  seconds and histograms get a bucket per power of two, up to the largest one
+  holding anything.
+*/
+inline std::string render_prometheus(snapshot const& totals) {
+    std::string out;
+    for (std::size_t c = 0; c < num_counters; ++c) {
+        std::string const name = std::string("vtquery_") + counter_name(static_cast<counter_id>(c)) + "_total";
+        out += "# TYPE " + name + " counter\n";
+        out += name + " " + std::to_string(totals.counters[c]) + "\n";
+    }
+    for (std::size_t h = 0; h < num_histograms; ++h) {
+        auto const id = static_cast<histogram_id>(h);
+        histogram const& hist = totals.histograms[h];
+        bool const seconds = id == queue_wait_ns || id == execute_ns || id == result_ns ||
+                             id == prepare_ns || id == scan_ns || id == materialize_ns;
+        std::string name = histogram_name(id);
+        if (seconds) {
+            name = name.substr(0, name.size() - 3) + "_seconds";
+        }
+        name = "vtquery_" + name;
+        auto const format = [seconds](std::uint64_t value) {
+            if (!seconds) {
+                return std::to_string(value);
+            }
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.9g", static_cast<double>(value) / 1e9);
+            return std::string(buffer);
+        };
+
+        std::size_t last = 0;
+        for (std::size_t b = 0; b < num_buckets; ++b) {
+            if (hist.buckets[b] > 0) {
+                last = b;
+            }
+        }
+        out += "# TYPE " + name + " histogram\n";
+        std::uint64_t cumulative = 0;
+        for (std::size_t b = 0; b < num_buckets; ++b) {
+            cumulative += hist.buckets[b];
+            // one bucket per power of two: the last sub bucket of each
+            if (b % sub_buckets == sub_buckets - 1 && b <= last + sub_buckets - 1) {
+                out += name + "_bucket{le=\"" + format(bucket_upper_bound(b)) + "\"} " + std::to_string(cumulative) + "\n";
+            }
+        }
+        out += name + "_bucket{le=\"+Inf\"} " + std::to_string(hist.count) + "\n";
+        out += name + "_sum " + format(hist.sum) + "\n";
+        out += name + "_count " + std::to_string(hist.count) + "\n";
+    }
+    return out;
+}
+
+} // namespace metrics
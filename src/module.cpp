@@ -3,6 +3,15 @@
 
 auto init(Napi::Env env, Napi::Object exports) -> Napi::Object {
     exports.Set(Napi::String::New(env, "vtquery"), Napi::Function::New(env, VectorTileQuery::vtquery));
+    exports.Set(Napi::String::New(env, "batch"), Napi::Function::New(env, VectorTileQuery::batch));
+    exports.Set(Napi::String::New(env, "compile"), Napi::Function::New(env, VectorTileQuery::compile));
+    VectorTileQuery::init_compiled_options(env, exports);
+    exports.Set(Napi::String::New(env, "buildIndex"), Napi::Function::New(env, VectorTileQuery::build_index));
+    exports.Set(Napi::String::New(env, "configure"), Napi::Function::New(env, VectorTileQuery::configure));
+    exports.Set(Napi::String::New(env, "stats"), Napi::Function::New(env, VectorTileQuery::stats));
+    exports.Set(Napi::String::New(env, "metrics"), Napi::Function::New(env, VectorTileQuery::metrics_snapshot));
+    exports.Set(Napi::String::New(env, "storeTile"), Napi::Function::New(env, VectorTileQuery::store_tile));
+    exports.Set(Napi::String::New(env, "dropTile"), Napi::Function::New(env, VectorTileQuery::drop_tile));
     return exports;
 }
 
@@ -0,0 +1,16 @@
+#pragma once
+#include <napi.h>
+#include <string>
+
+namespace utils {
+
+inline Napi::Value CallbackError(std::string const& message, Napi::CallbackInfo const& info) {
+    Napi::Object obj = Napi::Object::New(info.Env());
+    obj.Set("message", message);
+    auto func = info[info.Length() - 1].As<Napi::Function>();
+    // ^^^ here we assume that info has a valid callback function
+    // TODO: consider changing either method signature or adding internal checks
+    return func.Call({obj});
+}
+
+} // namespace utils
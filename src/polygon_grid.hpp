@@ -0,0 +1,235 @@
+#pragma once
+#include "geometry_kernels.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace kernels {
+
+/*
+  Cell grid over a (multi)polygon for repeated point in polygon tests.
+
+  The polygon's bounding box is split into cells. Cells crossed by an edge are
+  `boundary` cells, every other cell is wholly inside or outside and is
+  classified once from its center. Each row of cells also keeps the edges that
+  span its y range, which are the only edges a horizontal ray from a point in
+  that row can cross, so a point in a boundary cell is resolved by winding
+  numbers over the row's edges instead of every ring.
+
+  The grid owns the decoded geometry so callers holding a cached grid do not
+  have to decode the feature again.
+*/
+class polygon_grid {
+  public:
+    enum cell_class : std::uint8_t {
+        outside,
+        inside,
+        boundary
+    };
+
+    explicit polygon_grid(flat_geometry geom)
+        : geom_(std::move(geom)) {
+        build();
+    }
+
+    flat_geometry const& geometry() const { return geom_; }
+
+    std::size_t num_vertices() const { return geom_.xs.size(); }
+
+    /// classify the cell a point falls in, points outside the bounding box are `outside`
+    cell_class locate(double px, double py) const {
+        if (cells_.empty() || px < min_x_ || px > max_x_ || py < min_y_ || py > max_y_) {
+            return outside;
+        }
+        return static_cast<cell_class>(cells_[row_of(py) * cols_ + col_of(px)]);
+    }
+
+    /// whether a point is inside the polygon, same rule as closest_point_polygon
+    bool contains(double px, double py) const {
+        switch (locate(px, py)) {
+        case inside:
+            return true;
+        case boundary:
+            return contains_in_row(row_of(py), px, py);
+        default:
+            return false;
+        }
+    }
+
+    std::size_t memory_usage() const {
+        return sizeof(polygon_grid) +
+               (geom_.xs.capacity() + geom_.ys.capacity()) * sizeof(std::int32_t) +
+               (geom_.ring_offsets.capacity() + geom_.part_starts.capacity() + ring_part_.capacity()) * sizeof(std::uint32_t) +
+               cells_.capacity() +
+               row_offsets_.capacity() * sizeof(std::uint32_t) +
+               row_edges_.capacity() * sizeof(row_edge);
+    }
+
+  private:
+    /// an edge from vertex `vertex` to `vertex + 1` of ring `ring`
+    struct row_edge {
+        std::uint32_t ring;
+        std::uint32_t vertex;
+    };
+
+    static constexpr std::size_t max_cells_per_side = 512;
+
+    std::size_t col_of(double x) const {
+        auto const col = static_cast<std::size_t>((x - min_x_) / cell_width_);
+        return std::min(col, cols_ - 1);
+    }
+
+    std::size_t row_of(double y) const {
+        auto const row = static_cast<std::size_t>((y - min_y_) / cell_height_);
+        return std::min(row, rows_ - 1);
+    }
+
+    void build() {
+        std::size_t const num_rings = geom_.num_rings();
+        if (num_rings == 0 || geom_.part_starts.empty()) {
+            return;
+        }
+        min_x_ = *std::min_element(geom_.xs.begin(), geom_.xs.end());
+        max_x_ = *std::max_element(geom_.xs.begin(), geom_.xs.end());
+        min_y_ = *std::min_element(geom_.ys.begin(), geom_.ys.end());
+        max_y_ = *std::max_element(geom_.ys.begin(), geom_.ys.end());
+
+        // aim for about one cell per edge, shaped like the bounding box
+        double const width = std::max(max_x_ - min_x_, 1.0);
+        double const height = std::max(max_y_ - min_y_, 1.0);
+        double const edges = static_cast<double>(geom_.xs.size());
+        auto const side = [](double n) {
+            return std::min(std::max(static_cast<std::size_t>(std::ceil(n)), std::size_t{1}), max_cells_per_side);
+        };
+        cols_ = side(std::sqrt(edges * width / height));
+        rows_ = side(std::sqrt(edges * height / width));
+        cell_width_ = width / static_cast<double>(cols_);
+        cell_height_ = height / static_cast<double>(rows_);
+
+        ring_part_.resize(num_rings);
+        for (std::size_t part = 0; part < geom_.num_parts(); ++part) {
+            for (std::size_t r = geom_.part_starts[part]; r < geom_.part_end(part); ++r) {
+                ring_part_[r] = static_cast<std::uint32_t>(part);
+            }
+        }
+
+        // bucket edges by row (counting pass, then fill) and mark the cells they cross
+        cells_.assign(rows_ * cols_, outside);
+        row_offsets_.assign(rows_ + 1, 0);
+        for_each_edge_row([this](std::size_t row, std::uint32_t /*ring*/, std::uint32_t /*vertex*/) {
+            ++row_offsets_[row + 1];
+        });
+        for (std::size_t row = 0; row < rows_; ++row) {
+            row_offsets_[row + 1] += row_offsets_[row];
+        }
+        row_edges_.resize(row_offsets_.back());
+        std::vector<std::uint32_t> fill(row_offsets_.begin(), row_offsets_.end() - 1);
+        for_each_edge_row([this, &fill](std::size_t row, std::uint32_t ring, std::uint32_t vertex) {
+            row_edges_[fill[row]++] = row_edge{ring, vertex};
+            mark_boundary_cells(row, vertex);
+        });
+
+        // edges were visited ring by ring, so each row's edges are already grouped by ring
+        for (std::size_t row = 0; row < rows_; ++row) {
+            double const cy = min_y_ + (static_cast<double>(row) + 0.5) * cell_height_;
+            for (std::size_t col = 0; col < cols_; ++col) {
+                std::uint8_t& cell = cells_[row * cols_ + col];
+                if (cell != boundary) {
+                    double const cx = min_x_ + (static_cast<double>(col) + 0.5) * cell_width_;
+                    cell = contains_in_row(row, cx, cy) ? inside : outside;
+                }
+            }
+        }
+    }
+
+    template <typename F>
+    void for_each_edge_row(F&& f) const {
+        for (std::size_t r = 0; r < geom_.num_rings(); ++r) {
+            std::size_t const begin = geom_.ring_begin(r);
+            std::size_t const end = begin + geom_.ring_size(r);
+            for (std::size_t i = begin; i + 1 < end; ++i) {
+                std::size_t const first = row_of(std::min(geom_.ys[i], geom_.ys[i + 1]));
+                std::size_t const last = row_of(std::max(geom_.ys[i], geom_.ys[i + 1]));
+                for (std::size_t row = first; row <= last; ++row) {
+                    f(row, static_cast<std::uint32_t>(r), static_cast<std::uint32_t>(i));
+                }
+            }
+        }
+    }
+
+    /// mark the cells of `row` that the edge starting at `vertex` passes through
+    void mark_boundary_cells(std::size_t row, std::size_t vertex) {
+        double const ax = geom_.xs[vertex];
+        double const ay = geom_.ys[vertex];
+        double const bx = geom_.xs[vertex + 1];
+        double const by = geom_.ys[vertex + 1];
+        double x0 = std::min(ax, bx);
+        double x1 = std::max(ax, bx);
+        if (ay < by || ay > by) {
+            // clip the edge to the row's band
+            double const band_low = std::max(min_y_ + static_cast<double>(row) * cell_height_, std::min(ay, by));
+            double const band_high = std::min(min_y_ + static_cast<double>(row + 1) * cell_height_, std::max(ay, by));
+            double const xa = ax + (bx - ax) * (band_low - ay) / (by - ay);
+            double const xb = ax + (bx - ax) * (band_high - ay) / (by - ay);
+            x0 = std::max(x0, std::min(xa, xb));
+            x1 = std::min(x1, std::max(xa, xb));
+        }
+        // widen slightly so rounding never leaves a crossed cell unmarked
+        double const slack = cell_width_ * 1e-6;
+        std::size_t const first = col_of(std::max(x0 - slack, min_x_));
+        std::size_t const last = col_of(std::min(x1 + slack, max_x_));
+        for (std::size_t col = first; col <= last; ++col) {
+            cells_[row * cols_ + col] = boundary;
+        }
+    }
+
+    /// winding numbers over the edges of one row, grouped by ring and then by part
+    bool contains_in_row(std::size_t row, double px, double py) const {
+        std::size_t current_part = geom_.num_parts();
+        bool outer_hit = false;
+        bool hole_hit = false;
+        std::size_t i = row_offsets_[row];
+        std::size_t const end = row_offsets_[row + 1];
+        while (i < end) {
+            std::uint32_t const ring = row_edges_[i].ring;
+            int winding = 0;
+            for (; i < end && row_edges_[i].ring == ring; ++i) {
+                std::size_t const v = row_edges_[i].vertex;
+                winding += winding_scalar(geom_.xs.data() + v, geom_.ys.data() + v, 2, px, py);
+            }
+            std::size_t const part = ring_part_[ring];
+            if (part != current_part) {
+                if (outer_hit && !hole_hit) {
+                    return true;
+                }
+                current_part = part;
+                outer_hit = false;
+                hole_hit = false;
+            }
+            if (ring == geom_.part_starts[part]) {
+                outer_hit = winding != 0;
+            } else if (winding != 0) {
+                hole_hit = true;
+            }
+        }
+        return outer_hit && !hole_hit;
+    }
+
+    flat_geometry geom_;
+    std::vector<std::uint32_t> ring_part_;
+    std::vector<std::uint8_t> cells_;
+    std::vector<std::uint32_t> row_offsets_;
+    std::vector<row_edge> row_edges_;
+    double min_x_{0.0};
+    double max_x_{0.0};
+    double min_y_{0.0};
+    double max_y_{0.0};
+    double cell_width_{1.0};
+    double cell_height_{1.0};
+    std::size_t cols_{1};
+    std::size_t rows_{1};
+};
+
+} // namespace kernels
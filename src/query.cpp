@@ -0,0 +1,1770 @@
+#include "query.hpp"
+#include "columnar_tile.hpp"
+#include "geometry_kernels.hpp"
+#include "lru_cache.hpp"
+#include "mapped_file.hpp"
+#include "metrics.hpp"
+#include "polygon_grid.hpp"
+#include "simplify.hpp"
+#include "tile_index.hpp"
+#include "util.hpp"
+#include "vector_tile_util.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <exception>
+#include <gzip/decompress.hpp>
+#include <gzip/utils.hpp>
+#include <limits>
+#include <mapbox/geometry/algorithms/closest_point.hpp>
+#include <mapbox/geometry/algorithms/closest_point_impl.hpp>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <zlib.h>
+
+namespace VectorTileQuery {
+
+namespace {
+
+struct CompareDistance {
+    bool operator()(ResultObject const& r1, ResultObject const& r2) {
+        return r1.distance < r2.distance;
+    }
+};
+
+/// replace already existing results with a better, duplicate result
+void insert_result(ResultObject& old_result,
+                   std::vector<vtzero::property>& props_vec,
+                   std::string const& layer_name,
+                   mapbox::geometry::point<double> const& pt,
+                   double distance,
+                   GeomType geom_type,
+                   bool has_id,
+                   uint64_t id) {
+
+    std::swap(old_result.properties_vector, props_vec);
+    old_result.layer_name = layer_name;
+    old_result.coordinates = pt;
+    old_result.distance = distance;
+    old_result.original_geometry_type = geom_type;
+    old_result.has_id = has_id;
+    old_result.id = id;
+}
+
+/// generate a vector of vtzero::property objects
+std::vector<vtzero::property> get_properties_vector(vtzero::feature& feat) {
+    std::vector<vtzero::property> v;
+    v.reserve(feat.num_properties());
+    while (auto ii = feat.next_property()) {
+        v.push_back(ii);
+    }
+    return v;
+}
+
+double convert_to_double(value_type const& value) {
+    // float
+    if (value.which() == 0) {
+        return double(boost::get<float>(value));
+    }
+    // double
+    if (value.which() == 1) {
+        return boost::get<double>(value);
+    }
+    // int64_t
+    if (value.which() == 2) {
+        return double(boost::get<int64_t>(value));
+    }
+    // uint64_t
+    if (value.which() == 3) {
+        return double(boost::get<uint64_t>(value));
+    }
+    return 0.0f;
+}
+
+/// Evaluates a single filter on a feature - Returns true if it passes filter
+bool single_filter_feature(basic_filter_struct const& filter, value_type const& feature_value) {
+    double epsilon = 0.001;
+    if (feature_value.which() <= 3 && filter.value.which() <= 3) { // Numeric Types
+        double parameter_double = convert_to_double(feature_value);
+        double filter_double = convert_to_double(filter.value);
+        if ((filter.type == eq) && (std::abs(parameter_double - filter_double) < epsilon)) {
+            return true;
+        }
+        if ((filter.type == ne) && (std::abs(parameter_double - filter_double) >= epsilon)) {
+            return true;
+        }
+        if ((filter.type == gte) && (parameter_double >= filter_double)) {
+            return true;
+        }
+        if ((filter.type == gt) && (parameter_double > filter_double)) {
+            return true;
+        }
+        if ((filter.type == lte) && (parameter_double <= filter_double)) {
+            return true;
+        }
+        if ((filter.type == lt) && (parameter_double < filter_double)) {
+            return true;
+        }
+    } else if (feature_value.which() == 4 && filter.value.which() == 4) { // Boolean Types
+        bool feature_bool = boost::get<bool>(feature_value);
+        bool filter_bool = boost::get<bool>(filter.value);
+        if ((filter.type == eq) && (feature_bool == filter_bool)) {
+            return true;
+        }
+        if ((filter.type == ne) && (feature_bool != filter_bool)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// the feature's properties keyed by name, for evaluating filters
+map_type create_properties_map(std::vector<vtzero::property> const& props_vec) {
+    map_type map;
+    for (auto const& prop : props_vec) {
+        map.emplace(std::string(prop.key()), vtzero::convert_property_value<value_type>(prop.value()));
+    }
+    return map;
+}
+
+/// apply filters to a feature - Returns true if feature matches all features
+bool filter_feature_all(std::vector<vtzero::property> const& props_vec, std::vector<basic_filter_struct> const& filters) {
+    auto features_property_map = create_properties_map(props_vec);
+    for (auto const& filter : filters) {
+        auto it = features_property_map.find(filter.key);
+        if (it != features_property_map.end()) {
+            value_type feature_value = it->second;
+            if (!single_filter_feature(filter, feature_value)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/// apply filters to a feature - Returns true if feature matches any features
+bool filter_feature_any(std::vector<vtzero::property> const& props_vec, std::vector<basic_filter_struct> const& filters) {
+    auto features_property_map = create_properties_map(props_vec);
+    for (auto const& filter : filters) {
+        auto it = features_property_map.find(filter.key);
+        if (it != features_property_map.end()) {
+            value_type feature_value = it->second;
+            if (single_filter_feature(filter, feature_value)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/// compare two features to determine if they are duplicates
+bool value_is_duplicate(ResultObject const& r,
+                        bool candidate_has_id,
+                        uint64_t candidate_id,
+                        std::string const& candidate_layer,
+                        GeomType const candidate_geom,
+                        std::vector<vtzero::property> const& candidate_props_vec) {
+
+    // compare layer (if different layers, not duplicates)
+    if (r.layer_name != candidate_layer) {
+        return false;
+    }
+
+    // compare geometry (if different geometry types, not duplicates)
+    if (r.original_geometry_type != candidate_geom) {
+        return false;
+    }
+
+    // compare ids
+    if (r.has_id && candidate_has_id && r.id != candidate_id) {
+        return false;
+    }
+
+    // compare property tags
+    return r.properties_vector == candidate_props_vec;
+}
+
+enum FilterMode {
+    filter_none,
+    filter_mode_all,
+    filter_mode_any
+};
+
+/**
+  Query options that are fixed for the whole query, resolved at compile time.
+
+  Each combination of options gets its own instantiation of the feature loop so
+  the compiler can drop the branches that never apply to it.
+*/
+template <GeomType GeometryFilter, FilterMode Filter, bool Dedupe, bool DirectHitPolygon>
+struct static_flags {
+    static constexpr GeomType geometry_filter_type = GeometryFilter;
+    static constexpr FilterMode filter_mode = Filter;
+    static constexpr bool dedupe = Dedupe;
+    static constexpr bool direct_hit_polygon = DirectHitPolygon;
+};
+
+/// The same options checked at runtime, used when building with VTQUERY_GENERIC_KERNEL
+struct runtime_flags {
+    explicit runtime_flags(QueryOptions const& data)
+        : geometry_filter_type(data.geometry_filter_type),
+          filter_mode(data.basic_filter.filters.empty() ? filter_none : (data.basic_filter.type == filter_all ? filter_mode_all : filter_mode_any)),
+          dedupe(data.dedupe),
+          direct_hit_polygon(data.direct_hit_polygon) {}
+
+    GeomType geometry_filter_type;
+    FilterMode filter_mode;
+    bool dedupe;
+    bool direct_hit_polygon;
+};
+
+/// a tile ready to be queried
+struct QueryTile {
+    QueryTile(vtzero::data_view tile_data, vtzero::data_view raw, std::int32_t z0, std::int32_t x0, std::int32_t y0)
+        : data{tile_data},
+          tile{tile_data},
+          raw_data{raw},
+          z{z0},
+          x{x0},
+          y{y0} {}
+
+    /// hash of the bytes as they were given to us, computed on first use
+    std::uint64_t content_hash() const {
+        if (!hashed_) {
+            hash_ = utils::hash_bytes(raw_data.data(), raw_data.size());
+            hashed_ = true;
+        }
+        return hash_;
+    }
+
+    void set_content_hash(std::uint64_t hash) {
+        hash_ = hash;
+        hashed_ = true;
+    }
+
+    vtzero::data_view data;
+    vtzero::vector_tile tile;
+    vtzero::data_view raw_data;
+    std::int32_t z;
+    std::int32_t x;
+    std::int32_t y;
+    /// set when the query runs on the pre-decoded form of the tile
+    std::shared_ptr<columnar::tile const> columnar;
+    /// set when a sidecar index was given for the tile, `index_file` keeps a mapped index alive
+    std::shared_ptr<utils::mapped_file const> index_file;
+    std::unique_ptr<tile_index::reader> index;
+
+  private:
+    mutable std::uint64_t hash_{0};
+    mutable bool hashed_{false};
+};
+
+std::atomic<std::size_t>& memory_current() {
+    static std::atomic<std::size_t> bytes{0};
+    return bytes;
+}
+
+std::atomic<std::size_t>& memory_peak() {
+    static std::atomic<std::size_t> bytes{0};
+    return bytes;
+}
+
+std::atomic<std::size_t>& memory_exceeded() {
+    static std::atomic<std::size_t> queries{0};
+    return queries;
+}
+
+/**
+  The bytes one query holds: the tiles it inflated, the columnar tiles, polygon
+  grids and simplified layers it built, its decoded geometry and its results.
+  They are added to the process-wide totals as they are taken and given back
+  when the query ends. Throws once `options.max_memory` is exceeded.
+*/
+class QueryMemory {
+  public:
+    explicit QueryMemory(std::size_t limit)
+        : limit_{limit} {}
+
+    /// a budget of one batched point: the bytes `shared` holds for every point count against its limit too
+    QueryMemory(std::size_t limit, QueryMemory const& shared)
+        : limit_{limit}, shared_{shared.used_} {}
+
+    ~QueryMemory() {
+        memory_current().fetch_sub(used_);
+    }
+
+    // non-copyable
+    QueryMemory(QueryMemory const&) = delete;
+    QueryMemory& operator=(QueryMemory const&) = delete;
+
+    // non-movable
+    QueryMemory(QueryMemory&&) = delete;
+    QueryMemory& operator=(QueryMemory&&) = delete;
+
+    void add(std::size_t bytes) {
+        used_ += bytes;
+        std::size_t const current = memory_current().fetch_add(bytes) + bytes;
+        std::size_t peak = memory_peak().load();
+        while (current > peak && !memory_peak().compare_exchange_weak(peak, current)) {
+        }
+        if (limited() && shared_ + used_ > limit_) {
+            exceeded();
+        }
+    }
+
+    /// charge the growth of the buffer reused from feature to feature
+    void hold_scratch(std::size_t bytes) {
+        if (bytes > scratch_) {
+            std::size_t const growth = bytes - scratch_;
+            scratch_ = bytes;
+            add(growth);
+        }
+    }
+
+    bool limited() const { return limit_ > 0; }
+
+    /// bytes left before the limit, only meaningful when limited()
+    std::size_t remaining() const { return shared_ + used_ < limit_ ? limit_ - shared_ - used_ : 0; }
+
+    [[noreturn]] void exceeded() const {
+        ++memory_exceeded();
+        throw std::runtime_error("query exceeded 'max_memory' of " + std::to_string(limit_) + " bytes");
+    }
+
+  private:
+    std::size_t limit_;
+    std::size_t shared_{0};
+    std::size_t used_{0};
+    std::size_t scratch_{0};
+};
+
+/**
+  The bounded result sets of a query: one for all features, or with
+  options.group_by one per layer, per geometry type or per both, each keeping
+  the `limit` nearest features of its group. A layer's sets are added when
+  the feature loop first reaches it.
+*/
+class ResultGroups {
+  public:
+    explicit ResultGroups(QueryOptions const& options)
+        : limit_{options.num_results},
+          by_layer_{options.group_by_layer},
+          by_geometry_{options.group_by_geometry} {
+        if (!by_layer_) {
+            add_sets();
+        }
+    }
+
+    /// called as the feature loop moves on to a layer
+    void enter_layer(std::string const& layer_name) {
+        if (!by_layer_) {
+            return;
+        }
+        auto it = layers_.find(layer_name);
+        if (it == layers_.end()) {
+            it = layers_.emplace(layer_name, sets_.size()).first;
+            add_sets();
+        }
+        layer_first_ = it->second;
+    }
+
+    /// the set a feature of this geometry type in the current layer competes for
+    std::vector<ResultObject>& results(GeomType type) {
+        return sets_[layer_first_ + (by_geometry_ ? static_cast<std::size_t>(type) : 0)];
+    }
+
+    std::vector<std::vector<ResultObject>> const& sets() const { return sets_; }
+
+    /// every set in one, nearest first
+    std::vector<ResultObject> merge() {
+        if (sets_.size() == 1) {
+            return std::move(sets_.front());
+        }
+        std::vector<ResultObject> merged;
+        for (auto& set : sets_) {
+            for (auto& result : set) {
+                if (result.distance < std::numeric_limits<double>::max()) {
+                    merged.push_back(std::move(result));
+                }
+            }
+        }
+        std::stable_sort(merged.begin(), merged.end(), CompareDistance());
+        return merged;
+    }
+
+  private:
+    void add_sets() {
+        // point, linestring and polygon, in GeomType order
+        std::size_t const count = by_geometry_ ? 3 : 1;
+        for (std::size_t i = 0; i < count; ++i) {
+            sets_.emplace_back(limit_);
+        }
+    }
+
+    std::uint32_t limit_;
+    bool by_layer_;
+    bool by_geometry_;
+    std::vector<std::vector<ResultObject>> sets_;
+    std::unordered_map<std::string, std::size_t> layers_;
+    std::size_t layer_first_{0};
+};
+
+/// everything about the current layer that stays the same for each of its features
+struct LayerContext {
+    QueryTile const* tile;
+    /// what the query holds, charged with everything it builds
+    QueryMemory* memory{nullptr};
+    std::string layer_name;
+    std::uint32_t layer_index;
+    std::uint32_t feature_index;
+    std::uint32_t extent;
+    std::int32_t z;
+    std::int32_t x;
+    std::int32_t y;
+    mapbox::geometry::point<std::int64_t> query_point;
+    mapbox::geometry::point<double> query_lnglat;
+    /// the layer simplified for options.tolerance, if it is simplified
+    std::shared_ptr<kernels::simplified_layer const> simplified;
+    /// most meters the distance to a simplified feature can be above the exact one
+    double simplify_slack{0.0};
+    /// features visited so far, for metrics
+    std::size_t features_scanned{0};
+};
+
+/// identifies a tile across queries by its bytes
+struct TileKey {
+    std::uint64_t tile_hash;
+    std::size_t tile_size;
+
+    bool operator==(TileKey const& other) const {
+        return tile_hash == other.tile_hash && tile_size == other.tile_size;
+    }
+};
+
+struct TileKeyHash {
+    std::size_t operator()(TileKey const& key) const {
+        return static_cast<std::size_t>(key.tile_hash ^ (key.tile_size * 0x9e3779b97f4a7c15ULL));
+    }
+};
+
+/// identifies a feature across queries by the tile's bytes and the feature's position in them
+struct FeatureKey {
+    std::uint64_t tile_hash;
+    std::size_t tile_size;
+    std::uint32_t layer_index;
+    std::uint32_t feature_index;
+
+    bool operator==(FeatureKey const& other) const {
+        return tile_hash == other.tile_hash && tile_size == other.tile_size &&
+               layer_index == other.layer_index && feature_index == other.feature_index;
+    }
+};
+
+struct FeatureKeyHash {
+    std::size_t operator()(FeatureKey const& key) const {
+        std::uint64_t const position = (static_cast<std::uint64_t>(key.layer_index) << 32U) | key.feature_index;
+        return static_cast<std::size_t>(key.tile_hash ^ (position * 0x9e3779b97f4a7c15ULL));
+    }
+};
+
+/// identifies a layer simplified to one level of detail
+struct SimplifiedLayerKey {
+    std::uint64_t tile_hash;
+    std::size_t tile_size;
+    std::uint32_t layer_index;
+    std::int32_t level;
+
+    bool operator==(SimplifiedLayerKey const& other) const {
+        return tile_hash == other.tile_hash && tile_size == other.tile_size &&
+               layer_index == other.layer_index && level == other.level;
+    }
+};
+
+struct SimplifiedLayerKeyHash {
+    std::size_t operator()(SimplifiedLayerKey const& key) const {
+        std::uint64_t const position = (static_cast<std::uint64_t>(key.layer_index) << 32U) | static_cast<std::uint32_t>(key.level);
+        return static_cast<std::size_t>(key.tile_hash ^ (position * 0x9e3779b97f4a7c15ULL));
+    }
+};
+
+/// polygons with at least this much encoded geometry (a few hundred vertices) get a cached grid
+constexpr std::size_t polygon_grid_min_bytes = 1024;
+/// the same threshold for columnar tiles, which no longer know the encoded size
+constexpr std::size_t polygon_grid_min_vertices = 256;
+constexpr std::size_t polygon_grid_cache_bytes = 64 * 1024 * 1024;
+constexpr std::size_t columnar_cache_bytes = 256 * 1024 * 1024;
+constexpr std::size_t simplified_layer_cache_bytes = 64 * 1024 * 1024;
+/// simplification epsilons are powers of two tile units up to this one
+constexpr std::int32_t max_simplify_level = 12;
+/// bounds the address space taken by mapped index files rather than memory
+constexpr std::size_t index_file_cache_bytes = 1024 * 1024 * 1024;
+
+using PolygonGridCache = utils::lru_cache<FeatureKey, kernels::polygon_grid, FeatureKeyHash>;
+using ColumnarCache = utils::lru_cache<TileKey, columnar::tile, TileKeyHash>;
+using IndexFileCache = utils::lru_cache<std::string, utils::mapped_file>;
+using SimplifiedLayerCache = utils::lru_cache<SimplifiedLayerKey, kernels::simplified_layer, SimplifiedLayerKeyHash>;
+
+/// grids outlive single queries so repeated queries over the same large polygons share them
+PolygonGridCache& polygon_grid_cache() {
+    static PolygonGridCache cache{polygon_grid_cache_bytes};
+    return cache;
+}
+
+/// columnar tiles are only worth building when they are reused, so they are always cached
+ColumnarCache& columnar_cache() {
+    static ColumnarCache cache{columnar_cache_bytes};
+    return cache;
+}
+
+std::shared_ptr<columnar::tile const> find_or_build_columnar_tile(QueryTile const& tile, QueryMemory& memory) {
+    TileKey const key{tile.content_hash(), tile.raw_data.size()};
+    auto found = columnar_cache().get(key);
+    if (!found) {
+        auto built = std::make_shared<columnar::tile>(std::string(tile.data.data(), tile.data.size()));
+        memory.add(built->memory_usage());
+        columnar_cache().put(key, built, built->memory_usage());
+        found = std::move(built);
+    }
+    return found;
+}
+
+/// index files stay mapped between queries, and are mapped again when the file changes
+IndexFileCache& index_file_cache() {
+    static IndexFileCache cache{index_file_cache_bytes};
+    return cache;
+}
+
+std::shared_ptr<utils::mapped_file const> find_or_map_index_file(std::string const& path) {
+    auto const version = utils::stat_file(path);
+    auto mapped = index_file_cache().get(path);
+    if (!mapped || !(mapped->version() == version)) {
+        auto fresh = std::make_shared<utils::mapped_file>(path);
+        index_file_cache().put(path, fresh, fresh->size());
+        mapped = std::move(fresh);
+    }
+    return mapped;
+}
+
+/// simplified layers are kept per tile, layer and level of detail, for every tolerance that rounds to that level
+SimplifiedLayerCache& simplified_layer_cache() {
+    static SimplifiedLayerCache cache{simplified_layer_cache_bytes};
+    return cache;
+}
+
+/// read a sidecar index and check that it was built from this tile's bytes
+void attach_index(QueryTile& tile, vtzero::data_view index_data) {
+    auto index = std::make_unique<tile_index::reader>(index_data);
+    if (!index->matches(tile.raw_data.size(), tile.content_hash())) {
+        throw std::runtime_error("tile index does not match the tile buffer");
+    }
+    tile.index = std::move(index);
+}
+
+/// `fill` writes the feature's geometry into the flat_geometry it is given, only called on a cache miss
+template <typename Fill>
+std::shared_ptr<kernels::polygon_grid const> find_or_build_polygon_grid(LayerContext const& ctx, Fill&& fill) {
+    FeatureKey const key{ctx.tile->content_hash(), ctx.tile->raw_data.size(), ctx.layer_index, ctx.feature_index};
+    auto grid = polygon_grid_cache().get(key);
+    if (!grid) {
+        kernels::flat_geometry geom;
+        fill(geom);
+        auto built = std::make_shared<kernels::polygon_grid>(std::move(geom));
+        ctx.memory->add(built->memory_usage());
+        polygon_grid_cache().put(key, built, built->memory_usage());
+        grid = std::move(built);
+    }
+    return grid;
+}
+
+/**
+  Most meters one tile unit of the current layer can span, anywhere within a
+  tile of it, as distances are measured from the query point. Features can
+  reach into the tile's buffer, so the tiles above and below count too.
+*/
+double max_meters_per_unit(LayerContext const& ctx) {
+    double const extent = static_cast<double>(ctx.extent);
+    double const degrees_per_unit = 360.0 / (extent * static_cast<double>(static_cast<std::int64_t>(1) << ctx.z));
+    auto const north = utils::convert_vt_to_ll(ctx.extent, ctx.z, ctx.x, ctx.y, mapbox::geometry::point<double>{0.0, -extent});
+    auto const south = utils::convert_vt_to_ll(ctx.extent, ctx.z, ctx.x, ctx.y, mapbox::geometry::point<double>{0.0, 2.0 * extent});
+    // a unit spans the most latitude where it is closest to the equator
+    double const max_cos = (north.y >= 0.0 && south.y <= 0.0) ? 1.0 : std::max(std::cos(north.y * M_PI / 180.0), std::cos(south.y * M_PI / 180.0));
+    double const lat = ctx.query_lnglat.y;
+    double const meters_per_degree_x = utils::distance_in_meters({0.0, lat}, {1.0, lat});
+    double const meters_per_degree_y = utils::distance_in_meters({0.0, lat}, {0.0, lat + 1.0});
+    return degrees_per_unit * std::max(meters_per_degree_x, meters_per_degree_y * max_cos);
+}
+
+/**
+  Look up (or build once) the current layer simplified for `tolerance` meters
+  and set it in `ctx`. The epsilon is the largest power of two tile units
+  within the tolerance, so nearby query points and similar tolerances share a
+  level of detail. Layers are left unsimplified below one tile unit.
+
+  `fill` adds every feature of the layer to the simplified_layer it is given,
+  with the epsilon it is given, only called on a cache miss.
+*/
+template <typename Fill>
+void attach_simplified_layer(double tolerance, LayerContext& ctx, Fill&& fill) {
+    ctx.simplified = nullptr;
+    ctx.simplify_slack = 0.0;
+    if (!(tolerance > 0.0)) {
+        return;
+    }
+    double const meters_per_unit = max_meters_per_unit(ctx);
+    double const units = tolerance / meters_per_unit;
+    if (!(units >= 1.0)) {
+        return;
+    }
+    std::int32_t const level = std::min(max_simplify_level, static_cast<std::int32_t>(std::floor(std::log2(units))));
+    double const epsilon = std::ldexp(1.0, level);
+
+    SimplifiedLayerKey const key{ctx.tile->content_hash(), ctx.tile->raw_data.size(), ctx.layer_index, level};
+    auto simplified = simplified_layer_cache().get(key);
+    if (!simplified) {
+        auto built = std::make_shared<kernels::simplified_layer>();
+        fill(*built, epsilon);
+        ctx.memory->add(built->memory_usage());
+        simplified_layer_cache().put(key, built, built->memory_usage());
+        simplified = std::move(built);
+    }
+    ctx.simplified = std::move(simplified);
+    ctx.simplify_slack = epsilon * meters_per_unit;
+}
+
+/// simplify every feature of an encoded layer, in order
+void fill_simplified_layer(vtzero::layer layer, kernels::simplified_layer& out, double epsilon) {
+    kernels::flat_geometry geom;
+    kernels::simplify_scratch scratch;
+    layer.reset_feature();
+    while (auto feature = layer.next_feature()) {
+        switch (feature.geometry_type()) {
+        case vtzero::GeomType::LINESTRING:
+            mapbox::vector_tile::extract_flat_line_string(feature, geom);
+            break;
+        case vtzero::GeomType::POLYGON:
+            mapbox::vector_tile::extract_flat_polygon(feature, geom);
+            break;
+        default:
+            geom.clear();
+            break;
+        }
+        out.add_feature(geom, epsilon, scratch);
+    }
+}
+
+/// simplify every feature of a columnar layer, in order
+void fill_simplified_layer(columnar::layer const& layer, kernels::simplified_layer& out, double epsilon) {
+    kernels::flat_geometry geom;
+    kernels::simplify_scratch scratch;
+    for (std::size_t i = 0; i < layer.num_features(); ++i) {
+        if (layer.geometry_type(i) == vtzero::GeomType::LINESTRING || layer.geometry_type(i) == vtzero::GeomType::POLYGON) {
+            layer.copy_geometry(i, geom);
+        } else {
+            geom.clear();
+        }
+        out.add_feature(geom, epsilon, scratch);
+    }
+}
+
+/**
+  Whether the current feature is certainly not kept, going by its simplified
+  geometry: even at `simplify_slack` meters closer than measured it would be
+  out of the radius, or further away than every result already found.
+*/
+template <GeomType FeatureGeom>
+bool simplified_out_of_reach(LayerContext const& ctx, QueryOptions const& data, std::vector<ResultObject> const& results_queue) {
+    if (FeatureGeom == GeomType::point || !ctx.simplified || ctx.feature_index >= ctx.simplified->num_features()) {
+        return false;
+    }
+    auto const& layer = *ctx.simplified;
+    std::size_t const i = ctx.feature_index;
+    double const px = static_cast<double>(ctx.query_point.x);
+    double const py = static_cast<double>(ctx.query_point.y);
+    auto const cp_info = FeatureGeom == GeomType::polygon
+                             ? kernels::closest_point_polygon(layer.geometry, layer.first_part(i), layer.last_part(i), px, py)
+                             : kernels::closest_point_rings(layer.geometry, layer.first_ring(i), layer.last_ring(i), px, py, kernels::active_kernels());
+    // direct hits, and features without geometry, are left to the exact geometry
+    if (!(cp_info.distance > 0.0)) {
+        return false;
+    }
+    double const meters = utils::distance_in_meters(ctx.query_lnglat, utils::convert_vt_to_ll(ctx.extent, ctx.z, ctx.x, ctx.y, cp_info));
+    double const lower_bound = meters - ctx.simplify_slack;
+    return lower_bound > data.radius || lower_bound > results_queue.back().distance;
+}
+
+kernels::closest_point_info closest_point_polygon_grid(kernels::polygon_grid const& grid, double px, double py, bool direct_hit_only) {
+    if (grid.contains(px, py)) {
+        return kernels::closest_point_info{px, py, 0.0};
+    }
+    // no edge crosses the point's cell, so it cannot lie on the boundary either:
+    // report no geometry, the feature is skipped like any other miss
+    if (direct_hit_only && grid.locate(px, py) != kernels::polygon_grid::boundary) {
+        return kernels::closest_point_info{};
+    }
+    auto const& grid_geom = grid.geometry();
+    return kernels::closest_point_rings(grid_geom, 0, grid_geom.num_rings(), px, py, kernels::active_kernels());
+}
+
+/**
+  Closest point on a feature whose geometry type is already known, skipping the generic type switch.
+
+  `direct_hit_only` is set when only features containing the query point can
+  be kept, which lets polygons skip measuring distances they will never use.
+*/
+template <GeomType FeatureGeom>
+struct feature_closest_point;
+
+template <>
+struct feature_closest_point<GeomType::point> {
+    static mapbox::geometry::algorithms::closest_point_info compute(vtzero::feature const& f,
+                                                                    LayerContext const& ctx,
+                                                                    kernels::flat_geometry& /*unused*/,
+                                                                    bool /*unused*/) {
+        return mapbox::geometry::algorithms::closest_point(mapbox::vector_tile::detail::extract_geometry_point<std::int64_t>(f), ctx.query_point);
+    }
+};
+
+// linestrings and polygons are decoded into flat int32 arrays so the
+// vectorized ring kernels can scan them
+template <>
+struct feature_closest_point<GeomType::linestring> {
+    static kernels::closest_point_info compute(vtzero::feature const& f,
+                                               LayerContext const& ctx,
+                                               kernels::flat_geometry& geom,
+                                               bool /*unused*/) {
+        mapbox::vector_tile::extract_flat_line_string(f, geom);
+        return kernels::closest_point_line_string(geom, static_cast<double>(ctx.query_point.x), static_cast<double>(ctx.query_point.y));
+    }
+};
+
+template <>
+struct feature_closest_point<GeomType::polygon> {
+    static kernels::closest_point_info compute(vtzero::feature const& f,
+                                               LayerContext const& ctx,
+                                               kernels::flat_geometry& geom,
+                                               bool direct_hit_only) {
+        double const px = static_cast<double>(ctx.query_point.x);
+        double const py = static_cast<double>(ctx.query_point.y);
+        if (f.geometry().data().size() < polygon_grid_min_bytes) {
+            mapbox::vector_tile::extract_flat_polygon(f, geom);
+            return kernels::closest_point_polygon(geom, px, py);
+        }
+
+        // large polygons are looked up (or built once) in the grid cache instead of decoded
+        auto const grid = find_or_build_polygon_grid(ctx, [&f](kernels::flat_geometry& out) {
+            mapbox::vector_tile::extract_flat_polygon(f, out);
+        });
+        return closest_point_polygon_grid(*grid, px, py, direct_hit_only);
+    }
+};
+
+/// closest point on feature `i` of a columnar layer, the geometry is already decoded
+template <GeomType FeatureGeom>
+kernels::closest_point_info columnar_closest_point(columnar::layer const& layer,
+                                                   std::size_t i,
+                                                   LayerContext const& ctx,
+                                                   bool direct_hit_only) {
+    double const px = static_cast<double>(ctx.query_point.x);
+    double const py = static_cast<double>(ctx.query_point.y);
+    if (FeatureGeom != GeomType::polygon) {
+        // points are single vertex rings, which the ring scan measures directly
+        return kernels::closest_point_rings(layer.geometry, layer.first_ring(i), layer.last_ring(i), px, py, kernels::active_kernels());
+    }
+    if (layer.num_vertices(i) < polygon_grid_min_vertices) {
+        return kernels::closest_point_polygon(layer.geometry, layer.first_part(i), layer.last_part(i), px, py);
+    }
+    auto const grid = find_or_build_polygon_grid(ctx, [&layer, i](kernels::flat_geometry& out) {
+        layer.copy_geometry(i, out);
+    });
+    return closest_point_polygon_grid(*grid, px, py, direct_hit_only);
+}
+
+/// a vtzero feature as a result candidate
+struct VtzeroCandidate {
+    vtzero::feature& feature;
+
+    bool has_id() const { return feature.has_id(); }
+    uint64_t id() const { return feature.id(); }
+    std::vector<vtzero::property> properties() const { return get_properties_vector(feature); }
+};
+
+/// a feature of a columnar layer as a result candidate
+struct ColumnarCandidate {
+    columnar::layer const& layer;
+    std::size_t index;
+
+    bool has_id() const { return layer.has_ids[index] != 0; }
+    uint64_t id() const { return layer.ids[index]; }
+    std::vector<vtzero::property> properties() const { return layer.properties(index); }
+};
+
+/// keep a feature in the results if it is close enough and passes the filters
+template <GeomType FeatureGeom, typename Flags, typename ClosestPointInfo, typename Candidate>
+void add_candidate(Candidate const& candidate,
+                   ClosestPointInfo const& cp_info,
+                   LayerContext const& ctx,
+                   QueryOptions const& data,
+                   Flags const& flags,
+                   std::vector<ResultObject>& results_queue) {
+
+    // distance should never be less than zero, this is a safety check
+    if (cp_info.distance < 0.0) {
+        return;
+    }
+
+    double meters = 0.0;
+    auto ll = ctx.query_lnglat; // default to original query lng/lat
+
+    // if distance from the query point is greater than 0.0 (not a direct hit) so recalculate the latlng
+    if (cp_info.distance > 0.0) {
+        ll = utils::convert_vt_to_ll(ctx.extent, ctx.z, ctx.x, ctx.y, cp_info);
+        meters = utils::distance_in_meters(ctx.query_lnglat, ll);
+    }
+
+    // if distance from the query point is greater than the radius, don't add it
+    if (meters > data.radius) {
+        return;
+    }
+
+    // If direct_hit_polygon is enabled, disallow polygons that do not contain the point
+    if (FeatureGeom == GeomType::polygon && flags.direct_hit_polygon && meters > 0.0) {
+        return;
+    }
+
+    // If we have filters and the feature doesn't pass the filters, skip this feature
+    auto properties_vec = candidate.properties();
+    if (flags.filter_mode == filter_mode_all && !filter_feature_all(properties_vec, data.basic_filter.filters)) {
+        return;
+    }
+    if (flags.filter_mode == filter_mode_any && !filter_feature_any(properties_vec, data.basic_filter.filters)) {
+        return;
+    }
+
+    // check for duplicates
+    // if the candidate is a duplicate and smaller in distance, replace it
+    if (flags.dedupe) {
+        for (auto& result : results_queue) {
+            if (value_is_duplicate(result, candidate.has_id(), candidate.id(), ctx.layer_name, FeatureGeom, properties_vec)) {
+                // if we have a duplicate but it's lesser than what we already have, just skip and don't add below
+                if (meters <= result.distance) {
+                    insert_result(result, properties_vec, ctx.layer_name, ll, meters, FeatureGeom, candidate.has_id(), candidate.id());
+                    std::stable_sort(results_queue.begin(), results_queue.end(), CompareDistance());
+                }
+                return;
+            }
+        }
+    }
+
+    if (meters < results_queue.back().distance) {
+        insert_result(results_queue.back(), properties_vec, ctx.layer_name, ll, meters, FeatureGeom, candidate.has_id(), candidate.id());
+        std::stable_sort(results_queue.begin(), results_queue.end(), CompareDistance());
+    }
+}
+
+/// evaluate a single feature of a known geometry type against the query
+template <GeomType FeatureGeom, typename Flags>
+void process_feature(vtzero::feature& feature,
+                     LayerContext const& ctx,
+                     QueryOptions const& data,
+                     Flags const& flags,
+                     kernels::flat_geometry& geom,
+                     std::vector<ResultObject>& results_queue) {
+
+    if (simplified_out_of_reach<FeatureGeom>(ctx, data, results_queue)) {
+        return;
+    }
+
+    // only polygons containing the query point can be kept
+    bool const direct_hit_only = !(data.radius > 0.0) || flags.direct_hit_polygon;
+
+    // implement closest point algorithm on query geometry and the query point
+    auto const cp_info = feature_closest_point<FeatureGeom>::compute(feature, ctx, geom, direct_hit_only);
+    ctx.memory->hold_scratch(geom.memory_usage());
+    add_candidate<FeatureGeom>(VtzeroCandidate{feature}, cp_info, ctx, data, flags, results_queue);
+}
+
+/// evaluate feature `i` of a columnar layer, of a known geometry type, against the query
+template <GeomType FeatureGeom, typename Flags>
+void process_columnar_feature(columnar::layer const& layer,
+                              std::size_t i,
+                              LayerContext const& ctx,
+                              QueryOptions const& data,
+                              Flags const& flags,
+                              std::vector<ResultObject>& results_queue) {
+    if (simplified_out_of_reach<FeatureGeom>(ctx, data, results_queue)) {
+        return;
+    }
+    bool const direct_hit_only = !(data.radius > 0.0) || flags.direct_hit_polygon;
+    auto const cp_info = columnar_closest_point<FeatureGeom>(layer, i, ctx, direct_hit_only);
+    add_candidate<FeatureGeom>(ColumnarCandidate{layer, i}, cp_info, ctx, data, flags, results_queue);
+}
+
+/// check if this is a layer we should query
+bool wants_layer(QueryOptions const& data, std::string const& layer_name) {
+    return data.layers.empty() || data.layers.count(layer_name) > 0;
+}
+
+/// tile coordinates around the query point beyond which nothing is in range, see utils::create_query_box
+mapbox::geometry::box<std::int64_t> create_query_box(QueryOptions const& data, LayerContext const& ctx) {
+    mapbox::geometry::box<std::int64_t> box{{std::numeric_limits<std::int64_t>::min(), std::numeric_limits<std::int64_t>::min()},
+                                            {std::numeric_limits<std::int64_t>::max(), std::numeric_limits<std::int64_t>::max()}};
+    utils::create_query_box(ctx.query_lnglat.x, ctx.query_lnglat.y, data.radius, ctx.extent, ctx.z, ctx.x, ctx.y, box);
+    return box;
+}
+
+bool outside_query_box(std::int32_t min_x, std::int32_t min_y, std::int32_t max_x, std::int32_t max_y, mapbox::geometry::box<std::int64_t> const& box) {
+    return max_x < box.min.x || min_x > box.max.x || max_y < box.min.y || min_y > box.max.y;
+}
+
+/// check if features of this geometry type are kept by the query
+template <typename Flags>
+bool wants_geometry(Flags const& flags, vtzero::GeomType type) {
+    switch (type) {
+    case vtzero::GeomType::POINT:
+        return flags.geometry_filter_type == GeomType::all || flags.geometry_filter_type == GeomType::point;
+    case vtzero::GeomType::LINESTRING:
+        return flags.geometry_filter_type == GeomType::all || flags.geometry_filter_type == GeomType::linestring;
+    case vtzero::GeomType::POLYGON:
+        return flags.geometry_filter_type == GeomType::all || flags.geometry_filter_type == GeomType::polygon;
+    default:
+        return false;
+    }
+}
+
+/**
+  Whether a layer can hold any feature the query would keep, from what is
+  known about the whole layer: `geometry_types` has bit 1 << vtzero::GeomType
+  set for each type in the layer, and the box is around all of its features.
+*/
+template <typename Flags>
+bool layer_may_match(std::uint32_t geometry_types,
+                     std::int32_t min_x,
+                     std::int32_t min_y,
+                     std::int32_t max_x,
+                     std::int32_t max_y,
+                     Flags const& flags,
+                     mapbox::geometry::box<std::int64_t> const& box) {
+    bool wanted = false;
+    for (auto const type : {vtzero::GeomType::POINT, vtzero::GeomType::LINESTRING, vtzero::GeomType::POLYGON}) {
+        if ((geometry_types & (1U << static_cast<unsigned>(type))) != 0 && wants_geometry(flags, type)) {
+            wanted = true;
+        }
+    }
+    return wanted && !outside_query_box(min_x, min_y, max_x, max_y, box);
+}
+
+/**
+  Whether a layer with this key table holds any key of the filters. A feature
+  without the key of a filter passes it in an `all` filter, but not in an
+  `any` filter, so only `any` filters rule out layers lacking all of their keys.
+*/
+bool has_filter_key(QueryOptions const& data, std::vector<vtzero::data_view> const& keys) {
+    for (auto const& filter : data.basic_filter.filters) {
+        for (auto const& key : keys) {
+            if (key.size() == filter.key.size() && std::equal(key.data(), key.data() + key.size(), filter.key.data())) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+  The feature loop over an encoded tile.
+
+  With a sidecar index, layers and features that cannot be in range are
+  skipped using the precomputed bounding boxes, before their geometry is decoded.
+*/
+template <typename Flags>
+void query_vtzero_tile(QueryTile& tile_obj,
+                       QueryOptions const& data,
+                       Flags const& flags,
+                       LayerContext& ctx,
+                       kernels::flat_geometry& geom,
+                       ResultGroups& results) {
+    ctx.layer_index = 0;
+    for (auto layer = tile_obj.tile.next_layer(); layer; layer = tile_obj.tile.next_layer(), ++ctx.layer_index) {
+
+        // reuses the string of the previous layer rather than allocating one per layer
+        ctx.layer_name.assign(layer.name().data(), layer.name().size());
+        if (!wants_layer(data, ctx.layer_name) || layer.empty() ||
+            (flags.filter_mode == filter_mode_any && !has_filter_key(data, layer.key_table()))) {
+            continue;
+        }
+
+        ctx.extent = layer.extent();
+        // query point in relation to the current tile the layer extent
+        ctx.query_point = utils::create_query_point(ctx.query_lnglat.x, ctx.query_lnglat.y, ctx.extent, ctx.z, ctx.x, ctx.y);
+
+        tile_index::layer_entry const* entry = nullptr;
+        auto const box = create_query_box(data, ctx);
+        if (tile_obj.index && ctx.layer_index < tile_obj.index->layers().size()) {
+            entry = &tile_obj.index->layers()[ctx.layer_index];
+            if (!layer_may_match(entry->geometry_types, entry->min_x, entry->min_y, entry->max_x, entry->max_y, flags, box)) {
+                continue;
+            }
+        }
+        results.enter_layer(ctx.layer_name);
+        attach_simplified_layer(data.tolerance, ctx, [&layer](kernels::simplified_layer& out, double epsilon) {
+            fill_simplified_layer(layer, out, epsilon);
+        });
+
+        ctx.feature_index = 0;
+        for (auto feature = layer.next_feature(); feature; feature = layer.next_feature(), ++ctx.feature_index) {
+            ++ctx.features_scanned;
+            if (entry != nullptr && ctx.feature_index < entry->num_features) {
+                auto const indexed = entry->feature(ctx.feature_index);
+                if (outside_query_box(indexed.min_x, indexed.min_y, indexed.max_x, indexed.max_y, box)) {
+                    continue;
+                }
+            }
+            // check if this a geometry type we want to keep
+            switch (feature.geometry_type()) {
+            case vtzero::GeomType::POINT: {
+                if (flags.geometry_filter_type == GeomType::all || flags.geometry_filter_type == GeomType::point) {
+                    process_feature<GeomType::point>(feature, ctx, data, flags, geom, results.results(GeomType::point));
+                }
+                break;
+            }
+            case vtzero::GeomType::LINESTRING: {
+                if (flags.geometry_filter_type == GeomType::all || flags.geometry_filter_type == GeomType::linestring) {
+                    process_feature<GeomType::linestring>(feature, ctx, data, flags, geom, results.results(GeomType::linestring));
+                }
+                break;
+            }
+            case vtzero::GeomType::POLYGON: {
+                if (flags.geometry_filter_type == GeomType::all || flags.geometry_filter_type == GeomType::polygon) {
+                    process_feature<GeomType::polygon>(feature, ctx, data, flags, geom, results.results(GeomType::polygon));
+                }
+                break;
+            }
+            default: {
+                break;
+            }
+            }
+        } // end tile.layer.feature loop
+    }     // end tile.layer loop
+}
+
+/**
+  The same loop over a columnar tile.
+
+  Features are visited in the same order, but their bounding boxes are checked
+  against the query radius first so features that cannot be in range are
+  skipped without touching their geometry.
+*/
+template <typename Flags>
+void query_columnar_tile(QueryTile const& tile_obj,
+                         QueryOptions const& data,
+                         Flags const& flags,
+                         LayerContext& ctx,
+                         ResultGroups& results) {
+    ctx.layer_index = 0;
+    for (auto const& layer : tile_obj.columnar->layers()) {
+        ctx.layer_name = layer.name;
+        if (wants_layer(data, ctx.layer_name) && (flags.filter_mode != filter_mode_any || has_filter_key(data, layer.keys))) {
+            ctx.extent = layer.extent;
+            ctx.query_point = utils::create_query_point(ctx.query_lnglat.x, ctx.query_lnglat.y, ctx.extent, ctx.z, ctx.x, ctx.y);
+
+            auto const box = create_query_box(data, ctx);
+            if (!layer_may_match(layer.geometry_type_mask, layer.min_x, layer.min_y, layer.max_x, layer.max_y, flags, box)) {
+                ++ctx.layer_index;
+                continue;
+            }
+            results.enter_layer(ctx.layer_name);
+            attach_simplified_layer(data.tolerance, ctx, [&layer](kernels::simplified_layer& out, double epsilon) {
+                fill_simplified_layer(layer, out, epsilon);
+            });
+
+            std::size_t const num_features = layer.num_features();
+            ctx.features_scanned += num_features;
+            for (std::size_t i = 0; i < num_features; ++i) {
+                if (outside_query_box(layer.min_xs[i], layer.min_ys[i], layer.max_xs[i], layer.max_ys[i], box)) {
+                    continue;
+                }
+                ctx.feature_index = static_cast<std::uint32_t>(i);
+                switch (layer.geometry_type(i)) {
+                case vtzero::GeomType::POINT: {
+                    if (flags.geometry_filter_type == GeomType::all || flags.geometry_filter_type == GeomType::point) {
+                        process_columnar_feature<GeomType::point>(layer, i, ctx, data, flags, results.results(GeomType::point));
+                    }
+                    break;
+                }
+                case vtzero::GeomType::LINESTRING: {
+                    if (flags.geometry_filter_type == GeomType::all || flags.geometry_filter_type == GeomType::linestring) {
+                        process_columnar_feature<GeomType::linestring>(layer, i, ctx, data, flags, results.results(GeomType::linestring));
+                    }
+                    break;
+                }
+                case vtzero::GeomType::POLYGON: {
+                    if (flags.geometry_filter_type == GeomType::all || flags.geometry_filter_type == GeomType::polygon) {
+                        process_columnar_feature<GeomType::polygon>(layer, i, ctx, data, flags, results.results(GeomType::polygon));
+                    }
+                    break;
+                }
+                default: {
+                    break;
+                }
+                }
+            }
+        }
+        ++ctx.layer_index;
+    }
+}
+
+/// the feature loop over every tile and layer, specialized on the query flags, returns the number of features visited
+template <typename Flags>
+std::size_t run_query(std::vector<QueryTile>& tiles,
+                      QueryOptions const& data,
+                      Flags const& flags,
+                      mapbox::geometry::point<double> const& query_lnglat,
+                      QueryMemory& memory,
+                      ResultGroups& results) {
+    LayerContext ctx;
+    ctx.memory = &memory;
+    // decoded geometry storage, reused from feature to feature
+    kernels::flat_geometry geom;
+    // query point lng/lat geometry.hpp point (used for distance calculation later on)
+    ctx.query_lnglat = query_lnglat;
+
+    // for each tile
+    for (auto& tile_obj : tiles) {
+        ctx.tile = &tile_obj;
+        ctx.z = tile_obj.z;
+        ctx.x = tile_obj.x;
+        ctx.y = tile_obj.y;
+        if (tile_obj.columnar) {
+            query_columnar_tile(tile_obj, data, flags, ctx, results);
+        } else {
+            query_vtzero_tile(tile_obj, data, flags, ctx, geom, results);
+        }
+    } // end tile loop
+    return ctx.features_scanned;
+}
+
+/**
+  One pass over columnar tiles for many query points with the same options.
+
+  Each feature is visited once and measured against every query point whose
+  query box it overlaps, so the tiles' layers are scanned once per batch
+  instead of once per point. Every point keeps its own results. Returns the
+  number of features visited.
+*/
+template <typename Flags>
+std::size_t run_query_batch(std::vector<QueryTile> const& tiles,
+                            QueryOptions const& data,
+                            Flags const& flags,
+                            std::vector<mapbox::geometry::point<double>> const& query_lnglats,
+                            QueryMemory& memory,
+                            std::vector<ResultGroups>& results) {
+    std::size_t const num_points = query_lnglats.size();
+    std::vector<LayerContext> contexts(num_points);
+    std::vector<mapbox::geometry::box<std::int64_t>> boxes(num_points);
+    for (std::size_t p = 0; p < num_points; ++p) {
+        contexts[p].query_lnglat = query_lnglats[p];
+        contexts[p].memory = &memory;
+    }
+    std::size_t features_scanned = 0;
+
+    for (auto const& tile_obj : tiles) {
+        std::uint32_t layer_index = 0;
+        for (auto const& layer : tile_obj.columnar->layers()) {
+            if (wants_layer(data, layer.name) && (flags.filter_mode != filter_mode_any || has_filter_key(data, layer.keys))) {
+                bool may_match = false;
+                for (std::size_t p = 0; p < num_points; ++p) {
+                    LayerContext& ctx = contexts[p];
+                    ctx.extent = layer.extent;
+                    ctx.z = tile_obj.z;
+                    ctx.x = tile_obj.x;
+                    ctx.y = tile_obj.y;
+                    ctx.query_point = utils::create_query_point(ctx.query_lnglat.x, ctx.query_lnglat.y, ctx.extent, ctx.z, ctx.x, ctx.y);
+                    boxes[p] = create_query_box(data, ctx);
+                    may_match = may_match || layer_may_match(layer.geometry_type_mask, layer.min_x, layer.min_y, layer.max_x, layer.max_y, flags, boxes[p]);
+                }
+                if (!may_match) {
+                    ++layer_index;
+                    continue;
+                }
+                for (std::size_t p = 0; p < num_points; ++p) {
+                    LayerContext& ctx = contexts[p];
+                    ctx.tile = &tile_obj;
+                    ctx.layer_name = layer.name;
+                    ctx.layer_index = layer_index;
+                    results[p].enter_layer(layer.name);
+                    attach_simplified_layer(data.tolerance, ctx, [&layer](kernels::simplified_layer& out, double epsilon) {
+                        fill_simplified_layer(layer, out, epsilon);
+                    });
+                }
+
+                std::size_t const num_features = layer.num_features();
+                features_scanned += num_features;
+                for (std::size_t i = 0; i < num_features; ++i) {
+                    vtzero::GeomType const type = layer.geometry_type(i);
+                    if (!wants_geometry(flags, type)) {
+                        continue;
+                    }
+                    for (std::size_t p = 0; p < num_points; ++p) {
+                        if (outside_query_box(layer.min_xs[i], layer.min_ys[i], layer.max_xs[i], layer.max_ys[i], boxes[p])) {
+                            continue;
+                        }
+                        LayerContext& ctx = contexts[p];
+                        ctx.feature_index = static_cast<std::uint32_t>(i);
+                        switch (type) {
+                        case vtzero::GeomType::POINT:
+                            process_columnar_feature<GeomType::point>(layer, i, ctx, data, flags, results[p].results(GeomType::point));
+                            break;
+                        case vtzero::GeomType::LINESTRING:
+                            process_columnar_feature<GeomType::linestring>(layer, i, ctx, data, flags, results[p].results(GeomType::linestring));
+                            break;
+                        case vtzero::GeomType::POLYGON:
+                            process_columnar_feature<GeomType::polygon>(layer, i, ctx, data, flags, results[p].results(GeomType::polygon));
+                            break;
+                        default:
+                            break;
+                        }
+                    }
+                }
+            }
+            ++layer_index;
+        }
+    }
+    return features_scanned;
+}
+
+/**
+  Call `run` with the specialization of the query flags matching the query options.
+
+  The runtime options are peeled off one at a time, each level turning one of
+  them into a template argument, so this runs once per query rather than once
+  per feature.
+*/
+template <GeomType GeometryFilter, FilterMode Filter, bool Dedupe, typename Run>
+void dispatch_direct_hit(QueryOptions const& data, Run&& run) {
+    if (data.direct_hit_polygon) {
+        run(static_flags<GeometryFilter, Filter, Dedupe, true>{});
+    } else {
+        run(static_flags<GeometryFilter, Filter, Dedupe, false>{});
+    }
+}
+
+template <GeomType GeometryFilter, FilterMode Filter, typename Run>
+void dispatch_dedupe(QueryOptions const& data, Run&& run) {
+    if (data.dedupe) {
+        dispatch_direct_hit<GeometryFilter, Filter, true>(data, std::forward<Run>(run));
+    } else {
+        dispatch_direct_hit<GeometryFilter, Filter, false>(data, std::forward<Run>(run));
+    }
+}
+
+template <GeomType GeometryFilter, typename Run>
+void dispatch_filter(QueryOptions const& data, Run&& run) {
+    if (data.basic_filter.filters.empty()) {
+        dispatch_dedupe<GeometryFilter, filter_none>(data, std::forward<Run>(run));
+    } else if (data.basic_filter.type == filter_all) {
+        dispatch_dedupe<GeometryFilter, filter_mode_all>(data, std::forward<Run>(run));
+    } else {
+        dispatch_dedupe<GeometryFilter, filter_mode_any>(data, std::forward<Run>(run));
+    }
+}
+
+template <typename Run>
+void dispatch_query(QueryOptions const& data, Run&& run) {
+#ifdef VTQUERY_GENERIC_KERNEL
+    run(runtime_flags{data});
+#else
+    switch (data.geometry_filter_type) {
+    case GeomType::point:
+        dispatch_filter<GeomType::point>(data, std::forward<Run>(run));
+        break;
+    case GeomType::linestring:
+        dispatch_filter<GeomType::linestring>(data, std::forward<Run>(run));
+        break;
+    case GeomType::polygon:
+        dispatch_filter<GeomType::polygon>(data, std::forward<Run>(run));
+        break;
+    default:
+        dispatch_filter<GeomType::all>(data, std::forward<Run>(run));
+        break;
+    }
+#endif
+}
+
+/*
+  Results of earlier queries, reused by later queries from the same lng/lat
+  with the same options against the same tile bytes.
+
+  Only the exact query point is reused. A point a fraction of a pixel away can
+  have a feature outside the first point's radius or limit among its closest,
+  and the closest point on a line or polygon moves with it, so its results can
+  not be derived from another point's.
+*/
+constexpr std::size_t result_cache_default_bytes = 32 * 1024 * 1024;
+
+struct CachedResults {
+    std::vector<ResultObject> results;
+};
+
+using ResultCache = utils::lru_cache<std::string, CachedResults>;
+
+ResultCache& result_cache() {
+    static ResultCache cache{result_cache_default_bytes};
+    return cache;
+}
+
+} // namespace
+
+void append_options_key(std::string& key, QueryOptions const& data) {
+    using utils::append_key;
+    append_key(key, data.radius);
+    append_key(key, data.num_results);
+    append_key(key, data.dedupe);
+    append_key(key, data.direct_hit_polygon);
+    append_key(key, static_cast<std::int32_t>(data.geometry_filter_type));
+    append_key(key, data.group_by_layer);
+    append_key(key, data.group_by_geometry);
+    std::vector<std::string> layers(data.layers.begin(), data.layers.end());
+    std::sort(layers.begin(), layers.end());
+    append_key(key, layers.size());
+    for (auto const& layer : layers) {
+        append_key(key, layer);
+    }
+    append_key(key, static_cast<std::int32_t>(data.basic_filter.type));
+    append_key(key, data.basic_filter.filters.size());
+    for (auto const& filter : data.basic_filter.filters) {
+        append_key(key, filter.key);
+        append_key(key, static_cast<std::int32_t>(filter.type));
+        append_key(key, filter.value.which());
+        if (filter.value.which() == 4) {
+            append_key(key, boost::get<bool>(filter.value));
+        } else {
+            append_key(key, convert_to_double(filter.value));
+        }
+    }
+}
+
+namespace {
+
+using utils::append_key;
+
+/// key of a query in the result cache, tiles are hashed here unless hash_tiles() did it before
+std::string result_cache_key(std::vector<TileInput> const& tiles,
+                             mapbox::geometry::point<double> const& lnglat,
+                             QueryOptions const& options) {
+    std::string key;
+    append_options_key(key, options);
+    append_key(key, lnglat.x);
+    append_key(key, lnglat.y);
+    for (auto const& tile : tiles) {
+        append_key(key, tile.hashed ? tile.content_hash : utils::hash_bytes(tile.data.data(), tile.data.size()));
+        append_key(key, tile.data.size());
+        append_key(key, tile.z);
+        append_key(key, tile.x);
+        append_key(key, tile.y);
+    }
+    return key;
+}
+
+/// copy of a result without its property views, which point into tile data
+ResultObject copy_result(ResultObject const& result) {
+    ResultObject copy;
+    copy.properties_vector_materialized = result.properties_vector_materialized;
+    copy.layer_name = result.layer_name;
+    copy.coordinates = result.coordinates;
+    copy.distance = result.distance;
+    copy.original_geometry_type = result.original_geometry_type;
+    copy.has_id = result.has_id;
+    copy.id = result.id;
+    return copy;
+}
+
+std::size_t result_memory_usage(ResultObject const& result) {
+    std::size_t bytes = sizeof(ResultObject) + result.layer_name.capacity();
+    for (auto const& prop : result.properties_vector_materialized) {
+        bytes += sizeof(materialized_prop_type) + prop.first.capacity();
+        if (prop.second.is<std::string>()) {
+            bytes += prop.second.get<std::string>().capacity();
+        }
+    }
+    return bytes;
+}
+
+void cache_results(std::string const& key, std::vector<ResultObject> const& results) {
+    auto cached = std::make_shared<CachedResults>();
+    std::size_t bytes = sizeof(CachedResults) + key.capacity();
+    for (auto const& result : results) {
+        if (result.distance < std::numeric_limits<double>::max()) {
+            cached->results.push_back(copy_result(result));
+            bytes += result_memory_usage(result);
+        }
+    }
+    result_cache().put(key, std::move(cached), bytes);
+}
+
+/// a copy of cached results, already in the order query() returned them
+std::vector<ResultObject> results_from_cache(CachedResults const& cached) {
+    std::vector<ResultObject> results;
+    results.reserve(cached.results.size());
+    for (auto const& result : cached.results) {
+        results.push_back(copy_result(result));
+    }
+    return results;
+}
+
+/// ends a zlib inflate stream however inflate_tile() leaves
+struct InflateStream {
+    z_stream stream{};
+
+    InflateStream() {
+        // 32 + 15: gzip or zlib headers, detected from the data
+        if (inflateInit2(&stream, 32 + 15) != Z_OK) {
+            throw std::runtime_error("could not start decompressing a tile");
+        }
+    }
+
+    ~InflateStream() {
+        inflateEnd(&stream);
+    }
+
+    // non-copyable
+    InflateStream(InflateStream const&) = delete;
+    InflateStream& operator=(InflateStream const&) = delete;
+
+    // non-movable
+    InflateStream(InflateStream&&) = delete;
+    InflateStream& operator=(InflateStream&&) = delete;
+};
+
+/// the most a tile may inflate to without `max_memory`, as gzip-hpp allowed
+constexpr std::size_t max_inflated_tile = 1000000000;
+
+/**
+  Decompress a tile into `out`, within what is left of the query's memory.
+  Each block of output is charged before it is allocated, so a tile that
+  inflates past `max_memory` fails without taking the bytes.
+*/
+void inflate_tile(vtzero::data_view data, std::string& out, QueryMemory& memory) {
+    if (data.size() > std::numeric_limits<uInt>::max()) {
+        throw std::runtime_error("compressed tile is too large to decompress");
+    }
+    InflateStream inflater;
+    z_stream& stream = inflater.stream;
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+
+    out.clear();
+    std::size_t charged = 0;
+    std::size_t size = 0;
+    int ret = Z_OK;
+    while (ret != Z_STREAM_END) {
+        if (size == charged) {
+            // grow by at least twice the compressed size, then by doubling
+            std::size_t block = std::min<std::size_t>(std::max(data.size() * 2 + 1024, charged), std::numeric_limits<uInt>::max());
+            if (memory.limited()) {
+                if (memory.remaining() == 0) {
+                    memory.exceeded();
+                }
+                block = std::min(block, memory.remaining());
+            } else if (charged >= max_inflated_tile) {
+                throw std::runtime_error("tile inflates to more than " + std::to_string(max_inflated_tile) + " bytes");
+            }
+            memory.add(block);
+            charged += block;
+            out.resize(charged);
+        }
+        stream.next_out = reinterpret_cast<Bytef*>(&out[size]);
+        stream.avail_out = static_cast<uInt>(charged - size);
+        ret = inflate(&stream, Z_NO_FLUSH);
+        size = charged - stream.avail_out;
+        if (ret == Z_BUF_ERROR && stream.avail_in == 0) {
+            throw std::runtime_error("compressed tile is truncated");
+        }
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            throw std::runtime_error(stream.msg != nullptr ? stream.msg : "could not decompress a tile");
+        }
+    }
+    out.resize(size);
+    metrics::record(metrics::bytes_inflated, out.size());
+}
+
+/**
+  Decompress the tiles of a query and attach their sidecar indexes, ready to be
+  queried. `buffers` holds the decompressed bytes the tiles point into.
+*/
+void prepare_tiles(std::vector<TileInput> const& tile_objs,
+                   bool columnar,
+                   QueryMemory& memory,
+                   std::vector<std::string>& buffers,
+                   std::vector<QueryTile>& tiles) {
+    std::string uncompressed;
+    // reserved up front so the views into `buffers` stay valid
+    buffers.reserve(tile_objs.size());
+    tiles.reserve(tile_objs.size());
+    for (auto const& tile_obj : tile_objs) {
+        if (gzip::is_compressed(tile_obj.data.data(), tile_obj.data.size())) {
+            inflate_tile(tile_obj.data, uncompressed, memory);
+            buffers.emplace_back(std::move(uncompressed));
+            tiles.emplace_back(vtzero::data_view{buffers.back()}, tile_obj.data, tile_obj.z, tile_obj.x, tile_obj.y);
+        } else {
+            tiles.emplace_back(tile_obj.data, tile_obj.data, tile_obj.z, tile_obj.x, tile_obj.y);
+        }
+        if (tile_obj.hashed) {
+            tiles.back().set_content_hash(tile_obj.content_hash);
+        }
+        if (!tile_obj.index_path.empty()) {
+            tiles.back().index_file = find_or_map_index_file(tile_obj.index_path);
+            attach_index(tiles.back(), tiles.back().index_file->data());
+        } else if (tile_obj.index_data.size() > 0) {
+            attach_index(tiles.back(), tile_obj.index_data);
+        }
+        if (columnar) {
+            tiles.back().columnar = find_or_build_columnar_tile(tiles.back(), memory);
+        }
+    }
+}
+
+/**
+  Here we create "materialized" properties and drop the unused result slots. We do this before the
+  query returns because, when reading from a compressed buffer, it is unsafe to touch
+  `feature.properties_vector` afterwards. That is because the buffer may represent uncompressed data
+  that is not in scope outside of the query.
+*/
+void materialize_properties(std::vector<ResultObject>& results_queue) {
+    results_queue.erase(std::remove_if(results_queue.begin(), results_queue.end(), [](ResultObject const& result) {
+                            return !(result.distance < std::numeric_limits<double>::max());
+                        }),
+                        results_queue.end());
+    for (auto& feature : results_queue) {
+        feature.properties_vector_materialized.reserve(feature.properties_vector.size());
+        for (auto const& property : feature.properties_vector) {
+            auto val = vtzero::convert_property_value<mapbox::feature::value, mapbox::vector_tile::detail::property_value_mapping>(property.value());
+            feature.properties_vector_materialized.emplace_back(std::string(property.key()), std::move(val));
+        }
+        feature.properties_vector.clear();
+    }
+}
+
+/// charge the results a query returns
+void hold_results(std::vector<ResultObject> const& results, QueryMemory& memory) {
+    std::size_t bytes = 0;
+    for (auto const& result : results) {
+        bytes += result_memory_usage(result);
+    }
+    memory.add(bytes);
+}
+
+/// a materialized copy of the results found so far, for progress callbacks
+std::vector<ResultObject> snapshot_results(ResultGroups const& results) {
+    std::vector<ResultObject> snapshot;
+    for (auto const& set : results.sets()) {
+        for (auto const& result : set) {
+            if (result.distance < std::numeric_limits<double>::max()) {
+                snapshot.push_back(copy_result(result));
+                snapshot.back().properties_vector = result.properties_vector;
+            }
+        }
+    }
+    std::stable_sort(snapshot.begin(), snapshot.end(), CompareDistance());
+    materialize_properties(snapshot);
+    return snapshot;
+}
+
+/// how far lng/lat is from a tile as a fraction of the world's width, 0 for the tile containing it
+double tile_distance(TileInput const& tile, mapbox::geometry::point<double> const& lnglat) {
+    constexpr std::uint32_t extent = 4096;
+    auto const p = utils::create_query_point(lnglat.x, lnglat.y, extent, tile.z, tile.x, tile.y);
+    std::int64_t const dx = p.x < 0 ? -p.x : std::max<std::int64_t>(0, p.x - (extent - 1));
+    std::int64_t const dy = p.y < 0 ? -p.y : std::max<std::int64_t>(0, p.y - (extent - 1));
+    double const world = static_cast<double>(extent) * static_cast<double>(static_cast<std::int64_t>(1) << tile.z);
+    return std::hypot(static_cast<double>(dx), static_cast<double>(dy)) / world;
+}
+
+/// add the results of a query to the result cache
+void cache_query_results(std::vector<TileInput> const& tiles,
+                         mapbox::geometry::point<double> const& lnglat,
+                         QueryOptions const& options,
+                         std::vector<ResultObject> const& results) {
+    cache_results(result_cache_key(tiles, lnglat, options), results);
+}
+
+} // namespace
+
+std::vector<ResultObject> query(std::vector<TileInput> const& tiles,
+                                mapbox::geometry::point<double> const& lnglat,
+                                QueryOptions const& options) {
+    QueryMemory memory{options.max_memory};
+    std::vector<std::string> buffers;
+    std::vector<QueryTile> query_tiles;
+    auto phase = std::chrono::steady_clock::now();
+    prepare_tiles(tiles, options.columnar, memory, buffers, query_tiles);
+    metrics::record(metrics::prepare_ns, metrics::elapsed_ns(phase));
+
+    // reserve the query results and fill with empty objects
+    phase = std::chrono::steady_clock::now();
+    ResultGroups results{options};
+    std::size_t features_scanned = 0;
+    dispatch_query(options, [&](auto const& flags) {
+        features_scanned = run_query(query_tiles, options, flags, lnglat, memory, results);
+    });
+    metrics::record(metrics::features_scanned, features_scanned);
+    metrics::record(metrics::scan_ns, metrics::elapsed_ns(phase));
+
+    phase = std::chrono::steady_clock::now();
+    std::vector<ResultObject> results_queue = results.merge();
+    materialize_properties(results_queue);
+    hold_results(results_queue, memory);
+    metrics::record(metrics::materialize_ns, metrics::elapsed_ns(phase));
+
+    if (options.cache) {
+        cache_query_results(tiles, lnglat, options, results_queue);
+    }
+    return results_queue;
+}
+
+std::vector<ResultObject> query(std::vector<TileInput> const& tiles,
+                                mapbox::geometry::point<double> const& lnglat,
+                                QueryOptions const& options,
+                                QueryProgress const& progress) {
+    std::vector<TileInput> ordered(tiles);
+    std::stable_sort(ordered.begin(), ordered.end(), [&lnglat](TileInput const& a, TileInput const& b) {
+        return tile_distance(a, lnglat) < tile_distance(b, lnglat);
+    });
+
+    // each tile is decompressed just before it is queried, so the first snapshot
+    // does not wait for the others, and kept until the results are materialized
+    QueryMemory memory{options.max_memory};
+    std::vector<std::vector<std::string>> buffers(ordered.size());
+    std::vector<std::vector<QueryTile>> query_tiles(ordered.size());
+    ResultGroups results{options};
+    std::size_t features_scanned = 0;
+    std::size_t queried = 0;
+    // time spent on progress snapshots counts towards neither phase
+    std::uint64_t prepare_ns = 0;
+    std::uint64_t scan_ns = 0;
+    while (queried < ordered.size()) {
+        auto phase = std::chrono::steady_clock::now();
+        prepare_tiles({ordered[queried]}, options.columnar, memory, buffers[queried], query_tiles[queried]);
+        prepare_ns += metrics::elapsed_ns(phase);
+        phase = std::chrono::steady_clock::now();
+        dispatch_query(options, [&](auto const& flags) {
+            features_scanned += run_query(query_tiles[queried], options, flags, lnglat, memory, results);
+        });
+        scan_ns += metrics::elapsed_ns(phase);
+        ++queried;
+        if (queried < ordered.size() && !progress(snapshot_results(results), queried)) {
+            break;
+        }
+    }
+    metrics::record(metrics::features_scanned, features_scanned);
+    metrics::record(metrics::prepare_ns, prepare_ns);
+    metrics::record(metrics::scan_ns, scan_ns);
+
+    auto const phase = std::chrono::steady_clock::now();
+    std::vector<ResultObject> results_queue = results.merge();
+    materialize_properties(results_queue);
+    hold_results(results_queue, memory);
+    metrics::record(metrics::materialize_ns, metrics::elapsed_ns(phase));
+
+    // results of a stopped query are missing the tiles it did not get to
+    if (options.cache && queried == ordered.size()) {
+        cache_query_results(tiles, lnglat, options, results_queue);
+    }
+    return results_queue;
+}
+
+std::vector<PointResults> query_batch(std::vector<TileInput> const& tiles,
+                                      std::vector<mapbox::geometry::point<double>> const& points,
+                                      QueryOptions const& options) {
+    // the tiles and what is built from them are held once for all points,
+    // the results of each point go to a budget of its own on top of that,
+    // so no point is charged for, or fails with, the results of the others
+    QueryMemory memory{options.max_memory};
+    std::vector<std::string> buffers;
+    std::vector<QueryTile> query_tiles;
+    auto phase = std::chrono::steady_clock::now();
+    prepare_tiles(tiles, true, memory, buffers, query_tiles);
+    metrics::record(metrics::prepare_ns, metrics::elapsed_ns(phase));
+
+    phase = std::chrono::steady_clock::now();
+    std::vector<ResultGroups> results;
+    results.reserve(points.size());
+    for (std::size_t p = 0; p < points.size(); ++p) {
+        results.emplace_back(options);
+    }
+    std::size_t features_scanned = 0;
+    dispatch_query(options, [&](auto const& flags) {
+        features_scanned = run_query_batch(query_tiles, options, flags, points, memory, results);
+    });
+    metrics::record(metrics::features_scanned, features_scanned);
+    metrics::record(metrics::scan_ns, metrics::elapsed_ns(phase));
+
+    phase = std::chrono::steady_clock::now();
+    std::vector<PointResults> point_results(points.size());
+    std::deque<QueryMemory> point_memory;
+    for (std::size_t p = 0; p < points.size(); ++p) {
+        std::vector<ResultObject>& results_queue = point_results[p].results;
+        results_queue = results[p].merge();
+        materialize_properties(results_queue);
+        point_memory.emplace_back(options.max_memory, memory);
+        try {
+            hold_results(results_queue, point_memory.back());
+        } catch (std::runtime_error const& e) {
+            point_results[p].error = e.what();
+            results_queue.clear();
+            results_queue.shrink_to_fit();
+        }
+    }
+    metrics::record(metrics::materialize_ns, metrics::elapsed_ns(phase));
+    return point_results;
+}
+
+void hash_tiles(std::vector<TileInput>& tiles) {
+    for (auto& tile : tiles) {
+        if (!tile.hashed) {
+            tile.content_hash = utils::hash_bytes(tile.data.data(), tile.data.size());
+            tile.hashed = true;
+        }
+    }
+}
+
+bool find_cached_results(std::vector<TileInput> const& tiles,
+                         mapbox::geometry::point<double> const& lnglat,
+                         QueryOptions const& options,
+                         std::vector<ResultObject>& results) {
+    auto cached = result_cache().get(result_cache_key(tiles, lnglat, options));
+    if (!cached) {
+        return false;
+    }
+    results = results_from_cache(*cached);
+    return true;
+}
+
+void set_result_cache_capacity(std::size_t bytes) {
+    result_cache().set_capacity(bytes);
+}
+
+MemoryStats memory_stats() {
+    MemoryStats stats;
+    stats.current = memory_current().load();
+    stats.peak = memory_peak().load();
+    stats.exceeded = memory_exceeded().load();
+    return stats;
+}
+
+std::string build_index(vtzero::data_view tile) {
+    std::string decoded;
+    if (gzip::is_compressed(tile.data(), tile.size())) {
+        gzip::Decompressor decompressor;
+        decompressor.decompress(decoded, tile.data(), tile.size());
+    } else {
+        decoded.assign(tile.data(), tile.size());
+    }
+    columnar::tile const columnar_tile{std::move(decoded)};
+    return tile_index::build(tile, utils::hash_bytes(tile.data(), tile.size()), columnar_tile);
+}
+
+} // namespace VectorTileQuery
@@ -0,0 +1,246 @@
+#pragma once
+#include <array>
+#include <boost/variant.hpp>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mapbox/feature.hpp>
+#include <mapbox/geometry/point.hpp>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <vtzero/types.hpp>
+#include <vtzero/vector_tile.hpp>
+
+/*
+  The query engine, independent of Node.
+
+  Takes tiles as byte ranges and options as a struct and returns result
+  structs, so it can be linked into other C++ programs as the `vtquery_core`
+  library. The Node module in vtquery.cpp converts JavaScript arguments into
+  these types and the results back into GeoJSON.
+*/
+namespace VectorTileQuery {
+
+enum GeomType { point,
+                linestring,
+                polygon,
+                all,
+                unknown };
+static std::array<std::string, 4> const GeomTypeStrings = {"point", "linestring", "polygon", "unknown"};
+inline char const* getGeomTypeString(std::size_t index) {
+    return GeomTypeStrings[index].c_str();
+}
+
+using materialized_prop_type = std::pair<std::string, mapbox::feature::value>;
+
+/**
+  Main storage item for returning to the user.
+
+  `properties_vector` points into the tile data and is only used while a query
+  runs, results returned by query() carry `properties_vector_materialized`.
+*/
+struct ResultObject {
+    std::vector<vtzero::property> properties_vector;
+    std::vector<materialized_prop_type> properties_vector_materialized;
+    std::string layer_name;
+    mapbox::geometry::point<double> coordinates;
+    double distance;
+    GeomType original_geometry_type{GeomType::unknown};
+    bool has_id{false};
+    uint64_t id{0};
+
+    ResultObject() : coordinates(0.0, 0.0),
+                     distance(std::numeric_limits<double>::max()) {}
+
+    ResultObject(ResultObject&&) = default;
+    ResultObject& operator=(ResultObject&&) = default;
+    ResultObject(ResultObject const&) = delete;
+    ResultObject& operator=(ResultObject const&) = delete;
+    ~ResultObject() = default;
+};
+
+using value_type = boost::variant<float, double, int64_t, uint64_t, bool, std::string>;
+using map_type = std::unordered_map<std::string, value_type>;
+
+enum BasicFilterType {
+    ne,
+    eq,
+    lt,
+    lte,
+    gt,
+    gte
+};
+
+struct basic_filter_struct {
+    explicit basic_filter_struct()
+        : key(""),
+          value(false) {}
+
+    std::string key;
+    BasicFilterType type{eq};
+    value_type value;
+};
+
+enum BasicMetaFilterType {
+    filter_all,
+    filter_any
+};
+
+struct meta_filter_struct {
+    explicit meta_filter_struct() = default;
+
+    BasicMetaFilterType type{filter_all};
+    std::vector<basic_filter_struct> filters;
+};
+
+/// the options of a query, shared by every query point of a batch
+struct QueryOptions {
+    QueryOptions()
+        : radius(0.0),
+          num_results(5),
+          dedupe(true),
+          direct_hit_polygon(false),
+          columnar(false),
+          cache(false),
+          tolerance(0.0),
+          max_memory(0),
+          geometry_filter_type(GeomType::all),
+          group_by_layer(false),
+          group_by_geometry(false) {}
+
+    std::unordered_set<std::string> layers;
+    double radius;
+    std::uint32_t num_results;
+    bool dedupe;
+    bool direct_hit_polygon;
+    bool columnar;
+    bool cache;
+    /// meters of simplification used to rule features out before measuring
+    /// them exactly, results do not change
+    double tolerance;
+    /// bytes a query may hold before it fails, 0 for no limit, see QueryMemory in query.cpp.
+    /// Inflated tiles are checked before they are allocated, everything else once it is built
+    std::size_t max_memory;
+    GeomType geometry_filter_type;
+    /// keep `num_results` per layer and/or per geometry type, instead of for the whole query
+    bool group_by_layer;
+    bool group_by_geometry;
+    meta_filter_struct basic_filter;
+};
+
+/**
+  One tile of a query. `data` may be gzip compressed, the bytes it points to
+  (and `index_data`) must stay valid until the query returns.
+
+  A sidecar index from build_index() can be given as bytes or as the path of a
+  file to map. `content_hash` can be set with hash_tiles() ahead of the query,
+  otherwise it is computed when something needs it.
+*/
+struct TileInput {
+    TileInput() = default;
+
+    TileInput(vtzero::data_view data0, std::int32_t z0, std::int32_t x0, std::int32_t y0)
+        : data{data0},
+          z{z0},
+          x{x0},
+          y{y0} {}
+
+    vtzero::data_view data;
+    std::int32_t z{0};
+    std::int32_t x{0};
+    std::int32_t y{0};
+    vtzero::data_view index_data;
+    std::string index_path;
+    std::uint64_t content_hash{0};
+    bool hashed{false};
+};
+
+/**
+  The closest features to `lnglat` in `tiles`, sorted by distance, at most
+  `options.num_results` of them, or of each group with `group_by_layer` or
+  `group_by_geometry`.
+
+  Throws a std::exception (vtzero, gzip or std::runtime_error) if a tile or
+  sidecar index can not be read. With `options.cache`, the results are added
+  to the result cache.
+*/
+std::vector<ResultObject> query(std::vector<TileInput> const& tiles,
+                                mapbox::geometry::point<double> const& lnglat,
+                                QueryOptions const& options);
+
+/**
+  Called by the progress form of query() after each tile but the last, with a
+  copy of the results so far (in the form query() returns them) and the number
+  of tiles queried. Returning false stops the query.
+*/
+using QueryProgress = std::function<bool(std::vector<ResultObject>, std::size_t)>;
+
+/**
+  query(), reporting the results found so far after each tile. The tiles are
+  queried in order of their distance from `lnglat`, the tile containing it
+  first. A query stopped by `progress` returns the results of the tiles it
+  queried, and is not added to the result cache.
+*/
+std::vector<ResultObject> query(std::vector<TileInput> const& tiles,
+                                mapbox::geometry::point<double> const& lnglat,
+                                QueryOptions const& options,
+                                QueryProgress const& progress);
+
+/// the results of one point of query_batch(), or the message it failed with
+struct PointResults {
+    std::vector<ResultObject> results;
+    /// empty unless the point's own results went over `options.max_memory`, `results` is empty then
+    std::string error;
+};
+
+/**
+  The same query from many points, scanning the features of each layer once
+  for all of them. Tiles are always queried in their columnar form, sidecar
+  indexes are checked but not used and `options.cache` is ignored. Each point
+  has `options.max_memory` for the tiles they share plus its own results, and
+  a point going over it fails alone. Returns the results of each point in the
+  order of `points`, throws as query() does when the tiles can not be read or
+  do not fit in `options.max_memory`.
+*/
+std::vector<PointResults> query_batch(std::vector<TileInput> const& tiles,
+                                      std::vector<mapbox::geometry::point<double>> const& points,
+                                      QueryOptions const& options);
+
+/// set the content hash of every tile that does not have one yet
+void hash_tiles(std::vector<TileInput>& tiles);
+
+/**
+  Look up a query in the result cache. Returns false when it has to be run,
+  otherwise fills `results` as query() would. Hash the tiles with hash_tiles()
+  first when the query may be run afterwards, so it does not hash them again.
+*/
+bool find_cached_results(std::vector<TileInput> const& tiles,
+                         mapbox::geometry::point<double> const& lnglat,
+                         QueryOptions const& options,
+                         std::vector<ResultObject>& results);
+
+/// resize the result cache, 0 empties and disables it
+void set_result_cache_capacity(std::size_t bytes);
+
+/// the memory held by running queries across the process, see QueryOptions::max_memory
+struct MemoryStats {
+    /// bytes held right now
+    std::size_t current{0};
+    /// the most bytes ever held at once
+    std::size_t peak{0};
+    /// queries that failed for going over their max_memory
+    std::size_t exceeded{0};
+};
+
+MemoryStats memory_stats();
+
+/// the sidecar index of a tile, gzip compressed or not, see tile_index.hpp
+std::string build_index(vtzero::data_view tile);
+
+/// append the options that change results to `key`, in a fixed order
+void append_options_key(std::string& key, QueryOptions const& options);
+
+} // namespace VectorTileQuery
@@ -0,0 +1,115 @@
+#pragma once
+#include "geometry_kernels.hpp"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace kernels {
+
+/// buffers reused from ring to ring while simplifying
+struct simplify_scratch {
+    std::vector<std::uint8_t> keep;
+    std::vector<std::pair<std::size_t, std::size_t>> spans;
+};
+
+/*
+  Douglas-Peucker simplification of one ring (or line) of `in`, appended to `out`
+  as a ring of its own.
+
+  Every vertex of the original is within `epsilon` of the simplified segment
+  that replaced it, and so is every point between two such vertices. The
+  distance from any point to the original is therefore at least its distance
+  to the simplified ring minus `epsilon`, the lower bound queries use to rule
+  features out. Rings keep their first and last vertex and are never dropped,
+  so a point further than `epsilon` from a simplified ring has the same
+  winding number around it as around the original.
+*/
+inline void simplify_ring(flat_geometry const& in, std::size_t ring, double epsilon, simplify_scratch& scratch, flat_geometry& out) {
+    std::size_t const begin = in.ring_begin(ring);
+    std::size_t const size = in.ring_size(ring);
+    if (size <= 2) {
+        for (std::size_t i = begin; i < begin + size; ++i) {
+            out.add_point(in.xs[i], in.ys[i]);
+        }
+        out.end_ring();
+        return;
+    }
+
+    scratch.keep.assign(size, 0);
+    scratch.keep.front() = 1;
+    scratch.keep.back() = 1;
+    scratch.spans.clear();
+    scratch.spans.emplace_back(0, size - 1);
+    double const epsilon_squared = epsilon * epsilon;
+    while (!scratch.spans.empty()) {
+        auto const span = scratch.spans.back();
+        scratch.spans.pop_back();
+        double const ax = in.xs[begin + span.first];
+        double const ay = in.ys[begin + span.first];
+        double const bx = in.xs[begin + span.second];
+        double const by = in.ys[begin + span.second];
+        double farthest = -1.0;
+        std::size_t index = 0;
+        for (std::size_t i = span.first + 1; i < span.second; ++i) {
+            double const d = segment_distance_squared(ax, ay, bx, by, in.xs[begin + i], in.ys[begin + i]);
+            if (d > farthest) {
+                farthest = d;
+                index = i;
+            }
+        }
+        if (farthest > epsilon_squared) {
+            scratch.keep[index] = 1;
+            scratch.spans.emplace_back(span.first, index);
+            scratch.spans.emplace_back(index, span.second);
+        }
+    }
+
+    for (std::size_t i = 0; i < size; ++i) {
+        if (scratch.keep[i] != 0) {
+            out.add_point(in.xs[begin + i], in.ys[begin + i]);
+        }
+    }
+    out.end_ring();
+}
+
+/*
+  The linestrings and polygons of one layer simplified with one epsilon, laid
+  out like columnar::layer: feature `i` owns parts [part_offsets[i],
+  part_offsets[i + 1]) of `geometry`. Points and features without geometry own
+  no parts.
+*/
+struct simplified_layer {
+    flat_geometry geometry;
+    std::vector<std::uint32_t> part_offsets{0};
+
+    std::size_t num_features() const { return part_offsets.size() - 1; }
+
+    std::size_t first_part(std::size_t i) const { return part_offsets[i]; }
+
+    std::size_t last_part(std::size_t i) const { return part_offsets[i + 1]; }
+
+    std::size_t first_ring(std::size_t i) const {
+        return first_part(i) < last_part(i) ? geometry.part_starts[first_part(i)] : 0;
+    }
+
+    std::size_t last_ring(std::size_t i) const {
+        return first_part(i) < last_part(i) ? geometry.part_end(last_part(i) - 1) : 0;
+    }
+
+    /// append the next feature of the layer, pass an empty geometry for points
+    void add_feature(flat_geometry const& feature, double epsilon, simplify_scratch& scratch) {
+        for (std::size_t part = 0; part < feature.num_parts(); ++part) {
+            geometry.part_starts.push_back(static_cast<std::uint32_t>(geometry.num_rings()));
+            for (std::size_t ring = feature.part_starts[part]; ring < feature.part_end(part); ++ring) {
+                simplify_ring(feature, ring, epsilon, scratch, geometry);
+            }
+        }
+        part_offsets.push_back(static_cast<std::uint32_t>(geometry.num_parts()));
+    }
+
+    std::size_t memory_usage() const {
+        return sizeof(simplified_layer) + geometry.memory_usage() + part_offsets.capacity() * sizeof(std::uint32_t);
+    }
+};
+
+} // namespace kernels
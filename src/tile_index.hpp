@@ -0,0 +1,218 @@
+#pragma once
+#include "columnar_tile.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <vtzero/types.hpp>
+
+namespace tile_index {
+
+/*
+  A precomputed sidecar index for one tile: its layer directory and the
+  bounding box and geometry type of every feature, so a query can skip layers
+  and features without decoding them. Layers and features are identified by
+  their position in the tile, which is why an index is only valid for the
+  exact bytes it was built from.
+
+  All integers are little-endian.
+
+      header      "VTQI", u32 version, u64 tile size, u64 tile hash, u32 layer count, u32 reserved
+      per layer   u32 extent, u32 feature count, u32 geometry type mask,
+                  i32 min x, i32 min y, i32 max x, i32 max y,
+                  u64 offset of the feature table, u32 name length, name bytes
+      per feature i32 min x, i32 min y, i32 max x, i32 max y, u8 geometry type, 3 bytes padding
+
+  The geometry type mask has bit `1 << type` set for each vtzero::GeomType
+  found in the layer. Features without geometry have min > max.
+*/
+constexpr char magic[4] = {'V', 'T', 'Q', 'I'};
+constexpr std::uint32_t version = 1;
+constexpr std::size_t header_size = 32;
+constexpr std::size_t layer_entry_size = 40;
+constexpr std::size_t feature_entry_size = 20;
+
+namespace detail {
+
+inline void put_u32(std::string& out, std::uint32_t v) {
+    for (unsigned i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((v >> (8 * i)) & 0xffU));
+    }
+}
+
+inline void put_u64(std::string& out, std::uint64_t v) {
+    for (unsigned i = 0; i < 8; ++i) {
+        out.push_back(static_cast<char>((v >> (8 * i)) & 0xffU));
+    }
+}
+
+inline void put_i32(std::string& out, std::int32_t v) {
+    put_u32(out, static_cast<std::uint32_t>(v));
+}
+
+inline std::uint32_t get_u32(char const* p) {
+    std::uint32_t v = 0;
+    for (unsigned i = 0; i < 4; ++i) {
+        v |= static_cast<std::uint32_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+    }
+    return v;
+}
+
+inline std::uint64_t get_u64(char const* p) {
+    std::uint64_t v = 0;
+    for (unsigned i = 0; i < 8; ++i) {
+        v |= static_cast<std::uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+    }
+    return v;
+}
+
+inline std::int32_t get_i32(char const* p) {
+    return static_cast<std::int32_t>(get_u32(p));
+}
+
+} // namespace detail
+
+/// the bounding box and geometry type of one feature
+struct feature_entry {
+    std::int32_t min_x;
+    std::int32_t min_y;
+    std::int32_t max_x;
+    std::int32_t max_y;
+    vtzero::GeomType geometry_type;
+};
+
+/// one layer of the directory, `features` points into the index bytes
+struct layer_entry {
+    vtzero::data_view name;
+    std::uint32_t extent;
+    std::uint32_t num_features;
+    std::uint32_t geometry_types;
+    std::int32_t min_x;
+    std::int32_t min_y;
+    std::int32_t max_x;
+    std::int32_t max_y;
+    char const* features;
+
+    bool has_geometry_type(vtzero::GeomType type) const {
+        return (geometry_types & (1U << static_cast<unsigned>(type))) != 0;
+    }
+
+    feature_entry feature(std::size_t i) const {
+        char const* p = features + i * feature_entry_size;
+        return feature_entry{detail::get_i32(p), detail::get_i32(p + 4), detail::get_i32(p + 8), detail::get_i32(p + 12),
+                             static_cast<vtzero::GeomType>(static_cast<unsigned char>(p[16]))};
+    }
+};
+
+/// serialize the index of a tile, `raw` being the bytes as they will be passed to vtquery
+inline std::string build(vtzero::data_view raw, std::uint64_t raw_hash, columnar::tile const& tile) {
+    auto const& layers = tile.layers();
+    std::size_t directory_size = 0;
+    for (auto const& l : layers) {
+        directory_size += layer_entry_size + l.name.size();
+    }
+
+    std::string out;
+    out.append(magic, sizeof(magic));
+    detail::put_u32(out, version);
+    detail::put_u64(out, raw.size());
+    detail::put_u64(out, raw_hash);
+    detail::put_u32(out, static_cast<std::uint32_t>(layers.size()));
+    detail::put_u32(out, 0);
+
+    std::uint64_t features_offset = header_size + directory_size;
+    for (auto const& l : layers) {
+        detail::put_u32(out, l.extent);
+        detail::put_u32(out, static_cast<std::uint32_t>(l.num_features()));
+        detail::put_u32(out, l.geometry_type_mask);
+        detail::put_i32(out, l.min_x);
+        detail::put_i32(out, l.min_y);
+        detail::put_i32(out, l.max_x);
+        detail::put_i32(out, l.max_y);
+        detail::put_u64(out, features_offset);
+        detail::put_u32(out, static_cast<std::uint32_t>(l.name.size()));
+        out.append(l.name);
+        features_offset += l.num_features() * feature_entry_size;
+    }
+
+    for (auto const& l : layers) {
+        for (std::size_t i = 0; i < l.num_features(); ++i) {
+            detail::put_i32(out, l.min_xs[i]);
+            detail::put_i32(out, l.min_ys[i]);
+            detail::put_i32(out, l.max_xs[i]);
+            detail::put_i32(out, l.max_ys[i]);
+            out.push_back(static_cast<char>(l.geometry_types[i]));
+            out.append(3, '\0');
+        }
+    }
+    return out;
+}
+
+/*
+  Reads an index in place, without copying the feature tables. Throws
+  std::runtime_error if the bytes are not a complete index of this version.
+*/
+class reader {
+  public:
+    explicit reader(vtzero::data_view data) {
+        char const* const begin = data.data();
+        std::size_t const size = data.size();
+        if (size < header_size || std::string(begin, sizeof(magic)) != std::string(magic, sizeof(magic))) {
+            throw std::runtime_error("tile index is not a vtquery index");
+        }
+        if (detail::get_u32(begin + 4) != version) {
+            throw std::runtime_error("tile index version is not supported");
+        }
+        tile_size_ = detail::get_u64(begin + 8);
+        tile_hash_ = detail::get_u64(begin + 16);
+        std::uint32_t const num_layers = detail::get_u32(begin + 24);
+
+        std::size_t pos = header_size;
+        layers_.reserve(std::min<std::size_t>(num_layers, (size - header_size) / layer_entry_size));
+        for (std::uint32_t n = 0; n < num_layers; ++n) {
+            if (size - pos < layer_entry_size) {
+                throw std::runtime_error("tile index is truncated");
+            }
+            char const* p = begin + pos;
+            layer_entry entry{};
+            entry.extent = detail::get_u32(p);
+            entry.num_features = detail::get_u32(p + 4);
+            entry.geometry_types = detail::get_u32(p + 8);
+            entry.min_x = detail::get_i32(p + 12);
+            entry.min_y = detail::get_i32(p + 16);
+            entry.max_x = detail::get_i32(p + 20);
+            entry.max_y = detail::get_i32(p + 24);
+            std::uint64_t const features_offset = detail::get_u64(p + 28);
+            std::uint32_t const name_length = detail::get_u32(p + 36);
+            pos += layer_entry_size;
+            if (size - pos < name_length ||
+                features_offset > size ||
+                (size - features_offset) / feature_entry_size < entry.num_features) {
+                throw std::runtime_error("tile index is truncated");
+            }
+            entry.name = vtzero::data_view{begin + pos, name_length};
+            entry.features = begin + features_offset;
+            pos += name_length;
+            layers_.push_back(entry);
+        }
+    }
+
+    std::uint64_t tile_size() const { return tile_size_; }
+
+    std::uint64_t tile_hash() const { return tile_hash_; }
+
+    /// whether this index was built from tile bytes of this size and hash
+    bool matches(std::size_t size, std::uint64_t hash) const {
+        return tile_size_ == size && tile_hash_ == hash;
+    }
+
+    std::vector<layer_entry> const& layers() const { return layers_; }
+
+  private:
+    std::uint64_t tile_size_{0};
+    std::uint64_t tile_hash_{0};
+    std::vector<layer_entry> layers_;
+};
+
+} // namespace tile_index
@@ -1,34 +1,26 @@
 #pragma once
 #include <cmath>
+#include <cstring>
 #include <mapbox/cheap_ruler.hpp>
 #include <mapbox/geometry/algorithms/closest_point.hpp>
 #include <mapbox/geometry/geometry.hpp>
 #include <mapbox/variant.hpp>
-#include <napi.h>
+#include <string>
 #include <vtzero/types.hpp>
 #include <vtzero/vector_tile.hpp>
 
 namespace utils {
 
-inline Napi::Value CallbackError(std::string const& message, Napi::CallbackInfo const& info) {
-    Napi::Object obj = Napi::Object::New(info.Env());
-    obj.Set("message", message);
-    auto func = info[info.Length() - 1].As<Napi::Function>();
-    // ^^^ here we assume that info has a valid callback function
-    // TODO: consider changing either method signature or adding internal checks
-    return func.Call({obj});
-}
-
 /*
   Convert original lng/lat coordinates into a query point relative to the "active" tile in vector tile coordinates
   Returns a geometry.hpp point with std::int64_t values
 */
-mapbox::geometry::point<std::int64_t> create_query_point(double lng,
-                                                         double lat,
-                                                         std::uint32_t extent,
-                                                         std::int32_t active_tile_z,
-                                                         std::int32_t active_tile_x,
-                                                         std::int32_t active_tile_y) {
+inline mapbox::geometry::point<std::int64_t> create_query_point(double lng,
+                                                                double lat,
+                                                                std::uint32_t extent,
+                                                                std::int32_t active_tile_z,
+                                                                std::int32_t active_tile_x,
+                                                                std::int32_t active_tile_y) {
 
     lng = std::fmod((lng + 180.0), 360.0);
     if (lat > 89.9) {
@@ -52,14 +44,43 @@ mapbox::geometry::point<std::int64_t> create_query_point(double lng,
     return mapbox::geometry::point<std::int64_t>{query_x, query_y};
 }
 
+/*
+  Box in the active tile's coordinates holding every point within `radius` meters of
+  lng/lat, as measured by distance_in_meters, padded for the rounding in create_query_point.
+  Returns false when the box crosses the antimeridian or gets close to a pole, where it
+  cannot be expressed this way and nothing should be pruned with it.
+*/
+inline bool create_query_box(double lng,
+                             double lat,
+                             double radius,
+                             std::uint32_t extent,
+                             std::int32_t active_tile_z,
+                             std::int32_t active_tile_x,
+                             std::int32_t active_tile_y,
+                             mapbox::geometry::box<std::int64_t>& box) {
+    mapbox::cheap_ruler::CheapRuler ruler(lat, mapbox::cheap_ruler::CheapRuler::Meters);
+    auto const lnglat_box = ruler.bufferPoint(mapbox::geometry::point<double>{lng, lat}, radius);
+    if (lnglat_box.min.x < -180.0 || lnglat_box.max.x >= 180.0 || lnglat_box.min.y < -85.0 || lnglat_box.max.y > 85.0) {
+        return false;
+    }
+    constexpr std::int64_t slack = 2;
+    auto const north_west = create_query_point(lnglat_box.min.x, lnglat_box.max.y, extent, active_tile_z, active_tile_x, active_tile_y);
+    auto const south_east = create_query_point(lnglat_box.max.x, lnglat_box.min.y, extent, active_tile_z, active_tile_x, active_tile_y);
+    box.min = mapbox::geometry::point<std::int64_t>{north_west.x - slack, north_west.y - slack};
+    box.max = mapbox::geometry::point<std::int64_t>{south_east.x + slack, south_east.y + slack};
+    return true;
+}
+
 /*
   Create a geometry.hpp point from vector tile coordinates
+  Accepts any closest point result with `x` and `y` members
 */
+template <typename ClosestPointInfo>
 mapbox::geometry::point<double> convert_vt_to_ll(std::uint32_t extent,
                                                  std::int32_t z,
                                                  std::int32_t x,
                                                  std::int32_t y,
-                                                 mapbox::geometry::algorithms::closest_point_info cp_info) {
+                                                 ClosestPointInfo const& cp_info) {
     double z2 = static_cast<double>(static_cast<std::int64_t>(1) << z);
     double ex = static_cast<double>(extent);
     double size = ex * z2;
@@ -71,6 +92,46 @@ mapbox::geometry::point<double> convert_vt_to_ll(std::uint32_t extent,
     return mapbox::geometry::point<double>{x1, y1};
 }
 
+/*
+  Fast, non-cryptographic 64-bit hash of a byte range, used to recognize the
+  same tile bytes from one query to the next
+*/
+inline std::uint64_t hash_bytes(char const* data, std::size_t size) {
+    constexpr std::uint64_t k1 = 0x87c37b91114253d5ULL;
+    constexpr std::uint64_t k2 = 0x4cf5ad432745937fULL;
+    auto const rotl = [](std::uint64_t v, int r) { return (v << r) | (v >> (64 - r)); };
+    std::uint64_t hash = static_cast<std::uint64_t>(size) * 0x9e3779b97f4a7c15ULL;
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash ^= rotl(word * k1, 31) * k2;
+        hash = rotl(hash, 27) * 5 + 0x52dce729;
+    }
+    std::uint64_t tail = 0;
+    std::memcpy(&tail, data + i, size - i);
+    hash ^= rotl(tail * k1, 31) * k2;
+    // final avalanche
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/// append the bytes of a value to a cache key
+template <typename T>
+void append_key(std::string& key, T const& value) {
+    key.append(reinterpret_cast<char const*>(&value), sizeof(value));
+}
+
+/// append a string to a cache key, prefixed with its length so keys stay unambiguous
+inline void append_key(std::string& key, std::string const& value) {
+    append_key(key, value.size());
+    key.append(value);
+}
+
 /*
   Get the distance (in meters) between two geometry.hpp points using cheap-ruler
   https://github.com/mapbox/cheap-ruler-cpp
@@ -78,7 +139,7 @@ mapbox::geometry::point<double> convert_vt_to_ll(std::uint32_t extent,
   The first point is considered the "origin" and its latitude is used to initialize
   the ruler. The second is considered the "feature" and is the distance to.
 */
-double distance_in_meters(mapbox::geometry::point<double> const& origin_lnglat, mapbox::geometry::point<double> const& feature_lnglat) {
+inline double distance_in_meters(mapbox::geometry::point<double> const& origin_lnglat, mapbox::geometry::point<double> const& feature_lnglat) {
     // set up cheap ruler with query latitude
     mapbox::cheap_ruler::CheapRuler ruler(origin_lnglat.y, mapbox::cheap_ruler::CheapRuler::Meters);
     return ruler.distance(origin_lnglat, feature_lnglat);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "geometry_kernels.hpp"
 #include <mapbox/feature.hpp>
 #include <vtzero/types.hpp>
 #include <vtzero/vector_tile.hpp>
@@ -169,8 +170,97 @@ mapbox::geometry::geometry<CoordinateType> extract_geometry_line_string(vtzero::
     }
 }
 
+struct flat_point_handler {
+
+    kernels::flat_geometry& geom_;
+
+    flat_point_handler(kernels::flat_geometry& geom) : geom_(geom) {
+    }
+
+    void points_begin(std::uint32_t count) {
+        geom_.xs.reserve(geom_.xs.size() + count);
+        geom_.ys.reserve(geom_.ys.size() + count);
+    }
+
+    // every point is its own single vertex part
+    void points_point(const vtzero::point pt) {
+        geom_.part_starts.push_back(static_cast<std::uint32_t>(geom_.num_rings()));
+        geom_.add_point(pt.x, pt.y);
+        geom_.end_ring();
+    }
+
+    void points_end() {
+    }
+};
+
+struct flat_line_string_handler {
+
+    kernels::flat_geometry& geom_;
+
+    flat_line_string_handler(kernels::flat_geometry& geom) : geom_(geom) {
+    }
+
+    void linestring_begin(std::uint32_t count) {
+        geom_.xs.reserve(geom_.xs.size() + count);
+        geom_.ys.reserve(geom_.ys.size() + count);
+        geom_.part_starts.push_back(static_cast<std::uint32_t>(geom_.num_rings()));
+    }
+
+    void linestring_point(const vtzero::point pt) {
+        geom_.add_point(pt.x, pt.y);
+    }
+
+    void linestring_end() {
+        geom_.end_ring();
+    }
+};
+
+struct flat_polygon_handler {
+
+    kernels::flat_geometry& geom_;
+    std::size_t first_part_;
+
+    // `geom` may already hold other features, parts before `first_part_` are not ours
+    flat_polygon_handler(kernels::flat_geometry& geom) : geom_(geom), first_part_(geom.part_starts.size()) {
+    }
+
+    void ring_begin(std::uint32_t count) {
+        geom_.xs.reserve(geom_.xs.size() + count);
+        geom_.ys.reserve(geom_.ys.size() + count);
+    }
+
+    void ring_point(const vtzero::point pt) {
+        geom_.add_point(pt.x, pt.y);
+    }
+
+    // same grouping as extract_geometry_polygon: inner rings before the first
+    // outer ring and zero area rings are dropped
+    void ring_end(vtzero::ring_type type) {
+        if (type == vtzero::ring_type::outer) {
+            geom_.part_starts.push_back(static_cast<std::uint32_t>(geom_.num_rings()));
+        } else if (type != vtzero::ring_type::inner || geom_.part_starts.size() == first_part_) {
+            geom_.discard_ring();
+            return;
+        }
+        geom_.close_ring();
+        geom_.end_ring();
+    }
+};
+
 } // namespace detail
 
+/// decode a linestring feature into flat coordinate arrays, reusing the storage in `geom`
+inline void extract_flat_line_string(vtzero::feature const& f, kernels::flat_geometry& geom) {
+    geom.clear();
+    vtzero::decode_linestring_geometry(f.geometry(), detail::flat_line_string_handler(geom));
+}
+
+/// decode a polygon feature into flat coordinate arrays, reusing the storage in `geom`
+inline void extract_flat_polygon(vtzero::feature const& f, kernels::flat_geometry& geom) {
+    geom.clear();
+    vtzero::decode_polygon_geometry(f.geometry(), detail::flat_polygon_handler(geom));
+}
+
 template <typename CoordinateType>
 mapbox::geometry::geometry<CoordinateType> extract_geometry(vtzero::feature const& f) {
     switch (f.geometry_type()) {
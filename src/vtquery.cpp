@@ -1,160 +1,228 @@
 #include "vtquery.hpp"
+#include "capture.hpp"
+#include "metrics.hpp"
+#include "napi_util.hpp"
+#include "query.hpp"
 #include "util.hpp"
-#include "vector_tile_util.hpp"
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <exception>
-#include <gzip/decompress.hpp>
-#include <gzip/utils.hpp>
-#include <mapbox/geometry/algorithms/closest_point.hpp>
-#include <mapbox/geometry/algorithms/closest_point_impl.hpp>
 #include <memory>
-#include <queue>
-#include <stdexcept>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
 #include <utility>
 
 namespace VectorTileQuery {
 
-enum GeomType { point,
-                linestring,
-                polygon,
-                all,
-                unknown };
-static std::array<std::string, 4> const GeomTypeStrings = {"point", "linestring", "polygon", "unknown"};
-char const* getGeomTypeString(std::size_t index) {
-    return GeomTypeStrings[index].c_str();
+/// a tile copied into native memory by vtquery.storeTile()
+using StoredTile = std::shared_ptr<std::string const>;
+
+/**
+  The stored tiles, by key. The store belongs to the process rather than to a
+  node environment, so every worker thread queries the same copy of a tile.
+  Queries hold the tiles they read, replacing or dropping a tile never frees
+  memory a running query uses.
+*/
+std::unordered_map<std::string, StoredTile>& tile_store() {
+    static std::unordered_map<std::string, StoredTile> store;
+    return store;
 }
 
-using materialized_prop_type = std::pair<std::string, mapbox::feature::value>;
-
-/// main storage item for returning to the user
-struct ResultObject {
-    std::vector<vtzero::property> properties_vector;
-    std::vector<materialized_prop_type> properties_vector_materialized;
-    std::string layer_name;
-    mapbox::geometry::point<double> coordinates;
-    double distance;
-    GeomType original_geometry_type{GeomType::unknown};
-    bool has_id{false};
-    uint64_t id{0};
-
-    ResultObject() : coordinates(0.0, 0.0),
-                     distance(std::numeric_limits<double>::max()) {}
-
-    ResultObject(ResultObject&&) = default;
-    ResultObject& operator=(ResultObject&&) = default;
-    ResultObject(ResultObject const&) = delete;
-    ResultObject& operator=(ResultObject const&) = delete;
-    ~ResultObject() = default;
+std::mutex& tile_store_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+/// the tile stored as `key`, or nullptr
+StoredTile find_stored_tile(std::string const& key) {
+    std::lock_guard<std::mutex> lock(tile_store_mutex());
+    auto it = tile_store().find(key);
+    return it == tile_store().end() ? nullptr : it->second;
+}
+
+/// keeps the memory of the tiles and indexes of a query alive while it runs
+struct TileMemory {
+    std::vector<Napi::ObjectReference> objects;
+    std::vector<StoredTile> stored;
 };
 
-/// an intermediate representation of a tile buffer and its necessary components
-struct TileObject {
-    TileObject(std::int32_t z0,
-               std::int32_t x0,
-               std::int32_t y0,
-               Napi::Buffer<char> const& buffer)
-        : z{z0},
-          x{x0},
-          y{y0},
-          data{buffer.Data(), buffer.Length()},
-          buffer_ref{Napi::Persistent(buffer)} {
+/**
+  The bytes of a Buffer, any other TypedArray, a DataView, an ArrayBuffer or a
+  SharedArrayBuffer. Returns the object that has to be kept alive while the
+  bytes are read, or an empty object if `value` holds no bytes.
+*/
+Napi::Object byte_source(Napi::Value const& value, vtzero::data_view& bytes) {
+    Napi::Env env = value.Env();
+    if (value.IsTypedArray()) {
+        // napi_get_typedarray_info points into SharedArrayBuffers too, Napi::TypedArray::ArrayBuffer() does not
+        Napi::TypedArray array = value.As<Napi::TypedArray>();
+        void* data = nullptr;
+        if (napi_get_typedarray_info(env, array, nullptr, nullptr, &data, nullptr, nullptr) != napi_ok) {
+            return Napi::Object{};
+        }
+        bytes = vtzero::data_view{static_cast<char const*>(data), array.ByteLength()};
+        return array;
+    }
+    if (value.IsDataView()) {
+        Napi::DataView view = value.As<Napi::DataView>();
+        bytes = vtzero::data_view{static_cast<char const*>(view.Data()), view.ByteLength()};
+        return view;
+    }
+    if (value.IsArrayBuffer()) {
+        Napi::ArrayBuffer buffer = value.As<Napi::ArrayBuffer>();
+        bytes = vtzero::data_view{static_cast<char const*>(buffer.Data()), buffer.ByteLength()};
+        return buffer;
     }
+    // n-api can not read a SharedArrayBuffer itself, only a view on it
+    Napi::Value shared = env.Global().Get("SharedArrayBuffer");
+    if (value.IsObject() && shared.IsFunction() && value.As<Napi::Object>().InstanceOf(shared.As<Napi::Function>())) {
+        Napi::Function uint8_array = env.Global().Get("Uint8Array").As<Napi::Function>();
+        return byte_source(uint8_array.New({value}), bytes);
+    }
+    return Napi::Object{};
+}
 
-    ~TileObject() = default;
+/// the baton of data to be passed from the v8 thread into the cpp threadpool
+struct QueryData {
+    QueryData()
+        : latitude(0.0),
+          longitude(0.0) {}
 
-    // guarantee that objects are not being copied or moved
-    // by deleting the copy and move definitions
+    ~QueryData() = default;
 
     // non-copyable
-    TileObject(TileObject const&) = delete;
-    TileObject& operator=(TileObject const&) = delete;
+    QueryData(QueryData const&) = delete;
+    QueryData& operator=(QueryData const&) = delete;
 
     // non-movable
-    TileObject(TileObject&&) = delete;
-    TileObject& operator=(TileObject&&) = delete;
+    QueryData(QueryData&&) = delete;
+    QueryData& operator=(QueryData&&) = delete;
 
-    std::int32_t z;
-    std::int32_t x;
-    std::int32_t y;
-    vtzero::data_view data;
-    Napi::Reference<Napi::Buffer<char>> buffer_ref;
+    // shared with every query made with the same compiled options
+    std::shared_ptr<QueryOptions const> options;
+    // buffers object thing
+    std::vector<TileInput> tiles;
+    // keep the tile and index buffers alive while the query runs
+    TileMemory tile_memory;
+    double latitude;
+    double longitude;
 };
 
-using value_type = boost::variant<float, double, int64_t, uint64_t, bool, std::string>;
-using map_type = std::unordered_map<std::string, value_type>;
+/// the baton of a batch: many query points against the same tiles and options
+struct BatchData {
+    BatchData() = default;
 
-enum BasicFilterType {
-    ne,
-    eq,
-    lt,
-    lte,
-    gt,
-    gte
-};
+    ~BatchData() = default;
 
-struct basic_filter_struct {
-    explicit basic_filter_struct()
-        : key(""),
-          value(false) {}
+    // non-copyable
+    BatchData(BatchData const&) = delete;
+    BatchData& operator=(BatchData const&) = delete;
 
-    std::string key;
-    BasicFilterType type{eq};
-    value_type value;
-};
+    // non-movable
+    BatchData(BatchData&&) = delete;
+    BatchData& operator=(BatchData&&) = delete;
 
-enum BasicMetaFilterType {
-    filter_all,
-    filter_any
+    std::shared_ptr<QueryOptions const> options;
+    std::vector<TileInput> tiles;
+    TileMemory tile_memory;
+    std::vector<mapbox::geometry::point<double>> points;
 };
 
-struct meta_filter_struct {
-    explicit meta_filter_struct() = default;
+/**
+  Strings every FeatureCollection uses, created once per environment instead
+  of again for every feature of every query. Property keys and layer names
+  repeat across results too, the most recent ones are kept as well.
+*/
+class ResultStrings {
+  public:
+    /// keys and layer names kept at most, the cache starts over once it is full
+    static constexpr std::size_t max_cached = 4096;
+    /// longer strings are created every time, they are unlikely to repeat
+    static constexpr std::size_t max_cached_length = 128;
+
+    explicit ResultStrings(Napi::Env env)
+        : type{make(env, "type")},
+          feature_collection{make(env, "FeatureCollection")},
+          features{make(env, "features")},
+          feature{make(env, "Feature")},
+          id{make(env, "id")},
+          geometry{make(env, "geometry")},
+          point{make(env, "Point")},
+          coordinates{make(env, "coordinates")},
+          properties{make(env, "properties")},
+          tilequery{make(env, "tilequery")},
+          distance{make(env, "distance")},
+          layer{make(env, "layer")} {
+        for (std::size_t i = 0; i < GeomTypeStrings.size(); ++i) {
+            geom_types[i] = make(env, GeomTypeStrings[i].c_str());
+        }
+    }
 
-    BasicMetaFilterType type{filter_all};
-    std::vector<basic_filter_struct> filters;
-};
+    /// a property key or layer name
+    Napi::String get(Napi::Env env, std::string const& value) {
+        if (value.size() > max_cached_length) {
+            return Napi::String::New(env, value);
+        }
+        auto it = cached_.find(value);
+        if (it != cached_.end()) {
+            return it->second.Value();
+        }
+        if (cached_.size() >= max_cached) {
+            cached_.clear();
+        }
+        Napi::String string = Napi::String::New(env, value);
+        cached_.emplace(value, Napi::Persistent(string));
+        return string;
+    }
 
-/// the baton of data to be passed from the v8 thread into the cpp threadpool
-struct QueryData {
-    explicit QueryData(std::uint32_t num_tiles)
-        : latitude(0.0),
-          longitude(0.0),
-          radius(0.0),
-          num_results(5),
-          dedupe(true),
-          direct_hit_polygon(false),
-          geometry_filter_type(GeomType::all) {
-        tiles.reserve(num_tiles);
+    /// the name of an original geometry type, as getGeomTypeString() spells it
+    Napi::String geom_type(std::size_t index) {
+        // the last name is "unknown", which GeomType::unknown is past the end of
+        return geom_types[std::min(index, geom_types.size() - 1)].Value();
     }
 
-    ~QueryData() = default;
+    Napi::Reference<Napi::String> type;
+    Napi::Reference<Napi::String> feature_collection;
+    Napi::Reference<Napi::String> features;
+    Napi::Reference<Napi::String> feature;
+    Napi::Reference<Napi::String> id;
+    Napi::Reference<Napi::String> geometry;
+    Napi::Reference<Napi::String> point;
+    Napi::Reference<Napi::String> coordinates;
+    Napi::Reference<Napi::String> properties;
+    Napi::Reference<Napi::String> tilequery;
+    Napi::Reference<Napi::String> distance;
+    Napi::Reference<Napi::String> layer;
+    std::array<Napi::Reference<Napi::String>, std::tuple_size<decltype(GeomTypeStrings)>::value> geom_types;
+
+  private:
+    static Napi::Reference<Napi::String> make(Napi::Env env, char const* value) {
+        return Napi::Persistent(Napi::String::New(env, value));
+    }
 
-    // non-copyable
-    QueryData(QueryData const&) = delete;
-    QueryData& operator=(QueryData const&) = delete;
+    std::unordered_map<std::string, Napi::Reference<Napi::String>> cached_;
+};
 
-    // non-movable
-    QueryData(QueryData&&) = delete;
-    QueryData& operator=(QueryData&&) = delete;
+/**
+  What the binding keeps for each node environment: the main thread and every
+  worker thread that loads it. Freed by node along with the environment.
+*/
+struct InstanceData {
+    explicit InstanceData(Napi::Env env)
+        : strings{env} {}
 
-    // buffers object thing
-    std::vector<std::unique_ptr<TileObject>> tiles;
-    std::vector<std::string> layers;
-    double latitude;
-    double longitude;
-    double radius;
-    std::uint32_t num_results;
-    bool dedupe;
-    bool direct_hit_polygon;
-    GeomType geometry_filter_type;
-    meta_filter_struct basic_filter;
+    Napi::FunctionReference compiled_options;
+    ResultStrings strings;
 };
 
 /// convert properties to v8 types
 struct property_value_visitor {
     Napi::Object& properties_obj;
-    std::string const& key;
+    Napi::String key;
     Napi::Env& env;
     template <typename T>
     void operator()(T /*unused*/) {}
@@ -177,190 +245,142 @@ struct property_value_visitor {
 };
 
 /// used to create the final v8 (JSON) object to return to the user
-void set_property(materialized_prop_type const& property,
+void set_property(materialized_prop_type const& property, ResultStrings& strings,
                   Napi::Object& properties_obj, Napi::Env env) {
-    mapbox::util::apply_visitor(property_value_visitor{properties_obj, property.first, env}, property.second);
+    mapbox::util::apply_visitor(property_value_visitor{properties_obj, strings.get(env, property.first), env}, property.second);
 }
 
-GeomType get_geometry_type(vtzero::feature const& f) {
-    GeomType gt = GeomType::unknown;
-    switch (f.geometry_type()) {
-    case vtzero::GeomType::POINT: {
-        gt = GeomType::point;
-        break;
-    }
-    case vtzero::GeomType::LINESTRING: {
-        gt = GeomType::linestring;
-        break;
-    }
-    case vtzero::GeomType::POLYGON: {
-        gt = GeomType::polygon;
-        break;
-    }
-    default: {
-        break;
-    }
-    }
-
-    return gt;
+/// a plain writable, enumerable and configurable property, as Set() would make it
+Napi::PropertyDescriptor data_property(Napi::Reference<Napi::String> const& key, Napi::Value value) {
+    return Napi::PropertyDescriptor::Value(key.Value(), value, napi_property_attributes(napi_writable | napi_enumerable | napi_configurable));
 }
 
-struct CompareDistance {
-    bool operator()(ResultObject const& r1, ResultObject const& r2) {
-        return r1.distance < r2.distance;
-    }
-};
-
-/// replace already existing results with a better, duplicate result
-void insert_result(ResultObject& old_result,
-                   std::vector<vtzero::property>& props_vec,
-                   std::string const& layer_name,
-                   mapbox::geometry::point<double> const& pt,
-                   double distance,
-                   GeomType geom_type,
-                   bool has_id,
-                   uint64_t id) {
-
-    std::swap(old_result.properties_vector, props_vec);
-    old_result.layer_name = layer_name;
-    old_result.coordinates = pt;
-    old_result.distance = distance;
-    old_result.original_geometry_type = geom_type;
-    old_result.has_id = has_id;
-    old_result.id = id;
-}
+/**
+  create the GeoJSON FeatureCollection returned to the user, skipping unused result slots
+
+  Every feature, geometry and tilequery object gets the same keys in the same
+  order, so V8 gives all of them one hidden class, and gets them in a single
+  DefineProperties() call rather than a call per key.
+*/
+Napi::Object create_feature_collection(Napi::Env env, std::vector<ResultObject> const& results) {
+    metrics::scoped_timer timer{metrics::result_ns};
+    ResultStrings& strings = env.GetInstanceData<InstanceData>()->strings;
+    Napi::String const feature_type = strings.feature.Value();
+    Napi::String const point_type = strings.point.Value();
+    Napi::String const tilequery_key = strings.tilequery.Value();
+    Napi::Object results_object = Napi::Object::New(env);
+    Napi::Array features_array = Napi::Array::New(env);
+    std::uint32_t num_features = 0;
+    // for each result object
+    for (auto const& feature : results) {
+        if (feature.distance < std::numeric_limits<double>::max()) {
+            // if this is a default value, don't use it
+            // create geometry object
+            Napi::Array coordinates_array = Napi::Array::New(env, 2);
+            coordinates_array.Set(0u, feature.coordinates.x); // latitude
+            coordinates_array.Set(1u, feature.coordinates.y); // longitude
+            Napi::Object geometry_obj = Napi::Object::New(env);
+            geometry_obj.DefineProperties({data_property(strings.type, point_type),
+                                           data_property(strings.coordinates, coordinates_array)});
+
+            // create properties object
+            Napi::Object properties_obj = Napi::Object::New(env);
+            for (auto const& prop : feature.properties_vector_materialized) {
+                set_property(prop, strings, properties_obj, env);
+            }
 
-/// generate a vector of vtzero::property objects
-std::vector<vtzero::property> get_properties_vector(vtzero::feature& feat) {
-    std::vector<vtzero::property> v;
-    v.reserve(feat.num_properties());
-    while (auto ii = feat.next_property()) {
-        v.push_back(ii);
+            // set properties.tilquery
+            Napi::Object tilequery_properties_obj = Napi::Object::New(env);
+            tilequery_properties_obj.DefineProperties({data_property(strings.distance, Napi::Number::New(env, feature.distance)),
+                                                       data_property(strings.geometry, strings.geom_type(feature.original_geometry_type)),
+                                                       data_property(strings.layer, strings.get(env, feature.layer_name))});
+            properties_obj.Set(tilequery_key, tilequery_properties_obj);
+
+            Napi::Object feature_obj = Napi::Object::New(env);
+            feature_obj.DefineProperties({data_property(strings.type, feature_type),
+                                          data_property(strings.id, Napi::Number::New(env, static_cast<double>(feature.id))),
+                                          data_property(strings.geometry, geometry_obj),
+                                          data_property(strings.properties, properties_obj)});
+
+            // add feature to features array
+            features_array.Set(num_features++, feature_obj);
+        }
     }
-    return v;
+    results_object.DefineProperties({data_property(strings.type, strings.feature_collection.Value()),
+                                     data_property(strings.features, features_array)});
+    return results_object;
 }
 
-double convert_to_double(value_type const& value) {
-    // float
-    if (value.which() == 0) {
-        return double(boost::get<float>(value));
-    }
-    // double
-    if (value.which() == 1) {
-        return boost::get<double>(value);
-    }
-    // int64_t
-    if (value.which() == 2) {
-        return double(boost::get<int64_t>(value));
-    }
-    // uint64_t
-    if (value.which() == 3) {
-        return double(boost::get<uint64_t>(value));
-    }
-    return 0.0f;
-}
+/*
+  Queries running right now, keyed by everything that decides their result,
+  so an identical query arriving meanwhile waits for the same worker instead
+  of queueing its own.
 
-/// Evaluates a single filter on a feature - Returns true if it passes filter
-bool single_filter_feature(basic_filter_struct const& filter, value_type const& feature_value) {
-    double epsilon = 0.001;
-    if (feature_value.which() <= 3 && filter.value.which() <= 3) { // Numeric Types
-        double parameter_double = convert_to_double(feature_value);
-        double filter_double = convert_to_double(filter.value);
-        if ((filter.type == eq) && (std::abs(parameter_double - filter_double) < epsilon)) {
-            return true;
-        }
-        if ((filter.type == ne) && (std::abs(parameter_double - filter_double) >= epsilon)) {
-            return true;
-        }
-        if ((filter.type == gte) && (parameter_double >= filter_double)) {
-            return true;
-        }
-        if ((filter.type == gt) && (parameter_double > filter_double)) {
-            return true;
-        }
-        if ((filter.type == lte) && (parameter_double <= filter_double)) {
-            return true;
-        }
-        if ((filter.type == lt) && (parameter_double < filter_double)) {
-            return true;
-        }
-    } else if (feature_value.which() == 4 && filter.value.which() == 4) { // Boolean Types
-        bool feature_bool = boost::get<bool>(feature_value);
-        bool filter_bool = boost::get<bool>(filter.value);
-        if ((filter.type == eq) && (feature_bool == filter_bool)) {
-            return true;
-        }
-        if ((filter.type == ne) && (feature_bool != filter_bool)) {
-            return true;
-        }
-    }
-    return false;
-}
+  Tiles are identified by their buffer's address and length rather than a
+  hash of their bytes: the buffers of a running query are referenced and
+  cannot go away, and bursts of identical requests usually share them.
+  Hashing them here would read every tile on the main thread. A buffer must
+  not be changed while a query using it runs, the worker reads it in place,
+  so its address stands for its bytes until the callback.
 
-/// apply filters to a feature - Returns true if feature matches all features
-bool filter_feature_all(vtzero::feature& feature, std::vector<basic_filter_struct> const& filters) {
-    auto features_property_map = vtzero::create_properties_map<map_type>(feature);
-    for (auto const& filter : filters) {
-        auto it = features_property_map.find(filter.key);
-        if (it != features_property_map.end()) {
-            value_type feature_value = it->second;
-            if (!single_filter_feature(filter, feature_value)) {
-                return false;
-            }
-        }
-    }
-    return true;
-}
+  Queries with a progress callback are never joined, their snapshots belong
+  to them alone.
+*/
+struct Worker;
 
-/// apply filters to a feature - Returns true if feature matches any features
-bool filter_feature_any(vtzero::feature& feature, std::vector<basic_filter_struct> const& filters) {
-    auto features_property_map = vtzero::create_properties_map<map_type>(feature);
-    for (auto const& filter : filters) {
-        auto it = features_property_map.find(filter.key);
-        if (it != features_property_map.end()) {
-            value_type feature_value = it->second;
-            if (single_filter_feature(filter, feature_value)) {
-                return true;
-            }
-        }
-    }
-    return false;
-}
+using InFlightQueries = std::unordered_map<std::string, Worker*>;
 
-/// apply filters to a feature - Returns true if a feature matches the filters
-bool filter_feature(vtzero::feature& feature, std::vector<basic_filter_struct> const& filters, BasicMetaFilterType filter_type) {
-    if (filter_type == filter_all) {
-        return filter_feature_all(feature, filters);
-    }
-    return filter_feature_any(feature, filters);
+std::mutex& in_flight_mutex() {
+    static std::mutex mutex;
+    return mutex;
 }
 
-/// compare two features to determine if they are duplicates
-bool value_is_duplicate(ResultObject const& r,
-                        vtzero::feature const& candidate_feature,
-                        std::string const& candidate_layer,
-                        GeomType const candidate_geom,
-                        std::vector<vtzero::property> const& candidate_props_vec) {
-
-    // compare layer (if different layers, not duplicates)
-    if (r.layer_name != candidate_layer) {
-        return false;
-    }
+InFlightQueries& in_flight_queries() {
+    static InFlightQueries queries;
+    return queries;
+}
 
-    // compare geometry (if different geometry types, not duplicates)
-    if (r.original_geometry_type != candidate_geom) {
-        return false;
-    }
+std::atomic<std::uint64_t>& coalesced_queries() {
+    static std::atomic<std::uint64_t> count{0};
+    return count;
+}
 
-    // compare ids
-    if (r.has_id && candidate_feature.has_id() && r.id != candidate_feature.id()) {
-        return false;
+std::string in_flight_key(napi_env env, QueryData const& data) {
+    using utils::append_key;
+    std::string key;
+    // workers call back into the environment that queued them
+    append_key(key, static_cast<void const*>(env));
+    append_key(key, data.longitude);
+    append_key(key, data.latitude);
+    append_options_key(key, *data.options);
+    append_key(key, data.options->columnar);
+    append_key(key, data.options->cache);
+    // a query may only wait for one that fails when it would have failed too
+    append_key(key, data.options->max_memory);
+    for (auto const& tile : data.tiles) {
+        append_key(key, static_cast<void const*>(tile.data.data()));
+        append_key(key, tile.data.size());
+        append_key(key, tile.z);
+        append_key(key, tile.x);
+        append_key(key, tile.y);
+        append_key(key, static_cast<void const*>(tile.index_data.data()));
+        append_key(key, tile.index_data.size());
+        append_key(key, tile.index_path);
     }
-
-    // compare property tags
-    return r.properties_vector == candidate_props_vec;
+    return key;
 }
 
+/**
+  Shared by a query with a progress callback and the snapshots it sends to the
+  main thread, which may still be queued when the query finishes.
+*/
+struct ProgressState {
+    /// set when the progress callback returned false
+    std::atomic<bool> stopped{false};
+    /// set on the main thread once the final result was delivered, snapshots arriving later are dropped
+    bool finished{false};
+};
+
 /// main worker used by N-API
 struct Worker : Napi::AsyncWorker {
     using Base = Napi::AsyncWorker;
@@ -373,514 +393,1083 @@ struct Worker : Napi::AsyncWorker {
            Napi::Function& cb)
         : Base(cb),
           query_data_(std::move(query_data)),
-          // reserve the query results and fill with empty objects
-          results_queue_{query_data_->num_results} {}
+          queued_(std::chrono::steady_clock::now()) {}
 
     void Execute() override {
-        try {
-            QueryData const& data = *query_data_;
-
-            std::vector<basic_filter_struct> filters = data.basic_filter.filters;
-            bool filter_enabled = !filters.empty();
-            // query point lng/lat geometry.hpp point (used for distance calculation later on)
-            mapbox::geometry::point<double> query_lnglat{data.longitude, data.latitude};
-
-            gzip::Decompressor decompressor;
-            std::string uncompressed;
-            std::vector<std::string> buffers;
-            std::vector<std::tuple<vtzero::vector_tile, std::int32_t, std::int32_t, std::int32_t>> tiles;
-            tiles.reserve(data.tiles.size());
-            for (auto const& tile_ptr : data.tiles) {
-                TileObject const& tile_obj = *tile_ptr;
-                if (gzip::is_compressed(tile_obj.data.data(), tile_obj.data.size())) {
-                    decompressor.decompress(uncompressed, tile_obj.data.data(), tile_obj.data.size());
-                    buffers.emplace_back(std::move(uncompressed));
-                    tiles.emplace_back(vtzero::vector_tile(buffers.back()), tile_obj.z, tile_obj.x, tile_obj.y);
-                } else {
-                    tiles.emplace_back(vtzero::vector_tile(tile_obj.data), tile_obj.z, tile_obj.x, tile_obj.y);
-                }
-            }
-            // for each tile
-            for (auto& tile_obj : tiles) {
-                vtzero::vector_tile& tile = std::get<0>(tile_obj);
-                while (auto layer = tile.next_layer()) {
-
-                    // check if this is a layer we should query
-                    std::string layer_name = std::string(layer.name());
-                    if (!data.layers.empty() && std::find(data.layers.begin(), data.layers.end(), layer_name) == data.layers.end()) {
-                        continue;
-                    }
-
-                    std::uint32_t extent = layer.extent();
-                    std::int32_t tile_obj_z = std::get<1>(tile_obj);
-                    std::int32_t tile_obj_x = std::get<2>(tile_obj);
-                    std::int32_t tile_obj_y = std::get<3>(tile_obj);
-                    // query point in relation to the current tile the layer extent
-                    mapbox::geometry::point<std::int64_t> query_point = utils::create_query_point(data.longitude, data.latitude, extent, tile_obj_z, tile_obj_x, tile_obj_y);
-
-                    while (auto feature = layer.next_feature()) {
-                        auto original_geometry_type = get_geometry_type(feature);
-
-                        // check if this a geometry type we want to keep
-                        if (data.geometry_filter_type != GeomType::all && data.geometry_filter_type != original_geometry_type) {
-                            continue;
-                        }
-
-                        // implement closest point algorithm on query geometry and the query point
-                        auto const cp_info = mapbox::geometry::algorithms::closest_point(mapbox::vector_tile::extract_geometry<int64_t>(feature), query_point);
-
-                        // distance should never be less than zero, this is a safety check
-                        if (cp_info.distance < 0.0) {
-                            continue;
-                        }
-
-                        double meters = 0.0;
-                        auto ll = mapbox::geometry::point<double>{data.longitude, data.latitude}; // default to original query lng/lat
-
-                        // if distance from the query point is greater than 0.0 (not a direct hit) so recalculate the latlng
-                        if (cp_info.distance > 0.0) {
-                            ll = utils::convert_vt_to_ll(extent, tile_obj_z, tile_obj_x, tile_obj_y, cp_info);
-                            meters = utils::distance_in_meters(query_lnglat, ll);
-                        }
-
-                        // if distance from the query point is greater than the radius, don't add it
-                        if (meters > data.radius) {
-                            continue;
-                        }
-
-                        // If direct_hit_polygon is enabled, disallow polygons that do not contain the point
-                        if (meters > 0.0 && original_geometry_type == GeomType::polygon && data.direct_hit_polygon) {
-                            continue;
-                        }
-
-                        // If we have filters and the feature doesn't pass the filters, skip this feature
-                        if (filter_enabled && !filter_feature(feature, filters, data.basic_filter.type)) {
-                            continue;
-                        }
-
-                        // check for duplicates
-                        // if the candidate is a duplicate and smaller in distance, replace it
-                        bool found_duplicate = false;
-                        bool skip_duplicate = false;
-                        auto properties_vec = get_properties_vector(feature);
-                        if (data.dedupe) {
-                            for (auto& result : results_queue_) {
-                                if (value_is_duplicate(result, feature, layer_name, original_geometry_type, properties_vec)) {
-                                    if (meters <= result.distance) {
-                                        insert_result(result, properties_vec, layer_name, ll, meters, original_geometry_type, feature.has_id(), feature.id());
-                                        found_duplicate = true;
-                                        break;
-                                        // if we have a duplicate but it's lesser than what we already have, just skip and don't add below
-                                    }
-                                    skip_duplicate = true;
-                                    break;
-                                }
-                            }
-                        }
-
-                        if (skip_duplicate) {
-                            continue;
-                        }
-
-                        if (found_duplicate) {
-                            std::stable_sort(results_queue_.begin(), results_queue_.end(), CompareDistance());
-                            continue;
-                        }
-
-                        if (meters < results_queue_.back().distance) {
-                            insert_result(results_queue_.back(), properties_vec, layer_name, ll, meters, original_geometry_type, feature.has_id(), feature.id());
-                            std::stable_sort(results_queue_.begin(), results_queue_.end(), CompareDistance());
-                        }
-                    } // end tile.layer.feature loop
-                }     // end tile.layer loop
-            }         // end tile loop
-            // Here we create "materialized" properties. We do this here because, when reading from a compressed
-            // buffer, it is unsafe to touch `feature.properties_vector` once we've left this loop.
-            // That is because the buffer may represent uncompressed data that is not in scope outside of Execute()
-            for (auto& feature : results_queue_) {
-                feature.properties_vector_materialized.reserve(feature.properties_vector.size());
-                for (auto const& property : feature.properties_vector) {
-                    auto val = vtzero::convert_property_value<mapbox::feature::value, mapbox::vector_tile::detail::property_value_mapping>(property.value());
-                    feature.properties_vector_materialized.emplace_back(std::string(property.key()), std::move(val));
-                }
-            }
-        } catch (std::exception const& e) {
-            SetError(e.what());
+        metrics::record(metrics::queue_wait_ns, metrics::elapsed_ns(queued_));
+        auto const start = std::chrono::steady_clock::now();
+        metrics::count(metrics::queries);
+        QueryData const& data = *query_data_;
+        mapbox::geometry::point<double> const lnglat{data.longitude, data.latitude};
+        // tiles are hashed here rather than on the main thread, and a miss caches its results under the same hashes
+        if (data.options->cache) {
+            hash_tiles(query_data_->tiles);
+        }
+        if (data.options->cache && find_cached_results(data.tiles, lnglat, *data.options, results_queue_)) {
+            metrics::record(metrics::execute_ns, metrics::elapsed_ns(start));
+        } else {
+            execute_query(lnglat, start);
+        }
+        if (progress_) {
+            progress_fn_.Release();
         }
     }
 
     std::vector<napi_value> GetResult(Napi::Env env) override {
-        Napi::Object results_object = Napi::Object::New(Env());
-        Napi::Array features_array = Napi::Array::New(Env());
-        results_object.Set("type", "FeatureCollection");
-        // for each result object
-        while (!results_queue_.empty()) {
-            auto const& feature = results_queue_.back(); // get reference to top item in results queue
-            if (feature.distance < std::numeric_limits<double>::max()) {
-                // if this is a default value, don't use it
-                Napi::Object feature_obj = Napi::Object::New(Env());
-                feature_obj.Set("type", "Feature");
-                feature_obj.Set("id", feature.id);
-
-                // create geometry object
-                Napi::Object geometry_obj = Napi::Object::New(Env());
-                geometry_obj.Set("type", "Point");
-                Napi::Array coordinates_array = Napi::Array::New(Env(), 2);
-                coordinates_array.Set(0u, feature.coordinates.x); // latitude
-                coordinates_array.Set(1u, feature.coordinates.y); // longitude
-                geometry_obj.Set("coordinates", coordinates_array);
-                feature_obj.Set("geometry", geometry_obj);
-
-                // create properties object
-                Napi::Object properties_obj = Napi::Object::New(Env());
-                for (auto const& prop : feature.properties_vector_materialized) {
-                    set_property(prop, properties_obj, Env());
-                }
+        return {env.Undefined(), napi_value(create_feature_collection(env, results_queue_))};
+    }
 
-                // set properties.tilquery
-                Napi::Object tilequery_properties_obj = Napi::Object::New(Env());
-                tilequery_properties_obj.Set("distance", feature.distance);
-                std::string og_geom = getGeomTypeString(feature.original_geometry_type);
-                tilequery_properties_obj.Set("geometry", og_geom);
-                tilequery_properties_obj.Set("layer", feature.layer_name);
-                properties_obj.Set("tilequery", tilequery_properties_obj);
+    /// send snapshots of the results to `progress` while the query runs
+    void start_progress(Napi::Env env, Napi::Function const& progress) {
+        progress_fn_ = Napi::ThreadSafeFunction::New(env, progress, "vtquery progress", 0, 1);
+        progress_ = std::make_shared<ProgressState>();
+    }
+
+    /// make this worker answer identical queries arriving before it is done
+    void start_in_flight(std::string key) {
+        in_flight_key_ = std::move(key);
+        std::lock_guard<std::mutex> lock(in_flight_mutex());
+        in_flight_queries().emplace(in_flight_key_, this);
+    }
+
+    /// called with the in flight lock held
+    void add_waiter(Napi::Function const& callback) {
+        waiters_.push_back(Napi::Persistent(callback));
+    }
+
+    void OnOK() override {
+        finish_in_flight();
+        finish_progress();
+        Base::OnOK();
+        // each waiter gets its own result objects
+        for (auto& waiter : waiters_) {
+            waiter.Call({Env().Undefined(), create_feature_collection(Env(), results_queue_)});
+        }
+    }
 
-                // add properties to feature
-                feature_obj.Set("properties", properties_obj);
+    void OnError(Napi::Error const& e) override {
+        finish_in_flight();
+        finish_progress();
+        Base::OnError(e);
+        for (auto& waiter : waiters_) {
+            waiter.Call({Napi::Error::New(Env(), e.Message()).Value()});
+        }
+    }
 
-                // add feature to features array
-                features_array.Set(static_cast<uint32_t>(results_queue_.size() - 1), feature_obj);
+  private:
+    /// run the query on the worker thread, and capture it when it was slow
+    void execute_query(mapbox::geometry::point<double> const& lnglat, std::chrono::steady_clock::time_point start) {
+        QueryData const& data = *query_data_;
+        std::string error;
+        try {
+            if (progress_) {
+                results_queue_ = query(data.tiles, lnglat, *data.options, [this](std::vector<ResultObject> results, std::size_t tiles_queried) {
+                    return send_progress(std::move(results), tiles_queried);
+                });
+            } else {
+                results_queue_ = query(data.tiles, lnglat, *data.options);
             }
+        } catch (std::exception const& e) {
+            metrics::count(metrics::errors);
+            error = e.what();
+            SetError(error);
+        }
+        std::uint64_t const execute_ns = metrics::elapsed_ns(start);
+        metrics::record(metrics::execute_ns, execute_ns);
+        capture::get_recorder().capture(execute_ns, false, data.tiles, {lnglat}, *data.options, error);
+    }
 
-            results_queue_.pop_back();
+    /// called on the worker thread, queues a snapshot for the progress callback
+    bool send_progress(std::vector<ResultObject> results, std::size_t tiles_queried) {
+        if (progress_->stopped) {
+            return false;
         }
-        results_object.Set("features", features_array);
-        return {env.Undefined(), napi_value(results_object)};
+        auto state = progress_;
+        auto snapshot = std::make_shared<std::vector<ResultObject>>(std::move(results));
+        double const tiles_total = static_cast<double>(query_data_->tiles.size());
+        progress_fn_.BlockingCall([state, snapshot, tiles_queried, tiles_total](Napi::Env env, Napi::Function progress) {
+            if (state->finished || state->stopped) {
+                return;
+            }
+            Napi::Object progress_info = Napi::Object::New(env);
+            progress_info.Set("tiles_queried", static_cast<double>(tiles_queried));
+            progress_info.Set("tiles_total", tiles_total);
+            Napi::Value keep_going = progress.Call({create_feature_collection(env, *snapshot), progress_info});
+            if (!keep_going.IsEmpty() && keep_going.IsBoolean() && !keep_going.As<Napi::Boolean>().Value()) {
+                state->stopped = true;
+            }
+        });
+        return true;
     }
-};
 
-Napi::Value vtquery(Napi::CallbackInfo const& info) {
-    // validate callback function
-    // validate callback function
-    std::size_t length = info.Length();
-    if (length == 0) {
-        Napi::Error::New(info.Env(), "last argument must be a callback function").ThrowAsJavaScriptException();
-        return info.Env().Null();
+    void finish_progress() {
+        if (progress_) {
+            progress_->finished = true;
+        }
     }
-    Napi::Value callback_val = info[info.Length() - 1];
-    if (!callback_val.IsFunction()) {
-        Napi::Error::New(info.Env(), "last argument must be a callback function").ThrowAsJavaScriptException();
-        return info.Env().Null();
+
+    /// queries arriving from now on start a worker of their own
+    void finish_in_flight() {
+        if (in_flight_key_.empty()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(in_flight_mutex());
+        auto it = in_flight_queries().find(in_flight_key_);
+        if (it != in_flight_queries().end() && it->second == this) {
+            in_flight_queries().erase(it);
+        }
     }
-    Napi::Function callback = callback_val.As<Napi::Function>();
 
-    // validate tiles
-    if (!info[0].IsArray()) {
-        return utils::CallbackError("first arg 'tiles' must be an array of tile objects", info);
+    std::chrono::steady_clock::time_point queued_;
+    std::string in_flight_key_;
+    std::vector<Napi::FunctionReference> waiters_;
+    std::shared_ptr<ProgressState> progress_;
+    Napi::ThreadSafeFunction progress_fn_;
+};
+
+/// read the 'tiles' argument of a query, returns an error message or an empty string
+std::string parse_tiles(Napi::Value const& tiles_val,
+                        std::vector<TileInput>& tiles,
+                        TileMemory& tile_memory) {
+    if (!tiles_val.IsArray()) {
+        return "first arg 'tiles' must be an array of tile objects";
     }
 
-    Napi::Array tiles_arr_val = info[0].As<Napi::Array>();
+    Napi::Array tiles_arr_val = tiles_val.As<Napi::Array>();
     unsigned num_tiles = tiles_arr_val.Length();
 
     if (num_tiles <= 0) {
-        return utils::CallbackError("'tiles' array must be of length greater than 0", info);
+        return "'tiles' array must be of length greater than 0";
     }
 
-    std::unique_ptr<QueryData> query_data = std::make_unique<QueryData>(num_tiles);
-
+    tiles.reserve(num_tiles);
     for (unsigned t = 0; t < num_tiles; ++t) {
         Napi::Value tile_val = (tiles_arr_val).Get(t);
         if (!tile_val.IsObject()) {
-            return utils::CallbackError("items in 'tiles' array must be objects", info);
+            return "items in 'tiles' array must be objects";
         }
 
         Napi::Object tile_obj = tile_val.As<Napi::Object>();
-        // check buffer value
-        if (!tile_obj.Has("buffer")) {
-            return utils::CallbackError("item in 'tiles' array does not include a buffer value", info);
-        }
-        Napi::Value buf_val = tile_obj.Get("buffer");
-        if (buf_val.IsNull() || buf_val.IsUndefined()) {
-            return utils::CallbackError("buffer value in 'tiles' array item is null or undefined", info);
-        }
+        // check buffer value, or the key of a stored tile
+        vtzero::data_view data;
+        if (tile_obj.Has("stored")) {
+            if (tile_obj.Has("buffer")) {
+                return "item in 'tiles' array can not have both a 'buffer' and a 'stored' value";
+            }
+            Napi::Value stored_val = tile_obj.Get("stored");
+            if (!stored_val.IsString()) {
+                return "'stored' value in 'tiles' array item must be a string";
+            }
+            std::string const key = stored_val.As<Napi::String>();
+            StoredTile stored = find_stored_tile(key);
+            if (!stored) {
+                return "no tile is stored as '" + key + "'";
+            }
+            data = vtzero::data_view{stored->data(), stored->size()};
+            tile_memory.stored.push_back(std::move(stored));
+        } else {
+            if (!tile_obj.Has("buffer")) {
+                return "item in 'tiles' array does not include a buffer value";
+            }
+            Napi::Value buf_val = tile_obj.Get("buffer");
+            if (buf_val.IsNull() || buf_val.IsUndefined()) {
+                return "buffer value in 'tiles' array item is null or undefined";
+            }
 
-        Napi::Object buffer_obj = buf_val.As<Napi::Object>();
-        if (!buffer_obj.IsBuffer()) {
-            return utils::CallbackError("buffer value in 'tiles' array item is not a true buffer", info);
+            Napi::Object source = byte_source(buf_val, data);
+            if (source.IsEmpty()) {
+                return "buffer value in 'tiles' array item is not a true buffer";
+            }
+            tile_memory.objects.push_back(Napi::Persistent(source));
         }
-        Napi::Buffer<char> buffer = buffer_obj.As<Napi::Buffer<char>>();
 
         // z value
         if (!tile_obj.Has("z")) {
-            return utils::CallbackError("item in 'tiles' array does not include a 'z' value", info);
+            return "item in 'tiles' array does not include a 'z' value";
         }
         Napi::Value z_val = tile_obj.Get("z");
         if (!z_val.IsNumber()) {
-            return utils::CallbackError("'z' value in 'tiles' array item is not an int32", info);
+            return "'z' value in 'tiles' array item is not an int32";
         }
 
         std::int32_t z = z_val.As<Napi::Number>().Int32Value();
         if (z < 0) {
-            return utils::CallbackError("'z' value must not be less than zero", info);
+            return "'z' value must not be less than zero";
         }
 
         // x value
         if (!tile_obj.Has("x")) {
-            return utils::CallbackError("item in 'tiles' array does not include a 'x' value", info);
+            return "item in 'tiles' array does not include a 'x' value";
         }
         Napi::Value x_val = tile_obj.Get("x");
         if (!x_val.IsNumber()) {
-            return utils::CallbackError("'x' value in 'tiles' array item is not an int32", info);
+            return "'x' value in 'tiles' array item is not an int32";
         }
 
         std::int32_t x = x_val.As<Napi::Number>().Int32Value();
         if (x < 0) {
-            return utils::CallbackError("'x' value must not be less than zero", info);
+            return "'x' value must not be less than zero";
         }
 
         // y value
         if (!(tile_obj).Has("y")) {
-            return utils::CallbackError("item in 'tiles' array does not include a 'y' value", info);
+            return "item in 'tiles' array does not include a 'y' value";
         }
         Napi::Value y_val = tile_obj.Get("y");
         if (!y_val.IsNumber()) {
-            return utils::CallbackError("'y' value in 'tiles' array item is not an int32", info);
+            return "'y' value in 'tiles' array item is not an int32";
         }
 
         std::int32_t y = y_val.As<Napi::Number>().Int32Value();
         if (y < 0) {
-            return utils::CallbackError("'y' value must not be less than zero", info);
+            return "'y' value must not be less than zero";
         }
-        // in-place construction
-        query_data->tiles.push_back(std::make_unique<TileObject>(z, x, y, buffer));
-    }
+        TileInput tile{data, z, x, y};
 
-    // validate lng/lat array
-    if (!info[1].IsArray()) {
-        return utils::CallbackError("second arg 'lnglat' must be an array with [longitude, latitude] values", info);
+        // optional sidecar index
+        if (tile_obj.Has("index") && tile_obj.Has("index_path")) {
+            return "item in 'tiles' array can not have both an 'index' and an 'index_path' value";
+        }
+        if (tile_obj.Has("index")) {
+            Napi::Object index_source = byte_source(tile_obj.Get("index"), tile.index_data);
+            if (index_source.IsEmpty()) {
+                return "'index' value in 'tiles' array item is not a true buffer";
+            }
+            tile_memory.objects.push_back(Napi::Persistent(index_source));
+        }
+        if (tile_obj.Has("index_path")) {
+            Napi::Value index_path_val = tile_obj.Get("index_path");
+            if (!index_path_val.IsString()) {
+                return "'index_path' value in 'tiles' array item must be a string";
+            }
+            tile.index_path = index_path_val.As<Napi::String>();
+            if (tile.index_path.empty()) {
+                return "'index_path' value in 'tiles' array item must be a non-empty string";
+            }
+        }
+        tiles.push_back(std::move(tile));
     }
 
-    // Napi::Array lnglat_val(info[1]);
-    Napi::Array lnglat_val = info[1].As<Napi::Array>();
+    return "";
+}
+
+/// read a [longitude, latitude] array, returns an error message or an empty string
+std::string parse_lnglat(Napi::Value const& lnglat_arr_val, mapbox::geometry::point<double>& lnglat) {
+    Napi::Array lnglat_val = lnglat_arr_val.As<Napi::Array>();
     if (lnglat_val.Length() != 2) {
-        return utils::CallbackError("'lnglat' must be an array of [longitude, latitude]", info);
+        return "'lnglat' must be an array of [longitude, latitude]";
     }
 
     Napi::Value lng_val = lnglat_val.Get(0u);
     Napi::Value lat_val = lnglat_val.Get(1u);
     if (!lng_val.IsNumber() || !lat_val.IsNumber()) {
-        return utils::CallbackError("lnglat values must be numbers", info);
+        return "lnglat values must be numbers";
     }
-    query_data->longitude = lng_val.As<Napi::Number>().DoubleValue();
-    query_data->latitude = lat_val.As<Napi::Number>().DoubleValue();
+    lnglat.x = lng_val.As<Napi::Number>().DoubleValue();
+    lnglat.y = lat_val.As<Napi::Number>().DoubleValue();
+    return "";
+}
 
-    // validate options object if it exists
-    // defaults are set in the QueryData struct.
-    if (info.Length() > 3) {
+/// read the 'options' argument of a query, defaults are set in the QueryOptions struct.
+/// Returns an error message or an empty string
+std::string parse_query_options(Napi::Object const& options, QueryOptions& data) {
+    if (options.Has("dedupe")) {
+        Napi::Value dedupe_val = options.Get("dedupe");
+        if (!dedupe_val.IsBoolean()) {
+            return "'dedupe' must be a boolean";
+        }
 
-        if (!info[2].IsObject()) {
-            return utils::CallbackError("'options' arg must be an object", info);
+        bool dedupe = dedupe_val.As<Napi::Boolean>().Value();
+        data.dedupe = dedupe;
+    }
+
+    if (options.Has("direct_hit_polygon")) {
+        Napi::Value direct_hit_polygon_val = options.Get("direct_hit_polygon");
+        if (!direct_hit_polygon_val.IsBoolean()) {
+            return "'direct_hit_polygon' must be a boolean";
         }
 
-        Napi::Object options = info[2].As<Napi::Object>();
+        bool direct_hit_polygon = direct_hit_polygon_val.As<Napi::Boolean>().Value();
+        data.direct_hit_polygon = direct_hit_polygon;
+    }
+
+    if (options.Has("columnar")) {
+        Napi::Value columnar_val = options.Get("columnar");
+        if (!columnar_val.IsBoolean()) {
+            return "'columnar' must be a boolean";
+        }
 
-        if (options.Has("dedupe")) {
-            Napi::Value dedupe_val = options.Get("dedupe");
-            if (!dedupe_val.IsBoolean()) {
-                return utils::CallbackError("'dedupe' must be a boolean", info);
-            }
+        data.columnar = columnar_val.As<Napi::Boolean>().Value();
+    }
 
-            bool dedupe = dedupe_val.As<Napi::Boolean>().Value();
-            query_data->dedupe = dedupe;
+    if (options.Has("cache")) {
+        Napi::Value cache_val = options.Get("cache");
+        if (!cache_val.IsBoolean()) {
+            return "'cache' must be a boolean";
         }
 
-        if (options.Has("direct_hit_polygon")) {
-            Napi::Value direct_hit_polygon_val = options.Get("direct_hit_polygon");
-            if (!direct_hit_polygon_val.IsBoolean()) {
-                return utils::CallbackError("'direct_hit_polygon' must be a boolean", info);
-            }
+        data.cache = cache_val.As<Napi::Boolean>().Value();
+    }
 
-            bool direct_hit_polygon = direct_hit_polygon_val.As<Napi::Boolean>().Value();
-            query_data->direct_hit_polygon = direct_hit_polygon;
+    if (options.Has("radius")) {
+        Napi::Value radius_val = options.Get("radius");
+        if (!radius_val.IsNumber()) {
+            return "'radius' must be a number";
         }
 
-        if (options.Has("radius")) {
-            Napi::Value radius_val = options.Get("radius");
-            if (!radius_val.IsNumber()) {
-                return utils::CallbackError("'radius' must be a number", info);
-            }
+        double radius = radius_val.ToNumber();
+        if (radius < 0.0) {
+            return "'radius' must be a positive number";
+        }
 
-            double radius = radius_val.ToNumber();
-            if (radius < 0.0) {
-                return utils::CallbackError("'radius' must be a positive number", info);
-            }
+        data.radius = radius;
+    }
 
-            query_data->radius = radius;
+    if (options.Has("tolerance")) {
+        Napi::Value tolerance_val = options.Get("tolerance");
+        if (!tolerance_val.IsNumber()) {
+            return "'tolerance' must be a number";
         }
 
-        if (options.Has("limit")) {
-            Napi::Value num_results_val = options.Get("limit");
-            if (!num_results_val.IsNumber()) {
-                return utils::CallbackError("'limit' must be a number", info);
-            }
+        double tolerance = tolerance_val.As<Napi::Number>().DoubleValue();
+        if (!(tolerance >= 0.0)) {
+            return "'tolerance' must be a positive number";
+        }
 
-            std::int32_t num_results = num_results_val.As<Napi::Number>().Int32Value();
-            if (num_results < 1) {
-                return utils::CallbackError("'limit' must be 1 or greater", info);
-            }
-            if (num_results > 1000) {
-                return utils::CallbackError("'limit' must be less than 1000", info);
-            }
+        data.tolerance = tolerance;
+    }
 
-            query_data->num_results = static_cast<std::uint32_t>(num_results);
+    if (options.Has("max_memory")) {
+        Napi::Value max_memory_val = options.Get("max_memory");
+        if (!max_memory_val.IsNumber()) {
+            return "'max_memory' must be a number";
         }
 
-        if (options.Has("layers")) {
-            Napi::Value layers_val = options.Get("layers");
-            if (!layers_val.IsArray()) {
-                return utils::CallbackError("'layers' must be an array of strings", info);
-            }
+        double max_memory = max_memory_val.As<Napi::Number>().DoubleValue();
+        if (!(max_memory >= 1.0)) {
+            return "'max_memory' must be 1 or greater";
+        }
+
+        data.max_memory = static_cast<std::size_t>(max_memory);
+    }
+
+    if (options.Has("limit")) {
+        Napi::Value num_results_val = options.Get("limit");
+        if (!num_results_val.IsNumber()) {
+            return "'limit' must be a number";
+        }
+
+        std::int32_t num_results = num_results_val.As<Napi::Number>().Int32Value();
+        if (num_results < 1) {
+            return "'limit' must be 1 or greater";
+        }
+        if (num_results > 1000) {
+            return "'limit' must be less than 1000";
+        }
+
+        data.num_results = static_cast<std::uint32_t>(num_results);
+    }
+
+    if (options.Has("layers")) {
+        Napi::Value layers_val = options.Get("layers");
+        if (!layers_val.IsArray()) {
+            return "'layers' must be an array of strings";
+        }
+
+        Napi::Array layers_arr = layers_val.As<Napi::Array>();
+        unsigned num_layers = layers_arr.Length();
 
-            Napi::Array layers_arr = layers_val.As<Napi::Array>();
-            unsigned num_layers = layers_arr.Length();
-
-            // only gather layers if there are some in the array
-            if (num_layers > 0) {
-                for (unsigned j = 0; j < num_layers; ++j) {
-                    Napi::Value layer_val = layers_arr.Get(j);
-                    if (!layer_val.IsString()) {
-                        return utils::CallbackError("'layers' values must be strings", info);
-                    }
-                    std::string layer_name = layer_val.As<Napi::String>();
-                    if (layer_name.empty()) {
-                        return utils::CallbackError("'layers' values must be non-empty strings", info);
-                    }
-                    query_data->layers.emplace_back(layer_name);
+        // only gather layers if there are some in the array
+        if (num_layers > 0) {
+            for (unsigned j = 0; j < num_layers; ++j) {
+                Napi::Value layer_val = layers_arr.Get(j);
+                if (!layer_val.IsString()) {
+                    return "'layers' values must be strings";
                 }
+                std::string layer_name = layer_val.As<Napi::String>();
+                if (layer_name.empty()) {
+                    return "'layers' values must be non-empty strings";
+                }
+                data.layers.emplace(layer_name);
             }
         }
+    }
+
+    if (options.Has("geometry")) {
+        Napi::Value geometry_val = options.Get("geometry");
+        if (!geometry_val.IsString()) {
+            return "'geometry' option must be a string";
+        }
 
-        if (options.Has("geometry")) {
-            Napi::Value geometry_val = options.Get("geometry");
-            if (!geometry_val.IsString()) {
-                return utils::CallbackError("'geometry' option must be a string", info);
+        std::string geometry = geometry_val.As<Napi::String>();
+        if (geometry.empty()) {
+            return "'geometry' value must be a non-empty string";
+        }
+        if (geometry == "point") {
+            data.geometry_filter_type = GeomType::point;
+        } else if (geometry == "linestring") {
+            data.geometry_filter_type = GeomType::linestring;
+        } else if (geometry == "polygon") {
+            data.geometry_filter_type = GeomType::polygon;
+        } else {
+            return "'geometry' must be 'point', 'linestring', or 'polygon'";
+        }
+    }
+
+    if (options.Has("group_by")) {
+        static char const* const group_by_error = "'group_by' must be 'layer', 'geometry' or an array of them";
+        Napi::Value group_by_val = options.Get("group_by");
+        std::vector<Napi::Value> groups;
+        if (group_by_val.IsString()) {
+            groups.push_back(group_by_val);
+        } else if (group_by_val.IsArray()) {
+            Napi::Array group_by_arr = group_by_val.As<Napi::Array>();
+            for (unsigned j = 0; j < group_by_arr.Length(); ++j) {
+                groups.push_back(group_by_arr.Get(j));
             }
+        } else {
+            return group_by_error;
+        }
 
-            std::string geometry = geometry_val.As<Napi::String>();
-            if (geometry.empty()) {
-                return utils::CallbackError("'geometry' value must be a non-empty string", info);
+        for (auto const& group_val : groups) {
+            if (!group_val.IsString()) {
+                return group_by_error;
             }
-            if (geometry == "point") {
-                query_data->geometry_filter_type = GeomType::point;
-            } else if (geometry == "linestring") {
-                query_data->geometry_filter_type = GeomType::linestring;
-            } else if (geometry == "polygon") {
-                query_data->geometry_filter_type = GeomType::polygon;
+            std::string group = group_val.As<Napi::String>();
+            if (group == "layer") {
+                data.group_by_layer = true;
+            } else if (group == "geometry") {
+                data.group_by_geometry = true;
             } else {
-                return utils::CallbackError("'geometry' must be 'point', 'linestring', or 'polygon'", info);
+                return group_by_error;
             }
         }
+    }
+
+    if (options.Has("basic-filters")) {
+        Napi::Value basic_filter_val = options.Get("basic-filters");
+        if (basic_filter_val.IsArrayBuffer()) {
+            return "'basic-filters' must be of the form [type, [filters]]";
+        }
+
+        Napi::Array basic_filter_array = basic_filter_val.As<Napi::Array>();
+        unsigned basic_filter_length = basic_filter_array.Length();
 
-        if (options.Has("basic-filters")) {
-            Napi::Value basic_filter_val = options.Get("basic-filters");
-            if (basic_filter_val.IsArrayBuffer()) {
-                return utils::CallbackError("'basic-filters' must be of the form [type, [filters]]", info);
+        // gather filters from an array
+        if (basic_filter_length == 2) {
+            Napi::Value basic_filter_type = (basic_filter_array).Get(0u);
+            if (!basic_filter_type.IsString()) {
+                return "'basic-filters' must be of the form [string, [filters]]";
             }
+            std::string basic_filter_type_str = basic_filter_type.As<Napi::String>();
+            if (basic_filter_type_str == "all") {
+                data.basic_filter.type = filter_all;
+            } else if (basic_filter_type_str == "any") {
+                data.basic_filter.type = filter_any;
+            } else {
+                return "'basic-filters[0] must be 'any' or 'all'";
+            }
+
+            Napi::Value filters_array_val = basic_filter_array.Get(1u);
+            if (!filters_array_val.IsArray()) {
+                return "'basic-filters' must be of the form [type, [filters]]";
+            }
+
+            Napi::Array filters_array = filters_array_val.As<Napi::Array>();
+            unsigned num_filters = filters_array.Length();
+            for (unsigned j = 0; j < num_filters; ++j) {
+                basic_filter_struct filter;
+                Napi::Value filter_val = filters_array.Get(j);
+                if (!filter_val.IsArray()) {
+                    return "filters must be of the form [parameter, condition, value]";
+                }
+                Napi::Array filter_array = filter_val.As<Napi::Array>();
+                unsigned filter_length = filter_array.Length();
+
+                if (filter_length != 3) {
+                    return "filters must be of the form [parameter, condition, value]";
+                }
+
+                Napi::Value filter_parameter_val = filter_array.Get(0u);
+                if (!filter_parameter_val.IsString()) {
+                    return "parameter filter option must be a string";
+                }
 
-            Napi::Array basic_filter_array = basic_filter_val.As<Napi::Array>();
-            unsigned basic_filter_length = basic_filter_array.Length();
+                std::string filter_parameter = filter_parameter_val.As<Napi::String>();
+                if (filter_parameter.empty()) {
+                    return "parameter filter value must be a non-empty string";
+                }
+                filter.key = filter_parameter;
 
-            // gather filters from an array
-            if (basic_filter_length == 2) {
-                Napi::Value basic_filter_type = (basic_filter_array).Get(0u);
-                if (!basic_filter_type.IsString()) {
-                    return utils::CallbackError("'basic-filters' must be of the form [string, [filters]]", info);
+                Napi::Value filter_condition_val = filter_array.Get(1u);
+                if (!filter_condition_val.IsString()) {
+                    return "condition filter option must be a string";
                 }
-                std::string basic_filter_type_str = basic_filter_type.As<Napi::String>();
-                if (basic_filter_type_str == "all") {
-                    query_data->basic_filter.type = filter_all;
-                } else if (basic_filter_type_str == "any") {
-                    query_data->basic_filter.type = filter_any;
+
+                std::string filter_condition = filter_condition_val.As<Napi::String>();
+                if (filter_condition.empty()) {
+                    return "condition filter value must be a non-empty string";
+                }
+                if (filter_condition == "=") {
+                    filter.type = eq;
+                } else if (filter_condition == "!=") {
+                    filter.type = ne;
+                } else if (filter_condition == "<") {
+                    filter.type = lt;
+                } else if (filter_condition == "<=") {
+                    filter.type = lte;
+                } else if (filter_condition == ">") {
+                    filter.type = gt;
+                } else if (filter_condition == ">=") {
+                    filter.type = gte;
                 } else {
-                    return utils::CallbackError("'basic-filters[0] must be 'any' or 'all'", info);
+                    return "condition filter value must be =, !=, <, <=, >, or >=";
                 }
 
-                Napi::Value filters_array_val = basic_filter_array.Get(1u);
-                if (!filters_array_val.IsArray()) {
-                    return utils::CallbackError("'basic-filters' must be of the form [type, [filters]]", info);
+                Napi::Value filter_value_val = filter_array.Get(2u);
+                if (filter_value_val.IsNumber()) {
+                    double filter_value_double = filter_value_val.As<Napi::Number>().DoubleValue();
+                    filter.value = filter_value_double;
+                } else if (filter_value_val.IsBoolean()) {
+                    filter.value = filter_value_val.As<Napi::Boolean>();
+                } else {
+                    return "value filter value must be a number or boolean";
                 }
+                data.basic_filter.filters.push_back(filter);
+            }
+        } else {
+            return "'basic-filters' must be of the form [type, [filters]]";
+        }
+    }
+    return "";
+}
+
+/// the options of queries made without an options argument
+std::shared_ptr<QueryOptions const> const& default_query_options() {
+    static auto const options = std::make_shared<QueryOptions const>();
+    return options;
+}
+
+/**
+  Query options validated once by vtquery.compile(), then shared without
+  copying by every query they are passed to.
+*/
+class CompiledOptions : public Napi::ObjectWrap<CompiledOptions> {
+  public:
+    static void Init(Napi::Env env, Napi::Object exports) {
+        Napi::Function func = DefineClass(env, "CompiledOptions", {InstanceAccessor<&CompiledOptions::cache>("cache"),
+                                                                  InstanceAccessor<&CompiledOptions::columnar>("columnar")});
+        constructor(env) = Napi::Persistent(func);
+        exports.Set("CompiledOptions", func);
+    }
+
+    /// wrap options, only called by compile()
+    static Napi::Object New(Napi::Env env, std::shared_ptr<QueryOptions const> options) {
+        return constructor(env).New({Napi::External<std::shared_ptr<QueryOptions const>>::New(env, &options)});
+    }
+
+    /// the compiled options held by `value`, or nullptr if it is not a CompiledOptions object
+    static std::shared_ptr<QueryOptions const> unwrap(Napi::Object const& value) {
+        if (!value.InstanceOf(constructor(value.Env()).Value())) {
+            return nullptr;
+        }
+        return Unwrap(value)->options_;
+    }
 
-                Napi::Array filters_array = filters_array_val.As<Napi::Array>();
-                unsigned num_filters = filters_array.Length();
-                for (unsigned j = 0; j < num_filters; ++j) {
-                    basic_filter_struct filter;
-                    Napi::Value filter_val = filters_array.Get(j);
-                    if (!filter_val.IsArray()) {
-                        return utils::CallbackError("filters must be of the form [parameter, condition, value]", info);
-                    }
-                    Napi::Array filter_array = filter_val.As<Napi::Array>();
-                    unsigned filter_length = filter_array.Length();
-
-                    if (filter_length != 3) {
-                        return utils::CallbackError("filters must be of the form [parameter, condition, value]", info);
-                    }
-
-                    Napi::Value filter_parameter_val = filter_array.Get(0u);
-                    if (!filter_parameter_val.IsString()) {
-                        return utils::CallbackError("parameter filter option must be a string", info);
-                    }
-
-                    std::string filter_parameter = filter_parameter_val.As<Napi::String>();
-                    if (filter_parameter.empty()) {
-                        return utils::CallbackError("parameter filter value must be a non-empty string", info);
-                    }
-                    filter.key = filter_parameter;
-
-                    Napi::Value filter_condition_val = filter_array.Get(1u);
-                    if (!filter_condition_val.IsString()) {
-                        return utils::CallbackError("condition filter option must be a string", info);
-                    }
-
-                    std::string filter_condition = filter_condition_val.As<Napi::String>();
-                    if (filter_condition.empty()) {
-                        return utils::CallbackError("condition filter value must be a non-empty string", info);
-                    }
-                    if (filter_condition == "=") {
-                        filter.type = eq;
-                    } else if (filter_condition == "!=") {
-                        filter.type = ne;
-                    } else if (filter_condition == "<") {
-                        filter.type = lt;
-                    } else if (filter_condition == "<=") {
-                        filter.type = lte;
-                    } else if (filter_condition == ">") {
-                        filter.type = gt;
-                    } else if (filter_condition == ">=") {
-                        filter.type = gte;
-                    } else {
-                        return utils::CallbackError("condition filter value must be =, !=, <, <=, >, or >=", info);
-                    }
-
-                    Napi::Value filter_value_val = filter_array.Get(2u);
-                    if (filter_value_val.IsNumber()) {
-                        double filter_value_double = filter_value_val.As<Napi::Number>().DoubleValue();
-                        filter.value = filter_value_double;
-                    } else if (filter_value_val.IsBoolean()) {
-                        filter.value = filter_value_val.As<Napi::Boolean>();
-                    } else {
-                        return utils::CallbackError("value filter value must be a number or boolean", info);
-                    }
-                    query_data->basic_filter.filters.push_back(filter);
+    explicit CompiledOptions(Napi::CallbackInfo const& info)
+        : Napi::ObjectWrap<CompiledOptions>(info) {
+        if (info.Length() != 1 || !info[0].IsExternal()) {
+            Napi::TypeError::New(info.Env(), "use vtquery.compile() to create compiled options").ThrowAsJavaScriptException();
+            return;
+        }
+        options_ = *info[0].As<Napi::External<std::shared_ptr<QueryOptions const>>>().Data();
+    }
+
+    /// whether queries with these options use the result cache, read by the batch scheduler
+    Napi::Value cache(Napi::CallbackInfo const& info) {
+        return Napi::Boolean::New(info.Env(), options_ && options_->cache);
+    }
+
+    /// whether queries with these options use columnar tiles, read by the batch scheduler
+    Napi::Value columnar(Napi::CallbackInfo const& info) {
+        return Napi::Boolean::New(info.Env(), options_ && options_->columnar);
+    }
+
+  private:
+    /// each environment has a class of its own, objects from one can not be passed to another
+    static Napi::FunctionReference& constructor(Napi::Env env) {
+        return env.GetInstanceData<InstanceData>()->compiled_options;
+    }
+
+    std::shared_ptr<QueryOptions const> options_;
+};
+
+/**
+  Read the optional options argument of a query, the one before the callback,
+  either compiled options or a plain object to parse. Returns an error message
+  or an empty string
+*/
+std::string options_argument(Napi::CallbackInfo const& info, std::shared_ptr<QueryOptions const>& options) {
+    if (info.Length() <= 3) {
+        options = default_query_options();
+        return "";
+    }
+    if (!info[2].IsObject()) {
+        return "'options' arg must be an object";
+    }
+    Napi::Object options_obj = info[2].As<Napi::Object>();
+    options = CompiledOptions::unwrap(options_obj);
+    if (options) {
+        return "";
+    }
+    auto parsed = std::make_shared<QueryOptions>();
+    std::string error = parse_query_options(options_obj, *parsed);
+    options = std::move(parsed);
+    return error;
+}
+
+/**
+  Read the optional 'progress' callback from the options argument. It belongs to
+  one query, so it is read apart from the options that can be compiled.
+  Returns an error message or an empty string
+*/
+std::string progress_argument(Napi::CallbackInfo const& info, Napi::Function& progress) {
+    if (info.Length() <= 3 || !info[2].IsObject()) {
+        return "";
+    }
+    Napi::Object options_obj = info[2].As<Napi::Object>();
+    if (!options_obj.Has("progress")) {
+        return "";
+    }
+    Napi::Value progress_val = options_obj.Get("progress");
+    if (!progress_val.IsFunction()) {
+        return "'progress' must be a function";
+    }
+    progress = progress_val.As<Napi::Function>();
+    return "";
+}
+
+Napi::Value vtquery(Napi::CallbackInfo const& info) {
+    // validate callback function
+    // validate callback function
+    std::size_t length = info.Length();
+    if (length == 0) {
+        Napi::Error::New(info.Env(), "last argument must be a callback function").ThrowAsJavaScriptException();
+        return info.Env().Null();
+    }
+    Napi::Value callback_val = info[info.Length() - 1];
+    if (!callback_val.IsFunction()) {
+        Napi::Error::New(info.Env(), "last argument must be a callback function").ThrowAsJavaScriptException();
+        return info.Env().Null();
+    }
+    Napi::Function callback = callback_val.As<Napi::Function>();
+
+    std::unique_ptr<QueryData> query_data = std::make_unique<QueryData>();
+    std::string error = parse_tiles(info[0], query_data->tiles, query_data->tile_memory);
+    if (!error.empty()) {
+        return utils::CallbackError(error, info);
+    }
+
+    // validate lng/lat array
+    if (!info[1].IsArray()) {
+        return utils::CallbackError("second arg 'lnglat' must be an array with [longitude, latitude] values", info);
+    }
+    mapbox::geometry::point<double> lnglat;
+    error = parse_lnglat(info[1], lnglat);
+    if (!error.empty()) {
+        return utils::CallbackError(error, info);
+    }
+    query_data->longitude = lnglat.x;
+    query_data->latitude = lnglat.y;
+
+    // validate options object if it exists
+    error = options_argument(info, query_data->options);
+    if (!error.empty()) {
+        return utils::CallbackError(error, info);
+    }
+    Napi::Function progress;
+    error = progress_argument(info, progress);
+    if (!error.empty()) {
+        return utils::CallbackError(error, info);
+    }
+
+    // queries reporting progress have a callback of their own to serve
+    if (!progress.IsEmpty()) {
+        auto* worker = new Worker{std::move(query_data), callback};
+        worker->start_progress(info.Env(), progress);
+        worker->Queue();
+        return info.Env().Undefined();
+    }
+
+    // join an identical query that is already running
+    std::string key = in_flight_key(info.Env(), *query_data);
+    {
+        std::lock_guard<std::mutex> lock(in_flight_mutex());
+        auto it = in_flight_queries().find(key);
+        if (it != in_flight_queries().end()) {
+            it->second->add_waiter(callback);
+            ++coalesced_queries();
+            metrics::count(metrics::queries);
+            return info.Env().Undefined();
+        }
+    }
+
+    auto* worker = new Worker{std::move(query_data), callback};
+    worker->start_in_flight(std::move(key));
+    worker->Queue();
+    return info.Env().Undefined();
+}
+
+/**
+  Answers many query points against the same tiles with one scan of their features.
+
+  The tiles are always queried in their columnar form, decoded once and shared
+  with every point of the batch. A point whose own results go over max_memory
+  gets an Error in place of its FeatureCollection, the others are unaffected.
+*/
+struct BatchWorker : Napi::AsyncWorker {
+    using Base = Napi::AsyncWorker;
+
+    std::unique_ptr<BatchData> batch_data_;
+    std::vector<PointResults> point_results_;
+    std::chrono::steady_clock::time_point queued_;
+
+    BatchWorker(std::unique_ptr<BatchData> batch_data,
+                Napi::Function& cb)
+        : Base(cb),
+          batch_data_(std::move(batch_data)),
+          queued_(std::chrono::steady_clock::now()) {}
+
+    void Execute() override {
+        metrics::record(metrics::queue_wait_ns, metrics::elapsed_ns(queued_));
+        auto const start = std::chrono::steady_clock::now();
+        // every point is a query of its own
+        metrics::count(metrics::queries, batch_data_->points.size());
+        BatchData const& data = *batch_data_;
+        std::string error;
+        try {
+            point_results_ = query_batch(data.tiles, data.points, *data.options);
+        } catch (std::exception const& e) {
+            metrics::count(metrics::errors, batch_data_->points.size());
+            error = e.what();
+            SetError(error);
+        }
+        for (std::size_t p = 0; p < point_results_.size(); ++p) {
+            if (!point_results_[p].error.empty()) {
+                metrics::count(metrics::errors);
+                if (error.empty()) {
+                    // the capture replays every point, it names the first that failed
+                    error = "point " + std::to_string(p) + ": " + point_results_[p].error;
                 }
+            }
+        }
+        std::uint64_t const execute_ns = metrics::elapsed_ns(start);
+        metrics::record(metrics::execute_ns, execute_ns);
+        capture::get_recorder().capture(execute_ns, true, data.tiles, data.points, *data.options, error);
+    }
+
+    std::vector<napi_value> GetResult(Napi::Env env) override {
+        Napi::Array collections = Napi::Array::New(env, point_results_.size());
+        for (std::size_t p = 0; p < point_results_.size(); ++p) {
+            auto const index = static_cast<std::uint32_t>(p);
+            if (point_results_[p].error.empty()) {
+                collections.Set(index, create_feature_collection(env, point_results_[p].results));
             } else {
-                return utils::CallbackError("'basic-filters' must be of the form [type, [filters]]", info);
+                collections.Set(index, Napi::Error::New(env, point_results_[p].error).Value());
             }
         }
+        return {env.Undefined(), napi_value(collections)};
     }
+};
 
-    auto* worker = new Worker{std::move(query_data), callback};
+Napi::Value batch(Napi::CallbackInfo const& info) {
+    std::size_t length = info.Length();
+    if (length == 0 || !info[length - 1].IsFunction()) {
+        Napi::Error::New(info.Env(), "last argument must be a callback function").ThrowAsJavaScriptException();
+        return info.Env().Null();
+    }
+    Napi::Function callback = info[length - 1].As<Napi::Function>();
+
+    std::unique_ptr<BatchData> batch_data = std::make_unique<BatchData>();
+    std::string error = parse_tiles(info[0], batch_data->tiles, batch_data->tile_memory);
+    if (!error.empty()) {
+        return utils::CallbackError(error, info);
+    }
+
+    if (!info[1].IsArray() || info[1].As<Napi::Array>().Length() == 0) {
+        return utils::CallbackError("second arg 'points' must be a non-empty array of [longitude, latitude] values", info);
+    }
+    Napi::Array points_arr = info[1].As<Napi::Array>();
+    batch_data->points.resize(points_arr.Length());
+    for (std::uint32_t p = 0; p < points_arr.Length(); ++p) {
+        Napi::Value point_val = points_arr.Get(p);
+        if (!point_val.IsArray()) {
+            return utils::CallbackError("items in 'points' array must be [longitude, latitude] arrays", info);
+        }
+        error = parse_lnglat(point_val, batch_data->points[p]);
+        if (!error.empty()) {
+            return utils::CallbackError(error, info);
+        }
+    }
+
+    error = options_argument(info, batch_data->options);
+    if (!error.empty()) {
+        return utils::CallbackError(error, info);
+    }
+    Napi::Function progress;
+    error = progress_argument(info, progress);
+    if (error.empty() && !progress.IsEmpty()) {
+        error = "'progress' is not supported by batch";
+    }
+    if (!error.empty()) {
+        return utils::CallbackError(error, info);
+    }
+
+    auto* worker = new BatchWorker{std::move(batch_data), callback};
     worker->Queue();
     return info.Env().Undefined();
 }
 
+Napi::Value compile(Napi::CallbackInfo const& info) {
+    if (info.Length() < 1 || !info[0].IsObject()) {
+        Napi::TypeError::New(info.Env(), "first arg 'options' must be an object").ThrowAsJavaScriptException();
+        return info.Env().Null();
+    }
+    if (info[0].As<Napi::Object>().Has("progress")) {
+        Napi::TypeError::New(info.Env(), "'progress' can not be compiled, pass it in the options of a query").ThrowAsJavaScriptException();
+        return info.Env().Null();
+    }
+    auto options = std::make_shared<QueryOptions>();
+    std::string const error = parse_query_options(info[0].As<Napi::Object>(), *options);
+    if (!error.empty()) {
+        Napi::TypeError::New(info.Env(), error).ThrowAsJavaScriptException();
+        return info.Env().Null();
+    }
+    return CompiledOptions::New(info.Env(), std::move(options));
+}
+
+void init_compiled_options(Napi::Env env, Napi::Object exports) {
+    env.SetInstanceData(new InstanceData{env});
+    CompiledOptions::Init(env, exports);
+}
+
+Napi::Value stats(Napi::CallbackInfo const& info) {
+    Napi::Object stats_obj = Napi::Object::New(info.Env());
+    stats_obj.Set("coalesced", static_cast<double>(coalesced_queries().load()));
+    std::size_t stored_bytes = 0;
+    std::size_t stored_tiles = 0;
+    {
+        std::lock_guard<std::mutex> lock(tile_store_mutex());
+        for (auto const& entry : tile_store()) {
+            stored_bytes += entry.second->size();
+        }
+        stored_tiles = tile_store().size();
+    }
+    stats_obj.Set("stored_tiles", static_cast<double>(stored_tiles));
+    stats_obj.Set("stored_bytes", static_cast<double>(stored_bytes));
+    MemoryStats const memory = memory_stats();
+    stats_obj.Set("memory_current", static_cast<double>(memory.current));
+    stats_obj.Set("memory_peak", static_cast<double>(memory.peak));
+    stats_obj.Set("memory_exceeded", static_cast<double>(memory.exceeded));
+    capture::recorder const& recorder = capture::get_recorder();
+    stats_obj.Set("captured_queries", static_cast<double>(recorder.captured()));
+    stats_obj.Set("captured_bytes", static_cast<double>(recorder.bytes()));
+    stats_obj.Set("capture_dropped", static_cast<double>(recorder.dropped()));
+    return stats_obj;
+}
+
+Napi::Value configure(Napi::CallbackInfo const& info) {
+    if (info.Length() < 1 || !info[0].IsObject()) {
+        Napi::TypeError::New(info.Env(), "first arg 'options' must be an object").ThrowAsJavaScriptException();
+        return info.Env().Null();
+    }
+    Napi::Object options = info[0].As<Napi::Object>();
+
+    if (options.Has("result_cache_bytes")) {
+        Napi::Value bytes_val = options.Get("result_cache_bytes");
+        if (!bytes_val.IsNumber() || bytes_val.As<Napi::Number>().DoubleValue() < 0.0) {
+            Napi::TypeError::New(info.Env(), "'result_cache_bytes' must be a positive number").ThrowAsJavaScriptException();
+            return info.Env().Null();
+        }
+        set_result_cache_capacity(static_cast<std::size_t>(bytes_val.As<Napi::Number>().DoubleValue()));
+    }
+
+    // the threshold and size come first, so a new directory starts capturing with them
+    if (options.Has("capture_threshold_ms")) {
+        Napi::Value threshold_val = options.Get("capture_threshold_ms");
+        if (!threshold_val.IsNumber() || !(threshold_val.As<Napi::Number>().DoubleValue() >= 0.0)) {
+            Napi::TypeError::New(info.Env(), "'capture_threshold_ms' must be a positive number").ThrowAsJavaScriptException();
+            return info.Env().Null();
+        }
+        capture::get_recorder().set_threshold_ns(static_cast<std::uint64_t>(threshold_val.As<Napi::Number>().DoubleValue() * 1e6));
+    }
+
+    if (options.Has("capture_max_bytes")) {
+        Napi::Value max_bytes_val = options.Get("capture_max_bytes");
+        if (!max_bytes_val.IsNumber() || !(max_bytes_val.As<Napi::Number>().DoubleValue() >= 0.0)) {
+            Napi::TypeError::New(info.Env(), "'capture_max_bytes' must be a positive number").ThrowAsJavaScriptException();
+            return info.Env().Null();
+        }
+        capture::get_recorder().set_max_bytes(static_cast<std::uint64_t>(max_bytes_val.As<Napi::Number>().DoubleValue()));
+    }
+
+    if (options.Has("capture_dir")) {
+        Napi::Value dir_val = options.Get("capture_dir");
+        if (!dir_val.IsString() && !dir_val.IsNull()) {
+            Napi::TypeError::New(info.Env(), "'capture_dir' must be a string or null").ThrowAsJavaScriptException();
+            return info.Env().Null();
+        }
+        try {
+            capture::get_recorder().set_directory(dir_val.IsString() ? dir_val.As<Napi::String>().Utf8Value() : "");
+        } catch (std::exception const& e) {
+            Napi::Error::New(info.Env(), e.what()).ThrowAsJavaScriptException();
+            return info.Env().Null();
+        }
+    }
+
+    return info.Env().Undefined();
+}
+
+/// a histogram of a metrics snapshot as a JS object, only the buckets holding values are listed
+Napi::Object histogram_object(Napi::Env env, metrics::histogram const& hist) {
+    Napi::Object hist_obj = Napi::Object::New(env);
+    hist_obj.Set("count", static_cast<double>(hist.count));
+    hist_obj.Set("sum", static_cast<double>(hist.sum));
+    hist_obj.Set("p50", static_cast<double>(hist.quantile(0.5)));
+    hist_obj.Set("p90", static_cast<double>(hist.quantile(0.9)));
+    hist_obj.Set("p99", static_cast<double>(hist.quantile(0.99)));
+    hist_obj.Set("p999", static_cast<double>(hist.quantile(0.999)));
+    hist_obj.Set("max", static_cast<double>(hist.quantile(1.0)));
+    Napi::Array buckets = Napi::Array::New(env);
+    std::uint32_t num_buckets = 0;
+    for (std::size_t b = 0; b < metrics::num_buckets; ++b) {
+        if (hist.buckets[b] > 0) {
+            Napi::Array bucket = Napi::Array::New(env, 2);
+            bucket.Set(0u, static_cast<double>(metrics::bucket_upper_bound(b)));
+            bucket.Set(1u, static_cast<double>(hist.buckets[b]));
+            buckets.Set(num_buckets++, bucket);
+        }
+    }
+    hist_obj.Set("buckets", buckets);
+    return hist_obj;
+}
+
+Napi::Value metrics_snapshot(Napi::CallbackInfo const& info) {
+    bool prometheus = false;
+    if (info.Length() > 0 && !info[0].IsUndefined()) {
+        if (!info[0].IsObject()) {
+            Napi::TypeError::New(info.Env(), "first arg 'options' must be an object").ThrowAsJavaScriptException();
+            return info.Env().Null();
+        }
+        Napi::Object options = info[0].As<Napi::Object>();
+        if (options.Has("format")) {
+            Napi::Value format_val = options.Get("format");
+            std::string const format = format_val.IsString() ? format_val.As<Napi::String>().Utf8Value() : "";
+            if (format != "json" && format != "prometheus") {
+                Napi::TypeError::New(info.Env(), "'format' must be 'json' or 'prometheus'").ThrowAsJavaScriptException();
+                return info.Env().Null();
+            }
+            prometheus = format == "prometheus";
+        }
+    }
+
+    metrics::snapshot totals;
+    metrics::snapshot const delta = metrics::drain(totals);
+    if (prometheus) {
+        return Napi::String::New(info.Env(), metrics::render_prometheus(totals));
+    }
+    Napi::Object metrics_obj = Napi::Object::New(info.Env());
+    for (std::size_t c = 0; c < metrics::num_counters; ++c) {
+        metrics_obj.Set(metrics::counter_name(static_cast<metrics::counter_id>(c)), static_cast<double>(delta.counters[c]));
+    }
+    for (std::size_t h = 0; h < metrics::num_histograms; ++h) {
+        metrics_obj.Set(metrics::histogram_name(static_cast<metrics::histogram_id>(h)), histogram_object(info.Env(), delta.histograms[h]));
+    }
+    return metrics_obj;
+}
+
+/// builds the sidecar index of one tile
+struct BuildIndexWorker : Napi::AsyncWorker {
+    using Base = Napi::AsyncWorker;
+
+    BuildIndexWorker(Napi::Object const& source, vtzero::data_view data, Napi::Function& cb)
+        : Base(cb),
+          data_{data},
+          source_ref_{Napi::Persistent(source)} {}
+
+    void Execute() override {
+        try {
+            index_ = VectorTileQuery::build_index(data_);
+        } catch (std::exception const& e) {
+            SetError(e.what());
+        }
+    }
+
+    std::vector<napi_value> GetResult(Napi::Env env) override {
+        return {env.Undefined(), napi_value(Napi::Buffer<char>::Copy(env, index_.data(), index_.size()))};
+    }
+
+  private:
+    vtzero::data_view data_;
+    Napi::ObjectReference source_ref_;
+    std::string index_;
+};
+
+Napi::Value build_index(Napi::CallbackInfo const& info) {
+    std::size_t length = info.Length();
+    if (length == 0 || !info[length - 1].IsFunction()) {
+        Napi::Error::New(info.Env(), "last argument must be a callback function").ThrowAsJavaScriptException();
+        return info.Env().Null();
+    }
+    Napi::Function callback = info[length - 1].As<Napi::Function>();
+
+    vtzero::data_view data;
+    Napi::Object source = length < 2 ? Napi::Object{} : byte_source(info[0], data);
+    if (source.IsEmpty()) {
+        return utils::CallbackError("first arg 'buffer' must be a tile buffer", info);
+    }
+
+    auto* worker = new BuildIndexWorker{source, data, callback};
+    worker->Queue();
+    return info.Env().Undefined();
+}
+
+Napi::Value store_tile(Napi::CallbackInfo const& info) {
+    if (info.Length() < 1 || !info[0].IsString() || info[0].As<Napi::String>().Utf8Value().empty()) {
+        Napi::TypeError::New(info.Env(), "first arg 'key' must be a non-empty string").ThrowAsJavaScriptException();
+        return info.Env().Null();
+    }
+    vtzero::data_view data;
+    if (info.Length() < 2 || byte_source(info[1], data).IsEmpty()) {
+        Napi::TypeError::New(info.Env(), "second arg 'buffer' must be a tile buffer").ThrowAsJavaScriptException();
+        return info.Env().Null();
+    }
+    // copied outside the lock, the old copy is freed once no query holds it
+    auto tile = std::make_shared<std::string const>(data.data(), data.size());
+    std::string const key = info[0].As<Napi::String>();
+    {
+        std::lock_guard<std::mutex> lock(tile_store_mutex());
+        tile_store()[key] = std::move(tile);
+    }
+    return info.Env().Undefined();
+}
+
+Napi::Value drop_tile(Napi::CallbackInfo const& info) {
+    if (info.Length() < 1 || !info[0].IsString()) {
+        Napi::TypeError::New(info.Env(), "first arg 'key' must be a string").ThrowAsJavaScriptException();
+        return info.Env().Null();
+    }
+    std::string const key = info[0].As<Napi::String>();
+    StoredTile dropped;
+    {
+        std::lock_guard<std::mutex> lock(tile_store_mutex());
+        auto it = tile_store().find(key);
+        if (it != tile_store().end()) {
+            dropped = std::move(it->second);
+            tile_store().erase(it);
+        }
+    }
+    return Napi::Boolean::New(info.Env(), dropped != nullptr);
+}
+
 } // namespace VectorTileQuery
@@ -3,4 +3,13 @@
 
 namespace VectorTileQuery {
 Napi::Value vtquery(Napi::CallbackInfo const& info);
+Napi::Value batch(Napi::CallbackInfo const& info);
+Napi::Value compile(Napi::CallbackInfo const& info);
+void init_compiled_options(Napi::Env env, Napi::Object exports);
+Napi::Value build_index(Napi::CallbackInfo const& info);
+Napi::Value configure(Napi::CallbackInfo const& info);
+Napi::Value stats(Napi::CallbackInfo const& info);
+Napi::Value metrics_snapshot(Napi::CallbackInfo const& info);
+Napi::Value store_tile(Napi::CallbackInfo const& info);
+Napi::Value drop_tile(Napi::CallbackInfo const& info);
 }
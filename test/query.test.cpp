@@ -0,0 +1,659 @@
+// Unit tests of the query engine in src/query.hpp, without node.
+//
+// Tiles are built in memory with vtzero's builder so every expected feature,
+// and roughly every expected distance, is known up front. At z15 in San
+// Francisco one unit of a 4096 extent tile is about 0.23 meters.
+#include "../src/capture.hpp"
+#include "../src/query.hpp"
+#include "../src/util.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <exception>
+#include <functional>
+#include <gzip/compress.hpp>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <vtzero/builder.hpp>
+
+namespace {
+
+using VectorTileQuery::QueryOptions;
+using VectorTileQuery::ResultObject;
+using VectorTileQuery::TileInput;
+
+constexpr std::int32_t tile_z = 15;
+constexpr std::int32_t tile_x = 5238;
+constexpr std::int32_t tile_y = 12666;
+constexpr std::uint32_t extent = 4096;
+
+int failures = 0;
+
+void check(bool ok, char const* expr, char const* file, int line) {
+    if (!ok) {
+        ++failures;
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+    }
+}
+
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+void add_poi(vtzero::layer_builder& layer, std::uint64_t id, std::int32_t x, std::int32_t y, char const* name, std::int32_t rank) {
+    vtzero::point_feature_builder feature{layer};
+    feature.set_id(id);
+    feature.add_point(x, y);
+    feature.add_property("name", name);
+    feature.add_property("rank", rank);
+    feature.commit();
+}
+
+/// three points, a square park and a road across the tile
+std::string make_tile() {
+    vtzero::tile_builder tile;
+    {
+        vtzero::layer_builder pois{tile, "poi", 2, extent};
+        add_poi(pois, 1, 1000, 1000, "cafe", 3);
+        add_poi(pois, 2, 1010, 1000, "bar", 1);
+        add_poi(pois, 3, 3000, 3000, "museum", 5);
+    }
+    {
+        vtzero::layer_builder parks{tile, "park", 2, extent};
+        vtzero::polygon_feature_builder feature{parks};
+        feature.set_id(10);
+        feature.add_ring(5);
+        feature.set_point(2000, 2000);
+        feature.set_point(2400, 2000);
+        feature.set_point(2400, 2400);
+        feature.set_point(2000, 2400);
+        feature.set_point(2000, 2000);
+        feature.add_property("name", "green");
+        feature.commit();
+    }
+    {
+        vtzero::layer_builder roads{tile, "road", 2, extent};
+        vtzero::linestring_feature_builder feature{roads};
+        feature.set_id(20);
+        feature.add_linestring(2);
+        feature.set_point(0, 1200);
+        feature.set_point(4096, 1200);
+        feature.add_property("class", "street");
+        feature.commit();
+    }
+    return tile.serialize();
+}
+
+/// the lng/lat of a position in the test tile
+mapbox::geometry::point<double> lnglat_at(double x, double y) {
+    return utils::convert_vt_to_ll(extent, tile_z, tile_x, tile_y, mapbox::geometry::point<double>{x, y});
+}
+
+std::vector<TileInput> tiles_of(std::string const& data) {
+    return {TileInput{vtzero::data_view{data}, tile_z, tile_x, tile_y}};
+}
+
+QueryOptions options_with_radius(double radius) {
+    QueryOptions options;
+    options.radius = radius;
+    return options;
+}
+
+std::vector<std::uint64_t> ids(std::vector<ResultObject> const& results) {
+    std::vector<std::uint64_t> v;
+    for (auto const& result : results) {
+        v.push_back(result.id);
+    }
+    return v;
+}
+
+/// what identifies a result, with distances rounded to a millimeter
+std::vector<std::tuple<std::string, std::uint64_t, long>> summary(std::vector<ResultObject> const& results) {
+    std::vector<std::tuple<std::string, std::uint64_t, long>> v;
+    for (auto const& result : results) {
+        v.emplace_back(result.layer_name, result.id, std::lround(result.distance * 1000.0));
+    }
+    return v;
+}
+
+std::string property(ResultObject const& result, std::string const& key) {
+    for (auto const& prop : result.properties_vector_materialized) {
+        if (prop.first == key && prop.second.is<std::string>()) {
+            return prop.second.get<std::string>();
+        }
+    }
+    return "";
+}
+
+void test_closest_point() {
+    std::string const data = make_tile();
+    auto const results = VectorTileQuery::query(tiles_of(data), lnglat_at(1000.2, 1000.2), options_with_radius(1.0));
+    CHECK(results.size() == 1);
+    CHECK(results[0].id == 1);
+    CHECK(results[0].layer_name == "poi");
+    CHECK(results[0].original_geometry_type == VectorTileQuery::GeomType::point);
+    CHECK(results[0].distance < 0.5);
+    CHECK(property(results[0], "name") == "cafe");
+    CHECK(results[0].properties_vector.empty());
+}
+
+void test_radius_and_limit() {
+    std::string const data = make_tile();
+    auto const lnglat = lnglat_at(1000, 1000);
+    auto const both = VectorTileQuery::query(tiles_of(data), lnglat, options_with_radius(5.0));
+    CHECK((ids(both) == std::vector<std::uint64_t>{1, 2}));
+    CHECK(both.size() == 2 && both[0].distance <= both[1].distance);
+
+    QueryOptions one = options_with_radius(5.0);
+    one.num_results = 1;
+    CHECK((ids(VectorTileQuery::query(tiles_of(data), lnglat, one)) == std::vector<std::uint64_t>{1}));
+
+    // the road is 200 units away
+    auto const wide = VectorTileQuery::query(tiles_of(data), lnglat, options_with_radius(60.0));
+    CHECK((ids(wide) == std::vector<std::uint64_t>{1, 2, 20}));
+}
+
+void test_layers_and_geometry() {
+    std::string const data = make_tile();
+    QueryOptions roads = options_with_radius(100.0);
+    roads.layers.emplace("road");
+    auto const road_results = VectorTileQuery::query(tiles_of(data), lnglat_at(1000, 1000), roads);
+    CHECK((ids(road_results) == std::vector<std::uint64_t>{20}));
+
+    QueryOptions polygons = options_with_radius(0.0);
+    polygons.geometry_filter_type = VectorTileQuery::GeomType::polygon;
+    auto const inside = VectorTileQuery::query(tiles_of(data), lnglat_at(2200, 2200), polygons);
+    CHECK((ids(inside) == std::vector<std::uint64_t>{10}));
+    CHECK(inside.size() == 1 && inside[0].distance == 0.0);
+    CHECK(VectorTileQuery::query(tiles_of(data), lnglat_at(1000, 1000), polygons).empty());
+}
+
+void test_basic_filters() {
+    std::string const data = make_tile();
+    QueryOptions options = options_with_radius(1000.0);
+    options.layers.emplace("poi");
+    VectorTileQuery::basic_filter_struct filter;
+    filter.key = "rank";
+    filter.type = VectorTileQuery::gt;
+    filter.value = 2.0;
+    options.basic_filter.type = VectorTileQuery::filter_all;
+    options.basic_filter.filters.push_back(filter);
+    CHECK((ids(VectorTileQuery::query(tiles_of(data), lnglat_at(1000, 1000), options)) == std::vector<std::uint64_t>{1, 3}));
+}
+
+void test_gzip_and_columnar() {
+    std::string const data = make_tile();
+    std::string const compressed = gzip::compress(data.data(), data.size());
+    auto const lnglat = lnglat_at(1500, 1500);
+    QueryOptions options = options_with_radius(1000.0);
+    options.num_results = 10;
+    auto const expected = summary(VectorTileQuery::query(tiles_of(data), lnglat, options));
+    CHECK(expected.size() == 5);
+    CHECK(summary(VectorTileQuery::query(tiles_of(compressed), lnglat, options)) == expected);
+
+    options.columnar = true;
+    CHECK(summary(VectorTileQuery::query(tiles_of(data), lnglat, options)) == expected);
+    CHECK(summary(VectorTileQuery::query(tiles_of(compressed), lnglat, options)) == expected);
+}
+
+void test_batch() {
+    std::string const data = make_tile();
+    std::vector<mapbox::geometry::point<double>> const points{lnglat_at(1000, 1000), lnglat_at(2200, 2200), lnglat_at(3500, 100)};
+    QueryOptions const options = options_with_radius(300.0);
+    auto const batched = VectorTileQuery::query_batch(tiles_of(data), points, options);
+    CHECK(batched.size() == points.size());
+    for (std::size_t p = 0; p < points.size() && p < batched.size(); ++p) {
+        CHECK(batched[p].error.empty());
+        CHECK(summary(batched[p].results) == summary(VectorTileQuery::query(tiles_of(data), points[p], options)));
+    }
+}
+
+void test_sidecar_index() {
+    std::string const data = make_tile();
+    std::string const index = VectorTileQuery::build_index(vtzero::data_view{data});
+    auto const lnglat = lnglat_at(1000, 1000);
+    QueryOptions const options = options_with_radius(100.0);
+
+    auto indexed = tiles_of(data);
+    indexed[0].index_data = vtzero::data_view{index};
+    CHECK(summary(VectorTileQuery::query(indexed, lnglat, options)) == summary(VectorTileQuery::query(tiles_of(data), lnglat, options)));
+
+    std::string const other = gzip::compress(data.data(), data.size());
+    std::string const other_index = VectorTileQuery::build_index(vtzero::data_view{other});
+    indexed[0].index_data = vtzero::data_view{other_index};
+    std::string message;
+    try {
+        VectorTileQuery::query(indexed, lnglat, options);
+    } catch (std::runtime_error const& e) {
+        message = e.what();
+    }
+    CHECK(message == "tile index does not match the tile buffer");
+}
+
+void test_result_cache() {
+    std::string const data = make_tile();
+    auto tiles = tiles_of(data);
+    VectorTileQuery::hash_tiles(tiles);
+    auto const lnglat = lnglat_at(1000, 1000);
+    QueryOptions options = options_with_radius(60.0);
+    options.cache = true;
+
+    std::vector<ResultObject> cached;
+    CHECK(!VectorTileQuery::find_cached_results(tiles, lnglat, options, cached));
+    auto const results = VectorTileQuery::query(tiles, lnglat, options);
+    CHECK(VectorTileQuery::find_cached_results(tiles, lnglat, options, cached));
+    CHECK(summary(cached) == summary(results));
+    CHECK(cached.size() == 3 && property(cached[0], "name") == "cafe");
+
+    // only the exact point is reused, even within the same tile pixel
+    auto const nearby = lnglat_at(1000.3, 1000.3);
+    CHECK(!VectorTileQuery::find_cached_results(tiles, nearby, options, cached));
+    auto const nearby_results = VectorTileQuery::query(tiles, nearby, options);
+    CHECK(VectorTileQuery::find_cached_results(tiles, nearby, options, cached));
+    options.cache = false;
+    CHECK(summary(cached) == summary(VectorTileQuery::query(tiles, nearby, options)));
+    CHECK(summary(nearby_results) == summary(cached));
+}
+
+void test_progress() {
+    std::string const data = make_tile();
+    auto const lnglat = lnglat_at(1000, 1000);
+    QueryOptions options = options_with_radius(2000.0);
+    options.num_results = 20;
+    // the same tile spoofed one and two tiles east, given farthest first
+    std::vector<TileInput> tiles{TileInput{vtzero::data_view{data}, tile_z, tile_x + 2, tile_y},
+                                 TileInput{vtzero::data_view{data}, tile_z, tile_x + 1, tile_y},
+                                 TileInput{vtzero::data_view{data}, tile_z, tile_x, tile_y}};
+    std::vector<TileInput> nearest_first{tiles[2], tiles[1], tiles[0]};
+
+    std::vector<std::size_t> tiles_queried;
+    std::vector<std::uint64_t> first_ids;
+    auto const results = VectorTileQuery::query(tiles, lnglat, options, [&](std::vector<ResultObject> snapshot, std::size_t queried) {
+        if (tiles_queried.empty()) {
+            first_ids = ids(snapshot);
+        }
+        tiles_queried.push_back(queried);
+        return true;
+    });
+    CHECK((tiles_queried == std::vector<std::size_t>{1, 2}));
+    CHECK(first_ids == ids(VectorTileQuery::query(tiles_of(data), lnglat, options)));
+    CHECK(summary(results) == summary(VectorTileQuery::query(nearest_first, lnglat, options)));
+
+    std::size_t calls = 0;
+    auto const stopped = VectorTileQuery::query(tiles, lnglat, options, [&](std::vector<ResultObject> /*snapshot*/, std::size_t /*queried*/) {
+        ++calls;
+        return false;
+    });
+    CHECK(calls == 1);
+    CHECK(summary(stopped) == summary(VectorTileQuery::query(tiles_of(data), lnglat, options)));
+}
+
+void test_tolerance() {
+    std::string const data = make_tile();
+    for (auto const& at : std::vector<std::pair<double, double>>{{1000, 1000}, {2200, 2200}, {2100, 1900}, {3900, 100}}) {
+        auto const lnglat = lnglat_at(at.first, at.second);
+        for (double const radius : {0.0, 30.0, 1000.0}) {
+            QueryOptions options = options_with_radius(radius);
+            options.num_results = 2;
+            auto const expected = summary(VectorTileQuery::query(tiles_of(data), lnglat, options));
+            for (double const tolerance : {1.0, 10.0, 200.0}) {
+                options.tolerance = tolerance;
+                options.columnar = false;
+                CHECK(summary(VectorTileQuery::query(tiles_of(data), lnglat, options)) == expected);
+                options.columnar = true;
+                CHECK(summary(VectorTileQuery::query(tiles_of(data), lnglat, options)) == expected);
+            }
+        }
+    }
+}
+
+void test_max_memory() {
+    std::string const data = make_tile();
+    std::string const compressed = gzip::compress(data.data(), data.size());
+    auto const lnglat = lnglat_at(1000, 1000);
+    QueryOptions options = options_with_radius(1000.0);
+    auto const expected = summary(VectorTileQuery::query(tiles_of(data), lnglat, options));
+
+    options.max_memory = 64 * 1024 * 1024;
+    CHECK(summary(VectorTileQuery::query(tiles_of(compressed), lnglat, options)) == expected);
+    CHECK(VectorTileQuery::memory_stats().peak >= data.size());
+
+    std::size_t const exceeded = VectorTileQuery::memory_stats().exceeded;
+    options.max_memory = 16;
+    bool threw = false;
+    try {
+        VectorTileQuery::query(tiles_of(compressed), lnglat, options);
+    } catch (std::runtime_error const& e) {
+        threw = std::string(e.what()) == "query exceeded 'max_memory' of 16 bytes";
+    }
+    CHECK(threw);
+    CHECK(VectorTileQuery::memory_stats().exceeded == exceeded + 1);
+    CHECK(VectorTileQuery::memory_stats().current == 0);
+
+    // stopping halfway through the tile is going over the limit too
+    options.max_memory = data.size() / 2;
+    threw = false;
+    try {
+        VectorTileQuery::query(tiles_of(compressed), lnglat, options);
+    } catch (std::runtime_error const& e) {
+        threw = std::string(e.what()) == "query exceeded 'max_memory' of " + std::to_string(data.size() / 2) + " bytes";
+    }
+    CHECK(threw);
+    CHECK(VectorTileQuery::memory_stats().exceeded == exceeded + 2);
+
+    // a broken tile is an error of its own, with or without a limit
+    std::string const truncated = compressed.substr(0, compressed.size() / 2);
+    for (std::size_t const limit : {std::size_t{0}, std::size_t{64 * 1024 * 1024}}) {
+        options.max_memory = limit;
+        threw = false;
+        try {
+            VectorTileQuery::query(tiles_of(truncated), lnglat, options);
+        } catch (std::runtime_error const& e) {
+            threw = std::string(e.what()) == "compressed tile is truncated";
+        }
+        CHECK(threw);
+    }
+    CHECK(VectorTileQuery::memory_stats().exceeded == exceeded + 2);
+    CHECK(VectorTileQuery::memory_stats().current == 0);
+
+    // the least max_memory a columnar query from `point` needs once its tile is cached
+    options.columnar = true;
+    auto const least_memory = [&](mapbox::geometry::point<double> const& point) {
+        auto const passes = [&](std::size_t limit) {
+            options.max_memory = limit;
+            try {
+                VectorTileQuery::query(tiles_of(data), point, options);
+                return true;
+            } catch (std::runtime_error const&) {
+                return false;
+            }
+        };
+        std::size_t low = 1;
+        std::size_t high = 64 * 1024 * 1024;
+        CHECK(passes(high));
+        while (low < high) {
+            std::size_t const mid = low + (high - low) / 2;
+            if (passes(mid)) {
+                high = mid;
+            } else {
+                low = mid + 1;
+            }
+        }
+        return low;
+    };
+    // is enough for every point of a batch: points do not pay for each other's results
+    std::size_t const low = least_memory(lnglat);
+    options.max_memory = low;
+    std::vector<mapbox::geometry::point<double>> const points(64, lnglat);
+    auto const batched = VectorTileQuery::query_batch(tiles_of(data), points, options);
+    CHECK(batched.size() == points.size());
+    for (auto const& point : batched) {
+        CHECK(point.error.empty() && summary(point.results) == expected);
+    }
+    CHECK(VectorTileQuery::memory_stats().current == 0);
+
+    // a point whose own results go over fails alone, the others keep theirs
+    auto const fewer = lnglat_at(4000, 4000);
+    CHECK(least_memory(fewer) < low);
+    options.max_memory = 0;
+    auto const fewer_expected = summary(VectorTileQuery::query(tiles_of(data), fewer, options));
+    options.max_memory = low - 1;
+    auto const mixed = VectorTileQuery::query_batch(tiles_of(data), {fewer, lnglat, fewer}, options);
+    CHECK(mixed.size() == 3);
+    if (mixed.size() == 3) {
+        CHECK(mixed[0].error.empty() && summary(mixed[0].results) == fewer_expected);
+        CHECK(mixed[1].error == "query exceeded 'max_memory' of " + std::to_string(low - 1) + " bytes" && mixed[1].results.empty());
+        CHECK(mixed[2].error.empty() && summary(mixed[2].results) == fewer_expected);
+    }
+    CHECK(VectorTileQuery::memory_stats().current == 0);
+}
+
+/// layers ruled out up front give the same results on every path: encoded, columnar, indexed and batched
+void test_layer_summaries() {
+    std::string const data = make_tile();
+    std::string const index = VectorTileQuery::build_index(vtzero::data_view{data});
+    auto const lnglat = lnglat_at(1000, 1000);
+    auto indexed = tiles_of(data);
+    indexed[0].index_data = vtzero::data_view{index};
+
+    auto const check_paths = [&](QueryOptions options, std::vector<std::uint64_t> const& expected) {
+        options.num_results = 10;
+        CHECK(ids(VectorTileQuery::query(tiles_of(data), lnglat, options)) == expected);
+        CHECK(ids(VectorTileQuery::query(indexed, lnglat, options)) == expected);
+        auto const batched = VectorTileQuery::query_batch(tiles_of(data), {lnglat}, options);
+        CHECK(batched.size() == 1 && ids(batched[0].results) == expected);
+        options.columnar = true;
+        CHECK(ids(VectorTileQuery::query(tiles_of(data), lnglat, options)) == expected);
+    };
+
+    VectorTileQuery::basic_filter_struct ranked;
+    ranked.key = "rank";
+    ranked.type = VectorTileQuery::gt;
+    ranked.value = 2.0;
+    VectorTileQuery::basic_filter_struct missing;
+    missing.key = "lanes";
+    missing.type = VectorTileQuery::gt;
+    missing.value = 1.0;
+
+    // only the poi layer has a "rank" key
+    QueryOptions any = options_with_radius(1000.0);
+    any.basic_filter.type = VectorTileQuery::filter_any;
+    any.basic_filter.filters = {missing, ranked};
+    check_paths(any, {1, 3});
+    any.basic_filter.filters = {missing};
+    check_paths(any, {});
+
+    // features without the key pass an `all` filter, no layer can be skipped for it
+    QueryOptions all = options_with_radius(1000.0);
+    all.basic_filter.type = VectorTileQuery::filter_all;
+    all.basic_filter.filters = {missing};
+    check_paths(all, {1, 2, 20, 10, 3});
+
+    QueryOptions points = options_with_radius(1000.0);
+    points.geometry_filter_type = VectorTileQuery::GeomType::point;
+    check_paths(points, {1, 2, 3});
+    QueryOptions polygons = options_with_radius(1000.0);
+    polygons.geometry_filter_type = VectorTileQuery::GeomType::polygon;
+    check_paths(polygons, {10});
+}
+
+void test_group_by() {
+    std::string const data = make_tile();
+    auto const lnglat = lnglat_at(1000, 1000);
+
+    auto const check_paths = [&](QueryOptions options, std::vector<std::uint64_t> const& expected) {
+        CHECK(ids(VectorTileQuery::query(tiles_of(data), lnglat, options)) == expected);
+        auto const batched = VectorTileQuery::query_batch(tiles_of(data), {lnglat}, options);
+        CHECK(batched.size() == 1 && ids(batched[0].results) == expected);
+        options.columnar = true;
+        CHECK(ids(VectorTileQuery::query(tiles_of(data), lnglat, options)) == expected);
+    };
+
+    // the nearest of each layer, then of each geometry type, which are the same in this tile
+    QueryOptions by_layer = options_with_radius(1000.0);
+    by_layer.num_results = 1;
+    by_layer.group_by_layer = true;
+    check_paths(by_layer, {1, 20, 10});
+    QueryOptions by_geometry = options_with_radius(1000.0);
+    by_geometry.num_results = 1;
+    by_geometry.group_by_geometry = true;
+    check_paths(by_geometry, {1, 20, 10});
+
+    // the limit applies to each group, not to the query
+    by_layer.num_results = 2;
+    check_paths(by_layer, {1, 2, 20, 10});
+    by_layer.group_by_geometry = true;
+    by_layer.layers.emplace("poi");
+    check_paths(by_layer, {1, 2});
+}
+
+/// the names in a directory, sorted, without "." and ".."
+std::vector<std::string> list_dir(std::string const& dir) {
+    std::vector<std::string> names;
+    if (DIR* d = ::opendir(dir.c_str())) {
+        while (dirent* entry = ::readdir(d)) {
+            std::string const name = entry->d_name;
+            if (name != "." && name != "..") {
+                names.push_back(name);
+            }
+        }
+        ::closedir(d);
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+void remove_capture_dir(std::string const& dir) {
+    for (auto const& name : list_dir(dir + "/tiles")) {
+        std::remove((dir + "/tiles/" + name).c_str());
+    }
+    std::remove((dir + "/tiles").c_str());
+    for (auto const& name : list_dir(dir)) {
+        std::remove((dir + "/" + name).c_str());
+    }
+    std::remove(dir.c_str());
+}
+
+void test_capture() {
+    std::string const data = make_tile();
+    char dir_template[] = "/tmp/vtquery-capture-XXXXXX";
+    char const* made = ::mkdtemp(dir_template);
+    CHECK(made != nullptr);
+    if (made == nullptr) {
+        return;
+    }
+    std::string const dir = made;
+
+    VectorTileQuery::basic_filter_struct ranked;
+    ranked.key = "rank";
+    ranked.type = VectorTileQuery::gte;
+    ranked.value = 3.0;
+    QueryOptions options = options_with_radius(1000.0);
+    options.num_results = 3;
+    options.layers = {"poi", "road"};
+    options.group_by_layer = true;
+    options.basic_filter.type = VectorTileQuery::filter_any;
+    options.basic_filter.filters = {ranked};
+    auto const lnglat = lnglat_at(1000.5, 1000.25);
+    std::vector<mapbox::geometry::point<double>> const points = {lnglat, lnglat_at(3000, 3000)};
+
+    capture::recorder recorder;
+    recorder.set_threshold_ns(1000);
+    recorder.set_directory(dir);
+    recorder.capture(999, false, tiles_of(data), {lnglat}, options);
+    CHECK(recorder.captured() == 0);
+    recorder.capture(5000, false, tiles_of(data), {lnglat}, options);
+    recorder.capture(6000, true, tiles_of(data), points, options);
+    CHECK(recorder.captured() == 2);
+    // both queries read the same tile, it is written once
+    CHECK(list_dir(dir + "/tiles").size() == 1);
+
+    std::vector<capture::captured_query> captures;
+    for (auto const& name : list_dir(dir)) {
+        if (name != "tiles") {
+            captures.push_back(capture::read_capture(dir + "/" + name));
+        }
+    }
+    CHECK(captures.size() == 2);
+    if (captures.size() != 2) {
+        remove_capture_dir(dir);
+        return;
+    }
+    std::sort(captures.begin(), captures.end(), [](capture::captured_query const& a, capture::captured_query const& b) {
+        return a.execute_ns < b.execute_ns;
+    });
+
+    auto const& single = captures[0];
+    CHECK(single.execute_ns == 5000 && !single.batch && single.error.empty());
+    CHECK(single.points.size() == 1 && single.points[0] == lnglat);
+    CHECK(single.tiles.size() == 1 && single.tiles[0].data == data && single.tiles[0].z == tile_z);
+    CHECK(single.options.layers == options.layers);
+    CHECK(single.options.num_results == 3 && single.options.group_by_layer && !single.options.group_by_geometry);
+    CHECK(single.options.basic_filter.type == VectorTileQuery::filter_any && single.options.basic_filter.filters.size() == 1);
+    std::string key;
+    std::string captured_key;
+    VectorTileQuery::append_options_key(key, options);
+    VectorTileQuery::append_options_key(captured_key, single.options);
+    CHECK(key == captured_key);
+    CHECK(summary(VectorTileQuery::query(single.inputs(), single.points[0], single.options)) ==
+          summary(VectorTileQuery::query(tiles_of(data), lnglat, options)));
+
+    auto const& batch = captures[1];
+    CHECK(batch.batch && batch.points == points);
+    auto const replayed = VectorTileQuery::query_batch(batch.inputs(), batch.points, batch.options);
+    auto const original = VectorTileQuery::query_batch(tiles_of(data), points, options);
+    CHECK(replayed.size() == 2 && summary(replayed[0].results) == summary(original[0].results) && summary(replayed[1].results) == summary(original[1].results));
+
+    // a failed query is captured with its error, kept on one line
+    recorder.capture(7000, false, tiles_of(data), {lnglat}, options, "query exceeded\n'max_memory'");
+    CHECK(recorder.captured() == 3);
+    std::size_t failed = 0;
+    for (auto const& name : list_dir(dir)) {
+        if (name != "tiles") {
+            auto const q = capture::read_capture(dir + "/" + name);
+            if (q.execute_ns == 7000) {
+                CHECK(q.error == "query exceeded 'max_memory'");
+                ++failed;
+            }
+        }
+    }
+    CHECK(failed == 1);
+    CHECK(list_dir(dir + "/tiles").size() == 1);
+
+    // a new directory starts an empty budget, too small for anything here
+    remove_capture_dir(dir);
+    recorder.set_max_bytes(64);
+    recorder.set_directory(dir);
+    recorder.capture(5000, false, tiles_of(data), {lnglat}, options);
+    CHECK(recorder.captured() == 3 && recorder.dropped() == 1 && recorder.bytes() == 0);
+    CHECK(list_dir(dir) == std::vector<std::string>{"tiles"});
+    remove_capture_dir(dir);
+}
+
+void test_invalid_tile() {
+    std::string const data = "not a vector tile";
+    bool threw = false;
+    try {
+        VectorTileQuery::query(tiles_of(data), lnglat_at(1000, 1000), options_with_radius(10.0));
+    } catch (std::exception const&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+} // namespace
+
+int main() {
+    std::vector<std::pair<char const*, std::function<void()>>> const tests{
+        {"closest point", test_closest_point},
+        {"radius and limit", test_radius_and_limit},
+        {"layers and geometry", test_layers_and_geometry},
+        {"basic filters", test_basic_filters},
+        {"gzip and columnar", test_gzip_and_columnar},
+        {"batch", test_batch},
+        {"sidecar index", test_sidecar_index},
+        {"result cache", test_result_cache},
+        {"progress", test_progress},
+        {"tolerance", test_tolerance},
+        {"max memory", test_max_memory},
+        {"layer summaries", test_layer_summaries},
+        {"group by", test_group_by},
+        {"capture", test_capture},
+        {"invalid tile", test_invalid_tile}};
+
+    for (auto const& test : tests) {
+        int const before = failures;
+        try {
+            test.second();
+        } catch (std::exception const& e) {
+            ++failures;
+            std::fprintf(stderr, "%s: unexpected exception: %s\n", test.first, e.what());
+        }
+        std::printf("%s %s\n", failures == before ? "ok" : "not ok", test.first);
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -6,6 +6,7 @@ const vtquery = require('../lib/index.js');
 const mvtf = require('@mapbox/mvt-fixtures');
 const queue = require('d3-queue').queue;
 const fs = require('fs');
+const os = require('os');
 const zlib = require('zlib')
 
 const bufferSF = fs.readFileSync(path.resolve(__dirname+'/../node_modules/@mapbox/mvt-fixtures/real-world/sanfrancisco/15-5238-12666.mvt'));
@@ -293,6 +294,17 @@ test('failure: options.dedupe is not a boolean', assert => {
   });
 });
 
+test('failure: options.columnar is not a boolean', assert => {
+  const opts = {
+    columnar: 'yes'
+  };
+  vtquery([{buffer: Buffer.from('hey'), z: 0, x: 0, y: 0}], [47.6, -122.3], opts, function(err, result) {
+    assert.ok(err);
+    assert.equal(err.message, '\'columnar\' must be a boolean');
+    assert.end();
+  });
+});
+
 test('failure: options.radius is not a number', assert => {
   const opts = {
     radius: '4'
@@ -609,6 +621,85 @@ test('options - geometry: successfully returns only polygons', assert => {
   });
 });
 
+test('failure: options.group_by is not a string or array', assert => {
+  vtquery([{buffer: Buffer.from('hey'), z: 0, x: 0, y: 0}], [47.6, -122.3], { group_by: true }, function(err, result) {
+    assert.ok(err);
+    assert.equal(err.message, '\'group_by\' must be \'layer\', \'geometry\' or an array of them');
+    assert.end();
+  });
+});
+
+test('failure: options.group_by has an unknown group', assert => {
+  vtquery([{buffer: Buffer.from('hey'), z: 0, x: 0, y: 0}], [47.6, -122.3], { group_by: ['layer', 'id'] }, function(err, result) {
+    assert.ok(err);
+    assert.equal(err.message, '\'group_by\' must be \'layer\', \'geometry\' or an array of them');
+    assert.end();
+  });
+});
+
+test('options - group_by: each group gets the results of a query of its own', assert => {
+  const tiles = [{buffer: bufferSF, z: 15, x: 5238, y: 12666}];
+  const ll = [-122.4477, 37.7665]; // direct hit
+  const geometries = ['point', 'linestring', 'polygon'];
+  const byGroup = (features, group) => features.filter(f => group(f));
+  const strip = features => features.map(f => JSON.stringify(f));
+
+  vtquery(tiles, ll, { radius: 1000, limit: 1000 }, (err, all) => {
+    assert.ifError(err);
+    const layers = Array.from(new Set(all.features.map(f => f.properties.tilequery.layer)));
+    assert.ok(layers.length > 1, 'several layers to group');
+
+    const q = queue(1);
+    q.defer(vtquery, tiles, ll, { radius: 1000, limit: 2, group_by: 'layer' });
+    q.defer(vtquery, tiles, ll, { radius: 1000, limit: 2, group_by: 'layer', columnar: true });
+    q.defer(vtquery, tiles, ll, { radius: 1000, limit: 2, group_by: ['layer', 'geometry'] });
+    layers.forEach(layer => q.defer(vtquery, tiles, ll, { radius: 1000, limit: 2, layers: [layer] }));
+    layers.forEach(layer => geometries.forEach(geometry => {
+      q.defer(vtquery, tiles, ll, { radius: 1000, limit: 2, layers: [layer], geometry: geometry });
+    }));
+    q.awaitAll((err, results) => {
+      assert.ifError(err);
+      const byLayer = results[0].features;
+      const byLayerGeometry = results[2].features;
+      assert.deepEqual(results[1], results[0], 'columnar tiles give the same groups');
+      for (let i = 1; i < byLayer.length; ++i) {
+        assert.ok(byLayer[i - 1].properties.tilequery.distance <= byLayer[i].properties.tilequery.distance, 'nearest first');
+      }
+
+      let next = 3;
+      layers.forEach(layer => {
+        const own = results[next++].features;
+        const grouped = byGroup(byLayer, f => f.properties.tilequery.layer === layer);
+        assert.deepEqual(strip(grouped), strip(own), `same features for layer ${layer}`);
+      });
+      layers.forEach(layer => geometries.forEach(geometry => {
+        const own = results[next++].features;
+        const grouped = byGroup(byLayerGeometry, f => f.properties.tilequery.layer === layer && f.properties.tilequery.geometry === geometry);
+        assert.deepEqual(strip(grouped), strip(own), `same features for ${geometry}s of layer ${layer}`);
+      }));
+      assert.end();
+    });
+  });
+});
+
+test('options - group_by: batched points are grouped too', assert => {
+  const tiles = [{buffer: bufferSF, z: 15, x: 5238, y: 12666}];
+  const points = [[-122.4477, 37.7665], [-122.4371, 37.7703]];
+  const opts = { radius: 500, limit: 1, group_by: 'geometry' };
+  const q = queue(1);
+  q.defer(vtquery.batch, tiles, points, opts);
+  points.forEach(point => q.defer(vtquery, tiles, point, opts));
+  q.awaitAll((err, results) => {
+    assert.ifError(err);
+    points.forEach((point, i) => {
+      const geometries = results[0][i].features.map(f => f.properties.tilequery.geometry);
+      assert.equal(new Set(geometries).size, geometries.length, 'one feature per geometry type');
+      assert.deepEqual(results[0][i], results[i + 1], 'batch matches a single query');
+    });
+    assert.end();
+  });
+});
+
 // two painted tiles one above the other (Y-axis) - confirming deduplication is preventing
 // returning results that are actually tile borders
 test('options - dedupe: returns only one result when dedupe is on', assert => {
@@ -1067,3 +1158,828 @@ test('success: handles multiple zoom levels (with compressed tiles)', assert =>
     assert.end();
   });
 });
+
+test('success: repeated queries over large polygons return the same results', assert => {
+  // the terrain polygons in this tile are large enough to get a cached polygon grid after the first query
+  const buffer = fs.readFileSync(__dirname + '/fixtures/manila-roads-terrain-14-13698-7519.mvt');
+  const tiles = [{ buffer: buffer, z: 14, x: 13698, y: 7519 }];
+  const opts = { radius: 0, geometry: 'polygon', limit: 20 };
+  const q = queue(1);
+  for (let i = 0; i < 3; i++) {
+    q.defer(vtquery, tiles, [120.991, 14.6147], opts);
+  }
+  q.awaitAll((err, results) => {
+    assert.ifError(err);
+    assert.ok(results[0].features.length > 0, 'has direct hits');
+    results[0].features.forEach(f => assert.equal(f.properties.tilequery.distance, 0, 'is a direct hit'));
+    assert.deepEqual(results[1], results[0], 'second query matches first');
+    assert.deepEqual(results[2], results[0], 'third query matches first');
+    assert.end();
+  });
+});
+
+test('success: columnar tiles return the same results as vtzero tiles', assert => {
+  const sf = [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }];
+  const sfGzipped = [{ buffer: zlib.gzipSync(bufferSF), z: 15, x: 5238, y: 12666 }];
+  const props = [{ buffer: mvtf.get('038').buffer, z: 15, x: 5248, y: 11436 }];
+  const cases = [
+    { tiles: sf, lnglat: [-122.4371, 37.7703], opts: { radius: 0, limit: 10 } },
+    { tiles: sf, lnglat: [-122.4371, 37.7703], opts: { radius: 200, limit: 50 } },
+    { tiles: sfGzipped, lnglat: [-122.4371, 37.7703], opts: { radius: 200, limit: 50, geometry: 'point', dedupe: false } },
+    { tiles: sf, lnglat: [-122.4371, 37.7703], opts: { radius: 200, limit: 50, direct_hit_polygon: true } },
+    { tiles: props, lnglat: [-122.3384, 47.6635], opts: { radius: 800, 'basic-filters': ['all', [['int_value', '=', 6]]] } }
+  ];
+  const q = queue(1);
+  cases.forEach(c => {
+    q.defer(vtquery, c.tiles, c.lnglat, c.opts);
+    q.defer(vtquery, c.tiles, c.lnglat, Object.assign({ columnar: true }, c.opts));
+  });
+  q.awaitAll((err, results) => {
+    assert.ifError(err);
+    cases.forEach((c, i) => {
+      assert.ok(results[2 * i].features.length > 0, 'has results');
+      assert.deepEqual(results[2 * i + 1], results[2 * i], 'columnar matches for ' + JSON.stringify(c.opts));
+    });
+    assert.end();
+  });
+});
+
+test('success: queries with a sidecar index return the same results', assert => {
+  const buffer = fs.readFileSync(__dirname + '/fixtures/manila-roads-terrain-14-13698-7519.mvt');
+  vtquery.buildIndex(buffer, (err, index) => {
+    assert.ifError(err);
+    assert.ok(Buffer.isBuffer(index), 'index is a buffer');
+    const indexPath = path.join(require('os').tmpdir(), 'vtquery-test-' + process.pid + '.vtqi');
+    fs.writeFileSync(indexPath, index);
+    const cases = [
+      { radius: 0, limit: 10 },
+      { radius: 300, limit: 20 },
+      { radius: 3000, geometry: 'linestring', limit: 50 },
+      { radius: 1000, geometry: 'point' }
+    ];
+    const q = queue(1);
+    cases.forEach(opts => {
+      q.defer(vtquery, [{ buffer: buffer, z: 14, x: 13698, y: 7519 }], [120.991, 14.6147], opts);
+      q.defer(vtquery, [{ buffer: buffer, index: index, z: 14, x: 13698, y: 7519 }], [120.991, 14.6147], opts);
+      q.defer(vtquery, [{ buffer: buffer, index_path: indexPath, z: 14, x: 13698, y: 7519 }], [120.991, 14.6147], opts);
+    });
+    q.awaitAll((err, results) => {
+      fs.unlinkSync(indexPath);
+      assert.ifError(err);
+      cases.forEach((opts, i) => {
+        assert.deepEqual(results[3 * i + 1], results[3 * i], 'index buffer matches for ' + JSON.stringify(opts));
+        assert.deepEqual(results[3 * i + 2], results[3 * i], 'index file matches for ' + JSON.stringify(opts));
+      });
+      assert.end();
+    });
+  });
+});
+
+test('failure: sidecar index built from another tile', assert => {
+  const buffer = fs.readFileSync(__dirname + '/fixtures/manila-roads-terrain-14-13698-7519.mvt');
+  vtquery.buildIndex(zlib.gzipSync(buffer), (err, index) => {
+    assert.ifError(err);
+    vtquery([{ buffer: buffer, index: index, z: 14, x: 13698, y: 7519 }], [120.991, 14.6147], {}, (err, result) => {
+      assert.ok(err);
+      assert.equal(err.message, 'tile index does not match the tile buffer');
+      assert.end();
+    });
+  });
+});
+
+test('failure: sidecar index is not an index', assert => {
+  const buffer = fs.readFileSync(__dirname + '/fixtures/manila-roads-terrain-14-13698-7519.mvt');
+  vtquery([{ buffer: buffer, index: Buffer.from('hey'), z: 14, x: 13698, y: 7519 }], [120.991, 14.6147], {}, (err, result) => {
+    assert.ok(err);
+    assert.equal(err.message, 'tile index is not a vtquery index');
+    assert.end();
+  });
+});
+
+test('failure: sidecar index is not a buffer', assert => {
+  vtquery([{ buffer: Buffer.from('hey'), index: 'hey', z: 0, x: 0, y: 0 }], [47.6, -122.3], {}, (err, result) => {
+    assert.ok(err);
+    assert.equal(err.message, '\'index\' value in \'tiles\' array item is not a true buffer');
+    assert.end();
+  });
+});
+
+test('failure: buildIndex without a buffer', assert => {
+  vtquery.buildIndex('hey', (err, index) => {
+    assert.ok(err);
+    assert.equal(err.message, 'first arg \'buffer\' must be a tile buffer');
+    assert.end();
+  });
+});
+
+test('success: cached results match uncached results', assert => {
+  const tiles = [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }];
+  const opts = { radius: 100, limit: 10 };
+  vtquery(tiles, [-122.4371, 37.7703], opts, (err, expected) => {
+    assert.ifError(err);
+    vtquery(tiles, [-122.4371, 37.7703], Object.assign({ cache: true }, opts), (err, first) => {
+      assert.ifError(err);
+      assert.deepEqual(first, expected, 'first cached query matches');
+      vtquery(tiles, [-122.4371, 37.7703], Object.assign({ cache: true }, opts), (err, second) => {
+        assert.ifError(err);
+        assert.deepEqual(second, expected, 'answer from the cache matches');
+        assert.end();
+      });
+    });
+  });
+});
+
+test('success: a nearby query point is not answered with the results of another', assert => {
+  const tiles = [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }];
+  const opts = { radius: 100, limit: 10 };
+  // a fraction of a z15 tile pixel apart
+  const a = [-122.43710, 37.77030];
+  const b = [-122.4371001, 37.7703001];
+  vtquery(tiles, a, Object.assign({ cache: true }, opts), (err) => {
+    assert.ifError(err);
+    vtquery(tiles, b, opts, (err, expected) => {
+      assert.ifError(err);
+      vtquery(tiles, b, Object.assign({ cache: true }, opts), (err, cached) => {
+        assert.ifError(err);
+        assert.deepEqual(cached, expected, 'same results as an uncached query from the same point');
+        assert.end();
+      });
+    });
+  });
+});
+
+test('failure: options.cache is not a boolean', assert => {
+  vtquery([{buffer: Buffer.from('hey'), z: 0, x: 0, y: 0}], [47.6, -122.3], { cache: 1 }, function(err, result) {
+    assert.ok(err);
+    assert.equal(err.message, '\'cache\' must be a boolean');
+    assert.end();
+  });
+});
+
+test('configure: result_cache_bytes', assert => {
+  assert.throws(() => vtquery.configure(), /first arg 'options' must be an object/);
+  assert.throws(() => vtquery.configure({ result_cache_bytes: -1 }), /'result_cache_bytes' must be a positive number/);
+  vtquery.configure({ result_cache_bytes: 0 });
+  vtquery.configure({ result_cache_bytes: 32 * 1024 * 1024 });
+  assert.end();
+});
+
+test('configure: capture_dir, capture_threshold_ms and capture_max_bytes', assert => {
+  assert.throws(() => vtquery.configure({ capture_dir: 5 }), /'capture_dir' must be a string or null/);
+  assert.throws(() => vtquery.configure({ capture_threshold_ms: -1 }), /'capture_threshold_ms' must be a positive number/);
+  assert.throws(() => vtquery.configure({ capture_max_bytes: 'lots' }), /'capture_max_bytes' must be a positive number/);
+  assert.throws(() => vtquery.configure({ capture_dir: path.join(os.tmpdir(), 'vtquery-no-such-dir', 'captures') }), /could not create/);
+  assert.end();
+});
+
+test('success: slow queries are captured with their tiles', assert => {
+  const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'vtquery-capture-'));
+  const tiles = [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }];
+  const opts = { radius: 100, limit: 3, layers: ['poi_label', 'road'], 'basic-filters': ['any', [['scalerank', '<', 3]]] };
+  const before = vtquery.stats();
+  // every query is slow enough with a threshold of 0
+  vtquery.configure({ capture_dir: dir, capture_threshold_ms: 0 });
+  const q = queue(1);
+  q.defer(vtquery, tiles, [-122.4477, 37.7665], opts);
+  q.defer(vtquery, tiles, [-122.4371, 37.7703], opts);
+  q.awaitAll(err => {
+    vtquery.configure({ capture_dir: null, capture_threshold_ms: 100 });
+    assert.ifError(err);
+    const captures = fs.readdirSync(dir).filter(name => name.endsWith('.query')).sort();
+    assert.equal(captures.length, 2, 'both queries captured');
+    assert.equal(fs.readdirSync(path.join(dir, 'tiles')).filter(name => name.endsWith('.mvt')).length, 1, 'the shared tile is written once');
+    const lines = fs.readFileSync(path.join(dir, captures[0]), 'utf8').split('\n');
+    assert.equal(lines[0], 'vtquery-capture 1', 'versioned format');
+    ['radius 100', 'limit 3', 'filter any', 'filter_rule < 3 scalerank', 'layer poi_label', 'layer road'].forEach(line => {
+      assert.ok(lines.indexOf(line) !== -1, `has '${line}'`);
+    });
+    const tileLine = lines.find(line => line.startsWith('tile '));
+    assert.ok(/^tile 15 5238 12666 tiles\/[0-9a-f]{16}\.mvt$/.test(tileLine), 'tile coordinates and file');
+    assert.ok(fs.readFileSync(path.join(dir, tileLine.split(' ')[4])).equals(bufferSF), 'tile bytes as they were passed in');
+
+    const after = vtquery.stats();
+    assert.equal(after.captured_queries - before.captured_queries, 2, 'captured_queries');
+    assert.equal(after.captured_bytes, 0, 'no capture directory, nothing written to it');
+    assert.end();
+  });
+});
+
+test('success: capturing stops at capture_max_bytes', assert => {
+  const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'vtquery-capture-'));
+  const before = vtquery.stats();
+  vtquery.configure({ capture_dir: dir, capture_threshold_ms: 0, capture_max_bytes: 1024 });
+  vtquery([{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }], [-122.4477, 37.7665], { radius: 100 }, err => {
+    const after = vtquery.stats();
+    vtquery.configure({ capture_dir: null, capture_threshold_ms: 100, capture_max_bytes: 256 * 1024 * 1024 });
+    assert.ifError(err);
+    assert.deepEqual(fs.readdirSync(dir).filter(name => name.endsWith('.query')), [], 'nothing captured');
+    assert.equal(after.captured_bytes, 0, 'nothing written');
+    assert.equal(after.capture_dropped - before.capture_dropped, 1, 'the query was dropped');
+    assert.end();
+  });
+});
+
+test('success: identical queries in flight share one worker', assert => {
+  const tiles = [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }];
+  const opts = { radius: 100, limit: 10 };
+  const before = vtquery.stats().coalesced;
+  vtquery.metrics(); // start from nothing
+  const q = queue();
+  for (let i = 0; i < 3; i++) {
+    q.defer(vtquery, tiles, [-122.4371, 37.7703], opts);
+  }
+  q.awaitAll((err, results) => {
+    assert.ifError(err);
+    assert.equal(vtquery.stats().coalesced - before, 2, 'two queries waited for the first');
+    assert.equal(vtquery.metrics().queries, 3, 'every query is counted');
+    assert.deepEqual(results[1], results[0], 'same results');
+    assert.deepEqual(results[2], results[0], 'same results');
+    assert.notEqual(results[1], results[0], 'own result objects');
+    assert.end();
+  });
+});
+
+test('success: a buffer refilled after the callback is queried with its new bytes', assert => {
+  const buffer = Buffer.from(bufferSF);
+  const tiles = [{ buffer: buffer, z: 15, x: 5238, y: 12666 }];
+  vtquery(tiles, [-122.4371, 37.7703], { radius: 100 }, (err, result) => {
+    assert.ifError(err);
+    assert.ok(result.features.length > 0, 'found features');
+    // same address and length, other bytes
+    buffer.fill(0);
+    vtquery(tiles, [-122.4371, 37.7703], { radius: 100 }, (err) => {
+      assert.ok(err, 'the refilled buffer is read');
+      assert.end();
+    });
+  });
+});
+
+test('failure: identical queries in flight all get the error', assert => {
+  const tiles = [{ buffer: Buffer.from('hey'), z: 0, x: 0, y: 0 }];
+  const q = queue();
+  for (let i = 0; i < 2; i++) {
+    q.defer(cb => vtquery(tiles, [47.6, -122.3], {}, err => cb(null, err)));
+  }
+  q.awaitAll((err, errors) => {
+    assert.ifError(err);
+    assert.ok(errors[0] && errors[1], 'both queries failed');
+    assert.equal(errors[1].message, errors[0].message, 'same error');
+    assert.end();
+  });
+});
+
+test('success: batch matches one query per point', assert => {
+  const tiles = [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }];
+  const opts = { radius: 100, limit: 10 };
+  const points = [[-122.4371, 37.7703], [-122.4380, 37.7690], [-122.4477, 37.7665]];
+  const q = queue();
+  points.forEach(point => q.defer(vtquery, tiles, point, opts));
+  q.awaitAll((err, expected) => {
+    assert.ifError(err);
+    vtquery.batch(tiles, points, opts, (err, results) => {
+      assert.ifError(err);
+      assert.equal(results.length, points.length, 'one result per point');
+      assert.deepEqual(results, expected, 'same results');
+      assert.end();
+    });
+  });
+});
+
+test('failure: batch points must be an array', assert => {
+  const tiles = [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }];
+  vtquery.batch(tiles, [], {}, function(err, result) {
+    assert.ok(err);
+    assert.equal(err.message, 'second arg \'points\' must be a non-empty array of [longitude, latitude] values');
+    vtquery.batch(tiles, [[-122.4371]], {}, function(err, result) {
+      assert.ok(err);
+      assert.equal(err.message, '\'lnglat\' must be an array of [longitude, latitude]');
+      assert.end();
+    });
+  });
+});
+
+test('success: queries in a batch window get their own results', assert => {
+  const tiles = [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }];
+  const opts = { radius: 100, limit: 10, columnar: true };
+  const points = [[-122.4371, 37.7703], [-122.4380, 37.7690], [-122.4477, 37.7665]];
+  const q = queue();
+  points.forEach(point => q.defer(vtquery, tiles, point, opts));
+  q.awaitAll((err, expected) => {
+    assert.ifError(err);
+    vtquery.configure({ batch_window_ms: 5, batch_max: 2 });
+    const batched = queue();
+    points.forEach(point => batched.defer(vtquery, tiles, point, opts));
+    batched.awaitAll((err, results) => {
+      vtquery.configure({ batch_window_ms: 0 });
+      assert.ifError(err);
+      assert.deepEqual(results, expected, 'same results');
+      assert.end();
+    });
+  });
+});
+
+test('success: queries in a batch window use their options and tiles as they were called with', assert => {
+  const opts = { radius: 100, limit: 10, columnar: true };
+  const tiles = [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }];
+  const points = [[-122.4371, 37.7703], [-122.4380, 37.7690]];
+  const q = queue();
+  points.forEach(point => q.defer(vtquery, [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }], point, { radius: 100, limit: 10, columnar: true }));
+  q.awaitAll((err, expected) => {
+    assert.ifError(err);
+    vtquery.configure({ batch_window_ms: 5 });
+    const batched = queue();
+    points.forEach(point => batched.defer(vtquery, tiles, point, opts));
+    // reused by the caller before the window ends
+    opts.limit = 1;
+    opts.layers = ['nothing here'];
+    tiles[0].z = 0;
+    tiles.push({ buffer: Buffer.from('hey'), z: 0, x: 0, y: 0 });
+    batched.awaitAll((err, results) => {
+      vtquery.configure({ batch_window_ms: 0 });
+      assert.ifError(err);
+      assert.deepEqual(results, expected, 'same results');
+      assert.end();
+    });
+  });
+});
+
+test('success: storing a tile runs the queries in a batch window that read it', assert => {
+  vtquery.storeTile('batched', bufferSF);
+  const tiles = [{ stored: 'batched', z: 15, x: 5238, y: 12666 }];
+  const points = [[-122.4371, 37.7703], [-122.4380, 37.7690]];
+  const q = queue();
+  points.forEach(point => q.defer(vtquery, tiles, point, { radius: 100, limit: 10, columnar: true }));
+  q.awaitAll((err, expected) => {
+    assert.ifError(err);
+    vtquery.configure({ batch_window_ms: 5 });
+    const batched = queue();
+    points.forEach(point => batched.defer(vtquery, tiles, point, { radius: 100, limit: 10, columnar: true }));
+    vtquery.storeTile('batched', Buffer.from('hey'));
+    batched.awaitAll((err, results) => {
+      vtquery.configure({ batch_window_ms: 0 });
+      vtquery.dropTile('batched');
+      assert.ifError(err);
+      assert.deepEqual(results, expected, 'read the tile stored when they were called');
+      assert.end();
+    });
+  });
+});
+
+test('success: queries without columnar are not held by a batch window', assert => {
+  const tiles = [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }];
+  vtquery.configure({ batch_window_ms: 1000 });
+  const start = Date.now();
+  vtquery(tiles, [-122.4371, 37.7703], { radius: 100, max_memory: 64 * 1024 * 1024 }, (err, result) => {
+    vtquery.configure({ batch_window_ms: 0 });
+    assert.ifError(err);
+    assert.ok(result.features.length > 0, 'has results');
+    assert.ok(Date.now() - start < 1000, 'not held for the window');
+    assert.end();
+  });
+});
+
+test('failure: queries in a batch window all get the error', assert => {
+  const tiles = [{ buffer: Buffer.from('hey'), z: 0, x: 0, y: 0 }];
+  vtquery.configure({ batch_window_ms: 5 });
+  const q = queue();
+  q.defer(cb => vtquery(tiles, [47.6, -122.3], { columnar: true }, err => cb(null, err)));
+  q.defer(cb => vtquery(tiles, [47.7, -122.3], { columnar: true }, err => cb(null, err)));
+  q.awaitAll((err, errors) => {
+    vtquery.configure({ batch_window_ms: 0 });
+    assert.ifError(err);
+    assert.ok(errors[0] && errors[1], 'both queries failed');
+    assert.notEqual(errors[1], errors[0], 'own error objects');
+    assert.equal(errors[1].message, errors[0].message, 'same error');
+    assert.end();
+  });
+});
+
+test('configure: batch_window_ms and batch_max', assert => {
+  assert.throws(() => vtquery.configure({ batch_window_ms: -1 }), /'batch_window_ms' must be a positive number/);
+  assert.throws(() => vtquery.configure({ batch_window_ms: 'fast' }), /'batch_window_ms' must be a positive number/);
+  assert.throws(() => vtquery.configure({ batch_max: 0 }), /'batch_max' must be 1 or greater/);
+  vtquery.configure({ batch_window_ms: 0, batch_max: 64 });
+  assert.end();
+});
+
+test('success: compiled options give the same results as plain options', assert => {
+  const tiles = [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }];
+  const opts = {
+    radius: 100,
+    limit: 10,
+    layers: ['poi_label', 'road'],
+    'basic-filters': ['any', [['scalerank', '<', 3], ['localrank', '>=', 1]]]
+  };
+  const compiled = vtquery.compile(opts);
+  vtquery(tiles, [-122.4371, 37.7703], opts, (err, expected) => {
+    assert.ifError(err);
+    vtquery(tiles, [-122.4371, 37.7703], compiled, (err, result) => {
+      assert.ifError(err);
+      assert.deepEqual(result, expected, 'same results');
+      vtquery.batch(tiles, [[-122.4371, 37.7703]], compiled, (err, results) => {
+        assert.ifError(err);
+        assert.deepEqual(results[0], expected, 'same results from a batch');
+        assert.end();
+      });
+    });
+  });
+});
+
+test('failure: compile validates options', assert => {
+  assert.throws(() => vtquery.compile(), /first arg 'options' must be an object/);
+  assert.throws(() => vtquery.compile({ radius: -1 }), /'radius' must be a positive number/);
+  assert.throws(() => vtquery.compile({ layers: ['road', ''] }), /'layers' values must be non-empty strings/);
+  assert.end();
+});
+
+test('success: progress reports the nearest tile first, then the full result', assert => {
+  const point = [-122.4371, 37.7703];
+  const center = { buffer: bufferSF, z: 15, x: 5238, y: 12666 };
+  const east = { buffer: bufferSF, z: 15, x: 5239, y: 12666 };
+  const far = { buffer: bufferSF, z: 15, x: 5241, y: 12666 };
+  const opts = { radius: 3000, limit: 10 };
+  vtquery([center], point, opts, (err, nearest) => {
+    assert.ifError(err);
+    vtquery([center, east, far], point, opts, (err, expected) => {
+      assert.ifError(err);
+      const snapshots = [];
+      const progress = (result, info) => { snapshots.push({ result: result, info: info }); };
+      vtquery([far, east, center], point, Object.assign({ progress: progress }, opts), (err, result) => {
+        assert.ifError(err);
+        assert.deepEqual(result, expected, 'same final result');
+        // snapshots still queued when the query finishes are dropped
+        assert.ok(snapshots.length <= 2, 'no snapshot after the last tile');
+        snapshots.forEach((snapshot, i) => {
+          assert.ok(snapshot.info.tiles_queried > i, 'tiles queried so far');
+          assert.equal(snapshot.info.tiles_total, 3, 'tiles in the query');
+        });
+        if (snapshots.length > 0 && snapshots[0].info.tiles_queried === 1) {
+          assert.deepEqual(snapshots[0].result, nearest, 'first snapshot holds the containing tile');
+        }
+        assert.end();
+      });
+    });
+  });
+});
+
+test('success: progress returning false stops the query', assert => {
+  const tiles = [5238, 5239, 5240, 5241].map(x => ({ buffer: bufferSF, z: 15, x: x, y: 12666 }));
+  let calls = 0;
+  const opts = { radius: 3000, progress: () => { ++calls; return false; } };
+  vtquery(tiles, [-122.4371, 37.7703], opts, (err, result) => {
+    assert.ifError(err);
+    assert.equal(result.type, 'FeatureCollection', 'final result');
+    assert.ok(calls <= 1, 'not called again once stopped');
+    assert.end();
+  });
+});
+
+test('failure: progress must be a function', assert => {
+  const tiles = [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }];
+  vtquery(tiles, [-122.4371, 37.7703], { progress: true }, err => {
+    assert.equal(err.message, "'progress' must be a function", 'expected error message');
+    vtquery.batch(tiles, [[-122.4371, 37.7703]], { progress: () => {} }, err => {
+      assert.equal(err.message, "'progress' is not supported by batch", 'expected error message');
+      assert.throws(() => vtquery.compile({ progress: () => {} }), /'progress' can not be compiled/);
+      assert.end();
+    });
+  });
+});
+
+test('success: tolerance gives the same results as exact queries', assert => {
+  const roads = fs.readFileSync(path.resolve(__dirname + '/fixtures/manila-roads-terrain-14-13698-7519.mvt'));
+  const buildings = fs.readFileSync(path.resolve(__dirname + '/fixtures/manila-buildings-16-54789-30080.mvt'));
+  const cases = [
+    { tiles: [{ buffer: roads, z: 14, x: 13698, y: 7519 }], point: [120.991, 14.6147], opts: { radius: 3000, limit: 20 } },
+    { tiles: [{ buffer: roads, z: 14, x: 13698, y: 7519 }], point: [120.991, 14.6147], opts: { radius: 3000, geometry: 'polygon', columnar: true } },
+    { tiles: [{ buffer: buildings, z: 16, x: 54789, y: 30080 }], point: [120.9667, 14.6028], opts: { radius: 0 } }
+  ];
+  const q = queue(1);
+  cases.forEach(c => {
+    q.defer(cb => vtquery(c.tiles, c.point, c.opts, (err, expected) => {
+      if (err) return cb(err);
+      const q2 = queue(1);
+      [1, 20, 500].forEach(tolerance => {
+        q2.defer(vtquery, c.tiles, c.point, Object.assign({ tolerance: tolerance }, c.opts));
+      });
+      q2.awaitAll((err, results) => {
+        if (err) return cb(err);
+        results.forEach(result => assert.deepEqual(result, expected, 'same results'));
+        cb();
+      });
+    }));
+  });
+  q.awaitAll(err => {
+    assert.ifError(err);
+    assert.end();
+  });
+});
+
+test('failure: options.tolerance', assert => {
+  const tiles = [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }];
+  vtquery(tiles, [-122.4371, 37.7703], { tolerance: '10' }, err => {
+    assert.equal(err.message, "'tolerance' must be a number", 'expected error message');
+    vtquery(tiles, [-122.4371, 37.7703], { tolerance: -1 }, err => {
+      assert.equal(err.message, "'tolerance' must be a positive number", 'expected error message');
+      assert.end();
+    });
+  });
+});
+
+test('success: typed arrays, array buffers and shared array buffers give the same results as buffers', assert => {
+  const point = [-122.4371, 37.7703];
+  const options = { radius: 100, limit: 10 };
+  const shared = new SharedArrayBuffer(bufferSF.length);
+  new Uint8Array(shared).set(bufferSF);
+  const copy = new ArrayBuffer(bufferSF.length + 8);
+  new Uint8Array(copy, 8).set(bufferSF);
+  const sources = [
+    new Uint8Array(shared),
+    shared,
+    copy.slice(8),
+    new Uint8Array(copy, 8),
+    new DataView(copy, 8)
+  ];
+  vtquery([{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }], point, options, (err, expected) => {
+    assert.ifError(err);
+    assert.ok(expected.features.length > 0, 'found features');
+    const q = queue(1);
+    sources.forEach(source => q.defer(vtquery, [{ buffer: source, z: 15, x: 5238, y: 12666 }], point, options));
+    q.awaitAll((err, results) => {
+      assert.ifError(err);
+      results.forEach((result, i) => assert.deepEqual(result, expected, 'same results from source ' + i));
+      assert.end();
+    });
+  });
+});
+
+test('success: stored tiles are shared with worker threads', assert => {
+  let worker_threads;
+  try {
+    worker_threads = require('worker_threads');
+  } catch (err) {
+    assert.pass('worker_threads are not available');
+    return assert.end();
+  }
+  const point = [-122.4371, 37.7703];
+  const before = vtquery.stats();
+  vtquery.storeTile('test/sf', bufferSF);
+  assert.equal(vtquery.stats().stored_tiles, before.stored_tiles + 1, 'one more stored tile');
+  assert.equal(vtquery.stats().stored_bytes, before.stored_bytes + bufferSF.length, 'stored bytes');
+  vtquery([{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }], point, { radius: 100 }, (err, expected) => {
+    assert.ifError(err);
+    const worker = new worker_threads.Worker(`
+      const vtquery = require(${JSON.stringify(path.resolve(__dirname, '../lib/index.js'))});
+      const { parentPort } = require('worker_threads');
+      vtquery([{ stored: 'test/sf', z: 15, x: 5238, y: 12666 }], ${JSON.stringify(point)}, { radius: 100 }, (err, result) => {
+        parentPort.postMessage(err ? { error: err.message } : { result: result });
+      });
+    `, { eval: true });
+    worker.once('message', msg => {
+      assert.equal(msg.error, undefined, 'no error in the worker');
+      assert.deepEqual(msg.result, expected, 'the worker found the same features in the stored tile');
+      assert.equal(vtquery.dropTile('test/sf'), true, 'dropped');
+      assert.equal(vtquery.dropTile('test/sf'), false, 'already dropped');
+      worker.terminate().then(() => assert.end(), () => assert.end());
+    });
+    worker.once('error', err => {
+      assert.ifError(err);
+      assert.end();
+    });
+  });
+});
+
+test('failure: stored tiles', assert => {
+  assert.throws(() => vtquery.storeTile('', bufferSF), /first arg 'key' must be a non-empty string/);
+  assert.throws(() => vtquery.storeTile('test/bad', 'hey'), /second arg 'buffer' must be a tile buffer/);
+  assert.throws(() => vtquery.dropTile(1), /first arg 'key' must be a string/);
+  vtquery([{ stored: 'test/missing', z: 0, x: 0, y: 0 }], [0, 0], {}, err => {
+    assert.equal(err.message, 'no tile is stored as \'test/missing\'', 'expected error message');
+    vtquery([{ stored: 'test/missing', buffer: bufferSF, z: 0, x: 0, y: 0 }], [0, 0], {}, err => {
+      assert.equal(err.message, 'item in \'tiles\' array can not have both a \'buffer\' and a \'stored\' value', 'expected error message');
+      vtquery([{ stored: 1, z: 0, x: 0, y: 0 }], [0, 0], {}, err => {
+        assert.equal(err.message, '\'stored\' value in \'tiles\' array item must be a string', 'expected error message');
+        assert.end();
+      });
+    });
+  });
+});
+
+test('success: max_memory', assert => {
+  const point = [-122.4371, 37.7703];
+  const gzipped = zlib.gzipSync(bufferSF);
+  const before = vtquery.stats();
+  ['memory_current', 'memory_peak', 'memory_exceeded'].forEach(key => assert.equal(typeof before[key], 'number', key + ' is reported'));
+  vtquery([{ buffer: gzipped, z: 15, x: 5238, y: 12666 }], point, { radius: 100 }, (err, expected) => {
+    assert.ifError(err);
+    vtquery([{ buffer: gzipped, z: 15, x: 5238, y: 12666 }], point, { radius: 100, max_memory: 1024 * 1024 * 1024 }, (err, result) => {
+      assert.ifError(err);
+      assert.deepEqual(result, expected, 'same results within the limit');
+      assert.ok(vtquery.stats().memory_peak >= bufferSF.length, 'the inflated tile counts towards the peak');
+      vtquery([{ buffer: gzipped, z: 15, x: 5238, y: 12666 }], point, { radius: 100, max_memory: 1024 }, (err, result) => {
+        assert.equal(err.message, 'query exceeded \'max_memory\' of 1024 bytes', 'stopped while inflating');
+        vtquery([{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }], point, { radius: 100, max_memory: 1 }, (err, result) => {
+          assert.equal(err.message, 'query exceeded \'max_memory\' of 1 bytes', 'stopped by what an uncompressed tile query holds');
+          const after = vtquery.stats();
+          assert.equal(after.memory_exceeded - before.memory_exceeded, 2, 'two queries went over');
+          assert.equal(after.memory_current, 0, 'nothing is held once queries are done');
+          assert.end();
+        });
+      });
+    });
+  });
+});
+
+test('failure: options.max_memory', assert => {
+  const tiles = [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }];
+  vtquery(tiles, [-122.4371, 37.7703], { max_memory: '10' }, err => {
+    assert.equal(err.message, '\'max_memory\' must be a number', 'expected error message');
+    vtquery(tiles, [-122.4371, 37.7703], { max_memory: 0 }, err => {
+      assert.equal(err.message, '\'max_memory\' must be 1 or greater', 'expected error message');
+      assert.end();
+    });
+  });
+});
+
+test('success: metrics', assert => {
+  vtquery.metrics(); // start from nothing
+  const gzipped = zlib.gzipSync(bufferSF);
+  const q = queue(1);
+  q.defer(vtquery, [{ buffer: gzipped, z: 15, x: 5238, y: 12666 }], [-122.4371, 37.7703], { radius: 100 });
+  q.defer(vtquery, [{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }], [-122.4371, 37.7703], { radius: 100, columnar: true });
+  q.defer(cb => vtquery([{ buffer: bufferSF, z: 15, x: 5238, y: 12666 }], [-122.4371, 37.7703], { radius: 100, max_memory: 1 }, () => cb()));
+  q.awaitAll(err => {
+    assert.ifError(err);
+    const m = vtquery.metrics();
+    assert.equal(m.queries, 3, 'queries');
+    assert.equal(m.errors, 1, 'errors');
+    ['queue_wait_ns', 'execute_ns'].forEach(name => {
+      assert.equal(m[name].count, 3, name + ' recorded for each query');
+    });
+    assert.equal(m.features_scanned.count, 2, 'features scanned by each query that finished');
+    assert.equal(m.result_ns.count, 2, 'a result built for each successful query');
+    assert.equal(m.bytes_inflated.count, 1, 'one tile inflated');
+    assert.ok(m.bytes_inflated.max >= bufferSF.length && m.bytes_inflated.max <= bufferSF.length * 1.125, 'inflated size within a bucket');
+    assert.ok(m.features_scanned.sum > 0, 'features scanned');
+    assert.ok(m.execute_ns.p50 <= m.execute_ns.p99 && m.execute_ns.p99 <= m.execute_ns.max, 'ordered quantiles');
+    assert.equal(m.execute_ns.buckets.reduce((sum, b) => sum + b[1], 0), 3, 'buckets add up to the count');
+
+    assert.equal(vtquery.metrics().queries, 0, 'reset by the previous call');
+
+    const text = vtquery.metrics({ format: 'prometheus' });
+    assert.ok(/^vtquery_queries_total \d+$/m.test(text), 'prometheus counter');
+    assert.ok(/^vtquery_execute_seconds_bucket\{le="\+Inf"\} \d+$/m.test(text), 'prometheus histogram');
+    assert.ok(/^vtquery_features_scanned_count \d+$/m.test(text), 'prometheus count');
+    assert.throws(() => vtquery.metrics({ format: 'xml' }), /'format' must be 'json' or 'prometheus'/);
+    assert.end();
+  });
+});
+
+test('success: synthetic benchmark tiles can be queried', assert => {
+  const synthetic = require('../bench/synthetic-tile');
+  const tile = { z: 14, x: 8185, y: 5449 };
+  const points = synthetic.generate({ features: 100, properties: 4, layers: 2 });
+  const polygons = synthetic.generate({ geometry: 'polygon', features: 1, holes: 4, vertices: 64 });
+  const everywhere = { radius: 10000, limit: 1000, dedupe: false };
+  vtquery([Object.assign({ buffer: points }, tile)], synthetic.lngLat(14, 8185, 5449, 0.5, 0.5), everywhere, (err, result) => {
+    assert.ifError(err);
+    assert.equal(result.features.length, 200, 'every point of both layers');
+    assert.deepEqual(Object.keys(result.features[0].properties).filter(k => k !== 'tilequery').sort(), ['key-0', 'key-1', 'key-2', 'key-3'], 'properties');
+    vtquery([Object.assign({ buffer: polygons }, tile)], synthetic.lngLat(14, 8185, 5449, 0.5, 0.5), { geometry: 'polygon', radius: 10000 }, (err, result) => {
+      assert.ifError(err);
+      assert.equal(result.features.length, 1, 'the polygon');
+      assert.equal(result.features[0].properties.tilequery.geometry, 'polygon', 'decoded as a polygon');
+      assert.end();
+    });
+  });
+});
+
+test('success: features have the same keys in the same order, with more property keys than are cached', assert => {
+  const synthetic = require('../bench/synthetic-tile');
+  const tile = { z: 14, x: 8185, y: 5449 };
+  const point = synthetic.lngLat(14, 8185, 5449, 0.5, 0.5);
+  const everywhere = { radius: 10000, limit: 1000, dedupe: false };
+  const points = [Object.assign({ buffer: synthetic.generate({ features: 50, properties: 3, layers: 2 }) }, tile)];
+  const wide = [Object.assign({ buffer: synthetic.generate({ features: 1, properties: 5000 }) }, tile)];
+  const q = queue(1);
+  q.defer(vtquery, points, point, everywhere);
+  q.defer(vtquery, points, point, everywhere);
+  q.defer(vtquery, wide, point, everywhere);
+  q.awaitAll((err, results) => {
+    assert.ifError(err);
+    assert.deepEqual(results[0], results[1], 'the same results again, from cached keys');
+    results[0].features.forEach(feature => {
+      assert.deepEqual(Object.keys(feature), ['type', 'id', 'geometry', 'properties']);
+      assert.deepEqual(Object.keys(feature.geometry), ['type', 'coordinates']);
+      assert.deepEqual(Object.keys(feature.properties), ['key-0', 'key-1', 'key-2', 'tilequery']);
+      assert.deepEqual(Object.keys(feature.properties.tilequery), ['distance', 'geometry', 'layer']);
+    });
+    assert.deepEqual(results[0].features.map(f => f.properties.tilequery.layer).filter((l, i, all) => all.indexOf(l) === i).sort(), ['layer-0', 'layer-1'], 'layer names');
+    const properties = results[2].features[0].properties;
+    assert.equal(Object.keys(properties).length, 5001, 'every property key');
+    assert.equal(properties['key-4999'], 'value-49', 'the last key');
+    assert.end();
+  });
+});
+
+test('success: nearest loads only the tile holding the point when it has the closest features', assert => {
+  const synthetic = require('../bench/synthetic-tile');
+  const dense = synthetic.generate({ features: 1000, properties: 0 });
+  const loaded = [];
+  vtquery.nearest(synthetic.lngLat(14, 8185, 5449, 0.5, 0.5), {
+    zoom: 14,
+    limit: 5,
+    loader: (z, x, y) => {
+      loaded.push(`${z}/${x}/${y}`);
+      return dense;
+    }
+  }, (err, result) => {
+    assert.ifError(err);
+    assert.equal(result.features.length, 5, 'limit features');
+    assert.deepEqual(loaded, ['14/8185/5449'], 'only the center tile');
+    assert.end();
+  });
+});
+
+test('success: nearest matches a query over every tile it could have loaded', assert => {
+  const synthetic = require('../bench/synthetic-tile');
+  // a few points per tile, so the closest ones are in the next rings
+  const tileAt = (x, y) => synthetic.generate({ features: 2, properties: 0, seed: x * 7 + y });
+  const point = synthetic.lngLat(14, 8185, 5449, 0.1, 0.3);
+  const options = { limit: 10, dedupe: false };
+  const all = [];
+  for (let x = 8185 - 3; x <= 8185 + 3; ++x) {
+    for (let y = 5449 - 3; y <= 5449 + 3; ++y) all.push({ buffer: tileAt(x, y), z: 14, x: x, y: y });
+  }
+  let loads = 0;
+  vtquery.nearest(point, Object.assign({ zoom: 14, loader: (z, x, y) => { ++loads; return tileAt(x, y); } }, options), (err, nearest) => {
+    assert.ifError(err);
+    vtquery(all, point, Object.assign({ radius: 100000 }, options), (err, expected) => {
+      assert.ifError(err);
+      assert.deepEqual(nearest.features.map(f => f.properties.tilequery.distance), expected.features.map(f => f.properties.tilequery.distance), 'the same distances');
+      assert.equal(nearest.features.length, 10, 'limit features');
+      assert.ok(loads < all.length, `loaded ${loads} of ${all.length} tiles`);
+      assert.end();
+    });
+  });
+});
+
+test('success: nearest searches past missing tiles, with any kind of loader', assert => {
+  const synthetic = require('../bench/synthetic-tile');
+  const far = synthetic.generate({ features: 3, properties: 2 });
+  const point = synthetic.lngLat(14, 8185, 5449, 0.5, 0.5);
+  // the only tile is two rings out
+  const tileAt = (x, y) => (x === 8187 && y === 5449 ? far : null);
+  const loaders = [
+    (z, x, y) => tileAt(x, y),
+    (z, x, y) => Promise.resolve(tileAt(x, y)),
+    (z, x, y, callback) => setImmediate(() => callback(null, tileAt(x, y))),
+    (z, x, y) => (tileAt(x, y) ? { buffer: tileAt(x, y) } : null)
+  ];
+  const q = queue(1);
+  loaders.forEach(loader => q.defer(vtquery.nearest, point, { zoom: 14, limit: 3, loader: loader }));
+  q.awaitAll((err, results) => {
+    assert.ifError(err);
+    assert.equal(results[0].features.length, 3, 'found the features two rings out');
+    results.forEach(result => assert.deepEqual(result, results[0], 'the same results from every loader'));
+    vtquery.nearest(point, { zoom: 14, loader: loaders[0], max_rings: 1 }, (err, result) => {
+      assert.ifError(err);
+      assert.equal(result.features.length, 0, 'max_rings stops before the tile');
+      vtquery.nearest(point, { zoom: 14, loader: loaders[0], radius: 100 }, (err, result) => {
+        assert.ifError(err);
+        assert.equal(result.features.length, 0, 'radius stops before the tile');
+        assert.end();
+      });
+    });
+  });
+});
+
+test('failure: nearest', assert => {
+  const point = [-122.4477, 37.7665];
+  const loader = () => null;
+  const cases = [
+    [[0], { zoom: 14, loader: loader }, "first arg 'lnglat' must be an array with [longitude, latitude] values"],
+    [point, null, "second arg 'options' must be an object"],
+    [point, { loader: loader }, "'zoom' must be an integer from 0 to 30"],
+    [point, { zoom: 14 }, "'loader' must be a function"],
+    [point, { zoom: 14, loader: loader, max_rings: -1 }, "'max_rings' must be an integer, 0 or greater"],
+    [point, { zoom: 14, loader: loader, radius: -1 }, "'radius' must be a positive number"],
+    [point, { zoom: 14, loader: loader, limit: 0 }, "'limit' must be 1 or greater"],
+    [point, { zoom: 14, loader: loader, progress: () => {} }, "'progress' can not be used with vtquery.nearest"],
+    [point, { zoom: 14, loader: loader, group_by: 'layer' }, "'group_by' can not be used with vtquery.nearest"],
+    [point, { zoom: 14, loader: () => 'a tile' }, 'tile loader returned neither a tile buffer nor a tile object for 14/2619/6333'],
+    [point, { zoom: 14, loader: () => Promise.reject(new Error('tile server is down')) }, 'tile server is down'],
+    [point, { zoom: 14, loader: (z, x, y, callback) => callback(new Error('no such tile set')) }, 'no such tile set']
+  ];
+  const q = queue(1);
+  cases.forEach(c => q.defer(cb => vtquery.nearest(c[0], c[1], (err, result) => {
+    assert.ok(err, 'error');
+    assert.notOk(result, 'no result');
+    assert.equal(err && err.message, c[2], c[2]);
+    cb();
+  })));
+  q.awaitAll(() => {
+    assert.throws(() => vtquery.nearest(point, { zoom: 14, loader: loader }), /last arg 'callback' must be a function/);
+    assert.end();
+  });
+});